@@ -16,10 +16,13 @@
 
 #include "JNILoggerHelpers.h"
 #include <LogEntry.h>
+#include <fb/log.h>
 #include <logger/Logger.h>
+#include <logger/StringTable.h>
 #include <jni/NativeTraceWriter.h>
 #include <logger/buffer/RingBuffer.h>
 #include <mmapbuf/JBuffer.h>
+#include <util/Clock.h>
 
 namespace facebook {
 namespace profilo {
@@ -65,13 +68,21 @@ static jint loggerWriteAndWakeupTraceWriter(
 
   //
   // We know the buffer is initialized, NativeTraceWriter is already using it.
-  // Also, currentTail is only used because Cursor is not default constructible.
   //
   auto buffer = jbuffer->get();
   if (buffer == nullptr) {
     throw std::invalid_argument("buffer is null");
   }
-  TraceBuffer::Cursor cursor = buffer->ringBuffer().currentTail();
+  if (type == static_cast<jint>(EntryType::TRACE_START)) {
+    // The writer only reads from the trace start on, every name has to be
+    // defined again after it.
+    logger::StringTable::get().reset();
+  }
+
+  // In a sharded buffer the trace start can land in any shard, so every
+  // shard is read from where its head is before the write.
+  auto cursors = buffer->currentHeads();
+  TraceBuffer::Cursor cursor = cursors.front();
   jint id = buffer->logger().writeAndGetCursor(
       StandardEntry{
           .id = 0,
@@ -83,11 +94,28 @@ static jint loggerWriteAndWakeupTraceWriter(
           .extra = arg3,
       },
       cursor);
+  if (cursors.size() == 1) {
+    cursors.front() = cursor;
+  }
 
-  writer->submit(cursor, traceId);
+  if (!writer->submit(std::move(cursors), traceId)) {
+    // The trace was aborted, the entry we wrote won't be read.
+    return 0;
+  }
   return id;
 }
 
+static jboolean loggerSetClockSource(fbjni::alias_ref<jobject>, jint source) {
+  if (clock::setSource(static_cast<clock::Source>(source))) {
+    return JNI_TRUE;
+  }
+  FBLOGW(
+      "Clock source %d is not available, keeping %s",
+      source,
+      clock::sourceName(clock::currentSource()));
+  return JNI_FALSE;
+}
+
 void registerNatives() {
   fbjni::registerNatives(
       "com/facebook/profilo/logger/BufferLogger",
@@ -96,6 +124,7 @@ void registerNatives() {
           makeNativeMethod("writeBytesEntry", loggerWriteBytesEntry),
           makeNativeMethod(
               "writeAndWakeupTraceWriter", loggerWriteAndWakeupTraceWriter),
+          makeNativeMethod("setClockSource", loggerSetClockSource),
       });
 }
 
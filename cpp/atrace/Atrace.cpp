@@ -133,30 +133,32 @@ void log_systrace(const void* buf, size_t count) {
   entry.timestamp = monotonicTime();
   entry.type = type;
 
-  int32_t id = logger->write(entry);
-  if (type != EntryType::MARK_POP) {
-    // Format is B|<pid>|<name>.
-    // Skip "B|" trivially, find next '|' with memchr. We cannot use strchr
-    // since we can't trust the message to have a null terminator.
-    constexpr auto kPrefixLength = 2; // length of "B|";
-
-    const char* name = reinterpret_cast<const char*>(
-        memchr(msg + kPrefixLength, '|', count - kPrefixLength));
-    if (name == nullptr) {
-      return;
-    }
+  if (type == EntryType::MARK_POP) {
+    logger->write(entry);
+    return;
+  }
+
+  // Format is B|<pid>|<name>.
+  // Skip "B|" trivially, find next '|' with memchr. We cannot use strchr
+  // since we can't trust the message to have a null terminator.
+  constexpr auto kPrefixLength = 2; // length of "B|";
+
+  const char* name = reinterpret_cast<const char*>(
+      memchr(msg + kPrefixLength, '|', count - kPrefixLength));
+  ssize_t len = 0;
+  if (name != nullptr) {
     name++; // skip '|' to the next character
-    ssize_t len = msg + count - name;
-    if (len > 0) {
-      logger->writeBytes(
-          EntryType::STRING_NAME,
-          id,
-          (const uint8_t*)name,
-          std::min(len, kAtraceMessageLength));
-
-      FBLOGV("systrace event: %s", name);
-    }
+    len = msg + count - name;
+  }
+  if (len <= 0) {
+    logger->write(entry);
+    return;
   }
+
+  // Section names repeat a lot, so they're interned.
+  logger->writeNamed(entry, name, std::min(len, kAtraceMessageLength));
+
+  FBLOGV("systrace event: %s", name);
 }
 
 bool should_log_systrace(int fd, size_t count) {
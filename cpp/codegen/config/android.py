@@ -140,6 +140,11 @@ NAMES = [
     "MEMORY_MAPPING_FAILURE",
     "THREAD_NAMING",
     "STKERR_INVALID_MAP",
+    "TRACE_PACKETS_LOST",
+    "STRING_DEFINITION",
+    "BLOB_REFERENCE",
+    "STKERR_UNRESOLVED_STACK",
+    "BLOB_LOST",
 ]
 
 STACK_FRAME_ENTRIES = frozenset(
@@ -155,6 +160,9 @@ BYTES_ENTRIES = frozenset(
         "STRING_KEY",
         "STRING_VALUE",
         "STRING_NAME",
+        "STRING_DEFINITION",
+        "BLOB_REFERENCE",
+        "BLOB_LOST",
     ]
 )
 
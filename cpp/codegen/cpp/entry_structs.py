@@ -17,16 +17,63 @@ limitations under the License.
 from __future__ import absolute_import, division, print_function, unicode_literals
 
 from ..codegen import Codegen, SIGNED_SOURCE
-from ..types import DynamicArrayType
+from ..types import DynamicArrayType, IntegerType
 from .type_converter import TypeConverter
 
 
+def has_trailing_dynamic_array(fmt):
+    return isinstance(fmt.fields[-1][1], DynamicArrayType)
+
+
+def calculate_header_size(fmt):
+    """
+    Serialized size of everything before the values of the trailing dynamic
+    array: the serialization type, the constant-size fields, the array size
+    and the padding that aligns the values on a 4-byte boundary.
+    """
+    size = 1  # serialization format
+    for _, ftype in fmt.fields[:-1]:
+        size += ftype.constant_size
+    size += fmt.fields[-1][1].members[DynamicArrayType.MEMBER_SIZE].constant_size
+    return (size + 0x03) & ~0x03
+
+
+def compact_type_ids(formats):
+    """
+    Serialization types of the compact encoding, by typename, for the formats
+    that have one: those made of at most 8 integer fields, one per bit of the
+    presence bitmap. Numbered after the regular serialization types.
+    """
+    next_id = max(fmt.type_id for fmt in formats) + 1
+    ids = {}
+    for fmt in sorted(formats, key=lambda fmt: fmt.type_id):
+        if len(fmt.fields) > 8:
+            continue
+        if not all(isinstance(ftype, IntegerType) for _, ftype in fmt.fields):
+            continue
+        ids[fmt.typename] = next_id
+        next_id += 1
+    return ids
+
+
+def calculate_max_compact_size(fmt):
+    """
+    Largest compact encoding of the format: serialization type, presence
+    bitmap and every field as a varint of up to 7 bits per byte.
+    """
+    size = 2
+    for _, ftype in fmt.fields:
+        size += (ftype.constant_size * 8 + 6) // 7
+    return size
+
+
 class CppEntryStructsCodegen(Codegen):
     def __init__(self, entries):
         super(CppEntryStructsCodegen, self).__init__()
 
         # Keep only one example of each unique typename
         self.unique_types = {x.memory_format.typename: x.memory_format for x in entries}
+        self.compact_ids = compact_type_ids(list(self.unique_types.values()))
 
     def preferred_filename(self):
         return "Entry.h"
@@ -83,7 +130,7 @@ struct __attribute__((packed)) %%TYPENAME%% {
   static void unpack(%%TYPENAME%%& entry, const void* src, size_t size);
 
   static size_t calculateSize(%%TYPENAME%% const& entry);
-};
+%%HEADER_DECLS%%%%COMPACT_DECLS%%};
 """.lstrip()
 
         fields = [
@@ -93,6 +140,36 @@ struct __attribute__((packed)) %%TYPENAME%% {
         fields = "\n".join(fields)
         fields = Codegen.indent(fields)
 
+        header_decls = ""
+        if has_trailing_dynamic_array(fmt):
+            header_decls = """
+  // Size of the serialized entry up to the first value of the trailing
+  // dynamic array. packHeader() writes exactly these bytes, so callers can
+  // place the values themselves (e.g., straight into buffer slots).
+  static const size_t kHeaderSize = %%HEADER_SIZE%%;
+  static void packHeader(const %%TYPENAME%%& entry, void* dst, size_t size);
+""".replace(
+                "%%HEADER_SIZE%%", str(calculate_header_size(fmt))
+            )
+
+        compact_decls = ""
+        if fmt.typename in self.compact_ids:
+            compact_decls = """
+  // Compact encoding: a presence bitmap, then only the fields that aren't
+  // zero, as varints (zigzag for signed fields). unpack() also accepts it.
+  static const uint8_t kCompactSerializationType = %%COMPACT_TYPE_ID%%;
+  static const size_t kMaxCompactSize = %%MAX_COMPACT_SIZE%%;
+  static void packCompact(const %%TYPENAME%%& entry, void* dst, size_t size);
+  static void unpackCompact(%%TYPENAME%%& entry, const void* src, size_t size);
+  static size_t calculateCompactSize(%%TYPENAME%% const& entry);
+""".replace(
+                "%%COMPACT_TYPE_ID%%", str(self.compact_ids[fmt.typename])
+            ).replace(
+                "%%MAX_COMPACT_SIZE%%", str(calculate_max_compact_size(fmt))
+            )
+
+        template = template.replace("%%HEADER_DECLS%%", header_decls)
+        template = template.replace("%%COMPACT_DECLS%%", compact_decls)
         template = template.replace("%%TYPENAME%%", fmt.typename)
         template = template.replace("%%TYPE_ID%%", str(fmt.type_id))
         template = template.replace("%%FIELDS%%", fields)
@@ -108,6 +185,7 @@ class CppEntryStructsCppCodegen(Codegen):
 
         # Keep only one example of each unique typename
         self.unique_types = {x.memory_format.typename: x.memory_format for x in entries}
+        self.compact_ids = compact_type_ids(list(self.unique_types.values()))
 
     def preferred_filename(self):
         return "Entry.cpp"
@@ -124,6 +202,68 @@ namespace facebook {
 namespace profilo {
 namespace entries {
 
+namespace {
+
+uint64_t zigzag(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^
+      static_cast<uint64_t>(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+size_t varintFieldSize(uint64_t value) {
+  if (value == 0) {
+    return 0;
+  }
+  return (64 - __builtin_clzll(value) + 6) / 7;
+}
+
+/* Writes nothing for zero, the field is then absent from `present`. */
+size_t writeVarintField(
+    uint8_t* dst,
+    uint64_t value,
+    uint8_t bit,
+    uint8_t& present) {
+  if (value == 0) {
+    return 0;
+  }
+  present |= bit;
+  size_t size = 0;
+  while (value >= 0x80) {
+    dst[size++] = static_cast<uint8_t>(value) | 0x80;
+    value >>= 7;
+  }
+  dst[size++] = static_cast<uint8_t>(value);
+  return size;
+}
+
+uint64_t readVarintField(
+    const uint8_t* src,
+    size_t size,
+    size_t& offset,
+    uint8_t bit,
+    uint8_t present) {
+  if ((present & bit) == 0) {
+    return 0;
+  }
+  uint64_t value = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    if (offset >= size) {
+      throw std::out_of_range("Compact entry is truncated");
+    }
+    uint8_t byte = src[offset++];
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return value;
+    }
+  }
+  throw std::out_of_range("Compact entry has an overlong varint");
+}
+
+} // namespace
+
 %%ENTRIES_CODE%%
 
 uint8_t peek_type(const void* src, size_t len) {
@@ -164,6 +304,13 @@ uint8_t peek_type(const void* src, size_t len) {
         unpack_code = self._generate_unpack_code(fmt)
         calcsize_code = self._generate_calcsize_code(fmt)
 
+        if has_trailing_dynamic_array(fmt):
+            pack_code += "\n" + self._generate_pack_header_code(fmt)
+        if fmt.typename in self.compact_ids:
+            pack_code += "\n" + self._generate_pack_compact_code(fmt)
+            unpack_code += "\n" + self._generate_unpack_compact_code(fmt)
+            calcsize_code += "\n" + self._generate_calc_compact_size_code(fmt)
+
         template = template.replace("%%PACKCODE%%", pack_code)
         template = template.replace("%%UNPACKCODE%%", unpack_code)
         template = template.replace("%%CALCULATESIZECODE%%", calcsize_code)
@@ -211,6 +358,53 @@ void %%TYPENAME%%::pack(const %%TYPENAME%%& entry, void* dst, size_t size) {
         template = template.replace("%%MEMCOPIES%%", memcopies)
         return template
 
+    def _generate_pack_header_code(self, fmt):
+        template = """
+/* Alignment requirement: dst must be 4-byte aligned. */
+void %%TYPENAME%%::packHeader(
+    const %%TYPENAME%%& entry,
+    void* dst,
+    size_t size) {
+  if (size < kHeaderSize) {
+      throw std::out_of_range("Cannot fit %%TYPENAME%% header in destination");
+  }
+  if (dst == nullptr) {
+      throw std::invalid_argument("dst == nullptr");
+  }
+  uint8_t* dst_byte = reinterpret_cast<uint8_t*>(dst);
+  *dst_byte = kSerializationType;
+  size_t offset = 1;
+
+%%MEMCOPIES%%
+  // Zero the padding before the values.
+  std::memset(dst_byte + offset, 0, kHeaderSize - offset);
+}
+""".lstrip()
+
+        memcopies = []
+        for name, ftype in fmt.fields[:-1]:
+            memcpy = TypeConverter.get(ftype).generate_pack_code(
+                from_expression="entry.{name}".format(name=name),
+                to_expression="dst_byte",
+                offset_expr="offset",
+            )
+            memcopies.append(memcpy)
+
+        name, ftype = fmt.fields[-1]
+        memcopies.append(
+            TypeConverter.get(ftype).generate_pack_header_code(
+                from_expression="entry.{name}".format(name=name),
+                to_expression="dst_byte",
+                offset_expr="offset",
+            )
+        )
+        memcopies = "\n".join(memcopies)
+        memcopies = Codegen.indent(memcopies)
+
+        template = template.replace("%%TYPENAME%%", fmt.typename)
+        template = template.replace("%%MEMCOPIES%%", memcopies)
+        return template
+
     def _generate_unpack_code(self, fmt):
         template = """
 /* Alignment requirement: src must be 4-byte aligned. */
@@ -219,7 +413,7 @@ void %%TYPENAME%%::unpack(%%TYPENAME%%& entry, const void* src, size_t size) {
       throw std::invalid_argument("src == nullptr");
   }
   const uint8_t* src_byte = reinterpret_cast<const uint8_t*>(src);
-  if (*src_byte != kSerializationType) {
+%%COMPACT_DISPATCH%%  if (*src_byte != kSerializationType) {
       throw std::invalid_argument("Serialization type is incorrect");
   }
   size_t offset = 1;
@@ -227,6 +421,14 @@ void %%TYPENAME%%::unpack(%%TYPENAME%%& entry, const void* src, size_t size) {
 }
 """.lstrip()
 
+        compact_dispatch = ""
+        if fmt.typename in self.compact_ids:
+            compact_dispatch = """  if (*src_byte == kCompactSerializationType) {
+      unpackCompact(entry, src, size);
+      return;
+  }
+"""
+
         memcopies = []
         for name, ftype in fmt.fields:
             memcpy = TypeConverter.get(ftype).generate_unpack_code(
@@ -239,10 +441,110 @@ void %%TYPENAME%%::unpack(%%TYPENAME%%& entry, const void* src, size_t size) {
 
         memcopies = Codegen.indent(memcopies)
 
+        template = template.replace("%%COMPACT_DISPATCH%%", compact_dispatch)
         template = template.replace("%%TYPENAME%%", fmt.typename)
         template = template.replace("%%MEMCOPIES%%", memcopies)
         return template
 
+    def _generate_pack_compact_code(self, fmt):
+        template = """
+/* No alignment requirement. */
+void %%TYPENAME%%::packCompact(
+    const %%TYPENAME%%& entry,
+    void* dst,
+    size_t size) {
+  if (size < kMaxCompactSize && size < calculateCompactSize(entry)) {
+      throw std::out_of_range("Cannot fit compact %%TYPENAME%% in destination");
+  }
+  if (dst == nullptr) {
+      throw std::invalid_argument("dst == nullptr");
+  }
+  uint8_t* dst_byte = reinterpret_cast<uint8_t*>(dst);
+  dst_byte[0] = kCompactSerializationType;
+  uint8_t present = 0;
+  size_t offset = 2;
+%%FIELDS%%
+  dst_byte[1] = present;
+}
+""".lstrip()
+
+        fields = []
+        for idx, (name, ftype) in enumerate(fmt.fields):
+            value = TypeConverter.get(ftype).generate_compact_encode_expression(
+                "entry.{name}".format(name=name)
+            )
+            fields.append(
+                "offset += writeVarintField(\n"
+                "    dst_byte + offset, {value}, 0x{bit:02x}, present);".format(
+                    value=value, bit=1 << idx
+                )
+            )
+        fields = Codegen.indent("\n".join(fields))
+
+        template = template.replace("%%TYPENAME%%", fmt.typename)
+        template = template.replace("%%FIELDS%%", fields)
+        return template
+
+    def _generate_unpack_compact_code(self, fmt):
+        template = """
+/* No alignment requirement. */
+void %%TYPENAME%%::unpackCompact(
+    %%TYPENAME%%& entry,
+    const void* src,
+    size_t size) {
+  if (src == nullptr) {
+      throw std::invalid_argument("src == nullptr");
+  }
+  const uint8_t* src_byte = reinterpret_cast<const uint8_t*>(src);
+  if (size < 2) {
+      throw std::out_of_range("Compact entry is truncated");
+  }
+  if (src_byte[0] != kCompactSerializationType) {
+      throw std::invalid_argument("Serialization type is incorrect");
+  }
+  uint8_t present = src_byte[1];
+  size_t offset = 2;
+%%FIELDS%%
+}
+""".lstrip()
+
+        fields = []
+        for idx, (name, ftype) in enumerate(fmt.fields):
+            value = TypeConverter.get(ftype).generate_compact_decode_expression(
+                "readVarintField(src_byte, size, offset, 0x{bit:02x}, present)".format(
+                    bit=1 << idx
+                )
+            )
+            fields.append("entry.{name} = {value};".format(name=name, value=value))
+        fields = Codegen.indent("\n".join(fields))
+
+        template = template.replace("%%TYPENAME%%", fmt.typename)
+        template = template.replace("%%FIELDS%%", fields)
+        return template
+
+    def _generate_calc_compact_size_code(self, fmt):
+        template = """
+size_t %%TYPENAME%%::calculateCompactSize(%%TYPENAME%% const& entry) {
+  size_t offset = 2 /*serialization format, presence bitmap*/;
+%%EXPRESSIONS%%
+  return offset;
+}
+""".lstrip()
+
+        expressions = []
+        for name, ftype in fmt.fields:
+            value = TypeConverter.get(ftype).generate_compact_encode_expression(
+                "entry.{name}".format(name=name)
+            )
+            expressions.append(
+                "offset += varintFieldSize({value});".format(value=value)
+            )
+        expressions = Codegen.indent("\n".join(expressions))
+
+        template = template.replace("%%TYPENAME%%", fmt.typename)
+        template = template.replace("%%EXPRESSIONS%%", expressions)
+        return template
+
     def _generate_calcsize_code(self, fmt):
         template = """
 size_t %%TYPENAME%%::calculateSize(%%TYPENAME%% const& entry) {
@@ -17,6 +17,7 @@ limitations under the License.
 from __future__ import absolute_import, division, print_function, unicode_literals
 
 from ..codegen import Codegen, SIGNED_SOURCE
+from .entry_structs import compact_type_ids
 
 
 class CppParserCodegen(Codegen):
@@ -109,6 +110,22 @@ case %%ID%%: {
             )
             for x in list(self.unique_types.values())
         ]
+
+        compact_case_template = """
+case %%ID%%: {
+  %%TYPE%% data;
+  %%TYPE%%::unpackCompact(data, src, size);
+  visitor.visit(data);
+  break;
+}
+""".lstrip()
+        compact_ids = compact_type_ids(list(self.unique_types.values()))
+        cases += [
+            compact_case_template.replace("%%ID%%", str(compact_ids[x])).replace(
+                "%%TYPE%%", x
+            )
+            for x in sorted(compact_ids, key=compact_ids.get)
+        ]
         cases = "\n".join(cases)
         cases = Codegen.indent(cases)
         cases = Codegen.indent(cases)
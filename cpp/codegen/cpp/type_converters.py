@@ -57,6 +57,25 @@ class CppTypeConverter(object, metaclass=abc.ABCMeta):
             offset=offset_expression,
         )
 
+    def generate_compact_encode_expression(self, from_expression):
+        """
+        Expression turning the field into the uint64_t stored as a varint by
+        the compact encoding. Zero must map to zero.
+        """
+        raise RuntimeError(
+            "Cannot use the compact encoding for {type}".format(
+                type=self.abstract_type.__class__.__name__
+            )
+        )
+
+    def generate_compact_decode_expression(self, from_expression):
+        "Inverse of generate_compact_encode_expression()."
+        raise RuntimeError(
+            "Cannot use the compact encoding for {type}".format(
+                type=self.abstract_type.__class__.__name__
+            )
+        )
+
 
 class PrimitiveTypeConverter(CppTypeConverter, metaclass=abc.ABCMeta):
     def generate_pack_code(self, from_expression, to_expression, offset_expr):
@@ -105,6 +124,20 @@ class IntegerTypeConverter(PrimitiveTypeConverter):
             bits=bits,
         )
 
+    def generate_compact_encode_expression(self, from_expression):
+        # Zigzag keeps small negative values short.
+        if self.abstract_type.signed:
+            return "zigzag({from_})".format(from_=from_expression)
+        return "static_cast<uint64_t>({from_})".format(from_=from_expression)
+
+    def generate_compact_decode_expression(self, from_expression):
+        if self.abstract_type.signed:
+            from_expression = "unzigzag({from_})".format(from_=from_expression)
+        return "static_cast<{type}>({from_})".format(
+            type=self.map_type(),
+            from_=from_expression,
+        )
+
 
 class EntryTypeEnumConverter(IntegerTypeConverter):
     def __init__(self, abstract_type):
@@ -145,6 +178,12 @@ std::memcpy(&({to_tmp}), ({from_}) + {offset}, sizeof(({to_tmp})));
             offset=offset_expr,
         )
 
+    def generate_compact_encode_expression(self, from_expression):
+        return "static_cast<uint64_t>({from_})".format(from_=from_expression)
+
+    def generate_compact_decode_expression(self, from_expression):
+        return "static_cast<EntryType>({from_})".format(from_=from_expression)
+
 
 class ArrayTypeConverter(PrimitiveTypeConverter):
     def __init__(self, abstract_type):
@@ -269,6 +308,19 @@ std::memcpy(
             size_field=DynamicArrayType.MEMBER_SIZE,
         )
 
+    def generate_pack_header_code(self, from_expression, to_expression, offset_expr):
+        template = """
+auto _{size_field}_size = sizeof({from_}.{size_field});
+std::memcpy(({to} + {offset}), &({from_}.{size_field}), (_{size_field}_size));
+{offset} += _{size_field}_size;
+"""
+        return template.format(
+            from_=from_expression,
+            to=to_expression,
+            offset=offset_expr,
+            size_field=DynamicArrayType.MEMBER_SIZE,
+        )
+
     def generate_unpack_code(self, from_expression, to_expression, offset_expr):
         template = """
 auto _{size_field}_size = sizeof({to}.{size_field});
@@ -18,6 +18,7 @@
 
 #include <profilo/LogEntry.h>
 #include <logger/MultiBufferLogger.h>
+#include <profilo/util/Clock.h>
 #include <sys/types.h>
 #include <stdexcept>
 
@@ -106,6 +107,25 @@ class Counter {
 
 using TraceCounter = Counter;
 
+//
+// Timestamps for counters sampled every few milliseconds or less often,
+// where a jiffy of precision doesn't matter. Reads clock::coarseTime(),
+// which can repeat, and moves each reading past the previous one so that
+// Counter::record() always sees them increase. Not thread safe, like the
+// counters it stamps.
+//
+class CoarseTimestamps {
+ public:
+  int64_t next() {
+    auto time = clock::coarseTime();
+    last_ = time > last_ ? time : last_ + 1;
+    return last_;
+  }
+
+ private:
+  int64_t last_ = 0;
+};
+
 } // namespace counters
 } // namespace profilo
 } // namespace facebook
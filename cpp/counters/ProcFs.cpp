@@ -670,32 +670,42 @@ ThreadStatInfo& ThreadStatHolder::getInfo() {
   return last_info_;
 }
 
-ThreadCache::ThreadCache(MultiBufferLogger& logger) : logger_(logger) {}
+ThreadCache::ThreadCache(MultiBufferLogger& logger)
+    : logger_(logger),
+      cache_(),
+      threads_(),
+      thread_events_(false),
+      samplings_since_listing_(kSamplingsPerThreadListing) {}
 
 void ThreadCache::sampleAndLogForEach(
     uint32_t requested_stats_mask,
     const std::unordered_set<int32_t>* black_list) {
-  try {
-    const auto& threads = threadListFromProcFs();
+  if (!thread_events_ ||
+      samplings_since_listing_ >= kSamplingsPerThreadListing) {
+    try {
+      threads_ = threadListFromProcFs();
+    } catch (const std::system_error& e) {
+      // threadListFromProcFs can throw an error. Ignore it.
+      return;
+    }
+    samplings_since_listing_ = 0;
 
     // Delete cached data for gone threads.
     for (auto iter = cache_.begin(); iter != cache_.end();) {
-      if (threads.find(iter->first) == threads.end()) {
+      if (threads_.find(iter->first) == threads_.end()) {
         iter = cache_.erase(iter);
       } else {
         ++iter;
       }
     }
+  }
+  ++samplings_since_listing_;
 
-    for (auto tid : threads) {
-      if (black_list != nullptr && black_list->find(tid) != black_list->end()) {
-        continue;
-      }
-      sampleAndLogForThread(tid, requested_stats_mask);
+  for (auto tid : threads_) {
+    if (black_list != nullptr && black_list->find(tid) != black_list->end()) {
+      continue;
     }
-  } catch (const std::system_error& e) {
-    // threadListFromProcFs can throw an error. Ignore it.
-    return;
+    sampleAndLogForThread(tid, requested_stats_mask);
   }
 }
 
@@ -723,8 +733,23 @@ int32_t ThreadCache::getStatsAvailabililty(int32_t tid) {
   return stats_mask;
 }
 
+void ThreadCache::setThreadEvents(bool enabled) {
+  thread_events_ = enabled;
+}
+
+void ThreadCache::onThreadStart(int32_t tid) {
+  threads_.insert(tid);
+}
+
+void ThreadCache::onThreadExit(int32_t tid) {
+  threads_.erase(tid);
+  cache_.erase(tid);
+}
+
 void ThreadCache::clear() {
   cache_.clear();
+  threads_.clear();
+  samplings_since_listing_ = kSamplingsPerThreadListing;
 }
 
 } // namespace counters
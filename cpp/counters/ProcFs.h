@@ -359,6 +359,11 @@ class ThreadStatHolder {
 
 class ThreadCache {
  public:
+  // With thread lifecycle events, /proc/self/task is only listed on every
+  // kSamplingsPerThreadListing-th sampleAndLogForEach(), to catch the
+  // threads the events missed.
+  static constexpr uint32_t kSamplingsPerThreadListing = 16;
+
   ThreadCache(MultiBufferLogger& logger);
 
   // Execute `function` for all currently existing threads.
@@ -370,11 +375,20 @@ class ThreadCache {
 
   int32_t getStatsAvailabililty(int32_t tid);
 
+  // Whether onThreadStart() and onThreadExit() are told about threads.
+  void setThreadEvents(bool enabled);
+  void onThreadStart(int32_t tid);
+  void onThreadExit(int32_t tid);
+
   void clear();
 
  private:
   MultiBufferLogger& logger_;
   std::unordered_map<uint32_t, ThreadStatHolder> cache_;
+  // The threads as of the last listing and the events since.
+  ThreadList threads_;
+  bool thread_events_;
+  uint32_t samplings_since_listing_;
 };
 
 } // namespace counters
@@ -1,4 +1,4 @@
-// @generated SignedSource<<dac133554c4c93a6470de853350a032e>>
+// @generated SignedSource<<ecce117597f3e2620dea7eaf489814d8>>
 
 #include <cstring>
 #include <stdexcept>
@@ -8,6 +8,68 @@ namespace facebook {
 namespace profilo {
 namespace entries {
 
+namespace {
+
+uint64_t zigzag(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^
+      static_cast<uint64_t>(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+size_t varintFieldSize(uint64_t value) {
+  if (value == 0) {
+    return 0;
+  }
+  return (64 - __builtin_clzll(value) + 6) / 7;
+}
+
+/* Writes nothing for zero, the field is then absent from `present`. */
+size_t writeVarintField(
+    uint8_t* dst,
+    uint64_t value,
+    uint8_t bit,
+    uint8_t& present) {
+  if (value == 0) {
+    return 0;
+  }
+  present |= bit;
+  size_t size = 0;
+  while (value >= 0x80) {
+    dst[size++] = static_cast<uint8_t>(value) | 0x80;
+    value >>= 7;
+  }
+  dst[size++] = static_cast<uint8_t>(value);
+  return size;
+}
+
+uint64_t readVarintField(
+    const uint8_t* src,
+    size_t size,
+    size_t& offset,
+    uint8_t bit,
+    uint8_t present) {
+  if ((present & bit) == 0) {
+    return 0;
+  }
+  uint64_t value = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    if (offset >= size) {
+      throw std::out_of_range("Compact entry is truncated");
+    }
+    uint8_t byte = src[offset++];
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return value;
+    }
+  }
+  throw std::out_of_range("Compact entry has an overlong varint");
+}
+
+} // namespace
+
 /* Alignment requirement: dst must be 4-byte aligned. */
 void StandardEntry::pack(const StandardEntry& entry, void* dst, size_t size) {
   if (size < StandardEntry::calculateSize(entry)) {
@@ -51,6 +113,38 @@ void StandardEntry::pack(const StandardEntry& entry, void* dst, size_t size) {
   
 }
 
+/* No alignment requirement. */
+void StandardEntry::packCompact(
+    const StandardEntry& entry,
+    void* dst,
+    size_t size) {
+  if (size < kMaxCompactSize && size < calculateCompactSize(entry)) {
+      throw std::out_of_range("Cannot fit compact StandardEntry in destination");
+  }
+  if (dst == nullptr) {
+      throw std::invalid_argument("dst == nullptr");
+  }
+  uint8_t* dst_byte = reinterpret_cast<uint8_t*>(dst);
+  dst_byte[0] = kCompactSerializationType;
+  uint8_t present = 0;
+  size_t offset = 2;
+  offset += writeVarintField(
+      dst_byte + offset, zigzag(entry.id), 0x01, present);
+  offset += writeVarintField(
+      dst_byte + offset, static_cast<uint64_t>(entry.type), 0x02, present);
+  offset += writeVarintField(
+      dst_byte + offset, zigzag(entry.timestamp), 0x04, present);
+  offset += writeVarintField(
+      dst_byte + offset, zigzag(entry.tid), 0x08, present);
+  offset += writeVarintField(
+      dst_byte + offset, zigzag(entry.callid), 0x10, present);
+  offset += writeVarintField(
+      dst_byte + offset, zigzag(entry.matchid), 0x20, present);
+  offset += writeVarintField(
+      dst_byte + offset, zigzag(entry.extra), 0x40, present);
+  dst_byte[1] = present;
+}
+
 
 /* Alignment requirement: src must be 4-byte aligned. */
 void StandardEntry::unpack(StandardEntry& entry, const void* src, size_t size) {
@@ -58,6 +152,10 @@ void StandardEntry::unpack(StandardEntry& entry, const void* src, size_t size) {
       throw std::invalid_argument("src == nullptr");
   }
   const uint8_t* src_byte = reinterpret_cast<const uint8_t*>(src);
+  if (*src_byte == kCompactSerializationType) {
+      unpackCompact(entry, src, size);
+      return;
+  }
   if (*src_byte != kSerializationType) {
       throw std::invalid_argument("Serialization type is incorrect");
   }
@@ -94,6 +192,32 @@ void StandardEntry::unpack(StandardEntry& entry, const void* src, size_t size) {
   
 }
 
+/* No alignment requirement. */
+void StandardEntry::unpackCompact(
+    StandardEntry& entry,
+    const void* src,
+    size_t size) {
+  if (src == nullptr) {
+      throw std::invalid_argument("src == nullptr");
+  }
+  const uint8_t* src_byte = reinterpret_cast<const uint8_t*>(src);
+  if (size < 2) {
+      throw std::out_of_range("Compact entry is truncated");
+  }
+  if (src_byte[0] != kCompactSerializationType) {
+      throw std::invalid_argument("Serialization type is incorrect");
+  }
+  uint8_t present = src_byte[1];
+  size_t offset = 2;
+  entry.id = static_cast<int32_t>(unzigzag(readVarintField(src_byte, size, offset, 0x01, present)));
+  entry.type = static_cast<EntryType>(readVarintField(src_byte, size, offset, 0x02, present));
+  entry.timestamp = static_cast<int64_t>(unzigzag(readVarintField(src_byte, size, offset, 0x04, present)));
+  entry.tid = static_cast<int32_t>(unzigzag(readVarintField(src_byte, size, offset, 0x08, present)));
+  entry.callid = static_cast<int32_t>(unzigzag(readVarintField(src_byte, size, offset, 0x10, present)));
+  entry.matchid = static_cast<int32_t>(unzigzag(readVarintField(src_byte, size, offset, 0x20, present)));
+  entry.extra = static_cast<int64_t>(unzigzag(readVarintField(src_byte, size, offset, 0x40, present)));
+}
+
 
 size_t StandardEntry::calculateSize(StandardEntry const& entry) {
   size_t offset = 1 /*serialization format*/;
@@ -107,6 +231,18 @@ size_t StandardEntry::calculateSize(StandardEntry const& entry) {
   return offset;
 }
 
+size_t StandardEntry::calculateCompactSize(StandardEntry const& entry) {
+  size_t offset = 2 /*serialization format, presence bitmap*/;
+  offset += varintFieldSize(zigzag(entry.id));
+  offset += varintFieldSize(static_cast<uint64_t>(entry.type));
+  offset += varintFieldSize(zigzag(entry.timestamp));
+  offset += varintFieldSize(zigzag(entry.tid));
+  offset += varintFieldSize(zigzag(entry.callid));
+  offset += varintFieldSize(zigzag(entry.matchid));
+  offset += varintFieldSize(zigzag(entry.extra));
+  return offset;
+}
+
 
 /* Alignment requirement: dst must be 4-byte aligned. */
 void FramesEntry::pack(const FramesEntry& entry, void* dst, size_t size) {
@@ -159,6 +295,51 @@ void FramesEntry::pack(const FramesEntry& entry, void* dst, size_t size) {
   
 }
 
+/* Alignment requirement: dst must be 4-byte aligned. */
+void FramesEntry::packHeader(
+    const FramesEntry& entry,
+    void* dst,
+    size_t size) {
+  if (size < kHeaderSize) {
+      throw std::out_of_range("Cannot fit FramesEntry header in destination");
+  }
+  if (dst == nullptr) {
+      throw std::invalid_argument("dst == nullptr");
+  }
+  uint8_t* dst_byte = reinterpret_cast<uint8_t*>(dst);
+  *dst_byte = kSerializationType;
+  size_t offset = 1;
+
+  
+  std::memcpy((dst_byte) + offset, &(entry.id), sizeof((entry.id)));
+  offset += sizeof((entry.id));
+  
+  
+  uint8_t entry_type_tmp = static_cast<uint8_t>(entry.type);
+  std::memcpy((dst_byte) + offset, &(entry_type_tmp), sizeof((entry_type_tmp)));
+  offset += sizeof((entry_type_tmp));
+  
+  
+  std::memcpy((dst_byte) + offset, &(entry.timestamp), sizeof((entry.timestamp)));
+  offset += sizeof((entry.timestamp));
+  
+  
+  std::memcpy((dst_byte) + offset, &(entry.tid), sizeof((entry.tid)));
+  offset += sizeof((entry.tid));
+  
+  
+  std::memcpy((dst_byte) + offset, &(entry.matchid), sizeof((entry.matchid)));
+  offset += sizeof((entry.matchid));
+  
+  
+  auto _size_size = sizeof(entry.frames.size);
+  std::memcpy((dst_byte + offset), &(entry.frames.size), (_size_size));
+  offset += _size_size;
+  
+  // Zero the padding before the values.
+  std::memset(dst_byte + offset, 0, kHeaderSize - offset);
+}
+
 
 /* Alignment requirement: src must be 4-byte aligned. */
 void FramesEntry::unpack(FramesEntry& entry, const void* src, size_t size) {
@@ -268,6 +449,43 @@ void BytesEntry::pack(const BytesEntry& entry, void* dst, size_t size) {
   
 }
 
+/* Alignment requirement: dst must be 4-byte aligned. */
+void BytesEntry::packHeader(
+    const BytesEntry& entry,
+    void* dst,
+    size_t size) {
+  if (size < kHeaderSize) {
+      throw std::out_of_range("Cannot fit BytesEntry header in destination");
+  }
+  if (dst == nullptr) {
+      throw std::invalid_argument("dst == nullptr");
+  }
+  uint8_t* dst_byte = reinterpret_cast<uint8_t*>(dst);
+  *dst_byte = kSerializationType;
+  size_t offset = 1;
+
+  
+  std::memcpy((dst_byte) + offset, &(entry.id), sizeof((entry.id)));
+  offset += sizeof((entry.id));
+  
+  
+  uint8_t entry_type_tmp = static_cast<uint8_t>(entry.type);
+  std::memcpy((dst_byte) + offset, &(entry_type_tmp), sizeof((entry_type_tmp)));
+  offset += sizeof((entry_type_tmp));
+  
+  
+  std::memcpy((dst_byte) + offset, &(entry.matchid), sizeof((entry.matchid)));
+  offset += sizeof((entry.matchid));
+  
+  
+  auto _size_size = sizeof(entry.bytes.size);
+  std::memcpy((dst_byte + offset), &(entry.bytes.size), (_size_size));
+  offset += _size_size;
+  
+  // Zero the padding before the values.
+  std::memset(dst_byte + offset, 0, kHeaderSize - offset);
+}
+
 
 /* Alignment requirement: src must be 4-byte aligned. */
 void BytesEntry::unpack(BytesEntry& entry, const void* src, size_t size) {
@@ -1,4 +1,4 @@
-// @generated SignedSource<<92e7f010a9d663922326eefa54f7b0e0>>
+// @generated SignedSource<<3888b310254aa22d364cb17b781eda05>>
 
 #include <cstdint>
 #include <cstring>
@@ -28,6 +28,14 @@ struct __attribute__((packed)) StandardEntry {
   static void unpack(StandardEntry& entry, const void* src, size_t size);
 
   static size_t calculateSize(StandardEntry const& entry);
+
+  // Compact encoding: a presence bitmap, then only the fields that aren't
+  // zero, as varints (zigzag for signed fields). unpack() also accepts it.
+  static const uint8_t kCompactSerializationType = 4;
+  static const size_t kMaxCompactSize = 44;
+  static void packCompact(const StandardEntry& entry, void* dst, size_t size);
+  static void unpackCompact(StandardEntry& entry, const void* src, size_t size);
+  static size_t calculateCompactSize(StandardEntry const& entry);
 };
 
 struct __attribute__((packed)) FramesEntry {
@@ -48,6 +56,12 @@ struct __attribute__((packed)) FramesEntry {
   static void unpack(FramesEntry& entry, const void* src, size_t size);
 
   static size_t calculateSize(FramesEntry const& entry);
+
+  // Size of the serialized entry up to the first value of the trailing
+  // dynamic array. packHeader() writes exactly these bytes, so callers can
+  // place the values themselves (e.g., straight into buffer slots).
+  static const size_t kHeaderSize = 24;
+  static void packHeader(const FramesEntry& entry, void* dst, size_t size);
 };
 
 struct __attribute__((packed)) BytesEntry {
@@ -66,6 +80,12 @@ struct __attribute__((packed)) BytesEntry {
   static void unpack(BytesEntry& entry, const void* src, size_t size);
 
   static size_t calculateSize(BytesEntry const& entry);
+
+  // Size of the serialized entry up to the first value of the trailing
+  // dynamic array. packHeader() writes exactly these bytes, so callers can
+  // place the values themselves (e.g., straight into buffer slots).
+  static const size_t kHeaderSize = 12;
+  static void packHeader(const BytesEntry& entry, void* dst, size_t size);
 };
 
 
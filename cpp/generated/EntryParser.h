@@ -1,4 +1,4 @@
-// @generated SignedSource<<d642034c7e1830efd4a46871d51c5ac6>>
+// @generated SignedSource<<b53db2fc320b8bf01330a8f3c4a48e9c>>
 
 #pragma once
 
@@ -51,6 +51,13 @@ public:
         break;
       }
       
+      case 4: {
+        StandardEntry data;
+        StandardEntry::unpackCompact(data, src, size);
+        visitor.visit(data);
+        break;
+      }
+      
       default: throw std::invalid_argument("Unknown type in to_stream");
     }
   }
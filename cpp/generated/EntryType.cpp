@@ -1,4 +1,4 @@
-// @generated SignedSource<<ddb15ac11ce4c74eb08b3ee312829017>>
+// @generated SignedSource<<b992def2ef4253a573e896faa726f6e6>>
 
 #include <stdexcept>
 #include <generated/EntryType.h>
@@ -128,6 +128,11 @@ const char* to_string(EntryType type) {
     case EntryType::MEMORY_MAPPING_FAILURE: return "MEMORY_MAPPING_FAILURE";
     case EntryType::THREAD_NAMING: return "THREAD_NAMING";
     case EntryType::STKERR_INVALID_MAP: return "STKERR_INVALID_MAP";
+    case EntryType::TRACE_PACKETS_LOST: return "TRACE_PACKETS_LOST";
+    case EntryType::STRING_DEFINITION: return "STRING_DEFINITION";
+    case EntryType::BLOB_REFERENCE: return "BLOB_REFERENCE";
+    case EntryType::STKERR_UNRESOLVED_STACK: return "STKERR_UNRESOLVED_STACK";
+    case EntryType::BLOB_LOST: return "BLOB_LOST";
     default: throw std::invalid_argument("Unknown entry type");
   }
 }
@@ -1,4 +1,4 @@
-// @generated SignedSource<<1959b2ffeb1868d427c23292272a02c5>>
+// @generated SignedSource<<86f48115ea25c607b70aa6d5d09a24fa>>
 
 #pragma once
 
@@ -125,6 +125,11 @@ enum class EntryType {
   MEMORY_MAPPING_FAILURE = 116,
   THREAD_NAMING = 117,
   STKERR_INVALID_MAP = 118,
+  TRACE_PACKETS_LOST = 119,
+  STRING_DEFINITION = 120,
+  BLOB_REFERENCE = 121,
+  STKERR_UNRESOLVED_STACK = 122,
+  BLOB_LOST = 123,
 };
 
 
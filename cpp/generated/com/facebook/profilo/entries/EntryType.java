@@ -1,4 +1,4 @@
-// @generated SignedSource<<b59ea2208f5b4fdce3e6fcdb16da08a4>>
+// @generated SignedSource<<55d51ee7a2602003107a7e685b8e20b2>>
 
 package com.facebook.profilo.entries;
 
@@ -123,6 +123,11 @@ public class EntryType {
   public static final int MEMORY_MAPPING_FAILURE = 116;
   public static final int THREAD_NAMING = 117;
   public static final int STKERR_INVALID_MAP = 118;
+  public static final int TRACE_PACKETS_LOST = 119;
+  public static final int STRING_DEFINITION = 120;
+  public static final int BLOB_REFERENCE = 121;
+  public static final int STKERR_UNRESOLVED_STACK = 122;
+  public static final int BLOB_LOST = 123;
 
   public static final String[] NAMES = {
     "UNKNOWN_TYPE",
@@ -244,5 +249,10 @@ public class EntryType {
     "MEMORY_MAPPING_FAILURE",
     "THREAD_NAMING",
     "STKERR_INVALID_MAP",
+    "TRACE_PACKETS_LOST",
+    "STRING_DEFINITION",
+    "BLOB_REFERENCE",
+    "STKERR_UNRESOLVED_STACK",
+    "BLOB_LOST",
   };
 }
@@ -16,6 +16,8 @@
 
 #include "NativeTraceWriter.h"
 
+#include <fb/log.h>
+#include <logger/StringTable.h>
 #include <writer/trace_backwards.h>
 #include <writer/trace_headers.h>
 #include <sys/types.h>
@@ -42,7 +44,17 @@ NativeTraceWriter::NativeTraceWriter(
           std::move(buffer),
           callbacks_,
           calculateHeaders(),
-          traceBackwards) {}
+          [](entries::EntryVisitor& visitor,
+             Buffer& buffer,
+             ShardCursors& cursors) {
+            traceBackwards(visitor, buffer, cursors);
+          },
+          TraceFormat::TEXT,
+          CompressionConfig(),
+          TraceWriter::kDefaultMaxPendingTraces,
+          StreamingConfig(),
+          // The buffer is written to by this process.
+          &logger::StringTable::get()) {}
 
 void NativeTraceWriter::loop() {
   writer_.loop();
@@ -52,8 +64,18 @@ void NativeTraceWriter::dump(int64_t trace_id) {
   writer_.dump(trace_id);
 }
 
-void NativeTraceWriter::submit(TraceBuffer::Cursor cursor, int64_t trace_id) {
-  writer_.submit(cursor, trace_id);
+bool NativeTraceWriter::submit(TraceBuffer::Cursor cursor, int64_t trace_id) {
+  return submit(ShardCursors{cursor}, trace_id);
+}
+
+bool NativeTraceWriter::submit(ShardCursors cursors, int64_t trace_id) {
+  if (writer_.submit(std::move(cursors), trace_id)) {
+    return true;
+  }
+  // The writer never saw the trace, so nothing else will end it.
+  FBLOGE("Writer queue is full, aborting trace %lld", (long long)trace_id);
+  callbacks_->onTraceAbort(trace_id, AbortReason::WRITER_QUEUE_FULL);
+  return false;
 }
 
 local_ref<NativeTraceWriter::jhybriddata> NativeTraceWriter::initHybrid(
@@ -48,7 +48,16 @@ class NativeTraceWriter : public fbjni::HybridClass<NativeTraceWriter> {
 
   void dump(int64_t trace_id);
 
-  void submit(TraceBuffer::Cursor cursor, int64_t trace_id);
+  //
+  // Queue the trace on the writer. If the writer's queue is full the trace
+  // is aborted with AbortReason::WRITER_QUEUE_FULL and false is returned.
+  //
+  __attribute__((warn_unused_result)) bool submit(
+      TraceBuffer::Cursor cursor,
+      int64_t trace_id);
+  __attribute__((warn_unused_result)) bool submit(
+      ShardCursors cursors,
+      int64_t trace_id);
 
  private:
   friend HybridBase;
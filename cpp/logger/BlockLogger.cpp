@@ -23,16 +23,13 @@ namespace logger {
 
 BlockLogger::BlockLogger(MultiBufferLogger& logger, const char* name)
     : logger_(logger), tid_(threadID()) {
-  auto id = logger_.write(StandardEntry{
-      .type = EntryType::MARK_PUSH,
-      .timestamp = monotonicTime(),
-      .tid = tid_,
-  });
-
-  logger_.writeBytes(
-      EntryType::STRING_NAME,
-      id,
-      reinterpret_cast<const uint8_t*>(name),
+  logger_.writeNamed(
+      StandardEntry{
+          .type = EntryType::MARK_PUSH,
+          .timestamp = monotonicTime(),
+          .tid = tid_,
+      },
+      name,
       strlen(name));
 }
 BlockLogger::~BlockLogger() {
@@ -19,6 +19,7 @@
 #include <algorithm>
 #include <chrono>
 #include <cstring>
+#include <limits>
 #include <stdexcept>
 
 #include <util/common.h>
@@ -28,21 +29,129 @@ namespace profilo {
 
 using namespace entries;
 
+namespace {
+
+// IDs go from 1 to INT32_MAX, then start over from 1.
+constexpr uint64_t kIDRange = std::numeric_limits<int32_t>::max();
+
+// The block a thread is handing out IDs from, as (index << 32) | first:
+// the IDs are first + index up to first + kBlockSize - 1, wrapping around
+// like the counter. A first ID of 0 means no block. Claiming an ID is a
+// fetch_add on the index, so a signal handler that interrupts next() can't
+// get an ID that's also returned to the code it interrupted.
+constexpr uint32_t kLeaseIndexShift = 32;
+constexpr uint64_t kLeaseFirstMask = 0xffffffff;
+
+// A thread only keeps the lease of the last counter it used, switching to
+// another counter gives up what's left of it. The instance is that of the
+// counter the block was leased from, 0 for none.
+thread_local std::atomic<uint64_t> id_lease{0};
+thread_local std::atomic<uint64_t> id_lease_instance{0};
+
+std::atomic<uint64_t> id_counter_instances{0};
+
+} // namespace
+
+Logger::EntryIDCounter::EntryIDCounter(int32_t initialValue)
+    : instance_(id_counter_instances.fetch_add(1) + 1),
+      position_(initialValue > 0 ? initialValue - 1 : 0) {}
+
+int32_t Logger::EntryIDCounter::next() {
+  // Lagging or not, take the first ID of a block leased in this call, other
+  // threads leasing at the same time could otherwise keep us retrying.
+  bool leased = false;
+  for (;;) {
+    auto instance = id_lease_instance.load(std::memory_order_relaxed);
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    auto lease = id_lease.fetch_add(
+        uint64_t{1} << kLeaseIndexShift, std::memory_order_relaxed);
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+
+    uint64_t index = lease >> kLeaseIndexShift;
+    uint64_t first = lease & kLeaseFirstMask;
+    // A handler may have leased from another counter since the first load.
+    if (instance == instance_ &&
+        id_lease_instance.load(std::memory_order_relaxed) == instance &&
+        first != 0 && index < kBlockSize) {
+      uint64_t id = (first - 1 + index) % kIDRange + 1;
+      // How far the ID is behind the last one leased to any thread. A thread
+      // that sat on its block while others went on drops it, see kMaxLag.
+      uint64_t head = position_.load(std::memory_order_relaxed) % kIDRange;
+      if (leased || (head + kIDRange - id) % kIDRange <= kMaxLag) {
+        return static_cast<int32_t>(id);
+      }
+    }
+
+    // Invalidate the block before switching instances so a handler running
+    // in between can't claim from it on behalf of the wrong counter.
+    id_lease.store(0, std::memory_order_relaxed);
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    id_lease_instance.store(instance_, std::memory_order_relaxed);
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    uint64_t position =
+        position_.fetch_add(kBlockSize, std::memory_order_relaxed);
+    id_lease.store(position % kIDRange + 1, std::memory_order_relaxed);
+    leased = true;
+  }
+}
+
+Logger::PackedEntry::PackedEntry(const StandardEntry& entry)
+    : header_size_(StandardEntry::calculateSize(entry)),
+      tail_(nullptr),
+      tail_size_(0),
+      standard_(&entry),
+      bytes_(nullptr),
+      compact_size_(0) {
+  StandardEntry::pack(entry, header_, header_size_);
+}
+
+Logger::PackedEntry::PackedEntry(const FramesEntry& entry) : bytes_(nullptr) {
+  packWithArray(entry, entry.frames);
+}
+
+Logger::PackedEntry::PackedEntry(const BytesEntry& entry) : bytes_(&entry) {
+  packWithArray(entry, entry.bytes);
+}
+
+template <class U, class Array>
+void Logger::PackedEntry::packWithArray(const U& entry, const Array& array) {
+  static_assert(
+      U::kHeaderSize <= sizeof(header_), "Entry header must fit in a packet");
+  U::packHeader(entry, header_, U::kHeaderSize);
+  header_size_ = U::kHeaderSize;
+  tail_ = array.values;
+  tail_size_ = array.size * sizeof(*array.values);
+  standard_ = nullptr;
+  compact_size_ = 0;
+}
+
 Logger::EntryIDCounter& Logger::getGlobalEntryID() {
   static EntryIDCounter global_instance{kDefaultInitialID};
   return global_instance;
 }
 
-Logger::Logger(logger::TraceBufferProvider provider, EntryIDCounter& counter)
-    : entryID_(counter), logger_(provider) {}
+Logger::Logger(
+    logger::TraceBufferProvider provider,
+    EntryIDCounter& counter,
+    bool staged)
+    : entryID_(counter),
+      logger_(provider, staged),
+      byte_ring_(nullptr),
+      blob_arena_(nullptr) {}
+
+Logger::Logger(logger::ByteRingBuffer& byte_ring, EntryIDCounter& counter)
+    : entryID_(counter),
+      logger_(nullptr),
+      byte_ring_(&byte_ring),
+      blob_arena_(nullptr) {}
 
 int32_t Logger::writeBytes(
     EntryType type,
     int32_t arg1,
     const uint8_t* arg2,
     size_t len) {
-  if (len > kMaxVariableLengthEntry) {
-    throw std::overflow_error("len is bigger than kMaxVariableLengthEntry");
+  if (len > maxBytesLength()) {
+    throw std::overflow_error("len is bigger than maxBytesLength()");
   }
   if (arg2 == nullptr) {
     throw std::invalid_argument("arg2 is null");
@@ -57,5 +166,32 @@ int32_t Logger::writeBytes(
           .size = static_cast<uint16_t>(len)}});
 }
 
+TraceBuffer::Cursor Logger::writeBlob(const BytesEntry& entry) {
+  auto reservation = blob_arena_->reserve(entry.bytes.size);
+  if (reservation.data == nullptr) {
+    // Too large for the arena, or a lossy arena is too busy.
+    return writeEntryWithArray(entry, entry.bytes);
+  }
+  std::memcpy(reservation.data, entry.bytes.values, entry.bytes.size);
+  blob_arena_->commit(reservation);
+
+  BlobReference reference{
+      .position = logger::ByteRingBuffer::positionOf(reservation.position),
+      .length = entry.bytes.size,
+      .type = static_cast<uint32_t>(entry.type),
+  };
+  BytesEntry reference_entry{
+      .id = entry.id,
+      .type = EntryType::BLOB_REFERENCE,
+      .matchid = entry.matchid,
+      .bytes =
+          {
+              .values = reinterpret_cast<const uint8_t*>(&reference),
+              .size = sizeof(reference),
+          },
+  };
+  return writeEntryWithArray(reference_entry, reference_entry.bytes);
+}
+
 } // namespace profilo
 } // namespace facebook
@@ -19,7 +19,9 @@
 #include <LogEntry.h>
 #include <generated/Entry.h>
 #include <generated/EntryType.h>
+#include <logger/buffer/ByteRingBuffer.h>
 #include <atomic>
+#include <cstring>
 
 #include "PacketLogger.h"
 
@@ -27,36 +29,90 @@
 
 namespace facebook {
 namespace profilo {
+namespace mmapbuf {
+struct Buffer;
+} // namespace mmapbuf
 
 using namespace entries;
 
 class Logger {
  public:
+  //
+  // Hands out positive entry IDs, unique until they wrap around after
+  // INT32_MAX. Each thread leases a block of kBlockSize IDs at a time with
+  // a single fetch_add, and hands them out with a fetch_add on a thread
+  // local, so next() is safe to call from signal handlers. IDs only increase
+  // within a thread. Across threads, they're at most kMaxLag behind the last
+  // ID leased: a thread drops what's left of its block once others have
+  // leased more than kMaxLag IDs past it.
+  //
   struct EntryIDCounter {
-    EntryIDCounter(int32_t initialValue) : id_(initialValue) {}
+    static constexpr uint32_t kBlockSize = 64;
+    static constexpr uint32_t kMaxLag = 2 * kBlockSize;
+
+    EntryIDCounter(int32_t initialValue);
     EntryIDCounter(EntryIDCounter& copy) = delete;
 
-    int32_t next() {
-      int32_t value, newValue;
+    PROFILOEXPORT int32_t next();
 
-      do {
-        value = id_.load();
-        if (value <= 0 || value == std::numeric_limits<int32_t>::max()) {
-          // explicitly handle overflow and skip negative IDs.
-          newValue = 1;
-        } else {
-          newValue = value + 1;
-        }
-      } while (!id_.compare_exchange_weak(value, newValue));
+   private:
+    // Tells apart the leases of counters that lived at the same address.
+    const uint64_t instance_;
+    // Position of the next block in the sequence of IDs, see next().
+    std::atomic<uint64_t> position_;
+  };
 
-      return value;
-    }
+  //
+  // An entry serialized once, to be written into any number of buffers with
+  // writePacked(). Keeps pointers to the entry and its array values, which
+  // must outlive it.
+  //
+  class PackedEntry {
+   public:
+    explicit PackedEntry(const StandardEntry& entry);
+    explicit PackedEntry(const FramesEntry& entry);
+    explicit PackedEntry(const BytesEntry& entry);
 
    private:
-    std::atomic<int32_t> id_;
+    // The fixed encoding of a StandardEntry, or the header of an array entry.
+    alignas(4) char header_[sizeof(logger::Packet::data)];
+    size_t header_size_;
+    const void* tail_;
+    size_t tail_size_;
+    // StandardEntry only, the compact encoding is packed on first use.
+    const StandardEntry* standard_;
+    // BytesEntry only, for payloads that go to the blob arena.
+    const BytesEntry* bytes_;
+    uint8_t compact_[StandardEntry::kMaxCompactSize];
+    size_t compact_size_;
+
+    template <class U, class Array>
+    void packWithArray(const U& entry, const Array& array);
+
+    friend class Logger;
   };
 
   static constexpr size_t kMaxVariableLengthEntry = 1024;
+  // BytesEntry payloads from this size on go to the blob arena of the
+  // buffer, if it has one.
+  static constexpr size_t kMinBlobLength = 256;
+  // Largest payload writeBytes() takes for a buffer with a blob arena.
+  static constexpr size_t kMaxBlobLength = UINT16_MAX;
+
+  //
+  // Payload of a BLOB_REFERENCE entry, which stands in for a BytesEntry
+  // whose bytes went to the blob arena. The entry keeps the id and matchid
+  // of the original one.
+  //
+  struct __attribute__((packed)) BlobReference {
+    // Position of the blob record in the arena. Besides its offset, tells
+    // which lap of the arena it was written in, so a reader can tell when
+    // the blob has been overwritten since.
+    uint64_t position;
+    uint32_t length;
+    // EntryType of the original entry.
+    uint32_t type;
+  };
   // Start first entry shifted to allow safely adding extra entries to the trace
   // after completion.
   static constexpr int32_t kDefaultInitialID = 512;
@@ -69,12 +125,7 @@ class Logger {
       entry.id = entryID_.next();
     }
 
-    using U = std::decay_t<T>;
-    auto size = U::calculateSize(entry);
-    char payload[size];
-    U::pack(entry, payload, size);
-
-    logger_.write(payload, size);
+    writeEntry(entry);
     return entry.id;
   }
 
@@ -84,26 +135,185 @@ class Logger {
       entry.id = entryID_.next();
     }
 
-    using U = std::decay_t<T>;
-    auto size = U::calculateSize(entry);
-    char payload[size];
-    U::pack(entry, payload, size);
-
-    cursor = logger_.writeAndGetCursor(payload, size);
+    cursor = writeEntry(entry);
     return entry.id;
   }
 
+  //
+  // Payloads up to maxBytesLength() bytes. Throws std::overflow_error for
+  // larger ones.
+  //
   PROFILOEXPORT int32_t
   writeBytes(EntryType type, int32_t arg1, const uint8_t* arg2, size_t len);
 
+  //
+  // kMaxVariableLengthEntry, or with a blob arena, the largest record the
+  // arena takes up to kMaxBlobLength. Larger blobs would never make it into
+  // the arena.
+  //
+  size_t maxBytesLength() const {
+    if (blob_arena_ == nullptr) {
+      return kMaxVariableLengthEntry;
+    }
+    size_t arena_max = blob_arena_->maxRecordSize();
+    if (arena_max > kMaxBlobLength) {
+      return kMaxBlobLength;
+    }
+    return arena_max > kMaxVariableLengthEntry ? arena_max
+                                               : kMaxVariableLengthEntry;
+  }
+
+  //
+  // Writes an entry serialized by PackedEntry, which must already have its
+  // id. Same as write(), without serializing the entry again for every
+  // buffer it goes to.
+  //
+  TraceBuffer::Cursor writePacked(PackedEntry& packed) {
+    if (packed.bytes_ != nullptr && isBlob(*packed.bytes_)) {
+      // The header is of no use, the arena only takes the payload.
+      return writeEntry(*packed.bytes_);
+    }
+    if (byte_ring_ != nullptr) {
+      const void* head = packed.header_;
+      size_t head_size = packed.header_size_;
+      if (packed.standard_ != nullptr) {
+        if (packed.compact_size_ == 0) {
+          packed.compact_size_ =
+              StandardEntry::calculateCompactSize(*packed.standard_);
+          StandardEntry::packCompact(
+              *packed.standard_, packed.compact_, packed.compact_size_);
+        }
+        head = packed.compact_;
+        head_size = packed.compact_size_;
+      }
+      return writeRecord(
+          head_size + packed.tail_size_,
+          [head, head_size, &packed](void* dst, size_t size) {
+            std::memcpy(dst, head, head_size);
+            if (packed.tail_size_ > 0) {
+              std::memcpy(
+                  static_cast<char*>(dst) + head_size,
+                  packed.tail_,
+                  packed.tail_size_);
+            }
+          });
+    }
+    if (packed.standard_ != nullptr) {
+      return logger_.writeInPlace(
+          packed.header_size_, [&packed](void* dst, size_t size) {
+            std::memcpy(dst, packed.header_, size);
+          });
+    }
+    return logger_.writeAndGetCursor(
+        packed.header_, packed.header_size_, packed.tail_, packed.tail_size_);
+  }
+
   // This constructor is for internal framework use.
-  Logger(logger::TraceBufferProvider provider, EntryIDCounter& counter);
+  Logger(
+      logger::TraceBufferProvider provider,
+      EntryIDCounter& counter,
+      bool staged = false);
+
+  //
+  // Writes every entry as a single record of a byte ring instead of
+  // packetizing it. The returned cursors are positions in the byte ring.
+  //
+  Logger(logger::ByteRingBuffer& byte_ring, EntryIDCounter& counter);
 
  private:
   EntryIDCounter& entryID_;
   logger::PacketLogger logger_;
+  // If set, entries go here and logger_ is unused.
+  logger::ByteRingBuffer* byte_ring_;
+  // If set, takes the payloads of large BytesEntry writes.
+  logger::ByteRingBuffer* blob_arena_;
+
+  static_assert(
+      sizeof(StandardEntry) + 1 <= sizeof(logger::Packet::data),
+      "StandardEntry must fit into a single packet");
+
+  // Entries are serialized directly into the buffer: StandardEntry in place
+  // into its slot, and entries carrying an array as a packed header followed
+  // by the array values, without an intermediate payload copy.
+  //
+  // In a byte ring StandardEntry takes the compact encoding, most of its
+  // fields are usually zero and every byte saved is room for more entries.
+  // A packet slot holds one entry whatever its size, so there the cheaper
+  // fixed encoding wins.
+  TraceBuffer::Cursor writeEntry(const StandardEntry& entry) {
+    if (byte_ring_ != nullptr) {
+      return writeRecord(
+          StandardEntry::calculateCompactSize(entry),
+          [&entry](void* dst, size_t size) {
+            StandardEntry::packCompact(entry, dst, size);
+          });
+    }
+    return logger_.writeInPlace(
+        StandardEntry::calculateSize(entry), [&entry](void* dst, size_t size) {
+          StandardEntry::pack(entry, dst, size);
+        });
+  }
+
+  TraceBuffer::Cursor writeEntry(const FramesEntry& entry) {
+    return writeEntryWithArray(entry, entry.frames);
+  }
+
+  TraceBuffer::Cursor writeEntry(const BytesEntry& entry) {
+    if (isBlob(entry)) {
+      return writeBlob(entry);
+    }
+    return writeEntryWithArray(entry, entry.bytes);
+  }
+
+  bool isBlob(const BytesEntry& entry) const {
+    return blob_arena_ != nullptr && entry.bytes.size >= kMinBlobLength;
+  }
+
+  //
+  // Copies the payload into the blob arena and writes a BLOB_REFERENCE in
+  // place of the entry. Falls back to writing the entry itself if the arena
+  // drops the payload.
+  //
+  TraceBuffer::Cursor writeBlob(const BytesEntry& entry);
+
+  template <class U, class Array>
+  TraceBuffer::Cursor writeEntryWithArray(const U& entry, const Array& array) {
+    size_t array_size = array.size * sizeof(*array.values);
+    if (byte_ring_ != nullptr) {
+      return writeRecord(
+          U::kHeaderSize + array_size,
+          [&entry, &array, array_size](void* dst, size_t size) {
+            U::packHeader(entry, dst, U::kHeaderSize);
+            std::memcpy(
+                static_cast<char*>(dst) + U::kHeaderSize,
+                array.values,
+                array_size);
+          });
+    }
+
+    alignas(4) char header[U::kHeaderSize];
+    U::packHeader(entry, header, sizeof(header));
+    return logger_.writeAndGetCursor(
+        header,
+        sizeof(header),
+        array.values,
+        array_size);
+  }
+
+  // Serializes an entry of `size` bytes straight into a byte ring record.
+  template <class Pack>
+  TraceBuffer::Cursor writeRecord(size_t size, Pack&& pack) {
+    auto reservation = byte_ring_->reserve(size);
+    if (reservation.data != nullptr) {
+      pack(reservation.data, size);
+      byte_ring_->commit(reservation);
+    }
+    return reservation.position;
+  }
 
   Logger(const Logger& other) = delete;
+
+  friend struct mmapbuf::Buffer;
 };
 
 } // namespace profilo
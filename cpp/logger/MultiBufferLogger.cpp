@@ -16,25 +16,112 @@
 
 #include "MultiBufferLogger.h"
 
+#include <sched.h>
+#include <algorithm>
+
 namespace facebook {
 namespace profilo {
 namespace logger {
 
-MultiBufferLogger::MultiBufferLogger(MultiBufferLogger::EntryIDCounter& counter)
-    : entryID_(counter) {}
+MultiBufferLogger::MultiBufferLogger(
+    MultiBufferLogger::EntryIDCounter& counter,
+    StringTable& strings)
+    : entryID_(counter),
+      strings_(strings),
+      list_(new BufferList{
+          {},
+          std::numeric_limits<int32_t>::max(),
+          Logger::kMaxVariableLengthEntry}),
+      epoch_(0) {
+  for (auto& slot : readerSlots_) {
+    slot.readers[0].store(0, std::memory_order_relaxed);
+    slot.readers[1].store(0, std::memory_order_relaxed);
+  }
+}
+
+MultiBufferLogger::~MultiBufferLogger() {
+  delete list_.load(std::memory_order_acquire);
+}
 
 void MultiBufferLogger::addBuffer(std::shared_ptr<Buffer> buffer) {
-  WriterLock lock(&lock_);
-  buffers_.push_back(buffer);
+  std::lock_guard<std::mutex> lock(updateMutex_);
+  auto buffers = list_.load(std::memory_order_relaxed)->buffers;
+  buffers.push_back(buffer);
+  replaceList(std::move(buffers));
 }
 
 void MultiBufferLogger::removeBuffer(std::shared_ptr<Buffer> buffer) {
-  WriterLock lock(&lock_);
-  auto iter = std::find(buffers_.begin(), buffers_.end(), buffer);
-  if (iter == buffers_.end()) {
+  std::lock_guard<std::mutex> lock(updateMutex_);
+  auto buffers = list_.load(std::memory_order_relaxed)->buffers;
+  auto iter = std::find(buffers.begin(), buffers.end(), buffer);
+  if (iter == buffers.end()) {
     return;
   }
-  buffers_.erase(iter);
+  buffers.erase(iter);
+  replaceList(std::move(buffers));
+}
+
+void MultiBufferLogger::replaceList(
+    std::vector<std::shared_ptr<Buffer>> buffers) {
+  size_t min_packets = std::numeric_limits<size_t>::max();
+  size_t max_length = buffers.empty() ? Logger::kMaxVariableLengthEntry
+                                      : Logger::kMaxBlobLength;
+  for (auto& buf : buffers) {
+    // A byte ring takes the space of entryCount packets and is one shard.
+    min_packets =
+        std::min(min_packets, buf->entryCount / buf->shardCount());
+    max_length = std::min(max_length, buf->logger().maxBytesLength());
+  }
+
+  auto replaced = list_.exchange(
+      new BufferList{std::move(buffers), min_packets, max_length},
+      std::memory_order_seq_cst);
+  waitForReaders();
+  delete replaced;
+}
+
+int32_t MultiBufferLogger::definitionAge(
+    const BufferList& list,
+    size_t definitionSize) {
+  // Assumes the entries written after the definition take two packets (or
+  // the bytes of two) on average, and that all of them go to the shard the
+  // definition is in.
+  constexpr size_t kPacketsPerEntry = 2;
+  if (list.buffers.empty()) {
+    return std::numeric_limits<int32_t>::max();
+  }
+  auto packet_size = sizeof(Packet::data);
+  auto definition_packets =
+      std::max<size_t>((definitionSize + packet_size - 1) / packet_size, 1);
+  if (definition_packets >= list.minShardPackets) {
+    // Doesn't fit, or not with anything else, write it every time.
+    return 0;
+  }
+  auto age = (list.minShardPackets - definition_packets) / kPacketsPerEntry;
+  // Entries from threads lagging behind the counter, and a reference from
+  // one, make the ID distance short of the entries written in between by up
+  // to kMaxLag each.
+  constexpr size_t kLagMargin = 2 * Logger::EntryIDCounter::kMaxLag;
+  age = age > kLagMargin ? age - kLagMargin : 0;
+  return static_cast<int32_t>(std::min<size_t>(
+      age, std::numeric_limits<int32_t>::max()));
+}
+
+void MultiBufferLogger::waitForReaders() {
+  // A writer that loaded the replaced list counted itself in before the
+  // exchange, under the parity of whichever epoch it saw. That may be the
+  // current one or, for a writer that read the epoch just before the last
+  // flip, the previous one. Flipping twice and draining each parity in turn
+  // covers both, while writers entering after a flip count themselves under
+  // the other parity and can't hold up the wait.
+  for (int phase = 0; phase < 2; ++phase) {
+    uint32_t parity = epoch_.fetch_add(1, std::memory_order_seq_cst) & 1;
+    for (auto& slot : readerSlots_) {
+      while (slot.readers[parity].load(std::memory_order_seq_cst) != 0) {
+        sched_yield();
+      }
+    }
+  }
 }
 
 int32_t MultiBufferLogger::writeBytes(
@@ -42,13 +129,16 @@ int32_t MultiBufferLogger::writeBytes(
     int32_t arg1,
     const uint8_t* arg2,
     size_t len) {
-  if (len > Logger::kMaxVariableLengthEntry) {
-    throw std::overflow_error("len is bigger than kMaxVariableLengthEntry");
-  }
   if (arg2 == nullptr) {
     throw std::invalid_argument("arg2 is null");
   }
 
+  ReadSection section(*this);
+  auto& list = section.list();
+  if (len > list.maxBytesLength) {
+    throw std::overflow_error("len is too big for one of the buffers");
+  }
+
   // Maintain the same entry ID across all buffers
   auto id = entryID_.next();
 
@@ -63,12 +153,58 @@ int32_t MultiBufferLogger::writeBytes(
           },
   };
 
-  ReaderLock lock(&lock_);
-  for (auto& buf : buffers_) {
-    buf->logger().write(entry);
+  writeToAll(list, entry);
+  return entry.id;
+}
+
+int32_t MultiBufferLogger::writeNamed(
+    StandardEntry entry,
+    const char* name,
+    size_t len) {
+  auto stringID = strings_.intern(name, len);
+  entry.id = entryID_.next();
+  {
+    ReadSection section(*this);
+    auto& list = section.list();
+    BytesEntry definition{
+        .id = 0,
+        .type = EntryType::STRING_DEFINITION,
+        .matchid = stringID,
+        .bytes =
+            {
+                .values = reinterpret_cast<const uint8_t*>(name),
+                .size = static_cast<uint16_t>(len),
+            },
+    };
+    auto use = stringID == 0 ? StringTable::Use::INLINE
+                             : strings_.use(
+                                   stringID,
+                                   entry.id,
+                                   definitionAge(
+                                       list,
+                                       BytesEntry::calculateSize(definition)));
+    if (use == StringTable::Use::DEFINE) {
+      definition.id = entryID_.next();
+      writeToAll(list, definition);
+      strings_.defined(stringID, definition.id);
+    }
+    if (use != StringTable::Use::INLINE) {
+      entry.matchid = -stringID;
+    }
+    writeToAll(list, entry);
+    if (use != StringTable::Use::INLINE) {
+      return entry.id;
+    }
   }
+
+  writeBytes(
+      EntryType::STRING_NAME,
+      entry.id,
+      reinterpret_cast<const uint8_t*>(name),
+      len);
   return entry.id;
 }
+
 } // namespace logger
 } // namespace profilo
 } // namespace facebook
@@ -16,12 +16,13 @@
 
 #pragma once
 
-#include <pthread.h>
-#include <functional>
+#include <atomic>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <vector>
 
-#include <linker/locks.h>
+#include <logger/StringTable.h>
 #include <mmapbuf/Buffer.h>
 
 using namespace facebook::profilo::mmapbuf;
@@ -30,11 +31,24 @@ namespace facebook {
 namespace profilo {
 namespace logger {
 
+//
+// Writes every entry into all of its buffers, with the same entry ID.
+//
+// Writers never lock: the buffers are an immutable list that addBuffer()
+// and removeBuffer() replace as a whole. A replaced list is only freed once
+// every writer that could still be using it is done, which writers signal
+// through per-thread counters (see ReadSection).
+//
 class MultiBufferLogger {
  public:
   using EntryIDCounter = Logger::EntryIDCounter;
   explicit MultiBufferLogger(
-      EntryIDCounter& counter = Logger::getGlobalEntryID());
+      EntryIDCounter& counter = Logger::getGlobalEntryID(),
+      StringTable& strings = StringTable::get());
+  ~MultiBufferLogger();
+
+  MultiBufferLogger(const MultiBufferLogger&) = delete;
+  MultiBufferLogger& operator=(const MultiBufferLogger&) = delete;
 
   void addBuffer(std::shared_ptr<Buffer> buffer);
   void removeBuffer(std::shared_ptr<Buffer> buffer);
@@ -45,20 +59,127 @@ class MultiBufferLogger {
     auto id = entryID_.next();
     entry.id = id;
 
-    ReaderLock lock(&lock_);
-    for (auto& buf : buffers_) {
-      buf->logger().write(entry);
-    }
+    ReadSection section(*this);
+    writeToAll(section.list(), entry);
     return entry.id;
   }
 
+  //
+  // Throws std::overflow_error if one of the buffers can't take `len` bytes,
+  // see Logger::writeBytes().
+  //
   int32_t
   writeBytes(EntryType type, int32_t arg1, const uint8_t* arg2, size_t len);
 
+  //
+  // Writes a MARK_PUSH entry and its name. Equivalent to a write()
+  // followed by a STRING_NAME writeBytes(), but a name that's interned in
+  // the string table is only written as a STRING_DEFINITION once. The entry
+  // then references it with a matchid of -(string id).
+  //
+  int32_t writeNamed(StandardEntry entry, const char* name, size_t len);
+
+  //
+  // How many entry IDs after a definition of `definitionSize` serialized
+  // bytes it should be written again, for the likes of writeNamed() that
+  // log something once and refer to it later.
+  //
+  int32_t maxDefinitionAge(size_t definitionSize) {
+    ReadSection section(*this);
+    return definitionAge(section.list(), definitionSize);
+  }
+
  private:
-  pthread_rwlock_t lock_ = PTHREAD_RWLOCK_INITIALIZER;
-  std::vector<std::shared_ptr<Buffer>> buffers_{};
+  struct BufferList {
+    std::vector<std::shared_ptr<Buffer>> buffers;
+    // Packets in the smallest shard of any of the buffers, which bounds how
+    // long a definition written into one shard survives, see
+    // definitionAge().
+    size_t minShardPackets;
+    // Largest writeBytes() payload every buffer takes.
+    size_t maxBytesLength;
+  };
+
+  static constexpr size_t kReaderSlots = 64;
+
+  static int32_t definitionAge(const BufferList& list, size_t definitionSize);
+
+  // Writers inside a ReadSection, by the parity of the epoch they entered
+  // it in. Padded to a cache line, each thread sticks to one slot.
+  struct ReaderSlot {
+    std::atomic<uint32_t> readers[2];
+    char padding[64 - 2 * sizeof(std::atomic<uint32_t>)];
+  };
+
+  //
+  // Pins the current BufferList while a writer uses it. Entering costs an
+  // increment of a counter that other threads rarely touch, never a lock.
+  //
+  class ReadSection {
+   public:
+    explicit ReadSection(MultiBufferLogger& logger)
+        : slot_(logger.readerSlot()),
+          parity_(logger.epoch_.load(std::memory_order_seq_cst) & 1) {
+      slot_.readers[parity_].fetch_add(1, std::memory_order_seq_cst);
+      list_ = logger.list_.load(std::memory_order_seq_cst);
+    }
+
+    ~ReadSection() {
+      slot_.readers[parity_].fetch_sub(1, std::memory_order_release);
+    }
+
+    ReadSection(const ReadSection&) = delete;
+    ReadSection& operator=(const ReadSection&) = delete;
+
+    const BufferList& list() const {
+      return *list_;
+    }
+
+   private:
+    ReaderSlot& slot_;
+    const uint32_t parity_;
+    const BufferList* list_;
+  };
+
   EntryIDCounter& entryID_;
+  StringTable& strings_;
+  std::atomic<const BufferList*> list_;
+  std::atomic<uint32_t> epoch_;
+  ReaderSlot readerSlots_[kReaderSlots];
+  // Serializes the replacement of list_.
+  std::mutex updateMutex_;
+
+  ReaderSlot& readerSlot() {
+    static std::atomic<uint32_t> next_slot{0};
+    static thread_local uint32_t slot =
+        next_slot.fetch_add(1, std::memory_order_relaxed) % kReaderSlots;
+    return readerSlots_[slot];
+  }
+
+  // Publishes `buffers` and frees the list it replaces.
+  void replaceList(std::vector<std::shared_ptr<Buffer>> buffers);
+  // Waits until no writer can be using a list replaced before the call.
+  void waitForReaders();
+
+  //
+  // Serializes the entry once for any number of buffers. A single buffer
+  // serializes it straight into its slots instead.
+  //
+  template <class T>
+  static void writeToAll(const BufferList& list, T& entry) {
+    auto& buffers = list.buffers;
+    if (buffers.size() == 1) {
+      buffers.front()->logger().write(entry);
+      return;
+    }
+    if (buffers.empty()) {
+      return;
+    }
+    Logger::PackedEntry packed(entry);
+    for (auto& buf : buffers) {
+      buf->logger().writePacked(packed);
+    }
+  }
 };
 
 } // namespace logger
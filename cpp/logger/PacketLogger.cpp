@@ -16,14 +16,69 @@
 
 #include "PacketLogger.h"
 
+#include <algorithm>
+#include <array>
+#include <cstring>
 #include <stdexcept>
 
 namespace facebook {
 namespace profilo {
 namespace logger {
 
-PacketLogger::PacketLogger(TraceBufferProvider provider)
-    : streamID_(0), provider_(provider) {}
+PacketLogger::PacketLogger(TraceBufferProvider provider, bool staged)
+    : streamID_(0), provider_(provider), staged_(staged) {}
+
+namespace {
+
+constexpr auto kOnePacketSize = sizeof(Packet::data);
+
+// Entries of up to this many packets are packetized on the stack and
+// written with writeN(), larger ones are filled in place.
+constexpr uint32_t kMaxBatchedPackets = 8;
+
+} // namespace
+
+// An entry payload made of up to two consecutive segments.
+struct PacketLogger::Payload {
+  const char* head;
+  size_t head_size;
+  const char* tail;
+  size_t tail_size;
+
+  size_t size() const {
+    return head_size + tail_size;
+  }
+
+  // Copies `len` bytes starting at `offset` into the payload to `dst`.
+  void copy(char* dst, size_t offset, size_t len) const {
+    if (offset < head_size) {
+      size_t from_head = std::min(len, head_size - offset);
+      std::memcpy(dst, head + offset, from_head);
+      dst += from_head;
+      offset += from_head;
+      len -= from_head;
+    }
+    if (len > 0) {
+      std::memcpy(dst, tail + (offset - head_size), len);
+    }
+  }
+
+  // Fills `packet` with the chunk of the payload starting at `offset` and
+  // returns the number of payload bytes it holds.
+  size_t fillPacket(Packet& packet, StreamID stream_id, size_t offset) const {
+    auto remaining = size() - offset;
+    bool has_next = remaining > kOnePacketSize;
+    uint8_t write_size = std::min(kOnePacketSize, remaining);
+
+    packet.stream = stream_id;
+    packet.start = offset == 0;
+    packet.next = has_next;
+    packet.size = write_size;
+
+    copy(packet.data, offset, write_size);
+    return write_size;
+  }
+};
 
 void PacketLogger::write(void* payload, size_t size) {
   writeAndGetCursor(payload, size);
@@ -32,37 +87,86 @@ void PacketLogger::write(void* payload, size_t size) {
 TraceBuffer::Cursor PacketLogger::writeAndGetCursor(
     void* payload,
     size_t size) {
-  if (size == 0) {
+  return writeAndGetCursor(payload, size, nullptr, 0);
+}
+
+TraceBuffer::Cursor PacketLogger::writeAndGetCursor(
+    const void* head,
+    size_t head_size,
+    const void* tail,
+    size_t tail_size) {
+  if (head_size + tail_size == 0) {
     throw std::invalid_argument("size is 0");
   }
 
-  if (payload == nullptr) {
+  if (head == nullptr || (tail == nullptr && tail_size > 0)) {
     throw std::invalid_argument("payload is null");
   }
 
-  auto& buffer = provider_();
+  const Payload payload{
+      .head = static_cast<const char*>(head),
+      .head_size = head_size,
+      .tail = static_cast<const char*>(tail),
+      .tail_size = tail_size};
+  auto size = payload.size();
 
-  TraceBuffer::Cursor cursor = buffer.currentTail();
-  bool cursor_set = false;
+  auto& buffer = provider_();
 
   StreamID stream_id = streamID_.fetch_add(1, std::memory_order_relaxed);
 
+  uint32_t packet_count = (size + kOnePacketSize - 1) / kOnePacketSize;
+  if (packet_count > buffer.capacity()) {
+    // The entry can't be contiguous in a buffer this small.
+    return writeInterleaved(buffer, stream_id, payload);
+  }
+
+  if (staged_ || packet_count > kMaxBatchedPackets) {
+    return writeStaged(buffer, stream_id, payload, packet_count);
+  }
+
+  std::array<Packet, kMaxBatchedPackets> packets;
   size_t offset = 0;
-  while (offset < size) {
-    const auto kOnePacketSize = sizeof(Packet::data);
+  for (uint32_t idx = 0; idx < packet_count; ++idx) {
+    offset += payload.fillPacket(packets[idx], stream_id, offset);
+  }
 
-    auto remaining = size - offset;
-    bool has_next = remaining > kOnePacketSize;
-    uint8_t write_size = std::min(kOnePacketSize, remaining);
+  // All packets of the entry get a contiguous ticket range.
+  return buffer.writeN(packets.data(), packet_count);
+}
 
-    Packet packet{
-        .stream = stream_id,
-        .start = offset == 0,
-        .next = has_next,
-        .size = write_size,
-        .data = {}};
+TraceBuffer::Cursor PacketLogger::writeStaged(
+    TraceBuffer& buffer,
+    StreamID stream_id,
+    const Payload& payload,
+    uint32_t packet_count) {
+  // One ticket increment for the whole entry, then fill the run in place.
+  const TraceBuffer::Cursor first = buffer.reserve(packet_count);
+  TraceBuffer::Cursor slot = first;
+
+  for (uint32_t idx = 0; idx < packet_count; ++idx) {
+    // Not carried over from the previous fill, which a lossy buffer may
+    // have skipped.
+    size_t offset = idx * kOnePacketSize;
+    buffer.writeInPlaceAt(slot, [&](Packet& packet) {
+      payload.fillPacket(packet, stream_id, offset);
+    });
+    slot.moveForward();
+  }
+
+  return first;
+}
 
-    std::memcpy(packet.data, static_cast<char*>(payload) + offset, write_size);
+TraceBuffer::Cursor PacketLogger::writeInterleaved(
+    TraceBuffer& buffer,
+    StreamID stream_id,
+    const Payload& payload) {
+  TraceBuffer::Cursor cursor = buffer.currentTail();
+  bool cursor_set = false;
+
+  size_t offset = 0;
+  while (offset < payload.size()) {
+    Packet packet;
+    offset += payload.fillPacket(packet, stream_id, offset);
 
     if (!cursor_set) {
       cursor = buffer.writeAndGetCursor(packet);
@@ -70,7 +174,6 @@ TraceBuffer::Cursor PacketLogger::writeAndGetCursor(
     } else {
       buffer.write(packet);
     }
-    offset += write_size;
   }
 
   return cursor;
@@ -20,6 +20,7 @@
 #include <logger/buffer/TraceBuffer.h>
 #include <logger/lfrb/LockFreeRingBuffer.h>
 #include <functional>
+#include <stdexcept>
 
 #define PROFILOEXPORT __attribute__((visibility("default")))
 
@@ -33,7 +34,16 @@ using TraceBufferProvider = std::function<TraceBuffer&()>;
 
 class PacketLogger {
  public:
-  PacketLogger(TraceBufferProvider provider);
+  //
+  // The packets of an entry always occupy a contiguous range of the buffer,
+  // claimed with a single ticket increment.
+  //
+  // staged: if true, each write reserves its range and fills the slots in
+  //         place from the writing thread, instead of packetizing the entry
+  //         into a temporary array first. Entries too large for that array
+  //         are always written this way.
+  //
+  PacketLogger(TraceBufferProvider provider, bool staged = false);
   PacketLogger(const PacketLogger& other) = delete;
 
   PROFILOEXPORT void write(void* payload, size_t size);
@@ -41,9 +51,59 @@ class PacketLogger {
       void* payload,
       size_t size);
 
+  //
+  // Writes the concatenation of `head` and `tail` as a single entry. Both
+  // are copied straight into the packets, so a serialized header and the
+  // array it describes don't need to be joined in a temporary first.
+  //
+  PROFILOEXPORT TraceBuffer::Cursor writeAndGetCursor(
+      const void* head,
+      size_t head_size,
+      const void* tail,
+      size_t tail_size);
+
+  //
+  // Writes an entry of `size` bytes that fits into a single packet by
+  // calling `pack(void* dst, size_t size)` to serialize it directly into the
+  // buffer slot. `pack` must not throw.
+  //
+  template <class Pack>
+  TraceBuffer::Cursor writeInPlace(size_t size, Pack&& pack) {
+    if (size == 0) {
+      throw std::invalid_argument("size is 0");
+    }
+    if (size > sizeof(Packet::data)) {
+      throw std::invalid_argument("size does not fit in a single packet");
+    }
+
+    auto& buffer = provider_();
+    StreamID stream_id = streamID_.fetch_add(1, std::memory_order_relaxed);
+
+    return buffer.writeInPlace([&](Packet& packet) {
+      packet.stream = stream_id;
+      packet.start = true;
+      packet.next = false;
+      packet.size = size;
+      pack(static_cast<void*>(packet.data), size);
+    });
+  }
+
  private:
+  struct Payload;
+
   std::atomic<uint32_t> streamID_;
   TraceBufferProvider provider_;
+  const bool staged_;
+
+  TraceBuffer::Cursor writeStaged(
+      TraceBuffer& buffer,
+      StreamID stream_id,
+      const Payload& payload,
+      uint32_t packet_count);
+  TraceBuffer::Cursor writeInterleaved(
+      TraceBuffer& buffer,
+      StreamID stream_id,
+      const Payload& payload);
 };
 
 } // namespace logger
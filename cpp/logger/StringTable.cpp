@@ -0,0 +1,163 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "StringTable.h"
+
+#include <cstring>
+#include <new>
+
+namespace facebook {
+namespace profilo {
+namespace logger {
+
+// Allocated together with its characters, which follow it.
+struct StringTable::Name {
+  uint32_t hash;
+  uint32_t length;
+
+  const char* data() const {
+    return reinterpret_cast<const char*>(this + 1);
+  }
+};
+
+namespace {
+
+// Bounds the cost of interning a name into a nearly full table.
+constexpr size_t kMaxProbes = 32;
+
+uint32_t hashName(const char* name, size_t length) {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (size_t idx = 0; idx < length; ++idx) {
+    hash ^= static_cast<uint8_t>(name[idx]);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+size_t roundUpToPowerOfTwo(size_t value) {
+  size_t result = 1;
+  while (result < value) {
+    result <<= 1;
+  }
+  return result;
+}
+
+} // namespace
+
+StringTable& StringTable::get() {
+  static StringTable global_instance;
+  return global_instance;
+}
+
+StringTable::StringTable(size_t capacity)
+    : capacity_(roundUpToPowerOfTwo(capacity)),
+      slots_(new Slot[capacity_]) {
+  for (size_t idx = 0; idx < capacity_; ++idx) {
+    slots_[idx].name.store(nullptr, std::memory_order_relaxed);
+    slots_[idx].defined_by.store(kUndefined, std::memory_order_relaxed);
+  }
+}
+
+StringTable::~StringTable() {
+  for (size_t idx = 0; idx < capacity_; ++idx) {
+    delete[] reinterpret_cast<char*>(
+        slots_[idx].name.load(std::memory_order_relaxed));
+  }
+}
+
+int32_t StringTable::intern(const char* name, size_t length) {
+  if (length == 0 || length > kMaxLength) {
+    return 0;
+  }
+
+  uint32_t hash = hashName(name, length);
+  Name* added = nullptr;
+  int32_t id = 0;
+  for (size_t probe = 0; probe < kMaxProbes && probe < capacity_; ++probe) {
+    size_t index = (hash + probe) & (capacity_ - 1);
+    auto& slot = slots_[index];
+    auto current = slot.name.load(std::memory_order_acquire);
+    if (current == nullptr) {
+      if (added == nullptr) {
+        auto storage = new char[sizeof(Name) + length];
+        added = new (storage) Name{hash, static_cast<uint32_t>(length)};
+        std::memcpy(storage + sizeof(Name), name, length);
+      }
+      if (slot.name.compare_exchange_strong(
+              current, added, std::memory_order_acq_rel)) {
+        return static_cast<int32_t>(index + 1);
+      }
+      // Another thread took the slot, current is its name now.
+    }
+    if (current->hash == hash && current->length == length &&
+        std::memcmp(current->data(), name, length) == 0) {
+      id = static_cast<int32_t>(index + 1);
+      break;
+    }
+  }
+
+  delete[] reinterpret_cast<char*>(added);
+  return id;
+}
+
+StringTable::Use
+StringTable::use(int32_t id, int32_t entry_id, int32_t max_age) {
+  auto& defined_by = slots_[id - 1].defined_by;
+  auto definition = defined_by.load(std::memory_order_acquire);
+  if (definition == kDefining) {
+    return Use::INLINE;
+  }
+  // Entries whose ID was taken before the definition's have a negative age.
+  auto age = static_cast<int32_t>(
+      static_cast<uint32_t>(entry_id) - static_cast<uint32_t>(definition));
+  if (definition != kUndefined && age < max_age) {
+    return Use::REFERENCE;
+  }
+  if (defined_by.compare_exchange_strong(
+          definition, kDefining, std::memory_order_acq_rel)) {
+    return Use::DEFINE;
+  }
+  return Use::INLINE;
+}
+
+void StringTable::defined(int32_t id, int32_t definition_id) {
+  // Publishes the definition, which is in the buffers by now, to the threads
+  // that go on to reference it.
+  slots_[id - 1].defined_by.store(definition_id, std::memory_order_release);
+}
+
+void StringTable::reset() {
+  for (size_t idx = 0; idx < capacity_; ++idx) {
+    slots_[idx].defined_by.store(kUndefined, std::memory_order_relaxed);
+  }
+}
+
+const char* StringTable::lookup(int32_t id, size_t& length) const {
+  if (id <= 0 || static_cast<size_t>(id) > capacity_) {
+    return nullptr;
+  }
+  auto name = slots_[id - 1].name.load(std::memory_order_acquire);
+  if (name == nullptr) {
+    return nullptr;
+  }
+  length = name->length;
+  return name->data();
+}
+
+} // namespace logger
+} // namespace profilo
+} // namespace facebook
@@ -0,0 +1,102 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace facebook {
+namespace profilo {
+namespace logger {
+
+//
+// Interns names that get logged over and over, like block and atrace
+// section names. Each name gets a stable id and is written to the trace as
+// a STRING_DEFINITION entry once, later uses of it only carry the id.
+//
+// Lock-free open addressing over a fixed number of slots. Names are copied
+// on first use and never freed, so an id maps to the same name for the
+// lifetime of the table. Names that don't get a slot (the table is full,
+// or they are too long) aren't interned and are logged inline.
+//
+class StringTable {
+ public:
+  static constexpr size_t kDefaultCapacity = 4096;
+  static constexpr size_t kMaxLength = 256;
+
+  enum class Use {
+    // Write the definition, then call defined(), then reference the id.
+    DEFINE,
+    // The definition was written recently enough, reference the id.
+    REFERENCE,
+    // Another thread is writing the definition, log the name inline.
+    INLINE,
+  };
+
+  static StringTable& get();
+
+  explicit StringTable(size_t capacity = kDefaultCapacity);
+  ~StringTable();
+
+  StringTable(StringTable const&) = delete;
+  StringTable& operator=(StringTable const&) = delete;
+
+  //
+  // Returns the id of `name`, adding it if it's new. Ids are positive, 0
+  // means the name couldn't be interned.
+  //
+  int32_t intern(const char* name, size_t length);
+
+  //
+  // Decides how entry `entry_id` uses the interned string `id`. A
+  // definition written more than `max_age` entry IDs ago may have been
+  // overwritten in the buffer already, so it's written again.
+  //
+  Use use(int32_t id, int32_t entry_id, int32_t max_age);
+
+  // Records the entry ID of the definition asked for by use().
+  void defined(int32_t id, int32_t definition_id);
+
+  //
+  // Forgets all definitions, so that every string is defined again the
+  // next time it's used. Called when a trace starts.
+  //
+  void reset();
+
+  // The name interned as `id`, or nullptr.
+  const char* lookup(int32_t id, size_t& length) const;
+
+ private:
+  struct Name;
+  struct Slot {
+    std::atomic<Name*> name;
+    // Entry ID of the latest definition, or one of kUndefined/kDefining.
+    std::atomic<int32_t> defined_by;
+  };
+
+  static constexpr int32_t kUndefined = 0;
+  static constexpr int32_t kDefining = -1;
+
+  const size_t capacity_;
+  std::unique_ptr<Slot[]> slots_;
+};
+
+} // namespace logger
+} // namespace profilo
+} // namespace facebook
@@ -0,0 +1,279 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ByteRingBuffer.h"
+
+#include <sched.h>
+#include <new>
+
+namespace facebook {
+namespace profilo {
+namespace logger {
+
+//
+// The tag identifies the record a header belongs to: the low 31 bits of
+// position / kAlignment, shifted left, and the committed bit. A header left
+// over from an earlier lap never matches the tag expected at a position.
+//
+struct ByteRingBuffer::RecordHeader {
+  std::atomic<uint32_t> tag;
+  // Payload bytes, with kPaddingFlag set for padding records.
+  std::atomic<uint32_t> size;
+};
+
+namespace {
+
+constexpr uint32_t kCommittedBit = 1;
+constexpr uint32_t kPaddingFlag = 1u << 31;
+constexpr size_t kHeaderSize = ByteRingBuffer::kAlignment;
+
+uint32_t tagFor(uint64_t position) {
+  return static_cast<uint32_t>(position / ByteRingBuffer::kAlignment) << 1;
+}
+
+// Bytes taken by a record with `size` bytes of payload.
+uint64_t recordSpan(uint32_t size) {
+  return (kHeaderSize + size + ByteRingBuffer::kAlignment - 1) /
+      ByteRingBuffer::kAlignment * ByteRingBuffer::kAlignment;
+}
+
+} // namespace
+
+ByteRingBuffer::ByteRingBuffer(size_t capacity, WriteMode mode) noexcept
+    : capacity_(capacity / kAlignment * kAlignment),
+      mode_(mode),
+      head_(0),
+      padding_(),
+      committed_(0),
+      tail_(0),
+      dropped_(0) {
+  static_assert(
+      sizeof(RecordHeader) == kHeaderSize,
+      "Record headers must keep records aligned");
+}
+
+ByteRingBuffer*
+ByteRingBuffer::allocateAt(size_t capacity, void* ptr, WriteMode mode) noexcept {
+  return new (ptr) ByteRingBuffer(capacity, mode);
+}
+
+ByteRingBuffer::RecordHeader* ByteRingBuffer::header(
+    uint64_t position) const noexcept {
+  auto data = reinterpret_cast<char*>(const_cast<ByteRingBuffer*>(this)) +
+      sizeof(ByteRingBuffer);
+  return reinterpret_cast<RecordHeader*>(data + position % capacity_);
+}
+
+ByteRingBuffer::Reservation ByteRingBuffer::dropped(
+    uint64_t head,
+    uint32_t size) noexcept {
+  dropped_.fetch_add(1, std::memory_order_relaxed);
+  return Reservation{Cursor(head), nullptr, size};
+}
+
+size_t ByteRingBuffer::maxRecordSize() const noexcept {
+  // The largest span reserve() takes, less the header.
+  return capacity_ / 2 / kAlignment * kAlignment - kHeaderSize;
+}
+
+ByteRingBuffer::Reservation ByteRingBuffer::reserve(uint32_t size) noexcept {
+  uint64_t span = recordSpan(size);
+  uint64_t head = head_.load(std::memory_order_relaxed);
+  if (size >= kPaddingFlag || span > capacity_ / 2) {
+    return dropped(head, size);
+  }
+
+  uint64_t position, end;
+  while (true) {
+    // Records don't wrap around, one that doesn't fit before the end of the
+    // ring starts over at its beginning.
+    uint64_t offset = head % capacity_;
+    position = offset + span > capacity_ ? head + (capacity_ - offset) : head;
+    end = position + span;
+    if (end - committed_.load(std::memory_order_seq_cst) > capacity_) {
+      // Would overwrite a record that isn't committed yet.
+      if (mode_ == WriteMode::LOSSY) {
+        return dropped(head, size);
+      }
+      sched_yield();
+      head = head_.load(std::memory_order_relaxed);
+      continue;
+    }
+    if (head_.compare_exchange_weak(head, end)) {
+      break;
+    }
+  }
+
+  if (end > capacity_) {
+    reclaimUpTo(end - capacity_);
+  }
+  // Readers that see any of the writes below also see the tail moved past
+  // what they overwrite.
+  std::atomic_thread_fence(std::memory_order_release);
+
+  if (position != head) {
+    auto padding = header(head);
+    padding->size.store(
+        static_cast<uint32_t>(position - head - kHeaderSize) | kPaddingFlag,
+        std::memory_order_relaxed);
+    padding->tag.store(tagFor(head) | kCommittedBit, std::memory_order_seq_cst);
+  }
+
+  auto record = header(position);
+  record->size.store(size, std::memory_order_relaxed);
+  record->tag.store(tagFor(position), std::memory_order_release);
+  return Reservation{
+      Cursor(position), reinterpret_cast<char*>(record + 1), size};
+}
+
+void ByteRingBuffer::commit(Reservation const& reservation) noexcept {
+  if (reservation.data == nullptr) {
+    return;
+  }
+  uint64_t position = reservation.position.ticket;
+  // seq_cst on both sides: either this writer sees the commit of the
+  // record after its own, or that record's writer sees this commit, so the
+  // frontier never stalls behind two committed records.
+  header(position)->tag.store(
+      tagFor(position) | kCommittedBit, std::memory_order_seq_cst);
+  advanceCommitted();
+}
+
+void ByteRingBuffer::advanceCommitted() noexcept {
+  uint64_t committed = committed_.load(std::memory_order_seq_cst);
+  while (committed < head_.load(std::memory_order_acquire)) {
+    auto record = header(committed);
+    if (record->tag.load(std::memory_order_seq_cst) !=
+        (tagFor(committed) | kCommittedBit)) {
+      break;
+    }
+    uint64_t next = committed +
+        recordSpan(record->size.load(std::memory_order_relaxed) & ~kPaddingFlag);
+    // Fails if another writer moved the frontier first, in which case the
+    // header may not have been ours to read.
+    if (committed_.compare_exchange_weak(committed, next)) {
+      committed = next;
+    }
+  }
+}
+
+void ByteRingBuffer::reclaimUpTo(uint64_t position) noexcept {
+  uint64_t tail = tail_.load(std::memory_order_acquire);
+  while (tail < position) {
+    // Committed, and nobody overwrites it before the tail moves past it.
+    auto record = header(tail);
+    uint64_t next = tail +
+        recordSpan(record->size.load(std::memory_order_relaxed) & ~kPaddingFlag);
+    if (tail_.compare_exchange_weak(tail, next)) {
+      tail = next;
+    }
+  }
+}
+
+ByteRingBuffer::ReadResult ByteRingBuffer::tryRead(
+    Cursor& cursor,
+    std::vector<char>& record,
+    bool writers_gone) const noexcept {
+  uint64_t position = cursor.ticket;
+  while (true) {
+    if (position < tail_.load(std::memory_order_acquire)) {
+      return ReadResult::LAPPED;
+    }
+    uint64_t limit = writers_gone ? head_.load(std::memory_order_acquire)
+                                  : committed_.load(std::memory_order_acquire);
+    if (position >= limit) {
+      return ReadResult::NOT_READY;
+    }
+
+    auto current = header(position);
+    uint32_t tag = current->tag.load(std::memory_order_acquire);
+    uint32_t size = current->size.load(std::memory_order_relaxed);
+    bool padding = (size & kPaddingFlag) != 0;
+    size &= ~kPaddingFlag;
+    uint64_t span = recordSpan(size);
+    // Garbage from an overwritten record could point past the ring.
+    bool fits = span <= capacity_ - position % capacity_;
+    bool committed = tag == (tagFor(position) | kCommittedBit);
+    if (fits && committed && !padding) {
+      auto data = reinterpret_cast<const char*>(current + 1);
+      record.assign(data, data + size);
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (position < tail_.load(std::memory_order_relaxed)) {
+      return ReadResult::LAPPED;
+    }
+
+    if (!fits || (tag & ~kCommittedBit) != tagFor(position)) {
+      // Reserved by a writer that died before writing the header.
+      return ReadResult::NOT_READY;
+    }
+    position += span;
+    if (committed && !padding) {
+      cursor = Cursor(position);
+      return ReadResult::OK;
+    }
+    // Padding, or a record its writer never committed.
+    cursor = Cursor(position);
+  }
+}
+
+ByteRingBuffer::ReadResult ByteRingBuffer::readAt(
+    Cursor cursor,
+    std::vector<char>& record) const noexcept {
+  uint64_t position = cursor.ticket;
+  if (position < tail_.load(std::memory_order_acquire)) {
+    return ReadResult::LAPPED;
+  }
+  if (position % kAlignment != 0 ||
+      position >= head_.load(std::memory_order_acquire)) {
+    return ReadResult::NOT_READY;
+  }
+
+  auto current = header(position);
+  uint32_t tag = current->tag.load(std::memory_order_acquire);
+  uint32_t size = current->size.load(std::memory_order_relaxed);
+  bool padding = (size & kPaddingFlag) != 0;
+  size &= ~kPaddingFlag;
+  bool fits = recordSpan(size) <= capacity_ - position % capacity_;
+  // Also tells a record that starts here from one that spans the position.
+  bool committed = tag == (tagFor(position) | kCommittedBit);
+  if (fits && committed && !padding) {
+    auto data = reinterpret_cast<const char*>(current + 1);
+    record.assign(data, data + size);
+  }
+
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (position < tail_.load(std::memory_order_relaxed)) {
+    return ReadResult::LAPPED;
+  }
+  if (!fits || !committed || padding) {
+    return ReadResult::NOT_READY;
+  }
+  return ReadResult::OK;
+}
+
+ByteRingBuffer::Cursor ByteRingBuffer::currentHead() const noexcept {
+  return Cursor(head_.load(std::memory_order_acquire));
+}
+
+ByteRingBuffer::Cursor ByteRingBuffer::currentTail() const noexcept {
+  return Cursor(tail_.load(std::memory_order_acquire));
+}
+
+} // namespace logger
+} // namespace profilo
+} // namespace facebook
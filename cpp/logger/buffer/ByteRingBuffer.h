@@ -0,0 +1,181 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <logger/buffer/TraceBuffer.h>
+#include <logger/lfrb/LockFreeRingBuffer.h>
+
+namespace facebook {
+namespace profilo {
+namespace mmapbuf {
+struct Buffer;
+} // namespace mmapbuf
+
+namespace logger {
+
+//
+// A ring of variable-length records, an alternative to the fixed-size
+// Packet slots of a TraceBuffer. Every entry is stored whole and contiguous,
+// as an 8-byte header followed by its serialized bytes, padded to 8 bytes.
+// A record that would straddle the end of the ring is moved to its start
+// and the gap is left as a padding record.
+//
+// Like the perf_event mmap ring, writers reserve a range with a CAS on the
+// head, fill it in place and commit it. The oldest records are reclaimed
+// once the head needs their space, but never before they and every record
+// ahead of them are committed: in WriteMode::GUARANTEED a writer waits for
+// that, in WriteMode::LOSSY it drops its record instead.
+//
+// Positions are byte offsets into the unbounded stream of records, handed
+// out as TraceBuffer::Cursor so they travel the same way tickets do. Readers
+// never block writers: they copy a record out and then check that it
+// wasn't reclaimed in the meantime, like a sequence lock reader would.
+//
+class ByteRingBuffer {
+ public:
+  using Cursor = TraceBuffer::Cursor;
+  using WriteMode = lfrb::WriteMode;
+
+  static constexpr size_t kAlignment = 8;
+
+  enum class ReadResult {
+    OK,
+    // Not written or not committed yet.
+    NOT_READY,
+    // Reclaimed by writers before it could be read.
+    LAPPED,
+  };
+
+  //
+  // Space claimed by reserve(). `data` is null if the write was dropped,
+  // `position` is then where the record would have gone.
+  //
+  struct Reservation {
+    Cursor position;
+    char* data;
+    uint32_t size;
+  };
+
+  static size_t calculateAllocationSize(size_t capacity) {
+    return sizeof(ByteRingBuffer) + capacity / kAlignment * kAlignment;
+  }
+
+  ByteRingBuffer() = delete;
+  ByteRingBuffer(ByteRingBuffer const&) = delete;
+  ByteRingBuffer& operator=(ByteRingBuffer const&) = delete;
+
+  //
+  // Claims room for a record of `size` bytes, to be filled through `data`
+  // and published with commit(). Records larger than half the capacity are
+  // always dropped.
+  //
+  Reservation reserve(uint32_t size) noexcept;
+
+  // Largest record reserve() takes.
+  size_t maxRecordSize() const noexcept;
+
+  //
+  // Makes a reserved record visible to readers. Every reservation must be
+  // committed, reclaiming stops at the first one that isn't.
+  //
+  void commit(Reservation const& reservation) noexcept;
+
+  //
+  // Copies the record at `cursor` into `record` and moves the cursor to the
+  // next one. Padding is skipped.
+  //
+  // writers_gone: only for a ring no one writes to anymore, e.g. one left
+  //               behind by a crashed process. Also reads the committed
+  //               records that follow a record that never got committed,
+  //               skipping that one.
+  //
+  ReadResult tryRead(
+      Cursor& cursor,
+      std::vector<char>& record,
+      bool writers_gone = false) const noexcept;
+
+  //
+  // Copies the record that starts at `position`, e.g. one a reservation
+  // was made for. Unlike tryRead(), it doesn't wait for the records before
+  // it to be committed. NOT_READY if no committed record starts there.
+  //
+  ReadResult readAt(Cursor position, std::vector<char>& record) const noexcept;
+
+  //
+  // The byte position a cursor stands for, to refer to a record from
+  // elsewhere. Cursor(position) turns it back into a cursor.
+  //
+  static uint64_t positionOf(Cursor cursor) noexcept {
+    return cursor.ticket;
+  }
+
+  // Position of the next record to be reserved.
+  Cursor currentHead() const noexcept;
+  // Position of the oldest record that wasn't reclaimed.
+  Cursor currentTail() const noexcept;
+
+  size_t capacity() const {
+    return capacity_;
+  }
+
+  WriteMode writeMode() const {
+    return mode_;
+  }
+
+  // Records dropped so far, see reserve().
+  uint64_t droppedWrites() const {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct RecordHeader;
+
+  ByteRingBuffer(size_t capacity, WriteMode mode) noexcept;
+
+  static ByteRingBuffer*
+  allocateAt(size_t capacity, void* ptr, WriteMode mode) noexcept;
+
+  RecordHeader* header(uint64_t position) const noexcept;
+  // Moves the tail past every record before `position`.
+  void reclaimUpTo(uint64_t position) noexcept;
+  // Moves the commit frontier past all the records committed in a row.
+  void advanceCommitted() noexcept;
+  Reservation dropped(uint64_t head, uint32_t size) noexcept;
+
+  const uint64_t capacity_;
+  const WriteMode mode_;
+  std::atomic<uint64_t> head_;
+  // Keeps reserving writers and committing writers off each other's line.
+  char padding_[40];
+  // Every record before it is committed.
+  std::atomic<uint64_t> committed_;
+  // Every record before it may be overwritten.
+  std::atomic<uint64_t> tail_;
+  std::atomic<uint64_t> dropped_;
+
+  friend struct facebook::profilo::mmapbuf::Buffer;
+  friend class ByteRingBufferTestAccessor;
+};
+
+} // namespace logger
+} // namespace profilo
+} // namespace facebook
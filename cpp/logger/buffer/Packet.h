@@ -34,6 +34,14 @@ struct __attribute__((packed)) Packet {
   uint16_t size : 14;
 
   alignas(4) char data[52];
+
+  //
+  // A value-initialized packet, left by a lossy TraceBuffer in the slot of
+  // a dropped write. Packets written by PacketLogger always carry data.
+  //
+  bool isTombstone() const {
+    return !start && !next && size == 0;
+  }
 };
 
 //
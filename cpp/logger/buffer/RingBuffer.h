@@ -26,7 +26,12 @@ namespace profilo {
 
 class RingBuffer {
  public:
-  constexpr static auto kVersion = 1;
+  // bufferVersion of a file with TraceBuffer shards.
+  constexpr static auto kVersion = 2;
+  // bufferVersion of a file with a logger::ByteRingBuffer. Numbered apart
+  // from kVersion so that either can change on its own. Also covers how the
+  // entries in it are encoded.
+  constexpr static auto kByteRingVersion = 0x102;
 };
 
 } // namespace profilo
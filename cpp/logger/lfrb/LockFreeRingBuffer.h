@@ -17,11 +17,13 @@
 #pragma once
 
 #include <unistd.h>
+#include <algorithm>
 #include <atomic>
 #include <cmath>
 #include <cstring>
 #include <memory>
 #include <type_traits>
+#include <utility>
 
 #include <logger/lfrb/TurnSequencer.h>
 
@@ -32,6 +34,8 @@ struct Buffer;
 } // namespace mmapbuf
 
 namespace logger {
+class ByteRingBuffer;
+
 namespace lfrb {
 
 namespace {
@@ -68,6 +72,21 @@ template <typename T, template <typename> class Atom = std::atomic>
 class RingBufferSlot;
 } // namespace detail
 
+/// How writers deal with a slot that is still held by a writer from an
+/// earlier lap.
+enum class WriteMode : uint32_t {
+  /// Wait for it. Every write ends up in the buffer.
+  GUARANTEED = 0,
+  /// Never wait. A writer that finds its slot busy gives up on the write,
+  /// and a value-initialized T (a tombstone) is left in its place once the
+  /// slot frees up, so readers waiting on it can move on. A writer that
+  /// finds its slot idle at an earlier lap, because that lap's writer
+  /// hasn't shown up yet, leaves the tombstone in that lap's place instead
+  /// and writes its own value. Dropped writes are counted, see
+  /// droppedWrites().
+  LOSSY = 1,
+};
+
 /// LockFreeRingBuffer<T> is a fixed-size, concurrent ring buffer with the
 /// following semantics:
 ///
@@ -80,6 +99,9 @@ class RingBufferSlot;
 /// In this sense, reads from this buffer are best-effort but writes
 /// are guaranteed.
 ///
+/// In WriteMode::LOSSY, (1) no longer holds: writers never block, and
+/// writes are best-effort too.
+///
 /// Another way to think about this is as an unbounded stream of writes. The
 /// buffer contains the last <capacity> writes but readers can attempt to read
 /// any part of the stream, even outside this window. The read API takes a
@@ -128,9 +150,17 @@ class LockFreeRingBuffer {
       return prevTicket != ticket;
     }
 
+    /// Returns how many writes this cursor is behind `other`, 0 if it is
+    /// not behind.
+    uint64_t distanceTo(const Cursor& other) const noexcept {
+      return other.ticket > ticket ? other.ticket - ticket : 0;
+    }
+
    protected: // for test visibility reasons
     uint64_t ticket;
     friend class LockFreeRingBuffer;
+    // Which reuses cursors for byte positions.
+    friend class facebook::profilo::logger::ByteRingBuffer;
   };
 
   LockFreeRingBuffer() = delete;
@@ -141,12 +171,21 @@ class LockFreeRingBuffer {
     return capacity_;
   }
 
+  WriteMode writeMode() const {
+    return mode_;
+  }
+
+  /// Number of writes that gave up on their slot in WriteMode::LOSSY.
+  uint64_t droppedWrites() const {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+
   /// Perform a single write of an object of type T.
   /// Writes can block iff a previous writer has not yet completed a write
   /// for the same slot (before the most recent wrap-around).
   void write(T& value) noexcept {
     uint64_t ticket = ticket_.fetch_add(1);
-    slots_[idx(ticket)].write(turn(ticket), value);
+    writeSlot(ticket, value);
   }
 
   /// Perform a single write of an object of type T.
@@ -155,10 +194,59 @@ class LockFreeRingBuffer {
   /// Returns a Cursor pointing to the just-written T.
   Cursor writeAndGetCursor(T& value) noexcept {
     uint64_t ticket = ticket_.fetch_add(1);
-    slots_[idx(ticket)].write(turn(ticket), value);
+    writeSlot(ticket, value);
+    return Cursor(ticket);
+  }
+
+  /// Perform `count` consecutive writes of objects of type T with a single
+  /// ticket increment, so no other writer can interleave with them.
+  /// Writes can block iff a previous writer has not yet completed a write
+  /// for the same slot (before the most recent wrap-around).
+  /// Returns a Cursor pointing to the first written T.
+  Cursor writeN(const T* values, uint32_t count) noexcept {
+    Cursor cursor = reserve(count);
+    uint64_t ticket = cursor.ticket;
+    for (uint32_t i = 0; i < count; ++i, ++ticket) {
+      writeSlot(ticket, values[i]);
+    }
+    return cursor;
+  }
+
+  /// Reserve `count` consecutive writes with a single ticket increment.
+  /// Returns a Cursor pointing to the first reserved write. The caller owns
+  /// the whole range and must complete every write in it via writeAt(),
+  /// otherwise readers waiting on the skipped slots will never make progress.
+  Cursor reserve(uint32_t count) noexcept {
+    assert(count > 0 && count <= capacity_);
+    return Cursor(ticket_.fetch_add(count));
+  }
+
+  /// Perform a single write into a slot previously obtained from reserve().
+  /// Same blocking semantics as write().
+  void writeAt(const Cursor& cursor, T& value) noexcept {
+    writeSlot(cursor.ticket, value);
+  }
+
+  /// Perform a single write by letting `fill` build the new value directly
+  /// in the slot (`fill` is invoked with a T&), saving the copy of a fully
+  /// built T. `fill` runs while the slot is marked as being written and must
+  /// not throw. Same blocking semantics as write(). In WriteMode::LOSSY,
+  /// `fill` isn't invoked at all if the write is dropped.
+  /// Returns a Cursor pointing to the just-written T.
+  template <typename Fill>
+  Cursor writeInPlace(Fill&& fill) noexcept {
+    uint64_t ticket = ticket_.fetch_add(1);
+    writeSlotInPlace(ticket, std::forward<Fill>(fill));
     return Cursor(ticket);
   }
 
+  /// Same as writeInPlace() but into a slot previously obtained from
+  /// reserve().
+  template <typename Fill>
+  void writeInPlaceAt(const Cursor& cursor, Fill&& fill) noexcept {
+    writeSlotInPlace(cursor.ticket, std::forward<Fill>(fill));
+  }
+
   /// Read the value at the cursor.
   /// Returns true if the read succeeded, false otherwise. If the return
   /// value is false, dest is to be considered partially read and in an
@@ -175,6 +263,54 @@ class LockFreeRingBuffer {
     return slots_[idx(cursor.ticket)].waitAndTryRead(dest, turn(cursor.ticket));
   }
 
+  /// Read up to `count` consecutive values, starting at the cursor, into
+  /// dest[0], dest[1], ... Cheaper than as many tryRead() calls: the slots
+  /// are copied out in one pass, prefetching the ones ahead, and checked
+  /// again in a second one with a single fence for the whole range.
+  /// Returns how many leading values were read successfully. The ones
+  /// after them are to be discarded, like the value of a failed tryRead().
+  uint32_t
+  tryReadRange(T* dest, const Cursor& cursor, uint32_t count) noexcept {
+    // Locals, the copies into dest would otherwise make the compiler load
+    // them again for every slot.
+    const uint32_t capacity = capacity_;
+    auto slots = slots_;
+    count = std::min(count, capacity);
+    const uint32_t first_idx = idx(cursor.ticket);
+    const uint32_t first_turn = turn(cursor.ticket);
+
+    uint32_t valid = 0;
+    for (uint32_t i = first_idx, t = first_turn; valid < count; ++valid) {
+      if (valid + kReadAhead < count) {
+        uint32_t ahead = i + kReadAhead;
+        __builtin_prefetch(&slots[ahead < capacity ? ahead : ahead - capacity]);
+      }
+      auto& slot = slots[i];
+      if (!slot.isReadable(t)) {
+        break;
+      }
+      memcpy(&dest[valid], &slot.data, sizeof(T));
+      if (++i == capacity) {
+        i = 0;
+        ++t;
+      }
+    }
+
+    // Like the second check in tryRead(), but the copies above happen
+    // before all of the checks below.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    for (uint32_t n = 0, i = first_idx, t = first_turn; n < valid; ++n) {
+      if (!slots[i].isReadable(t)) {
+        return n;
+      }
+      if (++i == capacity) {
+        i = 0;
+        ++t;
+      }
+    }
+    return valid;
+  }
+
   /// Returns a Cursor pointing to the first write that has not occurred yet.
   Cursor currentHead() noexcept {
     return Cursor(ticket_.load());
@@ -200,20 +336,62 @@ class LockFreeRingBuffer {
   }
 
  private:
+  // How many slots ahead tryReadRange() prefetches.
+  static constexpr uint32_t kReadAhead = 8;
+
   const uint32_t capacity_;
+  const WriteMode mode_;
   Atom<uint64_t> ticket_;
+  Atom<uint64_t> dropped_;
   detail::RingBufferSlot<T, Atom> slots_[];
 
-  static LockFreeRingBuffer<T, Atom>* allocateAt(uint32_t capacity, void* ptr) {
+  static LockFreeRingBuffer<T, Atom>* allocateAt(
+      uint32_t capacity,
+      void* ptr,
+      WriteMode mode = WriteMode::GUARANTEED) {
     LockFreeRingBuffer<T, Atom>* buffer =
-        new (ptr) LockFreeRingBuffer<T, Atom>(capacity);
+        new (ptr) LockFreeRingBuffer<T, Atom>(capacity, mode);
     _uninitialized_default_construct_n(buffer->slots_, capacity);
 
     return buffer;
   }
 
-  explicit LockFreeRingBuffer(uint32_t capacity) noexcept
-      : capacity_(capacity), ticket_(0) {}
+  LockFreeRingBuffer(uint32_t capacity, WriteMode mode) noexcept
+      : capacity_(capacity), mode_(mode), ticket_(0), dropped_(0) {}
+
+  void writeSlot(uint64_t ticket, const T& value) noexcept {
+    writeSlotInPlace(ticket, [&value](T& data) { data = value; });
+  }
+
+  template <typename Fill>
+  void writeSlotInPlace(uint64_t ticket, Fill&& fill) noexcept {
+    auto& slot = slots_[idx(ticket)];
+    if (mode_ == WriteMode::GUARANTEED) {
+      slot.writeInPlace(turn(ticket), std::forward<Fill>(fill));
+      return;
+    }
+
+    if (!slot.tryWriteInPlace(turn(ticket), std::forward<Fill>(fill))) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    fillAbandonedTurns(ticket);
+  }
+
+  /// Writers from the following laps of the slot may have found it busy
+  /// while we held it and given up. Leave tombstones in their place for as
+  /// long as their tickets have been handed out. A writer that still shows
+  /// up for one of these turns finds it in the past and drops its write.
+  void fillAbandonedTurns(uint64_t ticket) noexcept {
+    for (uint64_t next = ticket + capacity_;
+         next < ticket_.load(std::memory_order_acquire);
+         next += capacity_) {
+      if (!slots_[idx(next)].tryWriteTombstone(turn(next))) {
+        // Its writer got there first and takes over from here.
+        break;
+      }
+    }
+  }
 
   ~LockFreeRingBuffer() {
     _destroy_n(slots_, capacity_);
@@ -237,18 +415,68 @@ class RingBufferSlot {
  public:
   explicit RingBufferSlot() noexcept : sequencer_(), data() {}
 
-  void write(const uint32_t turn, T& value) noexcept {
+  void write(const uint32_t turn, const T& value) noexcept {
+    writeInPlace(turn, [&value](T& data) { data = value; });
+  }
+
+  template <typename Fill>
+  void writeInPlace(const uint32_t turn, Fill&& fill) noexcept {
     Atom<uint32_t> cutoff(0);
     sequencer_.waitForTurn(turn * 2, cutoff, false);
 
     // Change to an odd-numbered turn to indicate write in process
     sequencer_.completeTurn(turn * 2);
 
-    data = std::move(value);
+    fill(data);
     sequencer_.completeTurn(turn * 2 + 1);
     // At (turn + 1) * 2
   }
 
+  /// Non-blocking writeInPlace() for WriteMode::LOSSY. Returns false if the
+  /// write was dropped, in which case `fill` was not invoked.
+  template <typename Fill>
+  bool tryWriteInPlace(const uint32_t turn, Fill&& fill) noexcept {
+    const uint32_t write_turn = turn * 2;
+    while (true) {
+      uint32_t current = sequencer_.currentTurn();
+      int32_t ahead = TurnSequencer<Atom>::turnDelta(current, write_turn);
+      if (ahead < 0) {
+        // Tombstoned by a writer from a later lap.
+        return false;
+      }
+      if (ahead == 0) {
+        if (!sequencer_.tryAdvance(write_turn, write_turn + 1)) {
+          continue;
+        }
+        fill(data);
+        sequencer_.completeTurn(write_turn + 1);
+        return true;
+      }
+      if (current & 1) {
+        // A writer from an earlier lap is still at it. It leaves the
+        // tombstone for us once it's done.
+        return false;
+      }
+      // Idle at an earlier lap whose writer hasn't shown up. Skip to the lap
+      // right before ours and leave a tombstone for it.
+      if (sequencer_.tryAdvance(current, write_turn - 1)) {
+        data = T();
+        sequencer_.completeTurn(write_turn - 1);
+      }
+    }
+  }
+
+  /// Leaves a tombstone for `turn` if it's the slot's next turn and nobody
+  /// has started writing it.
+  bool tryWriteTombstone(const uint32_t turn) noexcept {
+    if (!sequencer_.tryAdvance(turn * 2, turn * 2 + 1)) {
+      return false;
+    }
+    data = T();
+    sequencer_.completeTurn(turn * 2 + 1);
+    return true;
+  }
+
   bool waitAndTryRead(T& dest, uint32_t turn) noexcept {
     uint32_t desired_turn = (turn + 1) * 2;
     Atom<uint32_t> cutoff(0);
@@ -262,6 +490,11 @@ class RingBufferSlot {
     return sequencer_.isTurn(desired_turn);
   }
 
+  /// Whether the write of `turn` is complete and not overwritten yet.
+  bool isReadable(uint32_t turn) const noexcept {
+    return sequencer_.isTurn((turn + 1) * 2);
+  }
+
   bool tryRead(T& dest, uint32_t turn) noexcept {
     // The write that started at turn 0 ended at turn 2
     if (!sequencer_.isTurn((turn + 1) * 2)) {
@@ -276,7 +509,7 @@ class RingBufferSlot {
  private:
   TurnSequencer<Atom> sequencer_;
   T data;
-  friend class LockFreeRingBuffer<T>;
+  friend class LockFreeRingBuffer<T, Atom>;
 }; // RingBufferSlot
 
 } // namespace detail
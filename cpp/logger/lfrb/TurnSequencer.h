@@ -218,6 +218,38 @@ struct TurnSequencer {
     }
   }
 
+  /// Returns the current turn, truncated to the 26 bits kept in state_.
+  /// Compare it to other turns with turnDelta().
+  uint32_t currentTurn() const noexcept {
+    return decodeCurrentSturn(state_.load(std::memory_order_acquire)) >>
+        kTurnShift;
+  }
+
+  /// Returns how many turns `to` is ahead of `from`, negative if it is
+  /// behind.  Wrap-safe for turns less than 2^25 apart.
+  static int32_t turnDelta(const uint32_t from, const uint32_t to) noexcept {
+    return static_cast<int32_t>((to - from) << kTurnShift) >> kTurnShift;
+  }
+
+  /// Moves straight from turn `from` to turn `to` without blocking, if
+  /// `from` is the current turn.  Turns in between are skipped: their
+  /// waiters, like all others, are woken up and see them as PAST.
+  /// Returns false if the current turn isn't `from`.
+  bool tryAdvance(const uint32_t from, const uint32_t to) noexcept {
+    const uint32_t from_sturn = from << kTurnShift;
+    uint32_t state = state_.load(std::memory_order_acquire);
+    while (decodeCurrentSturn(state) == from_sturn) {
+      // Waiters re-register against the new turn once woken up.
+      if (state_.compare_exchange_strong(state, encode(to << kTurnShift, 0))) {
+        if (decodeMaxWaitersDelta(state) != 0) {
+          state_.futexWake(std::numeric_limits<int>::max(), ~0u);
+        }
+        return true;
+      }
+    }
+    return false;
+  }
+
   /// Returns the least-most significant byte of the current uncompleted
   /// turn.  The full 32 bit turn cannot be recovered.
   uint8_t uncompletedTurnLSB() const noexcept {
@@ -19,15 +19,24 @@
 #include <system_error>
 
 #include <fcntl.h>
+#include <sched.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <cstring>
 #include <memory>
+#include <stdexcept>
 
 #include <errno.h>
 
+#if defined(__GLIBC__) && defined(__has_include)
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define PROFILO_GLIBC_RSEQ 1
+#endif
+#endif
+
 #include <fb/log.h>
 
 namespace facebook {
@@ -36,21 +45,76 @@ namespace mmapbuf {
 
 namespace {
 
-static size_t calculateBufferSize(size_t entryCount) {
-  return sizeof(MmapBufferPrefix) +
-      TraceBuffer::calculateAllocationSize(entryCount);
+constexpr size_t kCacheLineSize = 64;
+
+// Shards are padded to whole cache lines, so the ticket of one shard never
+// shares a line with the slots of the previous one.
+static size_t calculateShardStride(size_t shardEntryCount) {
+  auto size = TraceBuffer::calculateAllocationSize(shardEntryCount);
+  return (size + kCacheLineSize - 1) / kCacheLineSize * kCacheLineSize;
+}
+
+static size_t calculateShardEntryCount(
+    size_t entryCount,
+    size_t shardCount,
+    Buffer::Backend backend = Buffer::Backend::PACKETS) {
+  if (backend == Buffer::Backend::BYTE_RING && shardCount != 1) {
+    throw std::invalid_argument("A byte ring can't be sharded");
+  }
+  if (shardCount == 0 || shardCount > UINT16_MAX) {
+    throw std::invalid_argument("shardCount must be in [1, 65535]");
+  }
+  if (entryCount < shardCount) {
+    throw std::invalid_argument("entryCount must be at least shardCount");
+  }
+  return entryCount / shardCount;
+}
+
+static void checkBlobArenaSize(size_t blobArenaSize) {
+  if (blobArenaSize != 0 && blobArenaSize < Buffer::kMinBlobArenaSize) {
+    throw std::invalid_argument(
+        "blobArenaSize must be 0 or at least kMinBlobArenaSize");
+  }
+}
+
+static unsigned int currentCpu() {
+#ifdef PROFILO_GLIBC_RSEQ
+  // glibc registers every thread with rseq, reading the CPU the kernel keeps
+  // up to date there is a plain load.
+  if (__rseq_size > 0) {
+    auto area = reinterpret_cast<const volatile struct rseq*>(
+        reinterpret_cast<const char*>(__builtin_thread_pointer()) +
+        __rseq_offset);
+    int32_t cpu = area->cpu_id;
+    if (cpu >= 0) {
+      return cpu;
+    }
+  }
+#endif
+  int cpu = sched_getcpu();
+  return cpu < 0 ? 0 : cpu;
 }
 
 } // namespace
 
-Buffer::Buffer(std::string const& path, size_t entryCount) {
+Buffer::Buffer(
+    std::string const& path,
+    size_t entryCount,
+    size_t shardCount,
+    WriteMode mode,
+    Backend backend,
+    size_t blobArenaSize) {
+  size_t shardEntryCount =
+      calculateShardEntryCount(entryCount, shardCount, backend);
+  checkBlobArenaSize(blobArenaSize);
   int fd = open(path.c_str(), O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR);
   if (fd == -1) {
     throw std::system_error(
         errno, std::system_category(), "Cannot open file " + path);
   }
 
-  size_t totalSize = calculateBufferSize(entryCount);
+  size_t totalSize =
+      calculateByteSize(entryCount, shardCount, backend, blobArenaSize);
 
   // In order to allocate file size of N bytes we seek to (N-1)th position and
   // just write single byte at the end. This allows us to avoid filling the
@@ -88,22 +152,62 @@ Buffer::Buffer(std::string const& path, size_t entryCount) {
   prefix = new (map_chr) MmapBufferPrefix();
   buffer = map_chr + sizeof(MmapBufferPrefix);
   this->path = path;
-  this->entryCount = entryCount;
+  this->entryCount = shardEntryCount * shardCount;
   this->totalByteSize = totalSize;
   this->file_backed_ = true;
-  lfrb_ = TraceBuffer::allocateAt(entryCount, (void*)buffer);
+  allocateShards(shardCount, mode, backend, blobArenaSize);
 }
 
-Buffer::Buffer(size_t entryCount) {
-  size_t totalSize = calculateBufferSize(entryCount);
+Buffer::Buffer(
+    size_t entryCount,
+    size_t shardCount,
+    WriteMode mode,
+    Backend backend,
+    size_t blobArenaSize) {
+  size_t shardEntryCount =
+      calculateShardEntryCount(entryCount, shardCount, backend);
+  checkBlobArenaSize(blobArenaSize);
+  size_t totalSize =
+      calculateByteSize(entryCount, shardCount, backend, blobArenaSize);
 
   auto mem = new char[totalSize];
   prefix = new (mem) MmapBufferPrefix();
   buffer = mem + sizeof(MmapBufferPrefix);
   this->totalByteSize = totalSize;
-  this->entryCount = entryCount;
+  this->entryCount = shardEntryCount * shardCount;
   this->file_backed_ = false;
-  lfrb_ = TraceBuffer::allocateAt(entryCount, (void*)buffer);
+  allocateShards(shardCount, mode, backend, blobArenaSize);
+}
+
+void Buffer::allocateShards(
+    size_t shardCount,
+    WriteMode mode,
+    Backend backend,
+    size_t blobArenaSize) {
+  if (blobArenaSize != 0) {
+    blob_arena_ = logger::ByteRingBuffer::allocateAt(
+        blobArenaSize,
+        reinterpret_cast<char*>(buffer) +
+            blobArenaOffset(entryCount, shardCount, backend),
+        mode);
+    logger_.blob_arena_ = blob_arena_;
+  }
+
+  if (backend == Backend::BYTE_RING) {
+    byte_ring_ = logger::ByteRingBuffer::allocateAt(
+        byteRingCapacity(entryCount), buffer, mode);
+    logger_.byte_ring_ = byte_ring_;
+    return;
+  }
+
+  size_t shardEntryCount = entryCount / shardCount;
+  shards_.reserve(shardCount);
+  for (size_t idx = 0; idx < shardCount; ++idx) {
+    shards_.push_back(TraceBuffer::allocateAt(
+        shardEntryCount,
+        reinterpret_cast<char*>(buffer) + shardOffset(shardEntryCount, idx),
+        mode));
+  }
 }
 
 Buffer::Buffer(Buffer&& other)
@@ -113,7 +217,13 @@ Buffer::Buffer(Buffer&& other)
       prefix(other.prefix),
       buffer(other.buffer),
       file_backed_(other.file_backed_),
-      lfrb_(std::move(other.lfrb_)) {
+      shards_(std::move(other.shards_)),
+      byte_ring_(other.byte_ring_),
+      blob_arena_(other.blob_arena_) {
+  logger_.byte_ring_ = byte_ring_;
+  logger_.blob_arena_ = blob_arena_;
+  other.byte_ring_ = nullptr;
+  other.blob_arena_ = nullptr;
   other.entryCount = 0;
   other.totalByteSize = 0;
   other.prefix = nullptr;
@@ -129,8 +239,14 @@ Buffer& Buffer::operator=(Buffer&& other) {
   totalByteSize = other.totalByteSize;
   prefix = other.prefix;
   buffer = other.buffer;
-  lfrb_ = std::move(other.lfrb_);
+  shards_ = std::move(other.shards_);
+  byte_ring_ = other.byte_ring_;
+  blob_arena_ = other.blob_arena_;
+  logger_.byte_ring_ = byte_ring_;
+  logger_.blob_arena_ = blob_arena_;
 
+  other.byte_ring_ = nullptr;
+  other.blob_arena_ = nullptr;
   other.buffer = other.prefix = nullptr;
   other.entryCount = other.totalByteSize = 0;
   other.file_backed_ = false;
@@ -154,6 +270,96 @@ Buffer::~Buffer() {
   }
 }
 
+TraceBuffer& Buffer::currentShard() {
+  if (shards_.size() == 1) {
+    return *shards_.front();
+  }
+  return *shards_[currentCpu() % shards_.size()];
+}
+
+Buffer::ShardCursors Buffer::currentHeads() {
+  if (byte_ring_ != nullptr) {
+    return ShardCursors{byte_ring_->currentHead()};
+  }
+  ShardCursors cursors;
+  cursors.reserve(shards_.size());
+  for (auto shard : shards_) {
+    cursors.push_back(shard->currentHead());
+  }
+  return cursors;
+}
+
+Buffer::ShardCursors Buffer::currentTails(double skipFraction) {
+  if (byte_ring_ != nullptr) {
+    return ShardCursors{byte_ring_->currentTail()};
+  }
+  ShardCursors cursors;
+  cursors.reserve(shards_.size());
+  for (auto shard : shards_) {
+    cursors.push_back(shard->currentTail(skipFraction));
+  }
+  return cursors;
+}
+
+uint64_t Buffer::droppedWrites() const {
+  if (byte_ring_ != nullptr) {
+    return byte_ring_->droppedWrites();
+  }
+  uint64_t dropped = 0;
+  for (auto shard : shards_) {
+    dropped += shard->droppedWrites();
+  }
+  return dropped;
+}
+
+size_t Buffer::shardOffset(size_t shardEntryCount, size_t shard) {
+  return shard * calculateShardStride(shardEntryCount);
+}
+
+size_t Buffer::calculateByteSize(
+    size_t entryCount,
+    size_t shardCount,
+    Backend backend,
+    size_t blobArenaSize) {
+  if (blobArenaSize != 0) {
+    return sizeof(MmapBufferPrefix) +
+        blobArenaOffset(entryCount, shardCount, backend) +
+        logger::ByteRingBuffer::calculateAllocationSize(blobArenaSize);
+  }
+  size_t shardEntryCount =
+      calculateShardEntryCount(entryCount, shardCount, backend);
+  if (backend == Backend::BYTE_RING) {
+    return sizeof(MmapBufferPrefix) +
+        logger::ByteRingBuffer::calculateAllocationSize(
+               byteRingCapacity(entryCount));
+  }
+  // The last shard isn't padded, an unsharded buffer is exactly the prefix
+  // and its TraceBuffer.
+  return sizeof(MmapBufferPrefix) +
+      shardOffset(shardEntryCount, shardCount - 1) +
+      TraceBuffer::calculateAllocationSize(shardEntryCount);
+}
+
+size_t Buffer::blobArenaOffset(
+    size_t entryCount,
+    size_t shardCount,
+    Backend backend) {
+  // Starts on a cache line of its own, like the shards.
+  size_t size = calculateByteSize(entryCount, shardCount, backend) -
+      sizeof(MmapBufferPrefix);
+  return (size + kCacheLineSize - 1) / kCacheLineSize * kCacheLineSize;
+}
+
+size_t Buffer::byteRingCapacity(size_t entryCount) {
+  // The bytes the slots of a TraceBuffer would take.
+  return entryCount * sizeof(TraceBufferSlot);
+}
+
+size_t Buffer::cpuShardCount() {
+  long cpus = sysconf(_SC_NPROCESSORS_CONF);
+  return cpus < 1 ? 1 : static_cast<size_t>(cpus);
+}
+
 void Buffer::rename(std::string const& new_path) {
   if (::rename(path.c_str(), new_path.c_str())) {
     throw std::system_error(
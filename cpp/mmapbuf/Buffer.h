@@ -18,8 +18,10 @@
 
 #include <string>
 #include <type_traits>
+#include <vector>
 
 #include <logger/Logger.h>
+#include <logger/buffer/ByteRingBuffer.h>
 #include <logger/buffer/TraceBuffer.h>
 #include <mmapbuf/header/MmapBufferHeader.h>
 
@@ -36,11 +38,56 @@ using MmapBufferPrefix = header::MmapBufferPrefix;
 /// In case it's file-backed, it keeps track of the file path
 /// and the file header.
 ///
+/// A sharded Buffer holds one TraceBuffer per shard instead, each with
+/// entryCount / shardCount entries. Its logger() writes every entry into the
+/// shard of the CPU the writing thread runs on, so threads on different CPUs
+/// don't contend on the same ticket and slots. Readers merge the shards back
+/// together by timestamp (see writer::ShardMergeReader).
+///
+/// With WriteMode::LOSSY, logging threads never wait on each other and drop
+/// their entries instead when the buffer is too small for the contention.
+///
+/// With Backend::BYTE_RING, the space of entryCount TraceBuffer slots holds a
+/// single logger::ByteRingBuffer instead, which stores entries as
+/// variable-length records and fits far more of them. Its cursors are byte
+/// positions, and it counts as one shard.
+///
+/// A Buffer can also hold a blob arena of blobArenaSize bytes after its
+/// shards (or byte ring): another logger::ByteRingBuffer that takes the
+/// payloads of large BytesEntry writes, so they don't push the history
+/// out of the main buffer. The main buffer only gets a BLOB_REFERENCE
+/// entry pointing into the arena, see Logger::writeBytes().
+///
 struct Buffer {
+  // One position per shard.
+  using ShardCursors = std::vector<TraceBuffer::Cursor>;
+  using WriteMode = logger::lfrb::WriteMode;
+
+  enum class Backend : uint32_t {
+    // TraceBuffer shards of fixed-size packets.
+    PACKETS = 0,
+    // An unsharded logger::ByteRingBuffer.
+    BYTE_RING = 1,
+  };
+
+  // Smallest blob arena a Buffer takes.
+  static constexpr size_t kMinBlobArenaSize = 4096;
+
   // Construct a Buffer from an mmapped file.
-  Buffer(std::string const& path, size_t entryCount);
+  Buffer(
+      std::string const& path,
+      size_t entryCount,
+      size_t shardCount = 1,
+      WriteMode mode = WriteMode::GUARANTEED,
+      Backend backend = Backend::PACKETS,
+      size_t blobArenaSize = 0);
   // Construct a Buffer from anonymous memory.
-  explicit Buffer(size_t entryCount);
+  explicit Buffer(
+      size_t entryCount,
+      size_t shardCount = 1,
+      WriteMode mode = WriteMode::GUARANTEED,
+      Backend backend = Backend::PACKETS,
+      size_t blobArenaSize = 0);
 
   Buffer(Buffer const&) = delete;
   Buffer(Buffer&&);
@@ -51,14 +98,97 @@ struct Buffer {
 
   void rename(std::string const& path);
 
+  //
+  // The TraceBuffer of an unsharded buffer. For a sharded one, only the
+  // first shard. Backend::PACKETS only.
+  //
   TraceBuffer& ringBuffer() {
-    return *lfrb_;
+    return *shards_.front();
+  }
+
+  Backend backend() const {
+    return byte_ring_ != nullptr ? Backend::BYTE_RING : Backend::PACKETS;
+  }
+
+  //
+  // Backend::BYTE_RING only.
+  //
+  logger::ByteRingBuffer& byteRing() {
+    return *byte_ring_;
+  }
+
+  //
+  // The blob arena, or nullptr if the buffer was made without one.
+  //
+  logger::ByteRingBuffer* blobArena() {
+    return blob_arena_;
+  }
+
+  size_t shardCount() const {
+    return byte_ring_ != nullptr ? 1 : shards_.size();
+  }
+
+  TraceBuffer& shard(size_t idx) {
+    return *shards_[idx];
   }
 
+  std::vector<TraceBuffer*> const& shards() const {
+    return shards_;
+  }
+
+  //
+  // The shard of the CPU the calling thread is (or recently was) running on.
+  //
+  TraceBuffer& currentShard();
+
+  ShardCursors currentHeads();
+  // skipFraction is ignored by a byte ring, which can only start reading at
+  // its tail.
+  ShardCursors currentTails(double skipFraction = 0.0);
+
+  //
+  // Packets (or byte ring records) dropped so far, always 0 in
+  // WriteMode::GUARANTEED.
+  //
+  uint64_t droppedWrites() const;
+
   Logger& logger() {
     return logger_;
   }
 
+  //
+  // Byte offset of a shard's TraceBuffer from the end of the prefix.
+  //
+  static size_t shardOffset(size_t shardEntryCount, size_t shard);
+
+  //
+  // Size of the prefix and all shards, or of the prefix and the byte ring,
+  // plus the blob arena if there is one.
+  //
+  static size_t calculateByteSize(
+      size_t entryCount,
+      size_t shardCount,
+      Backend backend = Backend::PACKETS,
+      size_t blobArenaSize = 0);
+
+  //
+  // Byte offset of the blob arena from the end of the prefix.
+  //
+  static size_t blobArenaOffset(
+      size_t entryCount,
+      size_t shardCount,
+      Backend backend = Backend::PACKETS);
+
+  //
+  // Bytes a byte ring gets in place of entryCount slots.
+  //
+  static size_t byteRingCapacity(size_t entryCount);
+
+  //
+  // Shard count that gives every configured CPU its own shard.
+  //
+  static size_t cpuShardCount();
+
   std::string path = "";
   size_t entryCount = 0;
   size_t totalByteSize = 0;
@@ -67,10 +197,20 @@ struct Buffer {
 
  private:
   bool file_backed_ = false;
-  TraceBuffer* lfrb_ = nullptr;
+  std::vector<TraceBuffer*> shards_;
+  logger::ByteRingBuffer* byte_ring_ = nullptr;
+  logger::ByteRingBuffer* blob_arena_ = nullptr;
+  // Staged, so entries are packetized straight into the reserved slots.
   Logger logger_{
-      {[this]() -> TraceBuffer& { return this->ringBuffer(); }},
-      Logger::getGlobalEntryID()};
+      {[this]() -> TraceBuffer& { return this->currentShard(); }},
+      Logger::getGlobalEntryID(),
+      /* staged */ true};
+
+  void allocateShards(
+      size_t shardCount,
+      WriteMode mode,
+      Backend backend,
+      size_t blobArenaSize);
 };
 
 namespace {
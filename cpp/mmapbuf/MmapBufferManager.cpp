@@ -36,10 +36,19 @@ MmapBufferManager::allocateBufferAnonymousForJava(int32_t buffer_size) {
 }
 
 std::shared_ptr<Buffer> MmapBufferManager::allocateBufferAnonymous(
-    int32_t buffer_size) {
+    int32_t buffer_size,
+    size_t shard_count,
+    Buffer::WriteMode write_mode,
+    Buffer::Backend backend,
+    size_t blob_arena_size) {
   std::shared_ptr<Buffer> buffer = nullptr;
   try {
-    buffer = std::make_shared<Buffer>((size_t)buffer_size);
+    buffer = std::make_shared<Buffer>(
+        (size_t)buffer_size,
+        shard_count,
+        write_mode,
+        backend,
+        blob_arena_size);
   } catch (std::exception& ex) {
     FBLOGE("%s", ex.what());
     return nullptr;
@@ -61,11 +70,21 @@ MmapBufferManager::allocateBufferFileForJava(
 
 std::shared_ptr<Buffer> MmapBufferManager::allocateBufferFile(
     int32_t buffer_size,
-    const std::string& path) {
+    const std::string& path,
+    size_t shard_count,
+    Buffer::WriteMode write_mode,
+    Buffer::Backend backend,
+    size_t blob_arena_size) {
   std::shared_ptr<Buffer> buffer = nullptr;
   try {
-    buffer = std::make_shared<Buffer>(path, (size_t)buffer_size);
-  } catch (std::system_error& ex) {
+    buffer = std::make_shared<Buffer>(
+        path,
+        (size_t)buffer_size,
+        shard_count,
+        write_mode,
+        backend,
+        blob_arena_size);
+  } catch (std::exception& ex) {
     FBLOGE("%s", ex.what());
     return nullptr;
   }
@@ -75,8 +94,15 @@ std::shared_ptr<Buffer> MmapBufferManager::allocateBufferFile(
 }
 
 void MmapBufferManager::registerBuffer(std::shared_ptr<Buffer> buffer) {
-  buffer->prefix->header.bufferVersion = RingBuffer::kVersion;
+  buffer->prefix->header.bufferVersion =
+      buffer->backend() == Buffer::Backend::BYTE_RING
+      ? RingBuffer::kByteRingVersion
+      : RingBuffer::kVersion;
   buffer->prefix->header.size = buffer->entryCount;
+  buffer->prefix->header.shardCount = buffer->shardCount();
+  buffer->prefix->header.blobArenaSize = buffer->blobArena() != nullptr
+      ? buffer->blobArena()->capacity()
+      : 0;
   buffer->prefix->header.pid = getpid();
   {
     WriterLock lock(&buffers_lock_);
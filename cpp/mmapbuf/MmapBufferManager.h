@@ -46,7 +46,20 @@ class MmapBufferManager : public fbjni::HybridClass<MmapBufferManager> {
   // Allocates TraceBuffer according to the passed parameters in a file.
   // Returns a non-null reference if successful, nullptr if not.
   //
-  std::shared_ptr<Buffer> allocateBufferAnonymous(int32_t buffer_slots_size);
+  // shard_count: see Buffer. The slots are split evenly between the shards.
+  // write_mode: whether logging threads wait for slots held by a slower
+  //             writer or drop their writes. See Buffer.
+  // backend: packet slots, or a byte ring taking the space of
+  //          buffer_slots_size slots. See Buffer.
+  // blob_arena_size: bytes set aside for large BytesEntry payloads, 0 for
+  //                  none. See Buffer.
+  //
+  std::shared_ptr<Buffer> allocateBufferAnonymous(
+      int32_t buffer_slots_size,
+      size_t shard_count = 1,
+      Buffer::WriteMode write_mode = Buffer::WriteMode::GUARANTEED,
+      Buffer::Backend backend = Buffer::Backend::PACKETS,
+      size_t blob_arena_size = 0);
 
   fbjni::local_ref<JBuffer::javaobject> allocateBufferAnonymousForJava(
       int32_t buffer_slots_size);
@@ -57,7 +70,11 @@ class MmapBufferManager : public fbjni::HybridClass<MmapBufferManager> {
   //
   std::shared_ptr<Buffer> allocateBufferFile(
       int32_t buffer_slots_size,
-      const std::string& path);
+      const std::string& path,
+      size_t shard_count = 1,
+      Buffer::WriteMode write_mode = Buffer::WriteMode::GUARANTEED,
+      Buffer::Backend backend = Buffer::Backend::PACKETS,
+      size_t blob_arena_size = 0);
 
   fbjni::local_ref<JBuffer::javaobject> allocateBufferFileForJava(
       int32_t buffer_slots_size,
@@ -26,7 +26,7 @@ namespace mmapbuf {
 namespace header {
 
 constexpr static uint64_t kMagic = 0x306c3166307270; // pr0f1l0
-constexpr static uint64_t kVersion = 8;
+constexpr static uint64_t kVersion = 10;
 
 //
 // Static header for primary buffer verification.
@@ -49,6 +49,11 @@ struct __attribute__((packed)) alignas(8) MmapBufferHeader {
   constexpr static auto kSessionIdLength = 40;
   constexpr static auto kMemoryMapsFilePathLength = 512;
   uint16_t bufferVersion;
+  // Number of TraceBuffers following the prefix, each holding
+  // size / shardCount entries. See mmapbuf::Buffer for the layout.
+  // Always 1 for a byte ring (see bufferVersion), which takes the space of
+  // size entries.
+  uint16_t shardCount;
   int64_t configId;
   int32_t versionCode;
   uint32_t size;
@@ -59,6 +64,9 @@ struct __attribute__((packed)) alignas(8) MmapBufferHeader {
   pid_t pid;
   char sessionId[kSessionIdLength];
   char memoryMapsFilePath[kMemoryMapsFilePathLength];
+  // Bytes of the blob arena following the shards or byte ring, 0 if the
+  // buffer has none. See mmapbuf::Buffer.
+  uint32_t blobArenaSize;
 };
 
 //
@@ -68,6 +76,11 @@ struct __attribute__((packed)) alignas(8) MmapBufferHeader {
 // The mmap buffer file has the following format.
 // [ Static header (16 bytes) Magic + Version ] - Fixed at build time.
 // [ Buffer Header (8-byte aligned)           ] - Dynamic state of Ring Buffer
+// [ TraceBuffer shards 0 .. shardCount - 1   ] - Padded to cache lines
+//   or
+// [ ByteRingBuffer                           ] - Byte ring buffers
+// [ Blob arena ByteRingBuffer                ] - If blobArenaSize > 0,
+//                                                 starts on a cache line
 struct __attribute__((packed)) alignas(8) MmapBufferPrefix {
   MmapStaticHeader staticHeader;
   MmapBufferHeader header;
@@ -80,7 +80,8 @@ class MmapBufferHeaderReader
       return 0;
     }
 
-    if (header->header.bufferVersion != RingBuffer::kVersion) {
+    if (header->header.bufferVersion != RingBuffer::kVersion &&
+        header->header.bufferVersion != RingBuffer::kByteRingVersion) {
       return 0;
     }
 
@@ -23,17 +23,21 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <cstring>
+#include <algorithm>
 #include <fstream>
 #include <memory>
 #include <stdexcept>
 #include <utility>
 #include <vector>
 
+#include <profilo/entries/EntryParser.h>
 #include <profilo/entries/EntryType.h>
+#include <profilo/logger/buffer/ByteRingBuffer.h>
 #include <profilo/logger/buffer/RingBuffer.h>
 #include <profilo/mmapbuf/Buffer.h>
 #include <profilo/mmapbuf/header/MmapBufferHeader.h>
 #include <profilo/util/common.h>
+#include <profilo/writer/ShardMergeReader.h>
 #include <profilo/writer/TraceWriter.h>
 #include <profilo/writer/trace_headers.h>
 
@@ -48,6 +52,8 @@ namespace {
 
 constexpr int64_t kTriggerEventFlag = 0x0002000000000000L; // 1 << 49
 static constexpr char kMemoryMappingKey[] = "l:s:u:o:s";
+// Packets copyBufferEntries() reads at a time.
+constexpr uint32_t kCopyBatchSize = 64;
 
 void loggerWrite(
     Logger& logger,
@@ -135,19 +141,87 @@ void loggerWriteQplTriggerAnnotation(
 //
 bool copyBufferEntries(TraceBuffer& source, TraceBuffer& dest) {
   TraceBuffer::Cursor cursor = source.currentTail(0);
-  alignas(4) Packet packet;
+  alignas(4) Packet packets[kCopyBatchSize];
   uint32_t processed_count = 0;
-  while (source.tryRead(packet, cursor)) {
-    Packet writePacket = packet; // copy
-    dest.write(writePacket);
-    ++processed_count;
-    if (!cursor.moveForward()) {
+  while (true) {
+    auto read = source.tryReadRange(packets, cursor, kCopyBatchSize);
+    for (uint32_t idx = 0; idx < read; ++idx) {
+      dest.write(packets[idx]);
+    }
+    processed_count += read;
+    if (read < kCopyBatchSize || !cursor.moveForward(read)) {
       break;
     }
   }
   return processed_count > 0;
 }
 
+//
+// Re-logs every entry it visits, keeping the original IDs.
+//
+class CopyingVisitor : public entries::EntryVisitor {
+ public:
+  explicit CopyingVisitor(Logger& logger) : logger_(logger), count_(0) {}
+
+  void visit(const StandardEntry& entry) override {
+    logger_.write(StandardEntry(entry));
+    ++count_;
+  }
+
+  void visit(const FramesEntry& entry) override {
+    logger_.write(FramesEntry(entry));
+    ++count_;
+  }
+
+  void visit(const BytesEntry& entry) override {
+    logger_.write(BytesEntry(entry));
+    ++count_;
+  }
+
+  uint32_t count() const {
+    return count_;
+  }
+
+ private:
+  Logger& logger_;
+  uint32_t count_;
+};
+
+//
+// Merges the shards of a sharded source buffer by timestamp into the
+// destination logger. Returns false if nothing was copied.
+//
+bool copyShardedBufferEntries(
+    std::vector<TraceBuffer*> const& shards,
+    Logger& dest) {
+  std::vector<TraceBuffer::Cursor> cursors;
+  for (auto shard : shards) {
+    cursors.push_back(shard->currentTail(0));
+  }
+  profilo::writer::ShardMergeReader reader(
+      shards, cursors, profilo::writer::ShardMergeReader::Direction::FORWARD);
+  CopyingVisitor visitor(dest);
+  while (reader.next(visitor) ==
+         profilo::writer::ShardMergeReader::Status::ENTRY) {
+  }
+  return visitor.count() > 0;
+}
+
+//
+// Re-logs the records of a byte ring whose writers are gone. Returns false
+// if nothing was copied.
+//
+bool copyByteRingEntries(logger::ByteRingBuffer const& source, Logger& dest) {
+  auto cursor = source.currentTail();
+  std::vector<char> record;
+  CopyingVisitor visitor(dest);
+  while (source.tryRead(cursor, record, /* writers_gone */ true) ==
+         logger::ByteRingBuffer::ReadResult::OK) {
+    entries::EntryParser::parse(record.data(), record.size(), visitor);
+  }
+  return visitor.count() > 0;
+}
+
 void processMemoryMappingsFile(
     Logger& logger,
     const char* file_path,
@@ -195,7 +269,8 @@ int64_t MmapBufferTraceWriter::nativeInitAndVerify(
     return 0;
   }
 
-  if (mapBufferPrefix->header.bufferVersion != RingBuffer::kVersion) {
+  if (mapBufferPrefix->header.bufferVersion != RingBuffer::kVersion &&
+      mapBufferPrefix->header.bufferVersion != RingBuffer::kByteRingVersion) {
     return 0;
   }
 
@@ -260,12 +335,33 @@ void MmapBufferTraceWriter::writeTrace(
   // entries.
   constexpr auto kExtraRecordCount = 4096;
 
-  std::shared_ptr<mmapbuf::Buffer> buffer =
-      std::make_shared<mmapbuf::Buffer>(entriesCount + kExtraRecordCount);
-  auto& ringBuffer = buffer->ringBuffer();
-  TraceBuffer::Cursor startCursor = ringBuffer.currentHead();
+  // The trace is rebuilt in a buffer of the same kind.
+  auto backend =
+      mapBufferPrefix->header.bufferVersion == RingBuffer::kByteRingVersion
+      ? mmapbuf::Buffer::Backend::BYTE_RING
+      : mmapbuf::Buffer::Backend::PACKETS;
+  // BLOB_REFERENCE entries are copied as they are, along with the whole blob
+  // arena they point into.
+  size_t blobArenaSize = mapBufferPrefix->header.blobArenaSize;
+  std::shared_ptr<mmapbuf::Buffer> buffer = std::make_shared<mmapbuf::Buffer>(
+      entriesCount + kExtraRecordCount,
+      1,
+      mmapbuf::Buffer::WriteMode::GUARANTEED,
+      backend,
+      blobArenaSize);
+  TraceBuffer::Cursor startCursor = buffer->currentHeads().front();
   Logger::EntryIDCounter newBufferEntryID{1};
-  Logger logger([&]() -> TraceBuffer& { return ringBuffer; }, newBufferEntryID);
+  std::unique_ptr<Logger> newBufferLogger;
+  if (backend == mmapbuf::Buffer::Backend::BYTE_RING) {
+    newBufferLogger =
+        std::make_unique<Logger>(buffer->byteRing(), newBufferEntryID);
+  } else {
+    auto& ringBuffer = buffer->ringBuffer();
+    newBufferLogger = std::make_unique<Logger>(
+        [&ringBuffer]() -> TraceBuffer& { return ringBuffer; },
+        newBufferEntryID);
+  }
+  Logger& logger = *newBufferLogger;
 
   // It's not technically backwards trace but that's what we use to denote Black
   // Box traces.
@@ -274,12 +370,64 @@ void MmapBufferTraceWriter::writeTrace(
 
   {
     // Copying entries from the saved buffer to the new one.
-    TraceBuffer* historicBuffer = reinterpret_cast<TraceBuffer*>(
-        reinterpret_cast<char*>(bufferMapHolder_->map_ptr) +
-        sizeof(MmapBufferPrefix));
-    bool ok = copyBufferEntries(*historicBuffer, ringBuffer);
-    if (!ok) {
-      throw std::runtime_error("Unable to read the file-backed buffer.");
+    char* shardsStart = reinterpret_cast<char*>(bufferMapHolder_->map_ptr) +
+        sizeof(MmapBufferPrefix);
+    if (blobArenaSize != 0) {
+      size_t shardCount = backend == mmapbuf::Buffer::Backend::BYTE_RING
+          ? 1
+          : std::max<size_t>(mapBufferPrefix->header.shardCount, 1);
+      if (entriesCount < shardCount ||
+          mmapbuf::Buffer::calculateByteSize(
+              entriesCount, shardCount, backend, blobArenaSize) >
+              bufferMapHolder_->size) {
+        throw std::runtime_error("Buffer file is too small for its blobs.");
+      }
+      // Only the trace writer reads the copy, the logger below doesn't write
+      // blobs.
+      std::memcpy(
+          buffer->blobArena(),
+          shardsStart +
+              mmapbuf::Buffer::blobArenaOffset(
+                  entriesCount, shardCount, backend),
+          logger::ByteRingBuffer::calculateAllocationSize(blobArenaSize));
+    }
+    if (backend == mmapbuf::Buffer::Backend::BYTE_RING) {
+      auto source = reinterpret_cast<logger::ByteRingBuffer*>(shardsStart);
+      if (mmapbuf::Buffer::calculateByteSize(entriesCount, 1, backend) >
+              bufferMapHolder_->size ||
+          source->capacity() !=
+              mmapbuf::Buffer::byteRingCapacity(entriesCount)) {
+        throw std::runtime_error("Buffer file is too small for its byte ring.");
+      }
+      if (!copyByteRingEntries(*source, logger)) {
+        throw std::runtime_error("Unable to read the file-backed buffer.");
+      }
+    } else {
+      size_t shardCount =
+          std::max<size_t>(mapBufferPrefix->header.shardCount, 1);
+      if (entriesCount < shardCount ||
+          mmapbuf::Buffer::calculateByteSize(entriesCount, shardCount) >
+              bufferMapHolder_->size) {
+        throw std::runtime_error("Buffer file is too small for its shards.");
+      }
+      size_t shardEntryCount = entriesCount / shardCount;
+
+      bool ok;
+      if (shardCount == 1) {
+        ok = copyBufferEntries(
+            *reinterpret_cast<TraceBuffer*>(shardsStart), buffer->ringBuffer());
+      } else {
+        std::vector<TraceBuffer*> shards;
+        for (size_t idx = 0; idx < shardCount; ++idx) {
+          shards.push_back(reinterpret_cast<TraceBuffer*>(
+              shardsStart +
+              mmapbuf::Buffer::shardOffset(shardEntryCount, idx)));
+        }
+        ok = copyShardedBufferEntries(shards, logger);
+      }
+      if (!ok) {
+        throw std::runtime_error("Unable to read the file-backed buffer.");
+      }
     }
   }
 
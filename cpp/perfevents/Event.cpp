@@ -20,8 +20,12 @@
 namespace facebook {
 namespace perfevents {
 
-static perf_event_attr
-createEventAttr(EventType type, int32_t tid, int32_t cpu, bool inherit) {
+static perf_event_attr createEventAttr(
+    EventType type,
+    int32_t tid,
+    int32_t cpu,
+    bool inherit,
+    const StackSampling& stacks) {
   perf_event_attr attr{};
   attr.size = sizeof(struct perf_event_attr);
 
@@ -79,6 +83,24 @@ createEventAttr(EventType type, int32_t tid, int32_t cpu, bool inherit) {
 
   attr.disabled = 1;
 
+  if (stacks.enabled()) {
+    if (type != EventType::EVENT_TYPE_TASK_CLOCK &&
+        type != EventType::EVENT_TYPE_CPU_CLOCK) {
+      throw std::invalid_argument("Only clock events can sample stacks");
+    }
+    // Clock events count nanoseconds.
+    attr.freq = 0;
+    attr.sample_period = stacks.periodNs;
+    attr.sample_type = kStackSampleType;
+    attr.sample_regs_user = stacks.userRegs;
+    attr.sample_stack_user = stacks.userStackBytes;
+    // Only user-space stacks are of interest, and sampling the kernel
+    // needs privileges an app doesn't have.
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.exclude_callchain_kernel = 1;
+  }
+
   if (inherit) {
     attr.inherit = 1;
   }
@@ -94,7 +116,12 @@ static int perf_event_open(
   return syscall(__NR_perf_event_open, attr, pid, cpu, group_fd, flags);
 }
 
-Event::Event(EventType type, int32_t tid, int32_t cpu, bool inherit)
+Event::Event(
+    EventType type,
+    int32_t tid,
+    int32_t cpu,
+    bool inherit,
+    const StackSampling& stacks)
     : type_(type),
       tid_(tid),
       cpu_(cpu),
@@ -102,7 +129,7 @@ Event::Event(EventType type, int32_t tid, int32_t cpu, bool inherit)
       buffer_(nullptr),
       buffer_size_(0),
       id_(0),
-      event_attr_(createEventAttr(type, tid, cpu, inherit)) {}
+      event_attr_(createEventAttr(type, tid, cpu, inherit, stacks)) {}
 
 Event::Event()
     : type_(EVENT_TYPE_NONE),
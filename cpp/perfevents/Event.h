@@ -42,6 +42,12 @@ constexpr uint64_t kSampleType = PERF_SAMPLE_TID | PERF_SAMPLE_TIME |
     PERF_SAMPLE_ADDR | PERF_SAMPLE_ID | PERF_SAMPLE_STREAM_ID |
     PERF_SAMPLE_CPU | PERF_SAMPLE_READ;
 
+// Stack sampling events add the user-space call chain, registers and a copy
+// of the top of the stack. These come after every field of kSampleType, so
+// RecordSample finds those at the same offsets.
+constexpr uint64_t kStackSampleType = kSampleType | PERF_SAMPLE_CALLCHAIN |
+    PERF_SAMPLE_REGS_USER | PERF_SAMPLE_STACK_USER;
+
 // If you change this, you need to change the struct that Event::open() uses
 constexpr uint64_t kReadFormat = PERF_FORMAT_TOTAL_TIME_ENABLED |
     PERF_FORMAT_TOTAL_TIME_RUNNING |
@@ -57,12 +63,33 @@ enum EventType {
   EVENT_TYPE_CPU_CLOCK = 6,
 };
 
+//
+// Turns a clock event into a sampler of user-space stacks, with
+// kStackSampleType. Events that share a buffer must agree on it, so a
+// session either samples stacks with all of its events or with none.
+//
+struct StackSampling {
+  // In nanoseconds of the clock, 0 to not sample stacks.
+  uint64_t periodNs;
+  // Mask of the architecture's PERF_REG_* to record.
+  uint64_t userRegs;
+  // Bytes of stack to copy from the stack pointer up, a multiple of 8. The
+  // whole sample must fit in 64KB.
+  uint32_t userStackBytes;
+
+  inline bool enabled() const {
+    return periodNs != 0;
+  }
+};
+
 // This is what users of this library use.
 struct EventSpec {
   static const int32_t kAllThreads = 0xFFFFFFFF;
 
   EventType type;
   int32_t tid;
+  // Optional, only for EVENT_TYPE_TASK_CLOCK and EVENT_TYPE_CPU_CLOCK.
+  StackSampling stacks;
 
   inline bool isProcessWide() const {
     return tid == kAllThreads;
@@ -71,7 +98,12 @@ struct EventSpec {
 
 class Event {
  public:
-  explicit Event(EventType type, int32_t tid, int32_t cpu, bool inherit = true);
+  explicit Event(
+      EventType type,
+      int32_t tid,
+      int32_t cpu,
+      bool inherit = true,
+      const StackSampling& stacks = StackSampling{});
   Event();
   Event(Event const& evt) = delete;
   Event(Event&& evt);
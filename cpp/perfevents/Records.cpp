@@ -41,7 +41,25 @@ bool RecordMmap::isAnonymous() const {
 }
 
 RecordSample::RecordSample(void* data, size_t len)
-    : data_((uint8_t*)data), len_(len) {}
+    : data_((uint8_t*)data),
+      len_(len),
+      sample_type_(kSampleType),
+      user_regs_(0) {}
+
+RecordSample::RecordSample(
+    void* data,
+    size_t len,
+    uint64_t sampleType,
+    uint64_t userRegs)
+    : data_((uint8_t*)data),
+      len_(len),
+      sample_type_(sampleType),
+      user_regs_(userRegs) {
+  if ((sampleType & ~kStackSampleType) != 0 ||
+      (sampleType & kSampleType) != kSampleType) {
+    throw std::invalid_argument("Unsupported sample_type");
+  }
+}
 
 uint64_t RecordSample::ip() const {
   return *(reinterpret_cast<uint64_t*>(data_ + offsetForField(PERF_SAMPLE_IP)));
@@ -91,10 +109,60 @@ uint64_t RecordSample::timeEnabled() const {
       data_ + offsetForField(PERF_FORMAT_TOTAL_TIME_ENABLED)));
 }
 
+const uint64_t* RecordSample::callchain(uint64_t& size) const {
+  size_t offset = offsetForVariableField(PERF_SAMPLE_CALLCHAIN);
+  uint64_t nr;
+  if (!readAt(offset, nr) ||
+      nr > (len_ - offset) / sizeof(uint64_t) - 1 /* nr */) {
+    return nullptr;
+  }
+  size = nr;
+  return reinterpret_cast<uint64_t*>(data_ + offset + sizeof(uint64_t));
+}
+
+const uint64_t* RecordSample::userRegs() const {
+  size_t offset = offsetForVariableField(PERF_SAMPLE_REGS_USER);
+  uint64_t abi;
+  if (!readAt(offset, abi) || abi == PERF_SAMPLE_REGS_ABI_NONE) {
+    return nullptr;
+  }
+  offset += sizeof(uint64_t);
+  size_t count = __builtin_popcountll(user_regs_);
+  if (count > (len_ - offset) / sizeof(uint64_t)) {
+    return nullptr;
+  }
+  return reinterpret_cast<uint64_t*>(data_ + offset);
+}
+
+const uint8_t* RecordSample::userStack(uint64_t& size) const {
+  // u64 size; char data[size]; u64 dyn_size, the part that was copied.
+  size_t offset = offsetForVariableField(PERF_SAMPLE_STACK_USER);
+  uint64_t copy_size;
+  if (!readAt(offset, copy_size) || copy_size == 0) {
+    return nullptr;
+  }
+  offset += sizeof(uint64_t);
+  uint64_t dyn_size;
+  if (copy_size > len_ - offset || !readAt(offset + copy_size, dyn_size) ||
+      dyn_size == 0 || dyn_size > copy_size) {
+    return nullptr;
+  }
+  size = dyn_size;
+  return data_ + offset;
+}
+
 size_t RecordSample::size() const {
   return len_;
 }
 
+bool RecordSample::readAt(size_t offset, uint64_t& value) const {
+  if (offset >= len_ || len_ - offset < sizeof(uint64_t)) {
+    return false;
+  }
+  std::memcpy(&value, data_ + offset, sizeof(value));
+  return true;
+}
+
 namespace {
 // Offset calculation routines for arbitrary sample_type and read_format
 // values. Used to generate constexpr constants for the sample_type and
@@ -261,5 +329,47 @@ size_t RecordSample::offsetForField(uint64_t field) const {
   throw std::invalid_argument("Requested field not in kSampleType");
 }
 
+size_t RecordSample::offsetForVariableField(uint64_t field) const {
+  // Every field of kSampleType comes first, see kStackSampleType.
+  static constexpr uint64_t kVariableOffset =
+      genericOffsetForField(kSampleType, kReadFormat, 0 /* none */);
+
+  if ((sample_type_ & field) == 0) {
+    return len_;
+  }
+  size_t offset = kVariableOffset;
+
+  if ((sample_type_ & PERF_SAMPLE_CALLCHAIN) != 0) {
+    if (field == PERF_SAMPLE_CALLCHAIN) {
+      return offset;
+    }
+    uint64_t nr;
+    if (!readAt(offset, nr) || nr > len_ / sizeof(uint64_t)) {
+      return len_;
+    }
+    offset += (1 + nr) * sizeof(uint64_t); // u64 nr, ips[nr]
+  }
+
+  if ((sample_type_ & PERF_SAMPLE_REGS_USER) != 0) {
+    if (field == PERF_SAMPLE_REGS_USER) {
+      return offset;
+    }
+    uint64_t abi;
+    if (!readAt(offset, abi)) {
+      return len_;
+    }
+    offset += sizeof(uint64_t); // u64 abi, regs[weight(mask)] unless none
+    if (abi != PERF_SAMPLE_REGS_ABI_NONE) {
+      offset += __builtin_popcountll(user_regs_) * sizeof(uint64_t);
+    }
+  }
+
+  if ((sample_type_ & PERF_SAMPLE_STACK_USER) != 0 &&
+      field == PERF_SAMPLE_STACK_USER) {
+    return offset;
+  }
+  return len_;
+}
+
 } // namespace perfevents
 } // namespace facebook
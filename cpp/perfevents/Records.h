@@ -52,6 +52,9 @@ class RecordSample {
   // Memory management is left to the caller, this class
   // is just a facade and will perform no copies.
   RecordSample(void* data, size_t len);
+  // A sample of an event with another sample_type, which may only add the
+  // fields of kStackSampleType, see Event::attr().
+  RecordSample(void* data, size_t len, uint64_t sampleType, uint64_t userRegs);
 
   // This object does not own any data and a copy may outlive
   // the pointed-to buffer.
@@ -68,14 +71,31 @@ class RecordSample {
   uint64_t timeRunning() const;
   uint64_t timeEnabled() const;
 
+  // The following are null when the sample_type doesn't have them, or the
+  // sample is truncated.
+
+  // PERF_SAMPLE_CALLCHAIN: `size` instruction pointers, innermost first,
+  // with PERF_CONTEXT_* markers in between.
+  const uint64_t* callchain(uint64_t& size) const;
+  // PERF_SAMPLE_REGS_USER: one value per bit of the userRegs mask, lowest
+  // bit first. Also null if the sampled thread had no user-space state.
+  const uint64_t* userRegs() const;
+  // PERF_SAMPLE_STACK_USER: `size` bytes of stack from the stack pointer.
+  const uint8_t* userStack(uint64_t& size) const;
+
   // Debugging:
   size_t size() const;
 
  private:
   uint8_t* data_;
   size_t len_;
+  uint64_t sample_type_;
+  uint64_t user_regs_;
 
   size_t offsetForField(uint64_t field) const;
+  // For the fields after the kSampleType ones, len_ if there's none.
+  size_t offsetForVariableField(uint64_t field) const;
+  bool readAt(size_t offset, uint64_t& value) const;
 };
 
 //
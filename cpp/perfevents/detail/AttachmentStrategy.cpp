@@ -194,12 +194,14 @@ EventList PerCoreAttachmentStrategy::eventsForDelta(
       if (spec.isProcessWide()) {
         for (auto& tid : delta) {
           // per thread we know about too
-          events.emplace_back(spec.type, tid, cpu, true /*inherit*/);
+          events.emplace_back(
+              spec.type, tid, cpu, true /*inherit*/, spec.stacks);
         }
       } else {
         // We're targeting a specific thread but we still
         // need one event per core.
-        events.emplace_back(spec.type, spec.tid, cpu, false /*inherit*/);
+        events.emplace_back(
+            spec.type, spec.tid, cpu, false /*inherit*/, spec.stacks);
       }
     }
   }
@@ -26,6 +26,7 @@ size_t parseEvent(
     void* data,
     size_t offset,
     const Event& bufferEvent,
+    const perf_event_attr& bufferAttr,
     IdEventMap& idEventMap,
     RecordListener* listener);
 void notifyMmap(void* data, RecordListener* listener);
@@ -35,6 +36,7 @@ void notifyLost(void* data, RecordListener* listener);
 void notifySample(
     void* data,
     size_t size,
+    const perf_event_attr& bufferAttr,
     const IdEventMap& idEventMap,
     RecordListener* listener);
 
@@ -64,12 +66,15 @@ void parseBuffer(
   size_t last_read = header->data_tail;
 
   size_t buffer_data_size = bufferEvent.bufferSize() - PAGE_SIZE;
+  // Every event writing to this buffer has the same sample layout.
+  auto buffer_attr = bufferEvent.attr();
 
   while (last_read < header->data_head) {
     // data_head and data_tail (last_read) are not restricted to within the
     // buffer boundaries. Wrap explicitly to find the offset within the buffer.
     size_t offset = (last_read % buffer_data_size);
-    last_read += parseEvent(data, offset, bufferEvent, idEventMap, listener);
+    last_read += parseEvent(
+        data, offset, bufferEvent, buffer_attr, idEventMap, listener);
   }
   header->data_tail = last_read;
 }
@@ -78,6 +83,7 @@ size_t parseEvent(
     void* data,
     size_t offset,
     const Event& bufferEvent,
+    const perf_event_attr& bufferAttr,
     IdEventMap& idEventMap,
     RecordListener* listener) {
   size_t buffer_data_size = bufferEvent.bufferSize() - PAGE_SIZE;
@@ -90,19 +96,18 @@ size_t parseEvent(
 
   perf_event_header* evt_header = (perf_event_header*)((uint8_t*)data + offset);
   uint8_t* data_bytes = ((uint8_t*)evt_header) + sizeof(perf_event_header);
+  size_t data_size = evt_header->size - sizeof(perf_event_header);
 
   // Note: evt_header->size includes the size of the header itself
   if (offset + evt_header->size > buffer_data_size) {
     // Split read, copy to buffer and present a contiguous view to the
     // listeners/etc.
-    split_buffer = std::make_unique<uint8_t[]>(evt_header->size);
+    split_buffer = std::make_unique<uint8_t[]>(data_size);
     size_t bytes_to_end =
         buffer_data_size - (offset + sizeof(perf_event_header));
     std::memcpy(split_buffer.get(), data_bytes, bytes_to_end);
     std::memcpy(
-        split_buffer.get() + bytes_to_end,
-        data,
-        evt_header->size - bytes_to_end);
+        split_buffer.get() + bytes_to_end, data, data_size - bytes_to_end);
 
     data_bytes = split_buffer.get();
   }
@@ -110,7 +115,7 @@ size_t parseEvent(
   int type = evt_header->type;
   switch (type) {
     case PERF_RECORD_SAMPLE: {
-      notifySample(data_bytes, evt_header->size, idEventMap, listener);
+      notifySample(data_bytes, data_size, bufferAttr, idEventMap, listener);
       break;
     }
     case PERF_RECORD_MMAP:
@@ -141,12 +146,14 @@ size_t parseEvent(
 void notifySample(
     void* data,
     size_t size,
+    const perf_event_attr& bufferAttr,
     const IdEventMap& idEventMap,
     RecordListener* listener) {
   if (listener == nullptr) {
     return;
   }
-  RecordSample rec(data, size);
+  RecordSample rec(
+      data, size, bufferAttr.sample_type, bufferAttr.sample_regs_user);
 
   // Need groupLeaderId() because inheritance may give us id()s which we never
   // set up explicitly. We're
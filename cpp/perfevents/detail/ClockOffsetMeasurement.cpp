@@ -16,10 +16,12 @@
 
 #include <profilo/perfevents/Session.h>
 #include <profilo/perfevents/detail/ClockOffsetMeasurement.h>
+#include <profilo/util/common.h>
 
 #include <stdint.h>
 #include <atomic>
 #include <condition_variable>
+#include <functional>
 #include <mutex>
 #include <thread>
 
@@ -49,9 +51,13 @@ struct ClockOffsetListener : public RecordListener {
 
   std::atomic<int64_t>& fault_time_;
 };
-} // namespace
 
-int64_t measureOffsetFromPerfClock(clockid_t clockid) {
+//
+// Reads a clock into `out` in nanoseconds, returns false on error.
+//
+using ClockReader = std::function<bool(int64_t& out)>;
+
+int64_t measureOffset(const ClockReader& readClock) {
   // The idea here is to
   // 1) start a session looking for minor faults from a target thread *only*
   // 2) capture the clockid_t timestamp before
@@ -106,16 +112,15 @@ int64_t measureOffsetFromPerfClock(clockid_t clockid) {
       return;
     }
 
-    struct timespec before {
-    }, after{};
-    if (clock_gettime(clockid, &before)) {
+    int64_t beforeTs, afterTs;
+    if (!readClock(beforeTs)) {
       return;
     }
 
     // incur actual fault
     *reinterpret_cast<uint32_t*>(area) = 0xfaceb00c;
 
-    if (clock_gettime(clockid, &after)) {
+    if (!readClock(afterTs)) {
       return;
     }
 
@@ -123,11 +128,6 @@ int64_t measureOffsetFromPerfClock(clockid_t clockid) {
       return;
     }
 
-    int64_t beforeTs =
-        static_cast<int64_t>(before.tv_sec) * 1000000000 + before.tv_nsec;
-    int64_t afterTs =
-        static_cast<int64_t>(after.tv_sec) * 1000000000 + after.tv_nsec;
-
     faultClockTime = beforeTs + (afterTs - beforeTs) / 2;
   });
 
@@ -196,6 +196,26 @@ int64_t measureOffsetFromPerfClock(clockid_t clockid) {
   return faultClockTime.load() - faultKernelTime.load();
 }
 
+} // namespace
+
+int64_t measureOffsetFromPerfClock(clockid_t clockid) {
+  return measureOffset([clockid](int64_t& out) {
+    struct timespec ts {};
+    if (clock_gettime(clockid, &ts)) {
+      return false;
+    }
+    out = static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    return true;
+  });
+}
+
+int64_t measureOffsetFromPerfClock() {
+  return measureOffset([](int64_t& out) {
+    out = profilo::monotonicTime();
+    return true;
+  });
+}
+
 } // namespace clock
 } // namespace detail
 } // namespace perfevents
@@ -27,6 +27,10 @@ namespace clock {
 // events clock. Returns INT64_MIN on error.
 int64_t measureOffsetFromPerfClock(clockid_t clockid);
 
+// Measures the offset between monotonicTime(), whichever clock source it is
+// using, and the perf events clock. Returns INT64_MIN on error.
+int64_t measureOffsetFromPerfClock();
+
 } // namespace clock
 } // namespace detail
 } // namespace perfevents
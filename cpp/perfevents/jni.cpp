@@ -191,7 +191,7 @@ static jlong nativeAttach(
     throw std::invalid_argument("Max iterations must fit in uint16_t");
   }
 
-  auto clockOffset = detail::clock::measureOffsetFromPerfClock(CLOCK_MONOTONIC);
+  auto clockOffset = detail::clock::measureOffsetFromPerfClock();
   if (clockOffset == INT64_MIN) {
     return 0;
   }
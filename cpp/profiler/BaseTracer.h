@@ -68,6 +68,28 @@ class BaseTracer {
       int tid,
       int64_t time_) = 0;
 
+  //
+  // Tracers that only capture the stack in collectStack() and unwind it
+  // later, away from the signal handler, return true. collectStack() then
+  // leaves whatever identifies the capture in `frames`, and the logger
+  // thread passes it to unwindDeferred() to get the actual frames.
+  //
+  virtual bool defersUnwinding() const {
+    return false;
+  }
+
+  //
+  // Replaces the `depth` values collectStack() left in `frames` with the
+  // unwound stack, returning the sample's retcode. A `max_depth` of 0 means
+  // the sample is dropped, only to release the capture.
+  //
+  virtual StackCollectionRetcode unwindDeferred(
+      int64_t* /* frames */,
+      uint16_t& /* depth */,
+      uint16_t /* max_depth */) {
+    return StackCollectionRetcode::SUCCESS;
+  }
+
   virtual void startTracing() = 0;
 
   virtual void stopTracing() = 0;
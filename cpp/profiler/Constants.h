@@ -23,11 +23,7 @@
 #define MAX_STACK_DEPTH 512
 
 /**
- * The maximum number of frames to track stack traces
+ * How often the logger thread drains the sample queues to the Profilo buffer,
+ * unless one of them fills up sooner
  */
-#define MAX_STACKS_COUNT 24
-
-/**
- * Number of full stacks upon which should flush stacks to the Profilo buffer
- */
-#define FLUSH_STACKS_COUNT 4
+#define SAMPLE_DRAIN_INTERVAL_MS 20
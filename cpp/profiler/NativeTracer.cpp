@@ -0,0 +1,248 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NativeTracer.h"
+
+#include <errno.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+
+namespace facebook {
+namespace profilo {
+namespace profiler {
+
+struct NativeTracer::Capture {
+  UnwindRegisters regs;
+  size_t size;
+  uint8_t stack[kStackCopySize];
+};
+
+namespace {
+
+// process_vm_readv() stops at the first iovec it can't read whole, so the
+// stack is read in pieces no larger than the smallest page.
+constexpr size_t kCopyChunkSize = 4096;
+
+size_t roundUpToPowerOfTwo(size_t value) {
+  size_t result = 1;
+  while (result < value) {
+    result <<= 1;
+  }
+  return result;
+}
+
+} // namespace
+
+NativeTracer::IndexQueue::IndexQueue(size_t capacity)
+    : mask_(roundUpToPowerOfTwo(capacity) - 1),
+      cells_(new Cell[mask_ + 1]),
+      enqueue_pos_(0),
+      dequeue_pos_(0) {
+  for (size_t idx = 0; idx <= mask_; ++idx) {
+    cells_[idx].sequence.store(idx, std::memory_order_relaxed);
+  }
+}
+
+bool NativeTracer::IndexQueue::push(uint32_t index) {
+  Cell* cell;
+  size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+  while (true) {
+    cell = &cells_[pos & mask_];
+    size_t sequence = cell->sequence.load(std::memory_order_acquire);
+    auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+    if (diff == 0) {
+      if (enqueue_pos_.compare_exchange_weak(
+              pos, pos + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+  cell->index = index;
+  cell->sequence.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+bool NativeTracer::IndexQueue::pop(uint32_t& index) {
+  Cell* cell;
+  size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+  while (true) {
+    cell = &cells_[pos & mask_];
+    size_t sequence = cell->sequence.load(std::memory_order_acquire);
+    auto diff =
+        static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+    if (diff == 0) {
+      if (dequeue_pos_.compare_exchange_weak(
+              pos, pos + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = dequeue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+  index = cell->index;
+  cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+  return true;
+}
+
+NativeTracer::NativeTracer(
+    MultiBufferLogger& /* logger */,
+    bool /* unwind_dex_frames */,
+    size_t unwind_queue_size,
+    bool log_partial_stacks)
+    : log_partial_stacks_(log_partial_stacks),
+      capture_count_(std::min(
+          std::max(unwind_queue_size, size_t{1}),
+          kMaxUnwindQueueSize)),
+      captures_(new Capture[capture_count_]),
+      free_(capture_count_),
+      tracing_(false),
+      unwinder_() {
+  for (uint32_t idx = 0; idx < capture_count_; ++idx) {
+    free_.push(idx);
+  }
+}
+
+NativeTracer::~NativeTracer() {
+  stopTracing();
+}
+
+size_t NativeTracer::copyStack(uintptr_t sp, uint8_t* dest) {
+  constexpr size_t kMaxChunks = kStackCopySize / kCopyChunkSize + 1;
+  iovec local{dest, kStackCopySize};
+  iovec remote[kMaxChunks];
+  size_t chunks = 0;
+  for (uintptr_t address = sp, end = sp + kStackCopySize; address < end;) {
+    uintptr_t chunk_end =
+        std::min(end, (address + kCopyChunkSize) & ~(kCopyChunkSize - 1));
+    remote[chunks++] =
+        iovec{reinterpret_cast<void*>(address), chunk_end - address};
+    address = chunk_end;
+  }
+
+  int saved_errno = errno;
+  auto copied = syscall(
+      SYS_process_vm_readv, getpid(), &local, 1, remote, chunks, 0);
+  size_t result = copied > 0 ? static_cast<size_t>(copied) : 0;
+  if (copied < 0 && (errno == ENOSYS || errno == EPERM)) {
+    // The page sp is in is always there.
+    result = remote[0].iov_len;
+    std::memcpy(dest, reinterpret_cast<void*>(sp), result);
+  }
+  errno = saved_errno;
+  return result;
+}
+
+StackCollectionRetcode NativeTracer::collectStack(
+    ucontext_t* ucontext,
+    int64_t* frames,
+    uint16_t& depth,
+    uint16_t max_depth) {
+  depth = 0;
+  if (!tracing_.load(std::memory_order_acquire)) {
+    return StackCollectionRetcode::TRACER_DISABLED;
+  }
+  if (max_depth == 0) {
+    return StackCollectionRetcode::STACK_OVERFLOW;
+  }
+
+  uint32_t index;
+  if (!free_.pop(index)) {
+    return StackCollectionRetcode::UNWINDER_QUEUE_OVERFLOW;
+  }
+  auto& capture = captures_[index];
+  if (!UnwindRegisters::fromContext(*ucontext, capture.regs) ||
+      (capture.size = copyStack(
+           capture.regs.values[UnwindRegisters::kSP], capture.stack)) == 0) {
+    free_.push(index);
+    return StackCollectionRetcode::STACK_COPY_FAILED;
+  }
+
+  frames[0] = index;
+  depth = 1;
+  return StackCollectionRetcode::SUCCESS;
+}
+
+StackCollectionRetcode NativeTracer::unwindDeferred(
+    int64_t* frames,
+    uint16_t& depth,
+    uint16_t max_depth) {
+  if (depth != 1 || frames[0] < 0 ||
+      static_cast<size_t>(frames[0]) >= capture_count_) {
+    depth = 0;
+    return StackCollectionRetcode::STACK_COPY_FAILED;
+  }
+  auto index = static_cast<uint32_t>(frames[0]);
+  auto& capture = captures_[index];
+  depth = 0;
+  auto result = NativeUnwinder::Result::PARTIAL;
+  if (max_depth > 0) {
+    StackSnapshot snapshot{
+        capture.regs,
+        capture.regs.values[UnwindRegisters::kSP],
+        capture.size,
+        capture.stack};
+    result = unwinder_.unwind(snapshot, frames, depth, max_depth);
+  }
+  free_.push(index);
+
+  if (result == NativeUnwinder::Result::PARTIAL) {
+    if (!log_partial_stacks_) {
+      depth = 0;
+    }
+    return StackCollectionRetcode::PARTIAL_STACK;
+  }
+  return StackCollectionRetcode::SUCCESS;
+}
+
+void NativeTracer::flushStack(
+    MultiBufferLogger& logger,
+    int64_t* frames,
+    uint16_t depth,
+    int tid,
+    int64_t time_) {
+  logger.write(FramesEntry{
+      .id = 0,
+      .type = EntryType::NATIVE_STACK_FRAME,
+      .timestamp = time_,
+      .tid = tid,
+      .matchid = 0,
+      .frames = {.values = const_cast<int64_t*>(frames), .size = depth}});
+}
+
+void NativeTracer::startTracing() {
+  tracing_.store(true, std::memory_order_release);
+}
+
+void NativeTracer::stopTracing() {
+  // Samples already taken keep their captures until the logger thread
+  // flushes them, or the next startProfiling() drops them.
+  tracing_.store(false, std::memory_order_release);
+}
+
+void NativeTracer::prepare() {}
+
+} // namespace profiler
+} // namespace profilo
+} // namespace facebook
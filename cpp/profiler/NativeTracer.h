@@ -0,0 +1,122 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <profiler/BaseTracer.h>
+#include <profiler/NativeUnwinder.h>
+
+#include <atomic>
+#include <memory>
+
+namespace facebook {
+namespace profilo {
+namespace profiler {
+
+//
+// Samples native stacks. The signal handler only copies the registers and
+// the top of the stack, and leaves the index of the copy as the sample's
+// only frame. SamplingProfiler's logger thread unwinds it when it flushes
+// the sample, see unwindDeferred().
+//
+// Samples wait for the logger thread in a pool of unwind_queue_size stack
+// copies, a sample that finds none free is dropped as a queue overflow.
+// Java frames aren't symbolized, unwind_dex_frames is not supported.
+// Unwinding runs on the logger thread, at its priority.
+//
+class NativeTracer : public BaseTracer {
+ public:
+  // Bytes of stack copied for every sample, above the stack pointer.
+  static constexpr size_t kStackCopySize = 16 * 1024;
+  static constexpr size_t kMaxUnwindQueueSize = 512;
+
+  NativeTracer(
+      MultiBufferLogger& logger,
+      bool unwind_dex_frames,
+      size_t unwind_queue_size,
+      bool log_partial_stacks);
+  ~NativeTracer() override;
+
+  StackCollectionRetcode collectStack(
+      ucontext_t* ucontext,
+      int64_t* frames,
+      uint16_t& depth,
+      uint16_t max_depth) override;
+
+  bool defersUnwinding() const override {
+    return true;
+  }
+
+  StackCollectionRetcode unwindDeferred(
+      int64_t* frames,
+      uint16_t& depth,
+      uint16_t max_depth) override;
+
+  void flushStack(
+      MultiBufferLogger& logger,
+      int64_t* frames,
+      uint16_t depth,
+      int tid,
+      int64_t time_) override;
+
+  void startTracing() override;
+
+  void stopTracing() override;
+
+  void prepare() override;
+
+ private:
+  struct Capture;
+
+  //
+  // Bounded lock-free queue of capture indices, safe to use from signal
+  // handlers. Holds at most the number of captures.
+  //
+  class IndexQueue {
+   public:
+    explicit IndexQueue(size_t capacity);
+
+    bool push(uint32_t index);
+    bool pop(uint32_t& index);
+
+   private:
+    struct Cell {
+      std::atomic<size_t> sequence;
+      uint32_t index;
+    };
+
+    const size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+    std::atomic<size_t> enqueue_pos_;
+    std::atomic<size_t> dequeue_pos_;
+  };
+
+  // Copies the stack at `sp` into the capture, returns the bytes copied.
+  static size_t copyStack(uintptr_t sp, uint8_t* dest);
+
+  const bool log_partial_stacks_;
+  const size_t capture_count_;
+  std::unique_ptr<Capture[]> captures_;
+  IndexQueue free_;
+
+  std::atomic<bool> tracing_;
+  // Only used by the logger thread, keeps its caches between traces.
+  NativeUnwinder unwinder_;
+};
+
+} // namespace profiler
+} // namespace profilo
+} // namespace facebook
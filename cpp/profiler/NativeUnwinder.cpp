@@ -0,0 +1,903 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NativeUnwinder.h"
+
+#include <link.h>
+#include <algorithm>
+#include <cstring>
+
+namespace facebook {
+namespace profilo {
+namespace profiler {
+
+namespace {
+
+constexpr auto kRefreshInterval = std::chrono::milliseconds(100);
+// Bounds the memory taken by the rows cached for a module.
+constexpr size_t kMaxCachedRows = 1024;
+// Nesting allowed for DW_CFA_remember_state.
+constexpr size_t kMaxRememberedStates = 8;
+
+// DW_EH_PE_* pointer encodings.
+enum : uint8_t {
+  kPeAbsptr = 0x00,
+  kPeUleb128 = 0x01,
+  kPeUdata2 = 0x02,
+  kPeUdata4 = 0x03,
+  kPeUdata8 = 0x04,
+  kPeSleb128 = 0x09,
+  kPeSdata2 = 0x0a,
+  kPeSdata4 = 0x0b,
+  kPeSdata8 = 0x0c,
+  kPePcrel = 0x10,
+  kPeDatarel = 0x30,
+  kPeOmit = 0xff,
+};
+
+// Reads the CFI data of a module, which is mapped in our own address space.
+class Reader {
+ public:
+  Reader(const uint8_t* pos, const uint8_t* end, uintptr_t data_base = 0)
+      : pos_(pos), end_(end), data_base_(data_base), ok_(true) {}
+
+  bool ok() const {
+    return ok_;
+  }
+
+  bool atEnd() const {
+    return !ok_ || pos_ >= end_;
+  }
+
+  const uint8_t* pos() const {
+    return pos_;
+  }
+
+  const uint8_t* end() const {
+    return end_;
+  }
+
+  template <typename T>
+  T fixed() {
+    T value{};
+    if (ok_ && static_cast<size_t>(end_ - pos_) >= sizeof(T)) {
+      std::memcpy(&value, pos_, sizeof(T));
+      pos_ += sizeof(T);
+    } else {
+      ok_ = false;
+    }
+    return value;
+  }
+
+  uint64_t uleb() {
+    uint64_t value = 0;
+    for (unsigned shift = 0; ok_; shift += 7) {
+      auto byte = fixed<uint8_t>();
+      if (shift < 64) {
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      }
+      if ((byte & 0x80) == 0) {
+        break;
+      }
+    }
+    return value;
+  }
+
+  int64_t sleb() {
+    uint64_t value = 0;
+    unsigned shift = 0;
+    uint8_t byte = 0;
+    do {
+      byte = fixed<uint8_t>();
+      if (shift < 64) {
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      }
+      shift += 7;
+    } while (ok_ && (byte & 0x80) != 0);
+    if (shift < 64 && (byte & 0x40) != 0) {
+      value |= ~uint64_t{0} << shift;
+    }
+    return static_cast<int64_t>(value);
+  }
+
+  void skip(uint64_t size) {
+    if (ok_ && static_cast<uint64_t>(end_ - pos_) >= size) {
+      pos_ += size;
+    } else {
+      ok_ = false;
+    }
+  }
+
+  // Indirect pointers are returned as the address they're read from, we
+  // never need the value of one.
+  uintptr_t pointer(uint8_t encoding) {
+    if (encoding == kPeOmit) {
+      return 0;
+    }
+    auto field = reinterpret_cast<uintptr_t>(pos_);
+    uintptr_t value = 0;
+    switch (encoding & 0x0f) {
+      case kPeAbsptr:
+        value = fixed<uintptr_t>();
+        break;
+      case kPeUleb128:
+        value = uleb();
+        break;
+      case kPeUdata2:
+        value = fixed<uint16_t>();
+        break;
+      case kPeUdata4:
+        value = fixed<uint32_t>();
+        break;
+      case kPeUdata8:
+        value = fixed<uint64_t>();
+        break;
+      case kPeSleb128:
+        value = sleb();
+        break;
+      case kPeSdata2:
+        value = static_cast<uintptr_t>(fixed<int16_t>());
+        break;
+      case kPeSdata4:
+        value = static_cast<uintptr_t>(fixed<int32_t>());
+        break;
+      case kPeSdata8:
+        value = static_cast<uintptr_t>(fixed<int64_t>());
+        break;
+      default:
+        ok_ = false;
+        return 0;
+    }
+    switch (encoding & 0x70) {
+      case 0:
+        break;
+      case kPePcrel:
+        value += field;
+        break;
+      case kPeDatarel:
+        value += data_base_;
+        break;
+      default:
+        ok_ = false;
+    }
+    return value;
+  }
+
+  // Starts a CIE or FDE: reads its length and limits reading to it.
+  bool enterRecord() {
+    uint64_t length = fixed<uint32_t>();
+    if (length == 0xffffffff) {
+      length = fixed<uint64_t>();
+    }
+    if (!ok_ || length == 0) {
+      return false;
+    }
+    end_ = pos_ + length;
+    return true;
+  }
+
+ private:
+  const uint8_t* pos_;
+  const uint8_t* end_;
+  uintptr_t data_base_;
+  bool ok_;
+};
+
+// Records are parsed within this many bytes, the real end comes from their
+// length.
+constexpr size_t kMaxRecordReach = 1 << 24;
+
+struct Cie {
+  uint64_t code_align;
+  int64_t data_align;
+  uint64_t return_register;
+  uint8_t fde_encoding;
+  bool has_augmentation_data;
+  const uint8_t* instructions;
+  const uint8_t* end;
+};
+
+bool parseCie(const uint8_t* address, Cie& cie) {
+  Reader reader(address, address + kMaxRecordReach);
+  if (!reader.enterRecord() || reader.fixed<uint32_t>() != 0) {
+    return false;
+  }
+  auto version = reader.fixed<uint8_t>();
+  if (version != 1 && version != 3 && version != 4) {
+    return false;
+  }
+  auto augmentation = reinterpret_cast<const char*>(reader.pos());
+  size_t augmentation_length = strnlen(augmentation, 16);
+  reader.skip(augmentation_length + 1);
+  if (std::strstr(augmentation, "eh") != nullptr) {
+    reader.skip(sizeof(uintptr_t));
+  }
+  if (version == 4) {
+    reader.skip(2); // address and segment selector sizes
+  }
+  cie.code_align = reader.uleb();
+  cie.data_align = reader.sleb();
+  cie.return_register =
+      version == 1 ? reader.fixed<uint8_t>() : reader.uleb();
+  cie.fde_encoding = kPeAbsptr;
+  cie.has_augmentation_data = augmentation[0] == 'z';
+
+  if (cie.has_augmentation_data) {
+    auto size = reader.uleb();
+    auto data_end = reader.pos() + size;
+    for (size_t idx = 1; idx < augmentation_length; ++idx) {
+      switch (augmentation[idx]) {
+        case 'L':
+          reader.fixed<uint8_t>();
+          break;
+        case 'P':
+          reader.pointer(reader.fixed<uint8_t>());
+          break;
+        case 'R':
+          cie.fde_encoding = reader.fixed<uint8_t>();
+          break;
+        default:
+          // 'S', 'B' and the like have no data.
+          break;
+      }
+    }
+    reader.skip(data_end - reader.pos());
+  }
+  cie.instructions = reader.pos();
+  cie.end = reader.end();
+  return reader.ok();
+}
+
+} // namespace
+
+struct RegisterRule {
+  enum Kind : uint8_t {
+    SAME,
+    UNDEFINED,
+    // Saved at CFA + value.
+    OFFSET,
+    // Is CFA + value.
+    VAL_OFFSET,
+    // Saved in register `value`.
+    REGISTER,
+    // An expression, which isn't evaluated.
+    UNSUPPORTED,
+  };
+
+  int32_t value;
+  Kind kind;
+};
+
+struct NativeUnwinder::Row {
+  uint32_t cfa_register;
+  int64_t cfa_offset;
+  bool cfa_valid;
+  uint32_t return_register;
+  RegisterRule rules[UnwindRegisters::kCount];
+};
+
+struct NativeUnwinder::Module {
+  // Where the module's code is.
+  uintptr_t start;
+  uintptr_t end;
+  const uint8_t* eh_frame_hdr;
+  // Sorted (initial location, FDE) pairs, relative to eh_frame_hdr.
+  const int32_t* table;
+  size_t fde_count;
+  std::unordered_map<uintptr_t, Row> rows;
+};
+
+namespace {
+
+void setRule(
+    NativeUnwinder::Row& row,
+    uint64_t reg,
+    RegisterRule::Kind kind,
+    int64_t value = 0) {
+  if (reg < UnwindRegisters::kCount) {
+    row.rules[reg] = RegisterRule{static_cast<int32_t>(value), kind};
+  }
+}
+
+//
+// Runs CFA instructions, starting at `location`, until the row for
+// `target` is complete. `initial` is the row the CIE instructions set up,
+// for DW_CFA_restore.
+//
+bool execute(
+    const uint8_t* begin,
+    const uint8_t* end,
+    const Cie& cie,
+    uintptr_t location,
+    uintptr_t target,
+    const NativeUnwinder::Row& initial,
+    NativeUnwinder::Row& row) {
+  NativeUnwinder::Row remembered[kMaxRememberedStates];
+  size_t remembered_count = 0;
+  Reader reader(begin, end);
+
+  auto advance = [&](uint64_t delta) {
+    location += delta * cie.code_align;
+    return location <= target;
+  };
+  auto restore = [&](uint64_t reg) {
+    if (reg < UnwindRegisters::kCount) {
+      row.rules[reg] = initial.rules[reg];
+    }
+  };
+
+  while (!reader.atEnd()) {
+    auto op = reader.fixed<uint8_t>();
+    uint8_t operand = op & 0x3f;
+    switch (op & 0xc0) {
+      case 0x40: // DW_CFA_advance_loc
+        if (!advance(operand)) {
+          return true;
+        }
+        continue;
+      case 0x80: // DW_CFA_offset
+        setRule(
+            row,
+            operand,
+            RegisterRule::OFFSET,
+            static_cast<int64_t>(reader.uleb()) * cie.data_align);
+        continue;
+      case 0xc0: // DW_CFA_restore
+        restore(operand);
+        continue;
+      default:
+        break;
+    }
+
+    switch (op) {
+      case 0x00: // DW_CFA_nop
+        break;
+      case 0x01: // DW_CFA_set_loc
+        location = reader.pointer(cie.fde_encoding);
+        if (location > target) {
+          return true;
+        }
+        break;
+      case 0x02: // DW_CFA_advance_loc1
+        if (!advance(reader.fixed<uint8_t>())) {
+          return true;
+        }
+        break;
+      case 0x03: // DW_CFA_advance_loc2
+        if (!advance(reader.fixed<uint16_t>())) {
+          return true;
+        }
+        break;
+      case 0x04: // DW_CFA_advance_loc4
+        if (!advance(reader.fixed<uint32_t>())) {
+          return true;
+        }
+        break;
+      case 0x05: { // DW_CFA_offset_extended
+        auto reg = reader.uleb();
+        setRule(
+            row,
+            reg,
+            RegisterRule::OFFSET,
+            static_cast<int64_t>(reader.uleb()) * cie.data_align);
+        break;
+      }
+      case 0x06: // DW_CFA_restore_extended
+        restore(reader.uleb());
+        break;
+      case 0x07: // DW_CFA_undefined
+        setRule(row, reader.uleb(), RegisterRule::UNDEFINED);
+        break;
+      case 0x08: // DW_CFA_same_value
+        setRule(row, reader.uleb(), RegisterRule::SAME);
+        break;
+      case 0x09: { // DW_CFA_register
+        auto reg = reader.uleb();
+        setRule(row, reg, RegisterRule::REGISTER, reader.uleb());
+        break;
+      }
+      case 0x0a: // DW_CFA_remember_state
+        if (remembered_count == kMaxRememberedStates) {
+          return false;
+        }
+        remembered[remembered_count++] = row;
+        break;
+      case 0x0b: // DW_CFA_restore_state
+        if (remembered_count == 0) {
+          return false;
+        }
+        row = remembered[--remembered_count];
+        break;
+      case 0x0c: // DW_CFA_def_cfa
+        row.cfa_register = reader.uleb();
+        row.cfa_offset = reader.uleb();
+        row.cfa_valid = true;
+        break;
+      case 0x0d: // DW_CFA_def_cfa_register
+        row.cfa_register = reader.uleb();
+        break;
+      case 0x0e: // DW_CFA_def_cfa_offset
+        row.cfa_offset = reader.uleb();
+        break;
+      case 0x0f: // DW_CFA_def_cfa_expression
+        reader.skip(reader.uleb());
+        row.cfa_valid = false;
+        break;
+      case 0x10: // DW_CFA_expression
+      case 0x16: { // DW_CFA_val_expression
+        auto reg = reader.uleb();
+        reader.skip(reader.uleb());
+        setRule(row, reg, RegisterRule::UNSUPPORTED);
+        break;
+      }
+      case 0x11: { // DW_CFA_offset_extended_sf
+        auto reg = reader.uleb();
+        setRule(
+            row, reg, RegisterRule::OFFSET, reader.sleb() * cie.data_align);
+        break;
+      }
+      case 0x12: // DW_CFA_def_cfa_sf
+        row.cfa_register = reader.uleb();
+        row.cfa_offset = reader.sleb() * cie.data_align;
+        row.cfa_valid = true;
+        break;
+      case 0x13: // DW_CFA_def_cfa_offset_sf
+        row.cfa_offset = reader.sleb() * cie.data_align;
+        break;
+      case 0x14: { // DW_CFA_val_offset
+        auto reg = reader.uleb();
+        setRule(
+            row,
+            reg,
+            RegisterRule::VAL_OFFSET,
+            static_cast<int64_t>(reader.uleb()) * cie.data_align);
+        break;
+      }
+      case 0x15: { // DW_CFA_val_offset_sf
+        auto reg = reader.uleb();
+        setRule(
+            row,
+            reg,
+            RegisterRule::VAL_OFFSET,
+            reader.sleb() * cie.data_align);
+        break;
+      }
+      case 0x2d: // DW_CFA_GNU_window_save, DW_CFA_AARCH64_negate_ra_state
+        // Signed return addresses are stripped when they're read.
+        break;
+      case 0x2e: // DW_CFA_GNU_args_size
+        reader.uleb();
+        break;
+      case 0x2f: { // DW_CFA_GNU_negative_offset_extended
+        auto reg = reader.uleb();
+        setRule(
+            row,
+            reg,
+            RegisterRule::OFFSET,
+            -static_cast<int64_t>(reader.uleb()) * cie.data_align);
+        break;
+      }
+      default:
+        return false;
+    }
+  }
+  return reader.ok();
+}
+
+uintptr_t stripPointerAuthentication(uintptr_t address) {
+#if defined(__aarch64__)
+  // Return addresses signed with PAC carry the signature in the high bits.
+  return address & ((uintptr_t{1} << 48) - 1);
+#else
+  return address;
+#endif
+}
+
+} // namespace
+
+bool UnwindRegisters::fromContext(
+    const ucontext_t& context,
+    UnwindRegisters& regs) {
+#if defined(__aarch64__)
+  auto& mcontext = context.uc_mcontext;
+  for (size_t reg = 0; reg < 31; ++reg) {
+    regs.values[reg] = mcontext.regs[reg];
+  }
+  regs.values[kSP] = mcontext.sp;
+  regs.pc = mcontext.pc;
+  return true;
+#elif defined(__x86_64__)
+  auto gregs = context.uc_mcontext.gregs;
+  static constexpr int kDwarfToGreg[] = {
+      REG_RAX,
+      REG_RDX,
+      REG_RCX,
+      REG_RBX,
+      REG_RSI,
+      REG_RDI,
+      REG_RBP,
+      REG_RSP,
+      REG_R8,
+      REG_R9,
+      REG_R10,
+      REG_R11,
+      REG_R12,
+      REG_R13,
+      REG_R14,
+      REG_R15,
+  };
+  for (size_t reg = 0; reg < sizeof(kDwarfToGreg) / sizeof(int); ++reg) {
+    regs.values[reg] = gregs[kDwarfToGreg[reg]];
+  }
+  // The return address column, which isn't a register.
+  regs.values[16] = 0;
+  regs.pc = gregs[REG_RIP];
+  return true;
+#else
+  (void)context;
+  (void)regs;
+  return false;
+#endif
+}
+
+uint64_t UnwindRegisters::perfRegsMask() {
+#if defined(__aarch64__)
+  // x0-x30, sp, pc
+  return (1ull << 33) - 1;
+#elif defined(__x86_64__)
+  // ax, bx, cx, dx, si, di, bp, sp, ip, then r8-r15 from bit 16
+  return 0x1ffull | (0xffull << 16);
+#else
+  return 0;
+#endif
+}
+
+bool UnwindRegisters::fromPerfRegs(
+    const uint64_t* values,
+    UnwindRegisters& regs) {
+#if defined(__aarch64__)
+  for (size_t reg = 0; reg < kCount; ++reg) {
+    regs.values[reg] = values[reg];
+  }
+  regs.pc = values[32];
+  return true;
+#elif defined(__x86_64__)
+  // The perf order of the registers before ip, as DWARF numbers.
+  static constexpr size_t kPerfToDwarf[] = {0, 3, 2, 1, 4, 5, 6, 7};
+  for (size_t idx = 0; idx < sizeof(kPerfToDwarf) / sizeof(size_t); ++idx) {
+    regs.values[kPerfToDwarf[idx]] = values[idx];
+  }
+  regs.pc = values[8];
+  for (size_t reg = 8; reg < 16; ++reg) {
+    regs.values[reg] = values[reg + 1];
+  }
+  regs.values[16] = 0;
+  return true;
+#else
+  (void)values;
+  (void)regs;
+  return false;
+#endif
+}
+
+bool StackSnapshot::read(uintptr_t address, uintptr_t& value) const {
+  if (address < base || address - base > size ||
+      size - (address - base) < sizeof(value)) {
+    return false;
+  }
+  std::memcpy(&value, data + (address - base), sizeof(value));
+  return true;
+}
+
+NativeUnwinder::NativeUnwinder() : modules_(), last_refresh_() {}
+
+NativeUnwinder::~NativeUnwinder() = default;
+
+void NativeUnwinder::refreshModules() {
+  last_refresh_ = std::chrono::steady_clock::now();
+
+  std::vector<std::unique_ptr<Module>> found;
+  dl_iterate_phdr(
+      [](dl_phdr_info* info, size_t, void* data) {
+        auto module = std::make_unique<Module>();
+        module->start = UINTPTR_MAX;
+        module->end = 0;
+        module->eh_frame_hdr = nullptr;
+        module->table = nullptr;
+        module->fde_count = 0;
+        for (size_t idx = 0; idx < info->dlpi_phnum; ++idx) {
+          auto& header = info->dlpi_phdr[idx];
+          auto address = info->dlpi_addr + header.p_vaddr;
+          if (header.p_type == PT_LOAD && (header.p_flags & PF_X) != 0) {
+            module->start = std::min<uintptr_t>(module->start, address);
+            module->end =
+                std::max<uintptr_t>(module->end, address + header.p_memsz);
+          } else if (header.p_type == PT_GNU_EH_FRAME) {
+            module->eh_frame_hdr = reinterpret_cast<const uint8_t*>(address);
+          }
+        }
+        if (module->start < module->end) {
+          static_cast<std::vector<std::unique_ptr<Module>>*>(data)->push_back(
+              std::move(module));
+        }
+        return 0;
+      },
+      &found);
+
+  for (auto& module : found) {
+    // Keeps the rows cached for the modules that are still there.
+    for (auto& known : modules_) {
+      if (known != nullptr && known->start == module->start &&
+          known->end == module->end &&
+          known->eh_frame_hdr == module->eh_frame_hdr) {
+        module = std::move(known);
+        break;
+      }
+    }
+    if (module->eh_frame_hdr == nullptr || module->table != nullptr) {
+      continue;
+    }
+
+    auto hdr = module->eh_frame_hdr;
+    Reader reader(
+        hdr, hdr + kMaxRecordReach, reinterpret_cast<uintptr_t>(hdr));
+    auto version = reader.fixed<uint8_t>();
+    auto eh_frame_ptr_encoding = reader.fixed<uint8_t>();
+    auto fde_count_encoding = reader.fixed<uint8_t>();
+    auto table_encoding = reader.fixed<uint8_t>();
+    reader.pointer(eh_frame_ptr_encoding);
+    auto fde_count = reader.pointer(fde_count_encoding);
+    // Only the encoding every linker uses is supported, the frame pointer
+    // chain is followed through the others.
+    if (reader.ok() && version == 1 &&
+        table_encoding == (kPeDatarel | kPeSdata4)) {
+      module->table = reinterpret_cast<const int32_t*>(reader.pos());
+      module->fde_count = fde_count;
+    }
+  }
+
+  std::sort(
+      found.begin(),
+      found.end(),
+      [](const std::unique_ptr<Module>& a, const std::unique_ptr<Module>& b) {
+        return a->start < b->start;
+      });
+  modules_ = std::move(found);
+}
+
+NativeUnwinder::Module* NativeUnwinder::findModule(uintptr_t pc) {
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    auto it = std::upper_bound(
+        modules_.begin(),
+        modules_.end(),
+        pc,
+        [](uintptr_t value, const std::unique_ptr<Module>& module) {
+          return value < module->start;
+        });
+    if (it != modules_.begin() && pc < (*(it - 1))->end) {
+      return (it - 1)->get();
+    }
+    if (attempt == 0 &&
+        std::chrono::steady_clock::now() - last_refresh_ >= kRefreshInterval) {
+      refreshModules();
+    } else {
+      break;
+    }
+  }
+  return nullptr;
+}
+
+bool NativeUnwinder::findRow(Module& module, uintptr_t pc, Row& row) {
+  if (module.table == nullptr || module.fde_count == 0) {
+    return false;
+  }
+  auto cached = module.rows.find(pc);
+  if (cached != module.rows.end()) {
+    row = cached->second;
+    return true;
+  }
+
+  // The last entry that starts at or before pc.
+  auto hdr = reinterpret_cast<uintptr_t>(module.eh_frame_hdr);
+  size_t low = 0;
+  size_t high = module.fde_count;
+  while (high - low > 1) {
+    size_t middle = low + (high - low) / 2;
+    if (hdr + module.table[2 * middle] <= pc) {
+      low = middle;
+    } else {
+      high = middle;
+    }
+  }
+  if (hdr + module.table[2 * low] > pc) {
+    return false;
+  }
+  auto fde = reinterpret_cast<const uint8_t*>(hdr + module.table[2 * low + 1]);
+
+  Reader reader(fde, fde + kMaxRecordReach);
+  if (!reader.enterRecord()) {
+    return false;
+  }
+  auto cie_pointer = reader.pos();
+  auto cie_offset = reader.fixed<uint32_t>();
+  Cie cie;
+  if (!reader.ok() || cie_offset == 0 || !parseCie(cie_pointer - cie_offset, cie)) {
+    return false;
+  }
+  auto pc_begin = reader.pointer(cie.fde_encoding);
+  auto pc_range = reader.pointer(cie.fde_encoding & 0x0f);
+  if (cie.has_augmentation_data) {
+    reader.skip(reader.uleb());
+  }
+  if (!reader.ok() || pc < pc_begin || pc - pc_begin >= pc_range) {
+    return false;
+  }
+
+  Row initial{};
+  initial.return_register = static_cast<uint32_t>(cie.return_register);
+  for (auto& rule : initial.rules) {
+    rule = RegisterRule{0, RegisterRule::SAME};
+  }
+  initial.cfa_valid = false;
+  Row defaults = initial;
+  if (!execute(
+          cie.instructions,
+          cie.end,
+          cie,
+          pc_begin,
+          UINTPTR_MAX,
+          defaults,
+          initial)) {
+    return false;
+  }
+  row = initial;
+  if (!execute(reader.pos(), reader.end(), cie, pc_begin, pc, initial, row) ||
+      !row.cfa_valid || row.cfa_register >= UnwindRegisters::kCount ||
+      row.return_register >= UnwindRegisters::kCount) {
+    return false;
+  }
+
+  if (module.rows.size() >= kMaxCachedRows) {
+    module.rows.clear();
+  }
+  module.rows.emplace(pc, row);
+  return true;
+}
+
+bool NativeUnwinder::stepWithCfi(
+    const StackSnapshot& snapshot,
+    const Row& row,
+    UnwindRegisters& regs,
+    uintptr_t& return_address,
+    bool& outermost) {
+  outermost = false;
+  if (row.rules[row.return_register].kind == RegisterRule::UNDEFINED) {
+    outermost = true;
+    return true;
+  }
+
+  uintptr_t cfa = regs.values[row.cfa_register] + row.cfa_offset;
+  UnwindRegisters caller = regs;
+  for (size_t reg = 0; reg < UnwindRegisters::kCount; ++reg) {
+    auto& rule = row.rules[reg];
+    switch (rule.kind) {
+      case RegisterRule::SAME:
+        break;
+      case RegisterRule::UNDEFINED:
+        caller.values[reg] = 0;
+        break;
+      case RegisterRule::OFFSET:
+        if (!snapshot.read(cfa + rule.value, caller.values[reg])) {
+          return false;
+        }
+        break;
+      case RegisterRule::VAL_OFFSET:
+        caller.values[reg] = cfa + rule.value;
+        break;
+      case RegisterRule::REGISTER:
+        if (static_cast<size_t>(rule.value) >= UnwindRegisters::kCount) {
+          return false;
+        }
+        caller.values[reg] = regs.values[rule.value];
+        break;
+      case RegisterRule::UNSUPPORTED:
+        if (reg == row.return_register || reg == UnwindRegisters::kFP) {
+          return false;
+        }
+        caller.values[reg] = 0;
+        break;
+    }
+  }
+
+  return_address = caller.values[row.return_register];
+  caller.values[UnwindRegisters::kSP] = cfa;
+  regs = caller;
+  return true;
+}
+
+bool NativeUnwinder::stepWithFramePointer(
+    const StackSnapshot& snapshot,
+    UnwindRegisters& regs,
+    uintptr_t& return_address) {
+  // A frame record is the caller's frame pointer followed by the return
+  // address, and the frame pointer points at it.
+  uintptr_t fp = regs.values[UnwindRegisters::kFP];
+  uintptr_t caller_fp = 0;
+  if (fp % sizeof(uintptr_t) != 0 || !snapshot.read(fp, caller_fp) ||
+      !snapshot.read(fp + sizeof(uintptr_t), return_address)) {
+    return false;
+  }
+  regs.values[UnwindRegisters::kFP] = caller_fp;
+  regs.values[UnwindRegisters::kSP] = fp + 2 * sizeof(uintptr_t);
+  return true;
+}
+
+NativeUnwinder::Result NativeUnwinder::unwind(
+    const StackSnapshot& snapshot,
+    int64_t* frames,
+    uint16_t& depth,
+    uint16_t max_depth) {
+  depth = 0;
+  if (max_depth == 0) {
+    return Result::PARTIAL;
+  }
+  UnwindRegisters regs = snapshot.regs;
+  uintptr_t pc = regs.pc;
+  frames[depth++] = static_cast<int64_t>(pc);
+
+  while (depth < max_depth) {
+    // Return addresses point past the call, which may be the first
+    // instruction of the next function. The interrupted pc doesn't.
+    uintptr_t lookup = depth == 1 ? pc : pc - 1;
+    uintptr_t sp = regs.values[UnwindRegisters::kSP];
+    uintptr_t return_address = 0;
+
+    Row row;
+    auto module = findModule(lookup);
+    if (module != nullptr && findRow(*module, lookup, row)) {
+      bool outermost = false;
+      if (!stepWithCfi(snapshot, row, regs, return_address, outermost)) {
+        return Result::PARTIAL;
+      }
+      if (outermost) {
+        return Result::COMPLETE;
+      }
+    } else if (!stepWithFramePointer(snapshot, regs, return_address)) {
+      // The outermost frame record is all zeroes.
+      return regs.values[UnwindRegisters::kFP] == 0 ? Result::COMPLETE
+                                                    : Result::PARTIAL;
+    }
+
+    return_address = stripPointerAuthentication(return_address);
+    if (return_address == 0) {
+      return Result::COMPLETE;
+    }
+    // Stacks grow down, a caller's frame must be above its callee's. Only
+    // the interrupted function may be a leaf that didn't make one.
+    auto caller_sp = regs.values[UnwindRegisters::kSP];
+    if (caller_sp < sp || (caller_sp == sp && depth > 1)) {
+      return Result::PARTIAL;
+    }
+    pc = return_address;
+    regs.pc = pc;
+    frames[depth++] = static_cast<int64_t>(pc);
+  }
+  return Result::PARTIAL;
+}
+
+} // namespace profiler
+} // namespace profilo
+} // namespace facebook
@@ -0,0 +1,144 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <ucontext.h>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace facebook {
+namespace profilo {
+namespace profiler {
+
+#if defined(__x86_64__) || defined(__aarch64__)
+#define PROFILO_NATIVE_UNWINDER_SUPPORTED 1
+#else
+#define PROFILO_NATIVE_UNWINDER_SUPPORTED 0
+#endif
+
+//
+// Registers of an interrupted thread, indexed by their DWARF numbers. Only
+// the ones CFI can restore from the stack are kept: the stack and frame
+// pointers, the return address and the callee-saved registers.
+//
+struct UnwindRegisters {
+#if defined(__aarch64__)
+  // x0-x30, sp
+  static constexpr size_t kCount = 32;
+  static constexpr size_t kFP = 29;
+  static constexpr size_t kSP = 31;
+#else
+  // rax, rdx, rcx, rbx, rsi, rdi, rbp, rsp, r8-r15, return address
+  static constexpr size_t kCount = 17;
+  static constexpr size_t kFP = 6;
+  static constexpr size_t kSP = 7;
+#endif
+
+  uintptr_t pc;
+  uintptr_t values[kCount];
+
+  // Whether the target has registers we know how to read from a ucontext.
+  static bool fromContext(const ucontext_t& context, UnwindRegisters& regs);
+
+  // The PERF_REG_* fromPerfRegs() reads, 0 if the target has none.
+  static uint64_t perfRegsMask();
+  // Same, from a perf sample's user registers taken with perfRegsMask().
+  static bool fromPerfRegs(const uint64_t* values, UnwindRegisters& regs);
+};
+
+//
+// A copy of the top of a thread's stack, taken in the profiling signal
+// handler so it can be unwound later, on another thread.
+//
+struct StackSnapshot {
+  UnwindRegisters regs;
+  // Where data[0] was on the thread's stack, the stack pointer.
+  uintptr_t base;
+  size_t size;
+  const uint8_t* data;
+
+  // Reads the word at `address` of the original stack, if it was copied.
+  bool read(uintptr_t address, uintptr_t& value) const;
+};
+
+//
+// Turns stack snapshots into return addresses. Frames with .eh_frame CFI
+// are unwound with it, the others by following the frame pointer chain.
+//
+// Unwind info is located through the .eh_frame_hdr search table of each
+// loaded module. The list of modules is taken with dl_iterate_phdr() and
+// taken again when a frame isn't in any of them, and the rules decoded for
+// a pc are cached per module. Not thread-safe, meant for one unwind thread.
+//
+class NativeUnwinder {
+ public:
+  enum class Result {
+    // Walked all the way to the thread's outermost frame.
+    COMPLETE,
+    // Stopped early: the stack copy ran out, or a frame couldn't be
+    // unwound. The frames found so far are still valid.
+    PARTIAL,
+  };
+
+  NativeUnwinder();
+  ~NativeUnwinder();
+
+  NativeUnwinder(const NativeUnwinder&) = delete;
+  NativeUnwinder& operator=(const NativeUnwinder&) = delete;
+
+  //
+  // Writes the interrupted pc followed by the return address of every
+  // frame to `frames`, at most `max_depth` of them.
+  //
+  Result unwind(
+      const StackSnapshot& snapshot,
+      int64_t* frames,
+      uint16_t& depth,
+      uint16_t max_depth);
+
+  // Defined along with the CFI parsing.
+  struct Module;
+  struct Row;
+
+ private:
+  // The module with code at `pc`, looking for new ones once per interval.
+  Module* findModule(uintptr_t pc);
+  void refreshModules();
+
+  bool findRow(Module& module, uintptr_t pc, Row& row);
+  bool stepWithCfi(
+      const StackSnapshot& snapshot,
+      const Row& row,
+      UnwindRegisters& regs,
+      uintptr_t& return_address,
+      bool& outermost);
+  bool stepWithFramePointer(
+      const StackSnapshot& snapshot,
+      UnwindRegisters& regs,
+      uintptr_t& return_address);
+
+  std::vector<std::unique_ptr<Module>> modules_;
+  std::chrono::steady_clock::time_point last_refresh_;
+};
+
+} // namespace profiler
+} // namespace profilo
+} // namespace facebook
@@ -0,0 +1,290 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PerfSampler.h"
+
+#include <unistd.h>
+#include <stdexcept>
+
+#include <fb/log.h>
+#include <profilo/perfevents/detail/ClockOffsetMeasurement.h>
+
+#include <profiler/BaseTracer.h>
+#include <profiler/Constants.h>
+#include <profiler/NativeUnwinder.h>
+#include <profiler/Retcode.h>
+#include <profiler/StackTable.h>
+#include <util/common.h>
+
+namespace facebook {
+namespace profilo {
+namespace profiler {
+
+using namespace perfevents;
+
+namespace {
+
+// How many times to go over /proc/self/task for threads started while
+// attaching, see PerCoreAttachmentStrategy.
+constexpr uint16_t kMaxAttachIterations = 4;
+// Of RLIMIT_NOFILE, there's an event per core and thread.
+constexpr float kMaxAttachedFdsRatio = 0.5f;
+
+} // namespace
+
+class PerfSampler::Listener : public RecordListener {
+ public:
+  Listener(
+      MultiBufferLogger& logger,
+      int64_t clock_offset,
+      SampleCallback onSample)
+      : reset_stack_table_(false),
+        logger_(logger),
+        pid_(static_cast<uint32_t>(getpid())),
+        clock_offset_(clock_offset),
+        on_sample_(std::move(onSample)),
+        unwinder_(),
+        stack_table_() {}
+
+  void onMmap(const RecordMmap& /* record */) override {}
+
+  void onSample(const EventType /* type */, const RecordSample& record)
+      override {
+    if (record.pid() != pid_) {
+      // A child process the events were inherited by.
+      return;
+    }
+    auto tid = static_cast<int32_t>(record.tid());
+    auto time = static_cast<int64_t>(record.time()) + clock_offset_;
+    if (on_sample_) {
+      on_sample_(tid);
+    }
+
+    uint16_t depth = 0;
+    auto retcode = collectStack(record, depth);
+    if (retcode == StackCollectionRetcode::SUCCESS) {
+      logStack(tid, time, depth);
+      return;
+    }
+
+    logger_.write(StandardEntry{
+        .type = EntryType::CPU_STACK_SAMPLE,
+        .timestamp = time,
+        .tid = tid,
+    });
+    StackCollectionEntryConverter::logRetcode(
+        logger_, retcode, tid, time, tracers::NATIVE);
+    if (retcode == StackCollectionRetcode::PARTIAL_STACK) {
+      // The frames found are still valid.
+      logger_.write(FramesEntry{
+          .id = 0,
+          .type = EntryType::NATIVE_STACK_FRAME,
+          .timestamp = time,
+          .tid = tid,
+          .matchid = 0,
+          .frames = {.values = frames_, .size = depth}});
+    }
+  }
+
+  void onForkEnter(const RecordForkExit& /* record */) override {}
+
+  void onForkExit(const RecordForkExit& /* record */) override {}
+
+  void onLost(const RecordLost& record) override {
+    logger_.write(StandardEntry{
+        .id = 0,
+        .type = EntryType::PERFEVENTS_LOST,
+        .timestamp = monotonicTime(),
+        .tid = threadID(),
+        .callid = 0,
+        .matchid = 0,
+        .extra = (int64_t)record.lost,
+    });
+  }
+
+  void onReaderStop() override {}
+
+  std::atomic_bool reset_stack_table_;
+
+ private:
+  StackCollectionRetcode collectStack(
+      const RecordSample& record,
+      uint16_t& depth) {
+    depth = 0;
+    UnwindRegisters regs;
+    uint64_t stack_size = 0;
+    auto values = record.userRegs();
+    auto stack = record.userStack(stack_size);
+    if (values != nullptr && stack != nullptr &&
+        UnwindRegisters::fromPerfRegs(values, regs)) {
+      StackSnapshot snapshot{
+          regs, regs.values[UnwindRegisters::kSP], stack_size, stack};
+      if (unwinder_.unwind(snapshot, frames_, depth, MAX_STACK_DEPTH) ==
+          NativeUnwinder::Result::COMPLETE) {
+        return StackCollectionRetcode::SUCCESS;
+      }
+    }
+
+    // The kernel follows the frame pointers, past the end of the copy too.
+    uint64_t chain_size = 0;
+    auto chain = record.callchain(chain_size);
+    uint16_t chain_depth = 0;
+    for (uint64_t idx = 0; chain != nullptr && idx < chain_size &&
+         chain_depth < MAX_STACK_DEPTH;
+         ++idx) {
+      if (chain[idx] < PERF_CONTEXT_MAX) {
+        ++chain_depth;
+      }
+    }
+    if (chain_depth > depth) {
+      depth = 0;
+      for (uint64_t idx = 0; depth < chain_depth; ++idx) {
+        if (chain[idx] < PERF_CONTEXT_MAX) {
+          frames_[depth++] = static_cast<int64_t>(chain[idx]);
+        }
+      }
+      return StackCollectionRetcode::SUCCESS;
+    }
+    return depth == 0 ? StackCollectionRetcode::STACK_COPY_FAILED
+                      : StackCollectionRetcode::PARTIAL_STACK;
+  }
+
+  void logStack(int32_t tid, int64_t time, uint16_t depth) {
+    bool expected_reset = true;
+    if (reset_stack_table_.compare_exchange_strong(expected_reset, false)) {
+      stack_table_.reset();
+    }
+
+    FramesEntry definition{.frames = {.values = frames_, .size = depth}};
+    int32_t stack_id;
+    auto use = stack_table_.use(
+        tracers::NATIVE,
+        frames_,
+        depth,
+        logger_.maxDefinitionAge(FramesEntry::calculateSize(definition)),
+        stack_id);
+    // Repeated stacks only log their id.
+    stack_table_.logged(logger_.write(StandardEntry{
+        .type = EntryType::CPU_STACK_SAMPLE,
+        .timestamp = time,
+        .tid = tid,
+        .matchid = use == StackTable::Use::REFERENCE ? -stack_id : stack_id,
+    }));
+    if (use != StackTable::Use::REFERENCE) {
+      logger_.write(FramesEntry{
+          .id = 0,
+          .type = EntryType::NATIVE_STACK_FRAME,
+          .timestamp = time,
+          .tid = tid,
+          .matchid = 0,
+          .frames = {.values = frames_, .size = depth}});
+    }
+  }
+
+  MultiBufferLogger& logger_;
+  const uint32_t pid_;
+  const int64_t clock_offset_;
+  SampleCallback on_sample_;
+  // Only used by the reader thread.
+  NativeUnwinder unwinder_;
+  StackTable stack_table_;
+  int64_t frames_[MAX_STACK_DEPTH];
+};
+
+PerfSampler::PerfSampler(MultiBufferLogger& logger)
+    : logger_(logger), session_(), listener_(nullptr), reader_() {}
+
+PerfSampler::~PerfSampler() {
+  stop();
+}
+
+bool PerfSampler::start(int sampling_rate_ms, SampleCallback onSample) {
+  if (session_ != nullptr) {
+    throw std::logic_error("PerfSampler already started");
+  }
+  auto regs = UnwindRegisters::perfRegsMask();
+  if (regs == 0) {
+    return false;
+  }
+  auto clock_offset = detail::clock::measureOffsetFromPerfClock();
+  if (clock_offset == INT64_MIN) {
+    return false;
+  }
+
+  EventSpec spec{
+      .type = EVENT_TYPE_CPU_CLOCK,
+      .tid = EventSpec::kAllThreads,
+      .stacks =
+          {
+              .periodNs = static_cast<uint64_t>(sampling_rate_ms) * 1000000,
+              .userRegs = regs,
+              .userStackBytes = kStackCopySize,
+          },
+  };
+  auto listener = new Listener(logger_, clock_offset, std::move(onSample));
+  session_.reset(new Session(
+      {spec},
+      {
+          .fallbacks = FALLBACK_RAISE_RLIMIT,
+          .maxAttachIterations = kMaxAttachIterations,
+          .maxAttachedFdsRatio = kMaxAttachedFdsRatio,
+      },
+      std::unique_ptr<RecordListener>(listener)));
+
+  bool attached;
+  try {
+    attached = session_->attach();
+  } catch (std::exception& ex) {
+    FBLOGW("Could not attach perf sampling events: %s", ex.what());
+    attached = false;
+  }
+  if (!attached) {
+    session_.reset();
+    return false;
+  }
+  listener_ = listener;
+
+  reader_ = std::thread([this] {
+    try {
+      session_->run();
+    } catch (std::exception& ex) {
+      FBLOGE("Perf sampling reader failed: %s", ex.what());
+    }
+  });
+  return true;
+}
+
+void PerfSampler::stop() {
+  if (session_ == nullptr) {
+    return;
+  }
+  // Reads what's left in the buffers before returning.
+  session_->stop();
+  reader_.join();
+  session_->detach();
+  session_.reset();
+  listener_ = nullptr;
+}
+
+void PerfSampler::resetStackTable() {
+  if (listener_ != nullptr) {
+    listener_->reset_stack_table_.store(true);
+  }
+}
+
+} // namespace profiler
+} // namespace profilo
+} // namespace facebook
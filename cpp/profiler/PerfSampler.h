@@ -0,0 +1,83 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+
+#include <logger/MultiBufferLogger.h>
+#include <profilo/perfevents/Session.h>
+
+namespace facebook {
+namespace profilo {
+namespace profiler {
+
+using logger::MultiBufferLogger;
+
+//
+// Samples CPU time with perf events instead of a POSIX timer per thread.
+// A CPU_CLOCK event per core and thread, inherited by the threads they
+// start, has the kernel copy the user registers and the top of the stack of
+// the running thread into a per-core ring buffer. A reader thread unwinds
+// these with NativeUnwinder and logs them as CPU_STACK_SAMPLE entries with
+// the native frames, deduplicated with a StackTable, so native stacks are
+// taken without interrupting the threads.
+//
+// Tracers that need the thread stopped, like the Java ones, are served by
+// the onSample callback, called on the reader thread with the tid of every
+// sample. The kernel's frame pointer call chain stands in for stacks that
+// the CFI unwind can't finish.
+//
+class PerfSampler {
+ public:
+  using SampleCallback = std::function<void(int32_t tid)>;
+
+  // Bytes of stack the kernel copies for every sample.
+  static constexpr uint32_t kStackCopySize = 16 * 1024;
+
+  explicit PerfSampler(MultiBufferLogger& logger);
+  ~PerfSampler();
+
+  PerfSampler(const PerfSampler&) = delete;
+  PerfSampler& operator=(const PerfSampler&) = delete;
+
+  //
+  // Attaches to every thread of the process and starts the reader thread,
+  // false if perf events or stack sampling aren't available. onSample is
+  // optional.
+  //
+  bool start(int sampling_rate_ms, SampleCallback onSample);
+
+  void stop();
+
+  // The next samples define their stacks again, for a new trace.
+  void resetStackTable();
+
+ private:
+  class Listener;
+
+  MultiBufferLogger& logger_;
+  std::unique_ptr<perfevents::Session> session_;
+  Listener* listener_;
+  std::thread reader_;
+};
+
+} // namespace profiler
+} // namespace profilo
+} // namespace facebook
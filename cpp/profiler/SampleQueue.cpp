@@ -0,0 +1,430 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SampleQueue.h"
+
+#include <errno.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+
+namespace facebook {
+namespace profilo {
+namespace profiler {
+
+//
+// The header of a record, padding records only use the span. Followed by
+// the frames and, for Java tracers, the method names and class
+// descriptors, `depth` of each once committed.
+//
+struct SampleQueue::Record {
+  // Bytes to the next record, with kPaddingFlag set for padding.
+  uint32_t span;
+  uint32_t profiler_type;
+  int64_t time;
+  uint16_t retcode;
+  uint16_t depth;
+  uint8_t timer_type;
+  uint8_t has_names;
+};
+
+namespace {
+
+constexpr uint32_t kPaddingFlag = 1u << 31;
+constexpr size_t kWordSize = sizeof(uint64_t);
+
+size_t slotFor(int32_t tid, size_t table_size) {
+  return (static_cast<uint32_t>(tid) * 2654435761u) & (table_size - 1);
+}
+
+bool isAlive(int32_t tid) {
+  return syscall(SYS_tgkill, getpid(), tid, 0) == 0 || errno != ESRCH;
+}
+
+constexpr int32_t kTombstone = -1;
+
+} // namespace
+
+SampleQueue::SampleQueue(int32_t tid)
+    : tid_(tid),
+      reserved_(0),
+      published_(0),
+      read_(0),
+      drain_requested_(false),
+      nesting_(0),
+      nested_(),
+      data_(new uint64_t[kCapacity / kWordSize]) {
+  static_assert(
+      sizeof(Record) % kWordSize == 0, "Records must keep frames aligned");
+  static_assert(
+      kCapacity / 2 >= sizeof(Record) + 3 * MAX_STACK_DEPTH * kWordSize,
+      "The queue must fit two samples of the largest size");
+  for (auto& nested : nested_) {
+    nested.armed.store(false, std::memory_order_relaxed);
+  }
+}
+
+SampleQueue::Record* SampleQueue::at(uint64_t position) const {
+  return reinterpret_cast<Record*>(
+      reinterpret_cast<char*>(data_.get()) + position % kCapacity);
+}
+
+bool SampleQueue::begin(bool with_names, Reservation& reservation) {
+  uint32_t level = nesting_.fetch_add(1);
+  if (level >= kMaxNesting) {
+    nesting_.fetch_sub(1);
+    return false;
+  }
+
+  uint64_t span = sizeof(Record) +
+      (with_names ? 3 : 1) * MAX_STACK_DEPTH * kWordSize;
+  uint64_t head = reserved_.load(std::memory_order_relaxed);
+  uint64_t position;
+  while (true) {
+    // Records don't wrap around, one that doesn't fit before the end of the
+    // ring starts over at its beginning.
+    uint64_t offset = head % kCapacity;
+    position = offset + span > kCapacity ? head + (kCapacity - offset) : head;
+    if (position + span - read_.load(std::memory_order_acquire) > kCapacity) {
+      nesting_.fetch_sub(1);
+      return false;
+    }
+    if (reserved_.compare_exchange_weak(head, position + span)) {
+      break;
+    }
+  }
+  if (position != head) {
+    at(head)->span = static_cast<uint32_t>(position - head) | kPaddingFlag;
+  }
+
+  auto words = reinterpret_cast<uint64_t*>(at(position) + 1);
+  reservation.position = position;
+  reservation.level = level;
+  reservation.frames = reinterpret_cast<int64_t*>(words);
+  if (with_names) {
+    reservation.method_names =
+        reinterpret_cast<char const**>(words + MAX_STACK_DEPTH);
+    reservation.class_descriptors =
+        reinterpret_cast<char const**>(words + 2 * MAX_STACK_DEPTH);
+  } else {
+    reservation.method_names = nullptr;
+    reservation.class_descriptors = nullptr;
+  }
+  return true;
+}
+
+void SampleQueue::arm(const Reservation& reservation) {
+  nested_[reservation.level].armed.store(true, std::memory_order_relaxed);
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+}
+
+bool SampleQueue::commit(
+    const Reservation& reservation,
+    int64_t time,
+    uint32_t profiler_type,
+    ThreadTimer::Type timer_type,
+    uint16_t retcode,
+    uint16_t depth) {
+  bool with_names = reservation.method_names != nullptr;
+  depth = std::min<uint16_t>(depth, MAX_STACK_DEPTH);
+  if (with_names) {
+    auto words = reinterpret_cast<uint64_t*>(reservation.frames);
+    std::memmove(
+        words + depth,
+        reservation.method_names,
+        depth * sizeof(*reservation.method_names));
+    std::memmove(
+        words + 2 * depth,
+        reservation.class_descriptors,
+        depth * sizeof(*reservation.class_descriptors));
+  }
+
+  uint64_t reserved = sizeof(Record) +
+      (with_names ? 3 : 1) * MAX_STACK_DEPTH * kWordSize;
+  uint64_t used = sizeof(Record) + (with_names ? 3 : 1) * depth * kWordSize;
+  uint64_t end = reservation.position + reserved;
+  uint64_t trimmed = reservation.position + used;
+  uint64_t span = reserved;
+  // Gives back what the sample didn't use, unless a nested handler reserved
+  // a record after this one.
+  if (trimmed != end && reserved_.compare_exchange_strong(end, trimmed)) {
+    span = used;
+  }
+
+  auto record = at(reservation.position);
+  record->span = static_cast<uint32_t>(span);
+  record->time = time;
+  record->profiler_type = profiler_type;
+  record->retcode = retcode;
+  record->depth = depth;
+  record->timer_type = static_cast<uint8_t>(timer_type);
+  record->has_names = with_names;
+
+  uint64_t pending = reserved_.load(std::memory_order_relaxed) -
+      read_.load(std::memory_order_relaxed);
+  return pending > kCapacity / 2 &&
+      !drain_requested_.exchange(true, std::memory_order_relaxed);
+}
+
+void SampleQueue::discard(const Reservation& reservation) {
+  uint64_t span = sizeof(Record) +
+      (reservation.method_names != nullptr ? 3 : 1) * MAX_STACK_DEPTH *
+          kWordSize;
+  uint64_t end = reservation.position + span;
+  // The common case, nothing reserved since: the record just goes away.
+  if (!reserved_.compare_exchange_strong(end, reservation.position)) {
+    at(reservation.position)->span = static_cast<uint32_t>(span) | kPaddingFlag;
+  }
+}
+
+void SampleQueue::end(const Reservation& reservation) {
+  nested_[reservation.level].armed.store(false, std::memory_order_relaxed);
+  if (reservation.level == 0) {
+    // Every handler this one interrupted is done, so is every record.
+    // Again if one more interrupts it in the meantime.
+    uint64_t reserved;
+    do {
+      reserved = reserved_.load();
+      published_.store(reserved, std::memory_order_release);
+    } while (reserved_.load() != reserved);
+  }
+  nesting_.fetch_sub(1);
+}
+
+sigjmp_buf* SampleQueue::innermostJumpBuffer() {
+  uint32_t nesting = nesting_.load();
+  if (nesting == 0 || nesting > kMaxNesting) {
+    return nullptr;
+  }
+  auto& nested = nested_[nesting - 1];
+  if (!nested.armed.load(std::memory_order_relaxed)) {
+    return nullptr;
+  }
+  return &nested.jump_buffer;
+}
+
+bool SampleQueue::next(uint64_t& position, uint64_t end, Sample& sample)
+    const {
+  while (position < end) {
+    auto record = at(position);
+    uint32_t span = record->span;
+    position += span & ~kPaddingFlag;
+    if ((span & kPaddingFlag) != 0) {
+      continue;
+    }
+
+    auto words = reinterpret_cast<const uint64_t*>(record + 1);
+    sample.time = record->time;
+    sample.tid = tid();
+    sample.profilerType = record->profiler_type;
+    sample.timerType = static_cast<ThreadTimer::Type>(record->timer_type);
+    sample.retcode = record->retcode;
+    sample.depth = record->depth;
+    sample.frames = reinterpret_cast<const int64_t*>(words);
+    if (record->has_names) {
+      sample.method_names =
+          reinterpret_cast<char const* const*>(words + record->depth);
+      sample.class_descriptors =
+          reinterpret_cast<char const* const*>(words + 2 * record->depth);
+    } else {
+      sample.method_names = nullptr;
+      sample.class_descriptors = nullptr;
+    }
+    return true;
+  }
+  return false;
+}
+
+SampleQueues::SampleQueues() : mutex_(), queues_() {
+  for (auto& entry : table_) {
+    entry.tid.store(0, std::memory_order_relaxed);
+    entry.queue.store(nullptr, std::memory_order_relaxed);
+  }
+  for (auto& spare : spares_) {
+    spare.store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+SampleQueues::~SampleQueues() = default;
+
+SampleQueue* SampleQueues::lookup(int32_t tid) {
+  size_t slot = slotFor(tid, kTableSize);
+  for (size_t probe = 0; probe < kTableSize; ++probe) {
+    auto& entry = table_[(slot + probe) & (kTableSize - 1)];
+    auto current = entry.tid.load(std::memory_order_acquire);
+    if (current == tid) {
+      return entry.queue.load(std::memory_order_acquire);
+    }
+    if (current == 0) {
+      break;
+    }
+  }
+  return nullptr;
+}
+
+SampleQueue* SampleQueues::find(int32_t tid) {
+  // Spares first: a claimed spare is added to the table before it's
+  // replaced, so a thread always finds the queue it claimed.
+  for (auto& spare : spares_) {
+    auto queue = spare.load(std::memory_order_acquire);
+    if (queue != nullptr && queue->tid() == tid) {
+      return queue;
+    }
+  }
+  return lookup(tid);
+}
+
+SampleQueue* SampleQueues::acquire(int32_t tid) {
+  auto queue = find(tid);
+  if (queue != nullptr) {
+    return queue;
+  }
+  for (auto& spare : spares_) {
+    queue = spare.load(std::memory_order_acquire);
+    if (queue != nullptr && queue->claim(tid)) {
+      return queue;
+    }
+  }
+  return nullptr;
+}
+
+SampleQueue* SampleQueues::newQueue(int32_t tid) {
+  queues_.push_back(Owned{std::make_unique<SampleQueue>(tid), false});
+  return queues_.back().queue.get();
+}
+
+bool SampleQueues::insert(int32_t tid, SampleQueue* queue) {
+  size_t slot = slotFor(tid, kTableSize);
+  Entry* free_entry = nullptr;
+  for (size_t probe = 0; probe < kTableSize; ++probe) {
+    auto& entry = table_[(slot + probe) & (kTableSize - 1)];
+    auto current = entry.tid.load(std::memory_order_relaxed);
+    if (current == tid) {
+      entry.queue.store(queue, std::memory_order_release);
+      return true;
+    }
+    if (current == kTombstone && free_entry == nullptr) {
+      free_entry = &entry;
+    } else if (current == 0) {
+      if (free_entry == nullptr) {
+        free_entry = &entry;
+      }
+      break;
+    }
+  }
+  if (free_entry == nullptr) {
+    return false;
+  }
+  // Readers that see the tid also see the queue.
+  free_entry->queue.store(queue, std::memory_order_relaxed);
+  free_entry->tid.store(tid, std::memory_order_release);
+  return true;
+}
+
+void SampleQueues::unlink(int32_t tid, SampleQueue* queue) {
+  size_t slot = slotFor(tid, kTableSize);
+  for (size_t probe = 0; probe < kTableSize; ++probe) {
+    auto& entry = table_[(slot + probe) & (kTableSize - 1)];
+    auto current = entry.tid.load(std::memory_order_relaxed);
+    if (current == tid &&
+        entry.queue.load(std::memory_order_relaxed) == queue) {
+      entry.queue.store(nullptr, std::memory_order_release);
+      entry.tid.store(kTombstone, std::memory_order_release);
+      return;
+    }
+    if (current == 0) {
+      return;
+    }
+  }
+}
+
+void SampleQueues::add(int32_t tid) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (lookup(tid) != nullptr) {
+    return;
+  }
+  for (auto& spare : spares_) {
+    auto queue = spare.load(std::memory_order_relaxed);
+    if (queue != nullptr && queue->tid() == tid) {
+      if (insert(tid, queue)) {
+        spare.store(newQueue(0), std::memory_order_release);
+      }
+      return;
+    }
+  }
+  insert(tid, newQueue(tid));
+}
+
+void SampleQueues::update() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Queues are only retired once their thread can't write to them anymore.
+  // The index loop: replacing a spare adds to queues_.
+  for (size_t idx = 0; idx < queues_.size(); ++idx) {
+    auto queue = queues_[idx].queue.get();
+    auto tid = queue->tid();
+    if (tid == 0 || queues_[idx].retired || isAlive(tid)) {
+      continue;
+    }
+    unlink(tid, queue);
+    for (auto& spare : spares_) {
+      if (spare.load(std::memory_order_relaxed) == queue) {
+        spare.store(newQueue(0), std::memory_order_release);
+      }
+    }
+    queues_[idx].retired = true;
+  }
+
+  for (auto& spare : spares_) {
+    auto queue = spare.load(std::memory_order_relaxed);
+    auto tid = queue != nullptr ? queue->tid() : 0;
+    if (tid == 0) {
+      continue;
+    }
+    // A queue the thread also got another way stays where it is, the
+    // thread doesn't use it anymore.
+    auto known = lookup(tid);
+    if (known == nullptr && !insert(tid, queue)) {
+      continue;
+    }
+    spare.store(newQueue(0), std::memory_order_release);
+  }
+}
+
+void SampleQueues::freeRetired() {
+  queues_.erase(
+      std::remove_if(
+          queues_.begin(),
+          queues_.end(),
+          [](const Owned& owned) { return owned.retired; }),
+      queues_.end());
+}
+
+void SampleQueues::reset() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& entry : table_) {
+    entry.tid.store(0, std::memory_order_relaxed);
+    entry.queue.store(nullptr, std::memory_order_relaxed);
+  }
+  queues_.clear();
+  for (auto& spare : spares_) {
+    spare.store(newQueue(0), std::memory_order_release);
+  }
+}
+
+} // namespace profiler
+} // namespace profilo
+} // namespace facebook
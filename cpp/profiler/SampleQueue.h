@@ -0,0 +1,268 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "ThreadTimer.h"
+
+#include <setjmp.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <profiler/Constants.h>
+
+namespace facebook {
+namespace profilo {
+namespace profiler {
+
+//
+// A sample as the logger thread reads it, pointing into its queue.
+//
+struct Sample {
+  int64_t time;
+  int32_t tid;
+  uint32_t profilerType;
+  ThreadTimer::Type timerType;
+  // A StackCollectionRetcode.
+  uint16_t retcode;
+  uint16_t depth;
+  const int64_t* frames;
+  // Only for Java tracers, null otherwise.
+  char const* const* method_names;
+  char const* const* class_descriptors;
+};
+
+//
+// The samples of one thread, written by its profiling signal handler and
+// read by the logger thread.
+//
+// Samples are variable-length records in a ring. A record is reserved with
+// room for MAX_STACK_DEPTH frames, for the tracer to write to in place, and
+// shrunk to the depth it collected once it's committed. The handler may be
+// interrupted by another one on the same thread, so the ring has a single
+// producer only in the sense that its producers nest: records are reserved
+// with a CAS, and published to the logger thread when the outermost handler
+// is done, which is when every record reserved until then is complete.
+//
+class SampleQueue {
+ public:
+  static constexpr size_t kCapacity = 32 * 1024;
+  // Handlers interrupted by more than this many others drop their sample.
+  static constexpr uint32_t kMaxNesting = 4;
+
+  // A record being written by a signal handler.
+  struct Reservation {
+    uint64_t position;
+    uint32_t level;
+    int64_t* frames;
+    char const** method_names;
+    char const** class_descriptors;
+  };
+
+  explicit SampleQueue(int32_t tid);
+
+  SampleQueue(const SampleQueue&) = delete;
+  SampleQueue& operator=(const SampleQueue&) = delete;
+
+  // The thread writing to the queue, 0 while it's a spare nobody claimed.
+  int32_t tid() const {
+    return tid_.load(std::memory_order_acquire);
+  }
+
+  bool claim(int32_t tid) {
+    int32_t unclaimed = 0;
+    return tid_.compare_exchange_strong(unclaimed, tid);
+  }
+
+  //
+  // Signal handler side. begin() reserves a record, false if the queue is
+  // full or nested too deep. Every successful begin() is followed by
+  // commit() or discard(), then end().
+  //
+  bool begin(bool with_names, Reservation& reservation);
+
+  sigjmp_buf& jumpBuffer(const Reservation& reservation) {
+    return nested_[reservation.level].jump_buffer;
+  }
+
+  // Once the jump buffer is set, faults can jump back to it.
+  void arm(const Reservation& reservation);
+
+  // Publishes the sample, true if the logger thread should drain the queue.
+  bool commit(
+      const Reservation& reservation,
+      int64_t time,
+      uint32_t profiler_type,
+      ThreadTimer::Type timer_type,
+      uint16_t retcode,
+      uint16_t depth);
+
+  void discard(const Reservation& reservation);
+
+  void end(const Reservation& reservation);
+
+  // For the fault handler: the jump buffer of the innermost handler on this
+  // thread that is collecting a stack, null if there's none.
+  sigjmp_buf* innermostJumpBuffer();
+
+  //
+  // Logger thread side. Calls fn for every committed sample, in order, and
+  // frees their records. peek() leaves them in the queue.
+  //
+  template <typename Fn>
+  size_t drain(Fn&& fn) {
+    return read(fn, true);
+  }
+
+  template <typename Fn>
+  size_t peek(Fn&& fn) {
+    return read(fn, false);
+  }
+
+ private:
+  struct Record;
+
+  struct Nested {
+    sigjmp_buf jump_buffer;
+    std::atomic<bool> armed;
+  };
+
+  Record* at(uint64_t position) const;
+
+  // The next sample from `position`, false at `end`.
+  bool next(uint64_t& position, uint64_t end, Sample& sample) const;
+
+  template <typename Fn>
+  size_t read(Fn& fn, bool consume) {
+    uint64_t position = read_.load(std::memory_order_relaxed);
+    uint64_t end = published_.load(std::memory_order_acquire);
+    size_t count = 0;
+    Sample sample{};
+    while (next(position, end, sample)) {
+      fn(static_cast<const Sample&>(sample));
+      ++count;
+    }
+    if (consume) {
+      read_.store(position, std::memory_order_release);
+      drain_requested_.store(false, std::memory_order_relaxed);
+    }
+    return count;
+  }
+
+  std::atomic<int32_t> tid_;
+  // Records before reserved_ were reserved, the ones before published_ are
+  // complete and the ones before read_ were consumed.
+  std::atomic<uint64_t> reserved_;
+  std::atomic<uint64_t> published_;
+  std::atomic<uint64_t> read_;
+  std::atomic<bool> drain_requested_;
+  std::atomic<uint32_t> nesting_;
+  Nested nested_[kMaxNesting];
+  std::unique_ptr<uint64_t[]> data_;
+};
+
+//
+// Finds the queue of the thread a profiling signal interrupted. Threads get
+// a queue when TimerManager discovers them. A thread that is sampled before
+// that claims one of a few spares, which becomes its queue from then on.
+//
+// Lookups and claims are lock-free, for signal handlers. Queues are added
+// and retired by the thread detection thread, or the perf sampler's reader,
+// and freed by the logger thread once drained, which the mutex orders.
+//
+class SampleQueues {
+ public:
+  static constexpr size_t kMaxThreads = 1024;
+  static constexpr size_t kSpares = 4;
+
+  SampleQueues();
+  ~SampleQueues();
+
+  SampleQueues(const SampleQueues&) = delete;
+  SampleQueues& operator=(const SampleQueues&) = delete;
+
+  // The queue of thread `tid`, claiming a spare if it has none. Signal-safe.
+  SampleQueue* acquire(int32_t tid);
+  // Same, without claiming anything. Signal-safe.
+  SampleQueue* find(int32_t tid);
+
+  // Gives the thread a queue ahead of its first sample.
+  void add(int32_t tid);
+  // Retires the queues of dead threads and replaces the claimed spares.
+  void update();
+
+  // Drains every queue, then frees the retired ones.
+  template <typename Fn>
+  size_t drain(Fn&& fn) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t count = 0;
+    for (auto& owned : queues_) {
+      count += owned.queue->drain(fn);
+    }
+    freeRetired();
+    return count;
+  }
+
+  template <typename Fn>
+  size_t peek(Fn&& fn) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t count = 0;
+    for (auto& owned : queues_) {
+      count += owned.queue->peek(fn);
+    }
+    return count;
+  }
+
+  // Drops all the queues and starts over with fresh spares. Only while no
+  // signal handler can use them.
+  void reset();
+
+ private:
+  struct Entry {
+    std::atomic<int32_t> tid;
+    std::atomic<SampleQueue*> queue;
+  };
+
+  static constexpr size_t kTableSize = 2 * kMaxThreads;
+
+  struct Owned {
+    std::unique_ptr<SampleQueue> queue;
+    // Its thread is gone, it's freed once drained.
+    bool retired;
+  };
+
+  SampleQueue* lookup(int32_t tid);
+  // The following need the mutex.
+  SampleQueue* newQueue(int32_t tid);
+  bool insert(int32_t tid, SampleQueue* queue);
+  void unlink(int32_t tid, SampleQueue* queue);
+  void freeRetired();
+
+  Entry table_[kTableSize];
+  std::atomic<SampleQueue*> spares_[kSpares];
+
+  std::mutex mutex_;
+  // Every queue, including the spares.
+  std::vector<Owned> queues_;
+};
+
+} // namespace profiler
+} // namespace profilo
+} // namespace facebook
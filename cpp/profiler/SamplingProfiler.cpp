@@ -17,7 +17,6 @@
 #include "SamplingProfiler.h"
 #include "TimerManager.h"
 
-#include <abort_with_reason.h>
 #include <errno.h>
 #include <pthread.h>
 #include <semaphore.h>
@@ -27,9 +26,11 @@
 #include <sys/types.h>
 #include <sys/utsname.h>
 #include <unistd.h>
+#include <algorithm>
 #include <chrono>
 #include <random>
 #include <string>
+#include <unordered_set>
 
 #include <fb/log.h>
 #include <fbjni/fbjni.h>
@@ -39,6 +40,9 @@
 #include <JavaBaseTracer.h>
 #include <Retcode.h>
 #include <ThreadTimer.h>
+#if HAS_PERF_SAMPLER
+#include <PerfSampler.h>
+#endif
 
 #include <LogEntry.h>
 #include <TraceProviders.h>
@@ -69,69 +73,24 @@ void SamplingProfiler::FaultHandler(
     void* ucontext) {
   ProfileState& state = ((SamplingProfiler*)scope.GetData())->state_;
 
-  uint64_t tid = threadID();
-  uint64_t targetBusyState = (tid << 16) | StackSlotState::BUSY_WITH_METADATA;
+  // Jump back to the innermost stack collection on this thread, this allows
+  // us to handle crashes during nested unwinding from the most inner one out.
+  auto queue = state.sampleQueues.find(threadID());
+  auto jumpBuffer = queue != nullptr ? queue->innermostJumpBuffer() : nullptr;
 
-  // Find the most recent slot occupied by this thread.
-  // This allows us to handle crashes during nested unwinding from
-  // the most inner one out.
-  int64_t max_time = -1;
-  int max_idx = -1;
-
-  for (int i = 0; i < MAX_STACKS_COUNT; i++) {
-    auto& slot = state.stacks[i];
-    if (slot.state.load() == targetBusyState && slot.time > max_time) {
-      max_time = slot.time;
-      max_idx = i;
-    }
-  }
-
-  if (max_idx >= 0) {
+  if (jumpBuffer != nullptr) {
     state.errSigCrashes.fetch_add(1);
-    scope.siglongjmp(state.stacks[max_idx].sig_jmp_buf, 1);
+    scope.siglongjmp(*jumpBuffer, 1);
   } else {
     scope.CallPreviousHandler(signum, siginfo, ucontext);
   }
 }
 
-void SamplingProfiler::maybeSignalReader() {
-  uint32_t prevSlotCounter = state_.fullSlotsCounter.fetch_add(1);
-  if ((prevSlotCounter + 1) % FLUSH_STACKS_COUNT == 0) {
-    int res = sem_post(&state_.slotsCounterSem);
-    if (res != 0) {
-      abort(); // Something went wrong
-    }
-  }
-}
-
-// Finds the next FREE slot and atomically sets its state to BUSY, so that
-// the acquiring thread can safely write to it, and returns the index via
-// <outSlot>. Returns true if a FREE slot was found, false otherwise.
-bool getSlotIndex(ProfileState& state_, uint64_t tid, uint32_t& outSlot) {
-  auto slotIndex = state_.currentSlot.fetch_add(1);
-  for (int i = 0; i < MAX_STACKS_COUNT; i++) {
-    auto nextSlotIndex = (slotIndex + i) % MAX_STACKS_COUNT;
-    auto& slot = state_.stacks[nextSlotIndex];
-    uint64_t expected = StackSlotState::FREE;
-    uint64_t targetBusyState = (tid << 16) | StackSlotState::BUSY;
-    if (slot.state.compare_exchange_strong(expected, targetBusyState)) {
-      outSlot = nextSlotIndex;
-
-      slot.time = monotonicTime();
-      memset(&slot.sig_jmp_buf, 0, sizeof(slot.sig_jmp_buf));
-
-      expected = targetBusyState;
-      targetBusyState = (tid << 16) | StackSlotState::BUSY_WITH_METADATA;
-      if (!slot.state.compare_exchange_strong(expected, targetBusyState)) {
-        abortWithReason(
-            "Invariant violation - BUSY to BUSY_WITH_METADATA failed");
-      }
-      return true;
-    }
+void SamplingProfiler::signalReader() {
+  int res = sem_post(&state_.drainSem);
+  if (res != 0) {
+    abort(); // Something went wrong
   }
-  // We didn't find an empty slot, so bump our counter
-  state_.errSlotMisses.fetch_add(1);
-  return false;
 }
 
 void SamplingProfiler::UnwindStackHandler(
@@ -142,12 +101,20 @@ void SamplingProfiler::UnwindStackHandler(
   SamplingProfiler& profiler = *(SamplingProfiler*)scope.GetData();
   ProfileState& state = profiler.state_;
 
-  uint64_t tid = threadID();
-  uint64_t busyState = (tid << 16) | StackSlotState::BUSY_WITH_METADATA;
+  auto queue = state.sampleQueues.acquire(threadID());
+  if (queue == nullptr) {
+    // A thread we haven't discovered yet and no spare queue left for it.
+    state.errSlotMisses.fetch_add(1);
+    return;
+  }
+  auto timerType = ThreadTimer::decodeType(siginfo->si_value.sival_int);
+  auto tracers = timerType == ThreadTimer::Type::CpuTime
+      ? state.cpuSignalTracers
+      : state.currentTracers;
 
   for (const auto& tracerEntry : state.tracersMap) {
     auto tracerType = tracerEntry.first;
-    if (!(tracerType & state.currentTracers)) {
+    if (!(tracerType & tracers)) {
       continue;
     }
 
@@ -160,81 +127,68 @@ void SamplingProfiler::UnwindStackHandler(
       }
     }
 
-    uint32_t slotIndex;
-    bool slot_found = getSlotIndex(state, tid, slotIndex);
-    if (!slot_found) {
-      // We're out of slots, no tracer is likely to succeed.
+    bool isJavaTracer = JavaBaseTracer::isJavaTracer(tracerType);
+    SampleQueue::Reservation sample;
+    if (!queue->begin(isJavaTracer, sample)) {
+      // The queue is full, no tracer is likely to succeed.
+      state.errSlotMisses.fetch_add(1);
       break;
     }
 
-    auto& slot = state.stacks[slotIndex];
-
-    // Can finally occupy the slot
-    if (sigsetjmp(slot.sig_jmp_buf, 1) == 0) {
-      memset(slot.method_names, 0, sizeof(slot.method_names));
-      memset(slot.class_descriptors, 0, sizeof(slot.class_descriptors));
-      uint8_t ret{StackSlotState::FREE};
-      if (JavaBaseTracer::isJavaTracer(tracerType)) {
+    bool drain;
+    if (sigsetjmp(queue->jumpBuffer(sample), 1) == 0) {
+      queue->arm(sample);
+      int64_t time = monotonicTime();
+      uint16_t depth = 0;
+      uint8_t ret;
+      if (isJavaTracer) {
+        memset(sample.method_names, 0, MAX_STACK_DEPTH * sizeof(char*));
+        memset(sample.class_descriptors, 0, MAX_STACK_DEPTH * sizeof(char*));
         ret = reinterpret_cast<JavaBaseTracer*>(tracerEntry.second.get())
                   ->collectJavaStack(
                       (ucontext_t*)ucontext,
-                      slot.frames,
-                      slot.method_names,
-                      slot.class_descriptors,
-                      slot.depth,
+                      sample.frames,
+                      sample.method_names,
+                      sample.class_descriptors,
+                      depth,
                       MAX_STACK_DEPTH);
       } else {
         ret = tracerEntry.second->collectStack(
-            (ucontext_t*)ucontext, slot.frames, slot.depth, MAX_STACK_DEPTH);
+            (ucontext_t*)ucontext, sample.frames, depth, MAX_STACK_DEPTH);
       }
 
-      slot.profilerType = tracerType;
       if (StackCollectionRetcode::STACK_OVERFLOW == ret) {
         state.errStackOverflows.fetch_add(1);
       }
 
-      slot.timerType = ThreadTimer::decodeType(siginfo->si_value.sival_int);
-
-      // Ignore TRACER_DISABLED errors for now and free the slot.
+      // Ignore TRACER_DISABLED errors for now and drop the sample.
       // TODO T42938550
-      if (StackCollectionRetcode::TRACER_DISABLED == ret) {
-        if (!slot.state.compare_exchange_strong(
-                busyState, StackSlotState::FREE)) {
-          abortWithReason(
-              "Invariant violation - BUSY_WITH_METADATA to FREE failed");
-        }
+      // In case if a Tracer class handles collection on it's own there's
+      // nothing to log either.
+      if (StackCollectionRetcode::TRACER_DISABLED == ret ||
+          StackCollectionRetcode::IGNORE == ret) {
+        queue->discard(sample);
+        queue->end(sample);
         continue;
       }
 
-      auto nextSlotState = (tid << 16) | ret;
-      // In case if a Tracer class handles collection on it's own the slot is
-      // freed after the signal is processed.
-      if (ret == StackCollectionRetcode::IGNORE) {
-        nextSlotState = StackSlotState::FREE;
-      }
-
-      if (!slot.state.compare_exchange_strong(busyState, nextSlotState)) {
-        // Slot was overwritten by another thread.
-        // This is an ordering violation, so abort.
-        abortWithReason(
-            "Invariant violation - BUSY_WITH_METADATA to return code failed");
-      }
-      if (nextSlotState != StackSlotState::FREE) {
-        profiler.maybeSignalReader();
-      }
+      drain = queue->commit(sample, time, tracerType, timerType, ret, depth);
     } else {
       // We came from the longjmp in sigcatch_handler.
       // Something must have crashed.
       // Log the error information and bail out
-      slot.time = monotonicTime();
-      slot.profilerType = tracerType;
-      if (!slot.state.compare_exchange_strong(
-              busyState,
-              (tid << 16) | StackCollectionRetcode::SIGNAL_INTERRUPT)) {
-        abortWithReason(
-            "Invariant violation - BUSY_WITH_METADATA to SIGNAL_INTERRUPT failed");
-      }
-      profiler.maybeSignalReader();
+      drain = queue->commit(
+          sample,
+          monotonicTime(),
+          tracerType,
+          timerType,
+          StackCollectionRetcode::SIGNAL_INTERRUPT,
+          0);
+    }
+    queue->end(sample);
+    state.queuedSamples.fetch_add(1);
+    if (drain) {
+      profiler.signalReader();
     }
   }
 }
@@ -290,91 +244,144 @@ void SamplingProfiler::unregisterSignalHandlers() {
   signal_handlers_.sigsegv->Disable();
 }
 
-static int32_t
-logTimerType(StackSlot& slot, int32_t tid, MultiBufferLogger& logger) {
-  auto type = slot.timerType == ThreadTimer::Type::CpuTime
+// The matchid refers to the sample's stack, see StackTable.
+static int32_t logTimerType(
+    const Sample& sample,
+    int32_t matchid,
+    MultiBufferLogger& logger) {
+  auto type = sample.timerType == ThreadTimer::Type::CpuTime
       ? EntryType::CPU_STACK_SAMPLE
       : EntryType::WALL_STACK_SAMPLE;
   auto id = logger.write(StandardEntry{
       .type = type,
-      .timestamp = slot.time,
-      .tid = tid,
+      .timestamp = sample.time,
+      .tid = sample.tid,
+      .matchid = matchid,
   });
 
   return id;
 }
 
 void SamplingProfiler::flushStackTraces(
-    std::unordered_set<uint64_t>& loggedFramesSet) {
-  int processedCount = 0;
+    std::unordered_set<uint64_t>& loggedFramesSet,
+    StackTable& stackTable) {
   auto& logger = *state_.logger;
-  for (size_t i = 0; i < MAX_STACKS_COUNT; i++) {
-    auto& slot = state_.stacks[i];
-
-    uint64_t slotStateCombo = slot.state.load();
-    uint16_t slotState = slotStateCombo & 0xffff;
-    if (slotState == StackSlotState::FREE ||
-        slotState == StackSlotState::BUSY ||
-        slotState == StackSlotState::BUSY_WITH_METADATA) {
-      continue;
-    }
+  bool expectedResetState = true;
+  if (state_.resetStackTable.compare_exchange_strong(
+          expectedResetState, false)) {
+    stackTable.reset();
+  }
 
+  // Stacks unwound after the fact, see BaseTracer::defersUnwinding().
+  int64_t unwound[MAX_STACK_DEPTH];
+  state_.sampleQueues.drain([&](const Sample& drained) {
+    auto& tracer = state_.tracersMap[drained.profilerType];
     // Ignore remains from a previous trace
-    if (slot.time > state_.profileStartTime) {
-      auto& tracer = state_.tracersMap[slot.profilerType];
-      auto tid = slotStateCombo >> 16;
+    bool stale = drained.time <= state_.profileStartTime;
+    Sample sample = drained;
+    if (StackCollectionRetcode::SUCCESS == drained.retcode &&
+        tracer->defersUnwinding()) {
+      std::copy(drained.frames, drained.frames + drained.depth, unwound);
+      sample.frames = unwound;
+      sample.retcode = tracer->unwindDeferred(
+          unwound, sample.depth, stale ? 0 : MAX_STACK_DEPTH);
+    }
+    if (stale) {
+      return;
+    }
+    auto tid = sample.tid;
 
-      logTimerType(slot, tid, logger);
+    if (sample.timerType == ThreadTimer::Type::CpuTime) {
+      state_.cpuTimeSamples.fetch_add(1);
+    } else {
+      state_.wallTimeSamples.fetch_add(1);
+    }
 
-      if (StackCollectionRetcode::SUCCESS == slotState) {
-        tracer->flushStack(logger, slot.frames, slot.depth, tid, slot.time);
+    if (StackCollectionRetcode::SUCCESS == sample.retcode) {
+      // The definition is mostly the frames entry.
+      FramesEntry definition{
+          .frames = {.values = sample.frames, .size = sample.depth}};
+      int32_t stackId;
+      auto use = stackTable.use(
+          sample.profilerType,
+          sample.frames,
+          sample.depth,
+          logger.maxDefinitionAge(FramesEntry::calculateSize(definition)),
+          stackId);
+      // Repeated stacks only log their id.
+      if (use == StackTable::Use::REFERENCE) {
+        stackTable.logged(logTimerType(sample, -stackId, logger));
       } else {
-        StackCollectionEntryConverter::logRetcode(
-            logger, slotState, tid, slot.time, slot.profilerType);
+        stackTable.logged(logTimerType(sample, stackId, logger));
+        tracer->flushStack(
+            logger,
+            const_cast<int64_t*>(sample.frames),
+            sample.depth,
+            tid,
+            sample.time);
+      }
+    } else {
+      logTimerType(sample, 0, logger);
+      StackCollectionEntryConverter::logRetcode(
+          logger, sample.retcode, tid, sample.time, sample.profilerType);
+      if (StackCollectionRetcode::PARTIAL_STACK == sample.retcode &&
+          sample.depth > 0) {
+        // The frames found are still valid.
+        tracer->flushStack(
+            logger,
+            const_cast<int64_t*>(sample.frames),
+            sample.depth,
+            tid,
+            sample.time);
       }
+    }
 
-      if (JavaBaseTracer::isJavaTracer(slot.profilerType)) {
-        for (int i = 0; i < slot.depth; i++) {
-          bool expectedResetState = true;
-          if (state_.resetFrameworkSymbols.compare_exchange_strong(
-                  expectedResetState, false)) {
-            loggedFramesSet.clear();
-          }
-
-          if (loggedFramesSet.find(slot.frames[i]) == loggedFramesSet.end() &&
-              JavaBaseTracer::isFramework(slot.class_descriptors[i])) {
-            StandardEntry entry{};
-            entry.tid = tid;
-            entry.timestamp = slot.time;
-            entry.type = EntryType::JAVA_FRAME_NAME;
-            entry.extra = slot.frames[i];
-            int32_t id = logger.write(std::move(entry));
-
-            std::string full_name{slot.class_descriptors[i]};
-            full_name += slot.method_names[i];
-            logger.writeBytes(
-                EntryType::STRING_VALUE,
-                id,
-                (const uint8_t*)full_name.c_str(),
-                full_name.length());
-          }
-          // Mark the frame as "logged" or "visited" so that we don't do a
-          // string comparison for it next time, regardless of whether it was
-          // a framework frame or not
-          loggedFramesSet.insert(slot.frames[i]);
+    if (JavaBaseTracer::isJavaTracer(sample.profilerType)) {
+      for (int i = 0; i < sample.depth; i++) {
+        bool expectedResetState = true;
+        if (state_.resetFrameworkSymbols.compare_exchange_strong(
+                expectedResetState, false)) {
+          loggedFramesSet.clear();
         }
+
+        if (loggedFramesSet.find(sample.frames[i]) == loggedFramesSet.end() &&
+            JavaBaseTracer::isFramework(sample.class_descriptors[i])) {
+          StandardEntry entry{};
+          entry.tid = tid;
+          entry.timestamp = sample.time;
+          entry.type = EntryType::JAVA_FRAME_NAME;
+          entry.extra = sample.frames[i];
+          int32_t id = logger.write(std::move(entry));
+
+          std::string full_name{sample.class_descriptors[i]};
+          full_name += sample.method_names[i];
+          logger.writeBytes(
+              EntryType::STRING_VALUE,
+              id,
+              (const uint8_t*)full_name.c_str(),
+              full_name.length());
+        }
+        // Mark the frame as "logged" or "visited" so that we don't do a
+        // string comparison for it next time, regardless of whether it was
+        // a framework frame or not
+        loggedFramesSet.insert(sample.frames[i]);
       }
     }
+  });
+}
 
-    uint64_t expected = slotStateCombo;
-    // Release the slot
-    if (!slot.state.compare_exchange_strong(expected, StackSlotState::FREE)) {
-      // Slot was re-used in the middle of the processing by another thread.
-      // Aborting.
-      abort();
+void SamplingProfiler::dropQueuedSamples() {
+  int64_t unwound[MAX_STACK_DEPTH];
+  state_.sampleQueues.drain([&](const Sample& sample) {
+    auto& tracer = state_.tracersMap[sample.profilerType];
+    if (StackCollectionRetcode::SUCCESS == sample.retcode &&
+        tracer->defersUnwinding()) {
+      // As for stale samples in flushStackTraces(), only releases them.
+      std::copy(sample.frames, sample.frames + sample.depth, unwound);
+      uint16_t depth = sample.depth;
+      tracer->unwindDeferred(unwound, depth, 0);
     }
-    processedCount++;
-  }
+  });
 }
 
 void logProfilingErrAnnotation(
@@ -410,9 +417,9 @@ bool SamplingProfiler::initialize(
   state_.timerManager.reset();
 
   // Init semaphore for stacks flush to the Ring Buffer
-  int res = sem_init(&state_.slotsCounterSem, 0, 0);
+  int res = sem_init(&state_.drainSem, 0, 0);
   if (res != 0) {
-    FBLOGV("Can not init slotsCounterSem semaphore: %s", strerror(errno));
+    FBLOGV("Can not init drainSem semaphore: %s", strerror(errno));
     errno = 0;
     return false;
   }
@@ -425,57 +432,171 @@ bool SamplingProfiler::initialize(
  *
  * Must only be called if SamplingProfiler::startProfiling() returns true.
  *
- * Waits in a loop for semaphore wakeup and then flushes the current profiling
- * stacks.
+ * Flushes the profiling stacks every SAMPLE_DRAIN_INTERVAL_MS, or sooner when
+ * woken up by a filling sample queue.
  */
 void SamplingProfiler::loggerLoop() {
   FBLOGV("Logger thread %d is going into the loop...", threadID());
   int res = 0;
   std::unordered_set<uint64_t> loggedFramesSet{};
+  StackTable stackTable{};
 
   do {
-    res = sem_wait(&state_.slotsCounterSem);
+    auto deadline = getAbsTimeInFutureMs(SAMPLE_DRAIN_INTERVAL_MS);
+    res = sem_timedwait(&state_.drainSem, &deadline);
+    if (res == -1 && errno == ETIMEDOUT) {
+      res = 0;
+    }
     if (res == 0) {
-      flushStackTraces(loggedFramesSet);
+      flushStackTraces(loggedFramesSet, stackTable);
     }
   } while (!state_.isLoggerLoopDone && (res == 0 || errno == EINTR));
   FBLOGV("Logger thread is shutting down...");
 }
 
 bool SamplingProfiler::startProfilingTimers() {
+  // The perf sampler replaces the CPU time timers.
+  bool cpuTimers = state_.cpuClockModeEnabled && state_.perfSampler == nullptr;
+  if (!cpuTimers && !state_.wallClockModeEnabled) {
+    return true;
+  }
   FBLOGI("Starting profiling timers w/sample rate %d", state_.samplingRateMs);
   state_.timerManager.reset(new TimerManager(
       state_.threadDetectIntervalMs,
       state_.samplingRateMs,
-      state_.cpuClockModeEnabled,
+      cpuTimers,
       state_.wallClockModeEnabled,
-      state_.wallClockModeEnabled ? state_.whitelist : nullptr));
+      state_.wallClockModeEnabled ? state_.whitelist : nullptr,
+      &state_.sampleQueues));
   state_.timerManager->start();
   return true;
 }
 
 bool SamplingProfiler::stopProfilingTimers() {
-  state_.timerManager->stop();
-  state_.timerManager.reset();
+  if (state_.timerManager != nullptr) {
+    state_.timerManager->stop();
+    state_.timerManager.reset();
+  }
   return true;
 }
 
+void SamplingProfiler::onThreadStart(int32_t tid) {
+  state_.logger->write(StandardEntry{
+      .type = EntryType::THREAD_START,
+      .timestamp = monotonicTime(),
+      .tid = tid,
+  });
+}
+
+void SamplingProfiler::onThreadExit(int32_t tid) {
+  state_.logger->write(StandardEntry{
+      .type = EntryType::THREAD_FINISH,
+      .timestamp = monotonicTime(),
+      .tid = tid,
+  });
+}
+
+#if HAS_PERF_SAMPLER
+
+//
+// Perf samples only carry native stacks. The other tracers of a sample's
+// thread get a CPU time profiling signal from the perf reader thread, so
+// only threads that are running are interrupted. The signal lands a little
+// after the sample was taken.
+//
+bool SamplingProfiler::startPerfSampler() {
+  if (!state_.cpuClockModeEnabled ||
+      !(state_.currentTracers & tracers::NATIVE)) {
+    return false;
+  }
+  state_.cpuSignalTracers = state_.currentTracers & ~tracers::NATIVE;
+
+  PerfSampler::SampleCallback onSample;
+  if (state_.cpuSignalTracers != 0) {
+    auto& state = state_;
+    auto threadDetectIntervalNs =
+        static_cast<int64_t>(state_.threadDetectIntervalMs) * 1000000;
+    // The reader thread does the thread detection TimerManager would.
+    onSample = [&state,
+                threadDetectIntervalNs,
+                knownThreads = std::unordered_set<int32_t>(),
+                nextDetection = int64_t{0}](int32_t tid) mutable {
+      auto now = monotonicTime();
+      if (now >= nextDetection) {
+        state.sampleQueues.update();
+        knownThreads.clear();
+        nextDetection = now + threadDetectIntervalNs;
+      }
+      if (knownThreads.insert(tid).second) {
+        state.sampleQueues.add(tid);
+      }
+
+      siginfo_t info{};
+      info.si_signo = PROFILER_SIGNAL;
+      info.si_code = SI_QUEUE;
+      info.si_pid = state.processId;
+      info.si_uid = getuid();
+      info.si_value.sival_int =
+          ThreadTimer::encodeType(ThreadTimer::Type::CpuTime);
+      // Fails if the thread exited since, nothing to do then.
+      syscall(
+          SYS_rt_tgsigqueueinfo, state.processId, tid, PROFILER_SIGNAL, &info);
+    };
+  }
+
+  auto sampler = std::make_shared<PerfSampler>(*state_.logger);
+  if (!sampler->start(state_.samplingRateMs, std::move(onSample))) {
+    FBLOGI("Perf sampling unavailable, falling back to timers");
+    state_.cpuSignalTracers = state_.currentTracers;
+    return false;
+  }
+  std::atomic_store(&state_.perfSampler, std::move(sampler));
+  return true;
+}
+
+void SamplingProfiler::stopPerfSampler() {
+  auto sampler = std::atomic_exchange(
+      &state_.perfSampler, std::shared_ptr<PerfSampler>());
+  if (sampler != nullptr) {
+    sampler->stop();
+  }
+}
+
+#else
+
+bool SamplingProfiler::startPerfSampler() {
+  return false;
+}
+
+void SamplingProfiler::stopPerfSampler() {}
+
+#endif
+
 bool SamplingProfiler::startProfiling(
     int requested_tracers,
     int sampling_rate_ms,
     int thread_detect_interval_ms,
     bool cpu_clock_mode_enabled,
-    bool wall_clock_mode_enabled) {
+    bool wall_clock_mode_enabled,
+    bool perf_sampling_enabled) {
   if (state_.isProfiling) {
     throw std::logic_error("startProfiling called while already profiling");
   }
   state_.isProfiling = true;
   FBLOGV("Start profiling");
 
+  // Samples of an earlier trace that the logger didn't get to are dropped.
+  dropQueuedSamples();
+  state_.sampleQueues.reset();
+  state_.queuedSamples = 0;
+  state_.cpuTimeSamples = 0;
+  state_.wallTimeSamples = 0;
+
   registerSignalHandlers();
 
   state_.profileStartTime = monotonicTime();
   state_.currentTracers = state_.availableTracers & requested_tracers;
+  state_.cpuSignalTracers = state_.currentTracers;
 
   if (state_.currentTracers == 0) {
     return false;
@@ -499,6 +620,10 @@ bool SamplingProfiler::startProfiling(
     }
   }
 
+  if (perf_sampling_enabled) {
+    startPerfSampler();
+  }
+  util::ThreadLifecycle::getInstance().addListener(this);
   return startProfilingTimers();
 }
 
@@ -516,11 +641,14 @@ void SamplingProfiler::stopProfiling() {
 
   FBLOGV("Stopping profiling");
 
+  util::ThreadLifecycle::getInstance().removeListener(this);
   if (!stopProfilingTimers()) {
     abort();
   }
+  // Before the tracers stop, it may still signal threads.
+  stopPerfSampler();
   state_.isLoggerLoopDone.store(true);
-  int res = sem_post(&state_.slotsCounterSem);
+  int res = sem_post(&state_.drainSem);
   if (res != 0) {
     FBLOGV("Can not execute sem_post for logger thread");
     errno = 0;
@@ -546,7 +674,6 @@ void SamplingProfiler::stopProfiling() {
       state_.errSigCrashes.load(),
       state_.errSlotMisses.load());
 
-  state_.currentSlot = 0;
   state_.errSigCrashes = 0;
   state_.errSlotMisses = 0;
   state_.errStackOverflows = 0;
@@ -576,6 +703,13 @@ void SamplingProfiler::removeFromWhitelist(int targetThread) {
 void SamplingProfiler::resetFrameworkNamesSet() {
   // Let the logger loop know we should reset our cache of frames
   state_.resetFrameworkSymbols.store(true);
+  state_.resetStackTable.store(true);
+#if HAS_PERF_SAMPLER
+  auto sampler = std::atomic_load(&state_.perfSampler);
+  if (sampler != nullptr) {
+    sampler->resetStackTable();
+  }
+#endif
 }
 
 } // namespace profiler
@@ -16,6 +16,8 @@
 
 #pragma once
 
+#include "SampleQueue.h"
+#include "StackTable.h"
 #include "TimerManager.h"
 
 #include <semaphore.h>
@@ -35,6 +37,7 @@
 #include <profiler/BaseTracer.h>
 #include <profiler/Constants.h>
 #include <profiler/SignalHandler.h>
+#include <profilo/util/ThreadLifecycle.h>
 
 namespace fbjni = facebook::jni;
 
@@ -44,39 +47,7 @@ namespace facebook {
 namespace profilo {
 namespace profiler {
 
-enum StackSlotState {
-  FREE = StackCollectionRetcode::MAXVAL + 1,
-  BUSY,
-  BUSY_WITH_METADATA,
-};
-
-//
-// Slots are preallocated storage for the sampling profiler. They
-// are necessary because unwinding happens in a signal context and thus
-// allocation via the traditional APIs is not possible.
-//
-// The slot state encodes the tid in the high 16 bits and the
-// state (StackSlotState) in the lower 16 bits.
-//
-// Each slot goes through a lifecycle:
-//   FREE -> BUSY -> BUSY_WITH_METADATA -> {StackCollectionRetcode}
-//
-struct StackSlot {
-  std::atomic<uint64_t> state;
-  uint16_t depth;
-  int64_t time;
-  sigjmp_buf sig_jmp_buf;
-  uint32_t profilerType;
-  ThreadTimer::Type timerType;
-  int64_t frames[MAX_STACK_DEPTH]; // frame pointer addresses
-  char const* method_names[MAX_STACK_DEPTH];
-  char const* class_descriptors[MAX_STACK_DEPTH];
-#ifdef PROFILER_COLLECT_PC
-  u2 pcs[MAX_STACK_DEPTH];
-#endif
-
-  StackSlot() : state(StackSlotState::FREE), depth(0) {}
-};
+class PerfSampler;
 
 struct Whitelist {
   std::unordered_set<int32_t> whitelistedThreads;
@@ -88,14 +59,19 @@ struct ProfileState {
   MultiBufferLogger* logger;
   int availableTracers;
   int currentTracers;
+  // The tracers CPU time signals collect stacks for. The perf sampler takes
+  // the native ones without a signal.
+  int cpuSignalTracers;
   std::unordered_map<int32_t, std::shared_ptr<BaseTracer>> tracersMap;
   int64_t profileStartTime;
   std::atomic_bool isProfiling{};
 
-  // Slots/Stacks
-  StackSlot stacks[MAX_STACKS_COUNT];
-  std::atomic<uint32_t> currentSlot;
-  std::atomic<uint32_t> fullSlotsCounter;
+  // Samples, per thread
+  SampleQueues sampleQueues;
+  std::atomic<uint32_t> queuedSamples;
+  // Samples logged, per timer type
+  std::atomic<uint32_t> cpuTimeSamples;
+  std::atomic<uint32_t> wallTimeSamples;
 
   // Error stats
   std::atomic<uint16_t> errSigCrashes;
@@ -103,7 +79,7 @@ struct ProfileState {
   std::atomic<uint16_t> errStackOverflows;
 
   // Logger
-  sem_t slotsCounterSem;
+  sem_t drainSem;
   std::atomic_bool isLoggerLoopDone;
 
   // Config parameters
@@ -117,17 +93,22 @@ struct ProfileState {
   std::shared_ptr<Whitelist> whitelist;
 
   std::unique_ptr<TimerManager> timerManager;
+  // Takes the CPU time samples instead of the timers, if it could start.
+  std::shared_ptr<PerfSampler> perfSampler;
 
   // If a secondary trace starts, we need to tell the logger loop to clear
   // its cache of logged frames, so that the new trace won't miss any symbols
   std::atomic_bool resetFrameworkSymbols;
+  // Same for its table of logged stacks, so that the new trace gets their
+  // definitions
+  std::atomic_bool resetStackTable;
 };
 
 /**
  * Exported functions
  */
 
-class SamplingProfiler {
+class SamplingProfiler : private util::ThreadLifecycle::Listener {
  public:
   static SamplingProfiler& getInstance();
 
@@ -149,7 +130,8 @@ class SamplingProfiler {
       int sampling_rate_ms,
       int thread_detect_interval_ms,
       bool cpu_clock_mode_enabled,
-      bool wall_clock_mode_enabled);
+      bool wall_clock_mode_enabled,
+      bool perf_sampling_enabled);
 
   void addToWhitelist(int targetThread);
 
@@ -168,13 +150,24 @@ class SamplingProfiler {
   // Profiling timer management
   bool startProfilingTimers();
   bool stopProfilingTimers();
+  bool startPerfSampler();
+  void stopPerfSampler();
 
   void registerSignalHandlers();
   void unregisterSignalHandlers();
 
   // Logger
-  void maybeSignalReader();
-  void flushStackTraces(std::unordered_set<uint64_t>& loggedFramesSet);
+  void signalReader();
+  void flushStackTraces(
+      std::unordered_set<uint64_t>& loggedFramesSet,
+      StackTable& stackTable);
+  // Drops the samples the logger didn't get to, giving back what deferring
+  // tracers hold for them.
+  void dropQueuedSamples();
+
+  // Logs THREAD_START and THREAD_FINISH while profiling.
+  void onThreadStart(int32_t tid) override;
+  void onThreadExit(int32_t tid) override;
 
   static void FaultHandler(SignalHandler::HandlerScope, int, siginfo_t*, void*);
   static void
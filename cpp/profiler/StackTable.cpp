@@ -0,0 +1,110 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "StackTable.h"
+
+#include <algorithm>
+#include <atomic>
+
+namespace facebook {
+namespace profilo {
+namespace profiler {
+
+namespace {
+
+std::atomic<int32_t> nextStackID{1};
+
+uint64_t hashStack(
+    uint32_t profiler_type,
+    const int64_t* frames,
+    uint16_t depth) {
+  // FNV-1a over the frames, seeded with the tracer and depth.
+  uint64_t hash = 0xcbf29ce484222325ull ^
+      ((static_cast<uint64_t>(profiler_type) << 16) | depth);
+  for (uint16_t idx = 0; idx < depth; ++idx) {
+    hash = (hash ^ static_cast<uint64_t>(frames[idx])) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+} // namespace
+
+StackTable::StackTable(size_t max_frames)
+    : max_frames_(max_frames),
+      last_entry_id_(0),
+      stacks_(),
+      frames_(),
+      index_() {}
+
+bool StackTable::matches(
+    const Stack& stack,
+    uint32_t profiler_type,
+    const int64_t* frames,
+    uint16_t depth) const {
+  return stack.profiler_type == profiler_type && stack.depth == depth &&
+      std::equal(frames, frames + depth, frames_.begin() + stack.offset);
+}
+
+StackTable::Use StackTable::use(
+    uint32_t profiler_type,
+    const int64_t* frames,
+    uint16_t depth,
+    int32_t max_age,
+    int32_t& id) {
+  auto hash = hashStack(profiler_type, frames, depth);
+  auto range = index_.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    auto& stack = stacks_[it->second];
+    if (!matches(stack, profiler_type, frames, depth)) {
+      continue;
+    }
+    id = stack.id;
+    // Entry IDs are leased to threads in blocks, so they only roughly
+    // increase. max_age allows for how far they can lag, see
+    // MultiBufferLogger::definitionAge().
+    if (last_entry_id_ - stack.defined_by > max_age) {
+      stack.defined_by = last_entry_id_;
+      return Use::DEFINE;
+    }
+    return Use::REFERENCE;
+  }
+
+  if (frames_.size() + depth > max_frames_) {
+    id = 0;
+    return Use::INLINE;
+  }
+  id = nextStackID.fetch_add(1, std::memory_order_relaxed);
+  stacks_.push_back(Stack{
+      .id = id,
+      .profiler_type = profiler_type,
+      .depth = depth,
+      .offset = frames_.size(),
+      .defined_by = last_entry_id_,
+  });
+  frames_.insert(frames_.end(), frames, frames + depth);
+  index_.emplace(hash, stacks_.size() - 1);
+  return Use::DEFINE;
+}
+
+void StackTable::reset() {
+  stacks_.clear();
+  frames_.clear();
+  index_.clear();
+}
+
+} // namespace profiler
+} // namespace profilo
+} // namespace facebook
@@ -0,0 +1,114 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace facebook {
+namespace profilo {
+namespace profiler {
+
+//
+// The stacks the logger thread has flushed in the current trace. A stack is
+// logged in full the first time it's sampled, as its definition, and later
+// samples of it only carry its id:
+//
+//   CPU_STACK_SAMPLE/WALL_STACK_SAMPLE with a matchid of
+//     id > 0: defines stack `id`, the frames entry of the same tid and
+//             timestamp follows as usual;
+//     -id:    a sample of stack `id`, no frames entry follows;
+//     0:      a stack that isn't in the table, its frames follow as usual.
+//
+// Only used by the logger thread. Ids are unique for the lifetime of the
+// process, so a buffer never holds two stacks with the same id.
+//
+class StackTable {
+ public:
+  // About 2 MB of frames.
+  static constexpr size_t kDefaultMaxFrames = 256 * 1024;
+
+  enum class Use {
+    // Log the sample with the id and the frames after it.
+    DEFINE,
+    // Log the sample with -id and no frames.
+    REFERENCE,
+    // The table is full, log the sample with no id and the frames after it.
+    INLINE,
+  };
+
+  explicit StackTable(size_t max_frames = kDefaultMaxFrames);
+
+  StackTable(const StackTable&) = delete;
+  StackTable& operator=(const StackTable&) = delete;
+
+  //
+  // Decides how the sample of a stack taken by `profiler_type` is logged,
+  // adding the stack if it's new, and returns its id in `id`. A definition
+  // logged more than `max_age` entry IDs ago may have been overwritten in
+  // the buffer, so it's asked for again.
+  //
+  Use use(
+      uint32_t profiler_type,
+      const int64_t* frames,
+      uint16_t depth,
+      int32_t max_age,
+      int32_t& id);
+
+  // Records the entry ID of the sample logged after use(), the table's
+  // notion of the current entry ID.
+  void logged(int32_t entry_id) {
+    last_entry_id_ = entry_id;
+  }
+
+  // Drops every stack, called when a trace starts.
+  void reset();
+
+  size_t size() const {
+    return stacks_.size();
+  }
+
+ private:
+  struct Stack {
+    int32_t id;
+    uint32_t profiler_type;
+    uint16_t depth;
+    // Into frames_.
+    size_t offset;
+    // Entry ID of the sample before the latest definition.
+    int32_t defined_by;
+  };
+
+  bool matches(
+      const Stack& stack,
+      uint32_t profiler_type,
+      const int64_t* frames,
+      uint16_t depth) const;
+
+  const size_t max_frames_;
+  int32_t last_entry_id_;
+  std::vector<Stack> stacks_;
+  std::vector<int64_t> frames_;
+  // Stack hash to index into stacks_.
+  std::unordered_multimap<uint64_t, size_t> index_;
+};
+
+} // namespace profiler
+} // namespace profilo
+} // namespace facebook
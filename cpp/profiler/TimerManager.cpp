@@ -26,6 +26,7 @@
 #include <sys/time.h>
 
 #include <fb/log.h>
+#include <algorithm>
 #include <random>
 #include <stdexcept>
 
@@ -44,6 +45,11 @@ constexpr int TRACE_CONFIG_PARAM_LOGGER_PRIORITY_DEFAULT = 5;
 constexpr auto kNanosecondsInSecond = 1000 * 1000 * 1000;
 constexpr auto kNanosecondsInMillisecond = 1000 * 1000;
 
+// How often threads are listed when thread lifecycle events tell about them.
+constexpr int kReconcileIntervalMs = 1000;
+
+} // namespace
+
 struct timespec getAbsTimeInFutureMs(int futureMs) {
   struct timespec abs_time;
   if (clock_gettime(CLOCK_REALTIME, &abs_time) == -1) {
@@ -55,7 +61,6 @@ struct timespec getAbsTimeInFutureMs(int futureMs) {
   abs_time.tv_sec += timeout_nsec / kNanosecondsInSecond;
   return abs_time;
 }
-} // namespace
 
 void TimerManager::updateThreadTimers() {
   // Modifies state_.threadTimers
@@ -67,6 +72,9 @@ void TimerManager::updateThreadTimers() {
     // threadListFromProcFs can throw an error. Ignore it.
     return;
   }
+  if (state_.sampleQueues != nullptr) {
+    state_.sampleQueues->update();
+  }
 
   if (state_.whitelist != nullptr) {
     // only process whitelisted threads
@@ -92,30 +100,79 @@ void TimerManager::updateThreadTimers() {
 
   // Start timers for threads that are new
   for (auto& tid : threads) {
-    if (state_.threadTimers.find(tid) != state_.threadTimers.end()) {
-      continue;
+    startThreadTimers(tid);
+  }
+}
+
+void TimerManager::startThreadTimers(int32_t tid) {
+  if (state_.threadTimers.find(tid) != state_.threadTimers.end()) {
+    return;
+  }
+  // Ahead of its first sample, so that it doesn't need a spare queue.
+  if (state_.sampleQueues != nullptr) {
+    state_.sampleQueues->add(tid);
+  }
+  try {
+    std::vector<ThreadTimer> timers;
+    if (state_.cpuClockModeEnabled) {
+      timers.emplace_back(
+          ThreadTimer(tid, state_.samplingRateMs, ThreadTimer::Type::CpuTime));
     }
-    try {
-      std::vector<ThreadTimer> timers;
-      if (state_.cpuClockModeEnabled) {
-        timers.emplace_back(ThreadTimer(
-            tid, state_.samplingRateMs, ThreadTimer::Type::CpuTime));
-      }
-      if (state_.wallClockModeEnabled) {
-        timers.emplace_back(ThreadTimer(
-            tid, state_.samplingRateMs, ThreadTimer::Type::WallTime));
+    if (state_.wallClockModeEnabled) {
+      timers.emplace_back(ThreadTimer(
+          tid, state_.samplingRateMs, ThreadTimer::Type::WallTime));
+    }
+    if (timers.size() > 0) {
+      bool ok = state_.threadTimers.emplace(tid, std::move(timers)).second;
+      if (!ok) {
+        FBLOGE("state_.threadTimers.insert failed");
       }
-      if (timers.size() > 0) {
-        bool ok = state_.threadTimers.emplace(tid, std::move(timers)).second;
-        if (!ok) {
-          FBLOGE("state_.threadTimers.insert failed");
-        }
+    }
+  } catch (const std::system_error& e) {
+    // thread may have ended
+    FBLOGV("ThreadTimer could not be created for tid %d", tid);
+  }
+}
+
+void TimerManager::applyThreadEvents() {
+  // Modifies state_.threadTimers, like updateThreadTimers()
+  std::vector<std::pair<int32_t, bool>> events;
+  {
+    std::lock_guard<std::mutex> lock(state_.threadEventsMtx);
+    events.swap(state_.threadEvents);
+  }
+
+  for (auto& event : events) {
+    auto tid = event.first;
+    if (!event.second) {
+      state_.threadTimers.erase(tid); // RAII deletes timer
+      continue;
+    }
+    if (state_.whitelist != nullptr) {
+      std::unique_lock<std::mutex> lock(
+          state_.whitelist->whitelistedThreadsMtx);
+      if (state_.whitelist->whitelistedThreads.count(tid) == 0) {
+        continue;
       }
-    } catch (const std::system_error& e) {
-      // thread may have ended
-      FBLOGV("ThreadTimer could not be created for tid %d", tid);
     }
+    startThreadTimers(tid);
+  }
+}
+
+void TimerManager::onThreadStart(int32_t tid) {
+  {
+    std::lock_guard<std::mutex> lock(state_.threadEventsMtx);
+    state_.threadEvents.emplace_back(tid, true);
+  }
+  sem_post(&state_.threadDetectSem);
+}
+
+void TimerManager::onThreadExit(int32_t tid) {
+  {
+    std::lock_guard<std::mutex> lock(state_.threadEventsMtx);
+    state_.threadEvents.emplace_back(tid, false);
   }
+  sem_post(&state_.threadDetectSem);
 }
 
 // must be started after sampling is enabled
@@ -134,16 +191,21 @@ void TimerManager::threadDetectLoop() {
   FBLOGV("ThreadDetectLoop thread %d is going into the loop...", threadID());
   int res;
   bool done;
+  auto detectIntervalMs = state_.hasThreadEvents
+      ? std::max(state_.threadDetectIntervalMs, kReconcileIntervalMs)
+      : state_.threadDetectIntervalMs;
   struct timespec nextThreadDetectWakeup = getAbsTimeInFutureMs(0);
   do {
     res = sem_timedwait(&state_.threadDetectSem, &nextThreadDetectWakeup);
     done = state_.isThreadDetectLoopDone.load();
     if (!done && res == -1 && errno == ETIMEDOUT) {
       // timed out
-      nextThreadDetectWakeup =
-          getAbsTimeInFutureMs(state_.threadDetectIntervalMs);
+      nextThreadDetectWakeup = getAbsTimeInFutureMs(detectIntervalMs);
       updateThreadTimers();
       res = 0;
+    } else if (!done && res == 0) {
+      // woken up by a thread event
+      applyThreadEvents();
     }
   } while (!done && (res == 0 || errno == EINTR));
   if (res != 0) {
@@ -160,14 +222,17 @@ TimerManager::TimerManager(
     int samplingRateMs,
     bool cpuClockModeEnabled,
     bool wallClockModeEnabled,
-    std::shared_ptr<Whitelist> whitelist) {
+    std::shared_ptr<Whitelist> whitelist,
+    SampleQueues* sampleQueues) {
   state_.threadDetectIntervalMs = threadDetectIntervalMs;
   state_.samplingRateMs = samplingRateMs;
   state_.cpuClockModeEnabled = cpuClockModeEnabled;
   state_.wallClockModeEnabled = wallClockModeEnabled;
   state_.whitelist = whitelist;
+  state_.sampleQueues = sampleQueues;
 
   state_.isThreadDetectLoopDone.store(false);
+  state_.hasThreadEvents = false;
   if (sem_init(&state_.threadDetectSem, 0, 0)) {
     throw std::system_error(
         errno, std::system_category(), "TimerManager sem_init failed");
@@ -175,12 +240,15 @@ TimerManager::TimerManager(
 }
 
 void TimerManager::start() {
+  state_.hasThreadEvents =
+      util::ThreadLifecycle::getInstance().addListener(this);
   // Create worker to detects new threads & starts profiling on them
   state_.threadDetectThread =
       std::thread(&TimerManager::threadDetectLoop, this);
 }
 
 void TimerManager::stop() {
+  util::ThreadLifecycle::getInstance().removeListener(this);
   state_.isThreadDetectLoopDone.store(true);
   sem_post(&state_.threadDetectSem); // wake up
   state_.threadDetectThread.join();
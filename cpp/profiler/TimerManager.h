@@ -33,11 +33,17 @@
 #include <utility>
 #include <vector>
 
+#include <profilo/util/ThreadLifecycle.h>
+
 namespace facebook {
 namespace profilo {
 namespace profiler {
 
 struct Whitelist;
+class SampleQueues;
+
+// The CLOCK_REALTIME time futureMs from now, a deadline for sem_timedwait().
+struct timespec getAbsTimeInFutureMs(int futureMs);
 
 struct TimerManagerState {
   int threadDetectIntervalMs;
@@ -48,20 +54,31 @@ struct TimerManagerState {
   // whitelist is optional; use null for "all threads"
   std::shared_ptr<Whitelist> whitelist;
 
+  // Optional, gets a queue for every thread with timers.
+  SampleQueues* sampleQueues;
+
   std::thread threadDetectThread;
   sem_t threadDetectSem;
   std::atomic_bool isThreadDetectLoopDone;
   std::unordered_map<pid_t, std::vector<ThreadTimer>> threadTimers;
+
+  // With thread lifecycle events, /proc/self/task is only listed now and
+  // then, to catch the threads they missed.
+  bool hasThreadEvents;
+  // Started (true) and exited threads since the loop last woke up.
+  std::mutex threadEventsMtx; // Guards threadEvents
+  std::vector<std::pair<int32_t, bool>> threadEvents;
 };
 
-class TimerManager {
+class TimerManager : private util::ThreadLifecycle::Listener {
  public:
   explicit TimerManager(
       int threadDetectIntervalMs,
       int samplingRateMs,
       bool cpuClockModeEnabled,
       bool wallClockModeEnabled,
-      std::shared_ptr<Whitelist> whitelist);
+      std::shared_ptr<Whitelist> whitelist,
+      SampleQueues* sampleQueues = nullptr);
   ~TimerManager() = default;
   void start(); // potentially blocks
   void stop(); // potentially blocks
@@ -69,7 +86,12 @@ class TimerManager {
  private:
   TimerManagerState state_;
   void updateThreadTimers();
+  void applyThreadEvents();
+  void startThreadTimers(int32_t tid);
   void threadDetectLoop();
+
+  void onThreadStart(int32_t tid) override;
+  void onThreadExit(int32_t tid) override;
 };
 
 } // namespace profiler
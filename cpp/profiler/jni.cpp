@@ -65,7 +65,6 @@ std::unordered_map<int32_t, std::shared_ptr<BaseTracer>> makeAvailableTracers(
     MultiBufferLogger& logger,
     uint32_t available_tracers,
     bool native_tracer_unwind_dex_frames,
-    int32_t native_tracer_unwind_thread_pri,
     size_t native_tracer_unwind_queue_size,
     bool native_tracer_log_partial_stacks) {
   std::unordered_map<int32_t, std::shared_ptr<BaseTracer>> tracers;
@@ -78,7 +77,6 @@ std::unordered_map<int32_t, std::shared_ptr<BaseTracer>> makeAvailableTracers(
     tracers[tracers::NATIVE] = std::make_shared<NativeTracer>(
         logger,
         native_tracer_unwind_dex_frames,
-        native_tracer_unwind_thread_pri,
         native_tracer_unwind_queue_size,
         native_tracer_log_partial_stacks);
   }
@@ -144,7 +142,6 @@ static jboolean nativeInitialize(
     JMultiBufferLogger* jlogger,
     jint tracers,
     jboolean native_tracer_unwind_dex_frames,
-    jint native_tracer_unwind_thread_pri,
     jint native_tracer_unwind_queue_size,
     jboolean native_tracer_log_partial_stacks) {
   auto available_tracers = static_cast<uint32_t>(tracers);
@@ -156,7 +153,6 @@ static jboolean nativeInitialize(
           logger,
           available_tracers,
           native_tracer_unwind_dex_frames,
-          native_tracer_unwind_thread_pri,
           static_cast<size_t>(native_tracer_unwind_queue_size),
           native_tracer_log_partial_stacks));
 }
@@ -175,13 +171,15 @@ static jboolean nativeStartProfiling(
     jint sampling_rate_ms,
     jint thread_detect_interval_ms,
     jboolean cpu_clock_mode,
-    jboolean wall_clock_mode) {
+    jboolean wall_clock_mode,
+    jboolean perf_sampling) {
   return SamplingProfiler::getInstance().startProfiling(
       requested_tracers,
       sampling_rate_ms,
       thread_detect_interval_ms,
       cpu_clock_mode,
-      wall_clock_mode);
+      wall_clock_mode,
+      perf_sampling);
 }
 
 static void nativeResetFrameworkNamesSet(fbjni::alias_ref<jobject>) {
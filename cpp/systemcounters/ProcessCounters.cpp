@@ -41,7 +41,7 @@ inline uint64_t timeval_sum_to_millis(timeval& tv1, timeval& tv2) {
 } // namespace
 
 void ProcessCounters::logCounters() {
-  auto time = monotonicTime();
+  auto time = timestamps_.next();
 
   logProcessCounters(time);
   logProcessSchedCounters(time);
@@ -59,7 +59,7 @@ void ProcessCounters::logProcessCounters(int64_t time) {
 }
 
 void ProcessCounters::logExpensiveCounters() {
-  auto time = monotonicTime();
+  auto time = timestamps_.next();
   if (!mappingAggregator_.refresh()) {
     return;
   }
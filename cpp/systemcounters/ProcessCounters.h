@@ -111,6 +111,7 @@ class ProcessCounters {
   std::unique_ptr<ProcStatmFile> statmStats_;
   MappingAggregator mappingAggregator_;
   ProcessStats stats_;
+  CoarseTimestamps timestamps_;
 };
 
 } // namespace counters
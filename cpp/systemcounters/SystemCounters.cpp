@@ -190,7 +190,7 @@ void SystemCounters::logMeminfoCounters(int64_t time) {
 }
 
 void SystemCounters::logCounters() {
-  auto time = monotonicTime();
+  auto time = timestamps_.next();
   logMallinfo(time);
   logSysinfo(time);
   logVmStatCounters(time);
@@ -83,6 +83,7 @@ class SystemCounters {
   bool meminfoTracingDisabled_;
   int32_t extraAvailableCounters_;
   SystemStats stats_;
+  CoarseTimestamps timestamps_;
 
  public:
   SystemCounters(MultiBufferLogger& logger, int32_t pid = getpid())
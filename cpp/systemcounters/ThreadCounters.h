@@ -18,7 +18,10 @@
 
 #include <logger/MultiBufferLogger.h>
 #include <profilo/counters/ProcFs.h>
+#include <profilo/util/ThreadLifecycle.h>
 #include <mutex>
+#include <utility>
+#include <vector>
 
 using facebook::profilo::logger::MultiBufferLogger;
 
@@ -40,14 +43,22 @@ constexpr auto kHighFreqStatsMask = StatType::CPU_TIME | StatType::STATE |
 
 } // namespace
 
-class ThreadCounters {
+class ThreadCounters : private util::ThreadLifecycle::Listener {
  public:
-  ThreadCounters(MultiBufferLogger& logger) : cache_(logger) {}
+  ThreadCounters(MultiBufferLogger& logger) : cache_(logger) {
+    cache_.setThreadEvents(
+        util::ThreadLifecycle::getInstance().addListener(this));
+  }
+
+  ~ThreadCounters() {
+    util::ThreadLifecycle::getInstance().removeListener(this);
+  }
 
   void logCounters(
       bool highFrequencyMode,
       std::unordered_set<int32_t>& ignoredTids) {
     std::lock_guard<std::mutex> lock(mtx_);
+    applyThreadEvents();
     cache_.sampleAndLogForEach(
         kAllThreadsStatsMask, highFrequencyMode ? &ignoredTids : nullptr);
   }
@@ -66,9 +77,39 @@ class ThreadCounters {
   }
 
  private:
+  // Queued rather than applied, not to block exiting threads on sampling.
+  void onThreadStart(int32_t tid) override {
+    std::lock_guard<std::mutex> lock(threadEventsMtx_);
+    threadEvents_.emplace_back(tid, true);
+  }
+
+  void onThreadExit(int32_t tid) override {
+    std::lock_guard<std::mutex> lock(threadEventsMtx_);
+    threadEvents_.emplace_back(tid, false);
+  }
+
+  // With mtx_ held.
+  void applyThreadEvents() {
+    std::vector<std::pair<int32_t, bool>> events;
+    {
+      std::lock_guard<std::mutex> lock(threadEventsMtx_);
+      events.swap(threadEvents_);
+    }
+    for (auto& event : events) {
+      if (event.second) {
+        cache_.onThreadStart(event.first);
+      } else {
+        cache_.onThreadExit(event.first);
+      }
+    }
+  }
+
   int32_t extraAvailableCounters_;
   std::mutex mtx_; // Guards cache_
   ThreadCache cache_;
+  std::mutex threadEventsMtx_; // Guards threadEvents_
+  // Started (true) and exited threads since the last sampling.
+  std::vector<std::pair<int32_t, bool>> threadEvents_;
 };
 
 } // namespace counters
@@ -0,0 +1,421 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <profilo/entries/EntryParser.h>
+#include <profilo/logger/Logger.h>
+#include <profilo/logger/buffer/ByteRingBuffer.h>
+#include <profilo/mmapbuf/Buffer.h>
+
+namespace facebook {
+namespace profilo {
+namespace logger {
+
+using ReadResult = ByteRingBuffer::ReadResult;
+using WriteMode = lfrb::WriteMode;
+
+class ByteRingBufferTestAccessor {
+ public:
+  static ByteRingBuffer* allocate(
+      size_t capacity,
+      WriteMode mode = WriteMode::GUARANTEED) {
+    auto mem = new uint64_t
+        [ByteRingBuffer::calculateAllocationSize(capacity) / sizeof(uint64_t)];
+    return ByteRingBuffer::allocateAt(capacity, mem, mode);
+  }
+
+  static void destroy(ByteRingBuffer* buf) {
+    delete[] reinterpret_cast<uint64_t*>(buf);
+  }
+};
+
+namespace {
+
+constexpr size_t kCapacity = 256;
+
+class ByteRingBufferTest : public ::testing::Test {
+ protected:
+  ByteRingBufferTest()
+      : ::testing::Test(), ring_(ByteRingBufferTestAccessor::allocate(kCapacity)) {}
+
+  ~ByteRingBufferTest() override {
+    ByteRingBufferTestAccessor::destroy(ring_);
+  }
+
+  ByteRingBuffer::Cursor write(std::string const& value) {
+    return write(*ring_, value);
+  }
+
+  static ByteRingBuffer::Cursor write(
+      ByteRingBuffer& ring,
+      std::string const& value) {
+    auto reservation = ring.reserve(value.size());
+    if (reservation.data != nullptr) {
+      std::memcpy(reservation.data, value.data(), value.size());
+      ring.commit(reservation);
+    }
+    return reservation.position;
+  }
+
+  std::vector<std::string> readAll(
+      ByteRingBuffer::Cursor cursor,
+      bool writers_gone = false) {
+    std::vector<std::string> values;
+    std::vector<char> record;
+    while (ring_->tryRead(cursor, record, writers_gone) == ReadResult::OK) {
+      values.emplace_back(record.begin(), record.end());
+    }
+    return values;
+  }
+
+  ByteRingBuffer* ring_;
+};
+
+} // namespace
+
+TEST_F(ByteRingBufferTest, testRecordsReadBackInOrder) {
+  write("a");
+  write("");
+  write("a longer record than the header");
+
+  auto values = readAll(ring_->currentTail());
+  ASSERT_EQ(values.size(), 3);
+  EXPECT_EQ(values[0], "a");
+  EXPECT_EQ(values[1], "");
+  EXPECT_EQ(values[2], "a longer record than the header");
+}
+
+TEST_F(ByteRingBufferTest, testRecordsAreContiguous) {
+  auto first = write("12345678");
+  auto second = write("x");
+  // 8 bytes of header, 8 of payload.
+  EXPECT_EQ(first.distanceTo(second), 16);
+  // 8 bytes of header, 1 of payload padded to 8.
+  EXPECT_EQ(second.distanceTo(ring_->currentHead()), 16);
+}
+
+TEST_F(ByteRingBufferTest, testUncommittedRecordHoldsBackReaders) {
+  auto first = ring_->reserve(4);
+  write("next");
+
+  std::vector<char> record;
+  auto cursor = ring_->currentTail();
+  EXPECT_EQ(ring_->tryRead(cursor, record), ReadResult::NOT_READY);
+
+  std::memcpy(first.data, "head", 4);
+  ring_->commit(first);
+
+  auto values = readAll(ring_->currentTail());
+  ASSERT_EQ(values.size(), 2);
+  EXPECT_EQ(values[0], "head");
+  EXPECT_EQ(values[1], "next");
+}
+
+TEST_F(ByteRingBufferTest, testWritersGoneSkipsUncommittedRecord) {
+  ring_->reserve(4);
+  write("after");
+
+  auto values = readAll(ring_->currentTail(), /* writers_gone */ true);
+  ASSERT_EQ(values.size(), 1);
+  EXPECT_EQ(values[0], "after");
+}
+
+TEST_F(ByteRingBufferTest, testRecordsDontStraddleTheEnd) {
+  // 24 byte records don't divide the ring, every lap ends in padding.
+  std::vector<std::string> written;
+  for (int idx = 0; idx < 100; ++idx) {
+    auto value = "record " + std::to_string(100 + idx) + "..";
+    ASSERT_EQ(value.size(), 12);
+    write(value);
+    written.push_back(value);
+  }
+
+  auto tail = ring_->currentTail();
+  auto values = readAll(tail);
+  ASSERT_GT(values.size(), 0);
+  EXPECT_LE(tail.distanceTo(ring_->currentHead()), kCapacity);
+  for (size_t idx = 0; idx < values.size(); ++idx) {
+    EXPECT_EQ(values[idx], written[written.size() - values.size() + idx]);
+  }
+}
+
+TEST_F(ByteRingBufferTest, testLappedReaderNotices) {
+  auto cursor = ring_->currentHead();
+  for (int idx = 0; idx < 20; ++idx) {
+    write("0123456789abcdef");
+  }
+
+  std::vector<char> record;
+  EXPECT_EQ(ring_->tryRead(cursor, record), ReadResult::LAPPED);
+}
+
+TEST_F(ByteRingBufferTest, testOversizedRecordIsDropped) {
+  auto reservation = ring_->reserve(kCapacity);
+  EXPECT_EQ(reservation.data, nullptr);
+  EXPECT_EQ(ring_->droppedWrites(), 1);
+}
+
+TEST_F(ByteRingBufferTest, testReadAtSkipsUncommittedRecords) {
+  auto first = ring_->reserve(4);
+  auto second = write("next");
+
+  std::vector<char> record;
+  EXPECT_EQ(ring_->readAt(first.position, record), ReadResult::NOT_READY);
+  ASSERT_EQ(ring_->readAt(second, record), ReadResult::OK);
+  EXPECT_EQ(std::string(record.begin(), record.end()), "next");
+  ring_->commit(first);
+}
+
+TEST_F(ByteRingBufferTest, testReadAtNeedsTheStartOfARecord) {
+  auto position = write("0123456789abcdef");
+
+  std::vector<char> record;
+  auto inside = ByteRingBuffer::Cursor(
+      ByteRingBuffer::positionOf(position) + ByteRingBuffer::kAlignment);
+  EXPECT_EQ(ring_->readAt(inside, record), ReadResult::NOT_READY);
+  EXPECT_EQ(
+      ring_->readAt(ring_->currentHead(), record), ReadResult::NOT_READY);
+}
+
+TEST_F(ByteRingBufferTest, testReadAtNoticesOverwrittenRecord) {
+  auto position = write("0123456789abcdef");
+  for (int idx = 0; idx < 20; ++idx) {
+    write("0123456789abcdef");
+  }
+
+  std::vector<char> record;
+  EXPECT_EQ(ring_->readAt(position, record), ReadResult::LAPPED);
+}
+
+TEST(ByteRingBufferLossyTest, testDropsInsteadOfWaiting) {
+  auto ring = ByteRingBufferTestAccessor::allocate(128, WriteMode::LOSSY);
+  // Stuck writer, nothing after it can be reclaimed.
+  auto stuck = ring->reserve(8);
+  ASSERT_NE(stuck.data, nullptr);
+
+  size_t dropped = 0;
+  for (int idx = 0; idx < 20; ++idx) {
+    auto reservation = ring->reserve(8);
+    if (reservation.data == nullptr) {
+      ++dropped;
+      continue;
+    }
+    ring->commit(reservation);
+  }
+  EXPECT_GT(dropped, 0);
+  EXPECT_EQ(ring->droppedWrites(), dropped);
+
+  ring->commit(stuck);
+  EXPECT_NE(ring->reserve(8).data, nullptr);
+  ByteRingBufferTestAccessor::destroy(ring);
+}
+
+TEST(ByteRingBufferConcurrencyTest, testReaderSeesWholeRecords) {
+  constexpr int kWriters = 4;
+  constexpr int kRecordsPerWriter = 20000;
+  auto ring = ByteRingBufferTestAccessor::allocate(4096);
+
+  // Record: writer index, sequence number, then the writer index repeated
+  // over a length that varies with the sequence number.
+  std::atomic<int> finished{0};
+  std::vector<std::thread> writers;
+  for (int writer = 0; writer < kWriters; ++writer) {
+    writers.emplace_back([ring, writer, &finished] {
+      for (int seq = 0; seq < kRecordsPerWriter; ++seq) {
+        std::string value(2 * sizeof(int) + seq % 37, static_cast<char>(writer));
+        std::memcpy(&value[0], &writer, sizeof(int));
+        std::memcpy(&value[sizeof(int)], &seq, sizeof(int));
+        auto reservation = ring->reserve(value.size());
+        std::memcpy(reservation.data, value.data(), value.size());
+        ring->commit(reservation);
+      }
+      finished.fetch_add(1);
+    });
+  }
+
+  std::vector<int> last_seq(kWriters, -1);
+  auto cursor = ring->currentTail();
+  std::vector<char> record;
+  while (true) {
+    bool done = finished.load() == kWriters;
+    auto result = ring->tryRead(cursor, record);
+    if (result == ReadResult::LAPPED) {
+      cursor = ring->currentTail();
+      continue;
+    }
+    if (result == ReadResult::NOT_READY) {
+      if (done) {
+        break;
+      }
+      std::this_thread::yield();
+      continue;
+    }
+
+    int writer, seq;
+    ASSERT_GE(record.size(), 2 * sizeof(int));
+    std::memcpy(&writer, record.data(), sizeof(int));
+    std::memcpy(&seq, record.data() + sizeof(int), sizeof(int));
+    ASSERT_GE(writer, 0);
+    ASSERT_LT(writer, kWriters);
+    ASSERT_EQ(record.size(), 2 * sizeof(int) + seq % 37);
+    for (size_t idx = 2 * sizeof(int); idx < record.size(); ++idx) {
+      ASSERT_EQ(record[idx], static_cast<char>(writer));
+    }
+    ASSERT_GT(seq, last_seq[writer]);
+    last_seq[writer] = seq;
+  }
+
+  for (auto& thread : writers) {
+    thread.join();
+  }
+  EXPECT_EQ(ring->droppedWrites(), 0);
+  ByteRingBufferTestAccessor::destroy(ring);
+}
+
+namespace {
+
+class CountingVisitor : public entries::EntryVisitor {
+ public:
+  void visit(const entries::StandardEntry& entry) override {
+    standard.push_back(entry.type);
+  }
+
+  void visit(const entries::FramesEntry& entry) override {
+    frames.push_back(entry.frames.size);
+  }
+
+  void visit(const entries::BytesEntry& entry) override {
+    bytes.emplace_back(
+        reinterpret_cast<const char*>(entry.bytes.values), entry.bytes.size);
+  }
+
+  std::vector<entries::EntryType> standard;
+  std::vector<uint16_t> frames;
+  std::vector<std::string> bytes;
+};
+
+size_t countReadable(mmapbuf::Buffer& buffer) {
+  CountingVisitor visitor;
+  if (buffer.backend() == mmapbuf::Buffer::Backend::BYTE_RING) {
+    auto cursor = buffer.byteRing().currentTail();
+    std::vector<char> record;
+    while (buffer.byteRing().tryRead(cursor, record) == ReadResult::OK) {
+      entries::EntryParser::parse(record.data(), record.size(), visitor);
+    }
+    return visitor.standard.size();
+  }
+  auto cursor = buffer.ringBuffer().currentTail();
+  alignas(4) Packet packet;
+  size_t count = 0;
+  while (buffer.ringBuffer().tryRead(packet, cursor)) {
+    ++count;
+    cursor.moveForward();
+  }
+  return count;
+}
+
+} // namespace
+
+TEST(ByteRingBackendTest, testLoggerWritesWholeEntries) {
+  mmapbuf::Buffer buffer(
+      256, 1, WriteMode::GUARANTEED, mmapbuf::Buffer::Backend::BYTE_RING);
+  ASSERT_EQ(buffer.shardCount(), 1);
+
+  auto before = buffer.currentHeads().front();
+  auto id = buffer.logger().write(entries::StandardEntry{
+      .id = 0,
+      .type = entries::EntryType::MARK_PUSH,
+      .timestamp = 1,
+      .tid = 1,
+      .callid = 0,
+      .matchid = 0,
+      .extra = 0});
+  std::string name(200, 'n');
+  buffer.logger().writeBytes(
+      entries::EntryType::STRING_VALUE,
+      id,
+      reinterpret_cast<const uint8_t*>(name.data()),
+      name.size());
+  int64_t frames[300] = {};
+  buffer.logger().write(entries::FramesEntry{
+      .id = 0,
+      .type = entries::EntryType::STACK_FRAME,
+      .timestamp = 2,
+      .tid = 1,
+      .matchid = 0,
+      .frames = {.values = frames, .size = 300}});
+
+  CountingVisitor visitor;
+  auto cursor = before;
+  std::vector<char> record;
+  while (buffer.byteRing().tryRead(cursor, record) == ReadResult::OK) {
+    entries::EntryParser::parse(record.data(), record.size(), visitor);
+  }
+  ASSERT_EQ(visitor.standard.size(), 1);
+  EXPECT_EQ(visitor.standard[0], entries::EntryType::MARK_PUSH);
+  cursor = before;
+  ASSERT_EQ(buffer.byteRing().tryRead(cursor, record), ReadResult::OK);
+  EXPECT_TRUE(
+      entries::peek_type(record.data(), record.size()) ==
+      entries::StandardEntry::kCompactSerializationType);
+  ASSERT_EQ(visitor.bytes.size(), 1);
+  EXPECT_EQ(visitor.bytes[0], name);
+  ASSERT_EQ(visitor.frames.size(), 1);
+  EXPECT_EQ(visitor.frames[0], 300);
+}
+
+TEST(ByteRingBackendTest, testHoldsMoreEntriesInTheSameSpace) {
+  constexpr size_t kSlots = 256;
+  mmapbuf::Buffer packets(kSlots);
+  mmapbuf::Buffer records(
+      kSlots, 1, WriteMode::GUARANTEED, mmapbuf::Buffer::Backend::BYTE_RING);
+
+  for (auto buffer : {&packets, &records}) {
+    for (size_t idx = 0; idx < 4 * kSlots; ++idx) {
+      buffer->logger().write(entries::StandardEntry{
+          .id = 0,
+          .type = entries::EntryType::MARK_PUSH,
+          .timestamp = static_cast<int64_t>(idx),
+          .tid = 1,
+          .callid = 0,
+          .matchid = 0,
+          .extra = 0});
+    }
+  }
+
+  EXPECT_EQ(countReadable(packets), kSlots);
+  // In the compact encoding these take less than half a slot each.
+  EXPECT_GT(countReadable(records), 2 * kSlots);
+}
+
+TEST(ByteRingBackendTest, testCantBeSharded) {
+  EXPECT_THROW(
+      mmapbuf::Buffer(
+          64, 2, WriteMode::GUARANTEED, mmapbuf::Buffer::Backend::BYTE_RING),
+      std::invalid_argument);
+}
+
+} // namespace logger
+} // namespace profilo
+} // namespace facebook
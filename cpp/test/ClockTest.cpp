@@ -0,0 +1,125 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <time.h>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <profilo/util/Clock.h>
+#include <profilo/util/common.h>
+
+namespace facebook {
+namespace profilo {
+
+namespace {
+
+// Generous, the test may be descheduled between any two reads.
+constexpr int64_t kToleranceNs = 50000000; // 50ms
+
+int64_t clockMonotonic() {
+  timespec ts{};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+class ClockTest : public ::testing::Test {
+ protected:
+  virtual void TearDown() override {
+    clock::setSource(clock::Source::VDSO);
+  }
+};
+
+} // namespace
+
+TEST_F(ClockTest, testDefaultSourceIsVdso) {
+  EXPECT_EQ(clock::currentSource(), clock::Source::VDSO);
+  EXPECT_EQ(std::string(clock::sourceName(clock::currentSource())), "vdso");
+}
+
+TEST_F(ClockTest, testSourcesShareTheMonotonicTimeline) {
+  for (auto source :
+       {clock::Source::VDSO,
+        clock::Source::SYSCALL,
+        clock::Source::CYCLE_COUNTER,
+        clock::Source::COARSE}) {
+    auto before = clockMonotonic();
+    auto value = clock::read(source);
+    auto after = clockMonotonic();
+    EXPECT_GE(value, before - kToleranceNs) << clock::sourceName(source);
+    EXPECT_LE(value, after + kToleranceNs) << clock::sourceName(source);
+  }
+}
+
+TEST_F(ClockTest, testMonotonicTimeFollowsSelectedSource) {
+  ASSERT_TRUE(clock::setSource(clock::Source::SYSCALL));
+  EXPECT_EQ(clock::currentSource(), clock::Source::SYSCALL);
+
+  auto first = monotonicTime();
+  auto second = monotonicTime();
+  EXPECT_LE(first, second);
+}
+
+TEST_F(ClockTest, testCoarseIsNotSelectable) {
+  EXPECT_TRUE(clock::isAvailable(clock::Source::COARSE));
+  EXPECT_FALSE(clock::setSource(clock::Source::COARSE));
+  EXPECT_EQ(clock::currentSource(), clock::Source::VDSO);
+}
+
+TEST_F(ClockTest, testCycleCounterTracksMonotonicClock) {
+  if (!clock::setSource(clock::Source::CYCLE_COUNTER)) {
+    // No usable counter on this machine.
+    EXPECT_EQ(clock::currentSource(), clock::Source::VDSO);
+    return;
+  }
+  EXPECT_EQ(clock::currentSource(), clock::Source::CYCLE_COUNTER);
+
+  // Cross a resync or two.
+  auto end = clockMonotonic() + 2 * clock::kResyncIntervalNs + 100000000;
+  int64_t last = 0;
+  while (clockMonotonic() < end) {
+    auto before = clockMonotonic();
+    auto value = monotonicTime();
+    auto after = clockMonotonic();
+    EXPECT_GE(value, before - kToleranceNs);
+    EXPECT_LE(value, after + kToleranceNs);
+    EXPECT_GT(value, last);
+    last = value;
+
+    timespec wait{.tv_sec = 0, .tv_nsec = 1000000};
+    nanosleep(&wait, nullptr);
+  }
+}
+
+TEST_F(ClockTest, testCycleCounterStrictlyIncreasesAcrossResyncs) {
+  if (!clock::setSource(clock::Source::CYCLE_COUNTER)) {
+    return;
+  }
+
+  // Back to back reads, so some land right before and after each resync.
+  auto end = clockMonotonic() + 2 * clock::kResyncIntervalNs + 100000000;
+  auto last = monotonicTime();
+  while (clockMonotonic() < end) {
+    for (int i = 0; i < 1000; ++i) {
+      auto value = monotonicTime();
+      ASSERT_GT(value, last);
+      last = value;
+    }
+  }
+}
+
+} // namespace profilo
+} // namespace facebook
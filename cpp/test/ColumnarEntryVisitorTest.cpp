@@ -0,0 +1,210 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <generated/EntryParser.h>
+#include <writer/ColumnarEntryVisitor.h>
+#include <writer/DeltaEncodingVisitor.h>
+#include <writer/PrintEntryVisitor.h>
+
+using namespace facebook::profilo::entries;
+using namespace facebook::profilo::writer;
+
+namespace facebook {
+namespace profilo {
+
+namespace {
+
+struct ByteReader {
+  const uint8_t* pos;
+  const uint8_t* end;
+
+  uint64_t varint() {
+    uint64_t value = 0;
+    for (int shift = 0;; shift += 7) {
+      EXPECT_LT(pos, end) << "varint past the end of its column";
+      uint8_t byte = *pos++;
+      value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0) {
+        return value;
+      }
+    }
+  }
+
+  int64_t zigzag() {
+    uint64_t value = varint();
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+  }
+
+  ByteReader slice(size_t size) {
+    ByteReader column{pos, pos + size};
+    pos += size;
+    return column;
+  }
+};
+
+// Turns the columnar encoding back into PrintEntryVisitor's text format.
+std::string decodeToText(std::string const& data, size_t& blocks) {
+  auto begin = reinterpret_cast<const uint8_t*>(data.data());
+  ByteReader reader{begin, begin + data.size()};
+  std::map<uint64_t, std::string> type_names;
+  std::stringstream out;
+
+  blocks = 0;
+  while (reader.pos < reader.end) {
+    ++blocks;
+    auto rows = reader.varint();
+    auto new_types = reader.varint();
+    for (uint64_t i = 0; i < new_types; ++i) {
+      auto type = reader.varint();
+      auto name = reader.slice(reader.varint());
+      type_names[type] = std::string(name.pos, name.end);
+    }
+
+    std::vector<ByteReader> columns;
+    for (int i = 0; i < 8; ++i) {
+      columns.push_back(reader.slice(reader.varint()));
+    }
+    auto& kind = columns[0];
+    auto& id = columns[1];
+    auto& matchid = columns[5];
+    auto& bytes = columns[7];
+
+    for (uint64_t row = 0; row < rows; ++row) {
+      auto row_kind = kind.varint();
+      out << id.zigzag() << '|' << type_names.at(row_kind >> 1) << '|';
+      if (row_kind & 1) {
+        out << matchid.zigzag() << '|';
+        auto value = bytes.slice(bytes.varint());
+        out << std::string(value.pos, value.end) << '\n';
+        continue;
+      }
+      out << columns[2].zigzag() << '|' << columns[3].zigzag() << '|'
+          << columns[4].zigzag() << '|' << matchid.zigzag() << '|'
+          << columns[6].zigzag() << '\n';
+    }
+
+    for (auto& column : columns) {
+      EXPECT_EQ(column.pos, column.end) << "column not fully consumed";
+    }
+  }
+  return out.str();
+}
+
+template <class Fn>
+void writeBoth(Fn&& fn, std::string& text, std::string& columnar) {
+  std::stringstream text_stream;
+  PrintEntryVisitor print(text_stream);
+  DeltaEncodingVisitor print_delta(print);
+  fn(print_delta);
+
+  std::stringstream columnar_stream;
+  ColumnarEntryVisitor columns(columnar_stream);
+  DeltaEncodingVisitor columns_delta(columns);
+  fn(columns_delta);
+  columns.flush();
+
+  text = text_stream.str();
+  columnar = columnar_stream.str();
+}
+
+} // namespace
+
+TEST(ColumnarEntryVisitorTest, testMatchesTextFormat) {
+  std::string text, columnar;
+  writeBoth(
+      [](EntryVisitor& visitor) {
+        visitor.visit(StandardEntry{
+            .id = 10,
+            .type = EntryType::TRACE_START,
+            .timestamp = 123,
+            .tid = 0,
+            .callid = 1,
+            .matchid = 2,
+            .extra = 3});
+        int64_t frames[] = {100, 200, -300};
+        visitor.visit(FramesEntry{
+            .id = 11,
+            .type = EntryType::STACK_FRAME,
+            .timestamp = 125,
+            .tid = 5,
+            .matchid = 0,
+            .frames = {.values = frames, .size = 3}});
+        uint8_t bytes[] = {'h', 'i', '!'};
+        visitor.visit(BytesEntry{
+            .id = 14,
+            .type = EntryType::STRING_KEY,
+            .matchid = 11,
+            .bytes = {.values = bytes, .size = 3}});
+        visitor.visit(StandardEntry{
+            .id = 15,
+            .type = EntryType::TRACE_END,
+            .timestamp = std::numeric_limits<int64_t>::max(),
+            .tid = std::numeric_limits<int32_t>::min(),
+            .callid = 0,
+            .matchid = 0,
+            .extra = std::numeric_limits<int64_t>::min()});
+      },
+      text,
+      columnar);
+
+  size_t blocks = 0;
+  EXPECT_EQ(decodeToText(columnar, blocks), text);
+  EXPECT_EQ(blocks, 1);
+}
+
+TEST(ColumnarEntryVisitorTest, testSplitsIntoBlocks) {
+  std::string text, columnar;
+  writeBoth(
+      [](EntryVisitor& visitor) {
+        constexpr auto kRows =
+            static_cast<int32_t>(ColumnarEntryVisitor::kBlockRows);
+        for (int32_t idx = 0; idx <= kRows; ++idx) {
+          visitor.visit(StandardEntry{
+              .id = idx,
+              .type = EntryType::MARK_PUSH,
+              .timestamp = idx * 1000,
+              .tid = 1,
+              .callid = 0,
+              .matchid = 0,
+              .extra = 0});
+        }
+      },
+      text,
+      columnar);
+
+  size_t blocks = 0;
+  EXPECT_EQ(decodeToText(columnar, blocks), text);
+  EXPECT_EQ(blocks, 2);
+  EXPECT_LT(columnar.size(), text.size() / 2);
+}
+
+TEST(ColumnarEntryVisitorTest, testFlushWithoutEntriesWritesNothing) {
+  std::stringstream stream;
+  ColumnarEntryVisitor visitor(stream);
+  visitor.flush();
+  EXPECT_TRUE(stream.str().empty());
+}
+
+} // namespace profilo
+} // namespace facebook
@@ -0,0 +1,90 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <gtest/gtest.h>
+#include <zstr/zstr.hpp>
+
+#include <writer/Compression.h>
+
+using namespace facebook::profilo::writer;
+
+namespace facebook {
+namespace profilo {
+
+namespace {
+
+std::string makeTraceText(size_t lines) {
+  std::stringstream text;
+  for (size_t i = 0; i < lines; ++i) {
+    text << (i + 1) << "|MARK_PUSH|" << (i * 17) << "|" << (1000 + i % 7)
+         << "|0|0|" << i << "\n";
+  }
+  return text.str();
+}
+
+// Writes `input` through the codec in two syncs, so the output holds two
+// gzip members.
+std::string compress(CompressionConfig const& config, std::string const& input) {
+  std::stringstream sink;
+  {
+    auto buf = makeCompressingStreambuf(sink.rdbuf(), config);
+    std::ostream out(buf.get());
+    size_t half = input.size() / 2;
+    out.write(input.data(), half);
+    out.flush();
+    out.write(input.data() + half, input.size() - half);
+    out.flush();
+  }
+  return sink.str();
+}
+
+} // namespace
+
+TEST(CompressionTest, testCodecNamesRoundTrip) {
+  for (auto codec : {CompressionCodec::NONE, CompressionCodec::ZLIB}) {
+    EXPECT_EQ(codec, parseCompressionCodec(getCompressionCodecName(codec)));
+  }
+  EXPECT_THROW(parseCompressionCodec("zstd"), std::invalid_argument);
+}
+
+TEST(CompressionTest, testNoneHasNoStreambuf) {
+  std::stringstream sink;
+  CompressionConfig config;
+  config.codec = CompressionCodec::NONE;
+  EXPECT_EQ(nullptr, makeCompressingStreambuf(sink.rdbuf(), config));
+}
+
+TEST(CompressionTest, testZlibRoundTrip) {
+  auto input = makeTraceText(10000);
+  CompressionConfig config;
+  config.codec = CompressionCodec::ZLIB;
+  auto compressed = compress(config, input);
+  EXPECT_LT(compressed.size(), input.size());
+
+  std::stringstream compressed_stream(compressed);
+  zstr::istreambuf decompressed(compressed_stream.rdbuf());
+  std::stringstream output;
+  output << &decompressed;
+  EXPECT_EQ(input, output.str());
+}
+
+} // namespace profilo
+} // namespace facebook
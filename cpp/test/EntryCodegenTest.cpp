@@ -16,12 +16,15 @@
 
 #include <limits>
 #include <sstream>
+#include <vector>
 
 #include <gtest/gtest.h>
 
 #include <generated/Entry.h>
 #include <generated/EntryParser.h>
 #include <entries/EntryType.h>
+#include <mmapbuf/Buffer.h>
+#include <writer/PacketReassembler.h>
 #include <writer/PrintEntryVisitor.h>
 
 namespace facebook {
@@ -73,6 +76,97 @@ TEST(EntryCodegen, testPackUnpackStandardEntry) {
   EXPECT_EQ(input.extra, entry.extra);
 }
 
+TEST(EntryCodegen, testPackUnpackCompactStandardEntry) {
+  StandardEntry input{
+      .id = 10,
+      .type = EntryType::TRACE_START,
+      .timestamp = std::numeric_limits<int64_t>::max(),
+      .tid = -1,
+      .callid = std::numeric_limits<int32_t>::min(),
+      .matchid = 0,
+      .extra = -300};
+
+  char buffer[StandardEntry::kMaxCompactSize]{};
+  StandardEntry::packCompact(input, buffer, sizeof(buffer));
+
+  TestVisitor visitor;
+  EntryParser::parse(
+      buffer, StandardEntry::calculateCompactSize(input), visitor);
+
+  auto& entry = visitor.standardEntry;
+  EXPECT_EQ(input.id, entry.id);
+  EXPECT_EQ(input.type, entry.type);
+  EXPECT_EQ(input.timestamp, entry.timestamp);
+  EXPECT_EQ(input.tid, entry.tid);
+  EXPECT_EQ(input.callid, entry.callid);
+  EXPECT_EQ(input.matchid, entry.matchid);
+  EXPECT_EQ(input.extra, entry.extra);
+}
+
+TEST(EntryCodegen, testCompactStandardEntryOmitsZeroFields) {
+  StandardEntry input{
+      .id = 1000,
+      .type = EntryType::MARK_PUSH,
+      .timestamp = 123456789012,
+      .tid = 4000,
+      .callid = 0,
+      .matchid = 0,
+      .extra = 0};
+
+  // type + bitmap + id (2) + type (1) + timestamp (6) + tid (2)
+  EXPECT_EQ(StandardEntry::calculateCompactSize(input), 13);
+  EXPECT_LT(
+      StandardEntry::calculateCompactSize(input),
+      StandardEntry::calculateSize(input) / 2);
+
+  char buffer[StandardEntry::kMaxCompactSize]{};
+  StandardEntry::packCompact(input, buffer, 13);
+
+  StandardEntry entry{
+      .id = 1,
+      .type = EntryType::MARK_POP,
+      .timestamp = 1,
+      .tid = 1,
+      .callid = 1,
+      .matchid = 1,
+      .extra = 1};
+  // unpack() takes either encoding.
+  StandardEntry::unpack(entry, buffer, 13);
+  EXPECT_EQ(input.id, entry.id);
+  EXPECT_EQ(input.type, entry.type);
+  EXPECT_EQ(input.timestamp, entry.timestamp);
+  EXPECT_EQ(input.tid, entry.tid);
+  EXPECT_EQ(0, entry.callid);
+  EXPECT_EQ(0, entry.matchid);
+  EXPECT_EQ(0, entry.extra);
+}
+
+TEST(EntryCodegen, testCompactStandardEntryBounds) {
+  StandardEntry input{
+      .id = 10,
+      .type = EntryType::COUNTER,
+      .timestamp = 123,
+      .tid = 1,
+      .callid = 0,
+      .matchid = 0,
+      .extra = 100000};
+  auto size = StandardEntry::calculateCompactSize(input);
+
+  char buffer[StandardEntry::kMaxCompactSize]{};
+  EXPECT_THROW(
+      StandardEntry::packCompact(input, buffer, size - 1), std::out_of_range);
+  EXPECT_THROW(
+      StandardEntry::packCompact(input, nullptr, size), std::invalid_argument);
+
+  StandardEntry::packCompact(input, buffer, size);
+  StandardEntry entry{};
+  EXPECT_THROW(
+      StandardEntry::unpackCompact(entry, buffer, size - 1), std::out_of_range);
+  EXPECT_THROW(
+      StandardEntry::unpackCompact(entry, nullptr, size),
+      std::invalid_argument);
+}
+
 TEST(EntryCodegen, testPrintStandardEntry) {
   StandardEntry input{
       .id = 10,
@@ -301,6 +395,121 @@ TEST(EntryCodegen, testPackTooSmallThrows) {
   }
 }
 
+TEST(EntryCodegen, testPackHeaderMatchesPack) {
+  int64_t frames[] = {100, 200, 300};
+  FramesEntry frames_input{
+      .id = 10,
+      .type = EntryType::STACK_FRAME,
+      .timestamp = 123,
+      .tid = 1,
+      .frames = {.values = frames, .size = 3},
+  };
+  uint8_t bytes[] = {'h', 'i', '!'};
+  BytesEntry bytes_input{
+      .id = 10,
+      .type = EntryType::STRING_KEY,
+      .matchid = 1,
+      .bytes = {.values = bytes, .size = 3},
+  };
+
+  // packHeader() followed by the raw values must be byte-identical to pack().
+  {
+    alignas(4) char packed[FramesEntry::kHeaderSize + sizeof(frames) + 8]{};
+    FramesEntry::pack(frames_input, packed, sizeof(packed));
+
+    alignas(4) char split[sizeof(packed)]{};
+    FramesEntry::packHeader(frames_input, split, FramesEntry::kHeaderSize);
+    std::memcpy(split + FramesEntry::kHeaderSize, frames, sizeof(frames));
+
+    EXPECT_EQ(
+        0,
+        std::memcmp(packed, split, FramesEntry::kHeaderSize + sizeof(frames)));
+  }
+  {
+    alignas(4) char packed[BytesEntry::kHeaderSize + sizeof(bytes) + 8]{};
+    BytesEntry::pack(bytes_input, packed, sizeof(packed));
+
+    alignas(4) char split[sizeof(packed)]{};
+    BytesEntry::packHeader(bytes_input, split, BytesEntry::kHeaderSize);
+    std::memcpy(split + BytesEntry::kHeaderSize, bytes, sizeof(bytes));
+
+    EXPECT_EQ(
+        0,
+        std::memcmp(packed, split, BytesEntry::kHeaderSize + sizeof(bytes)));
+  }
+}
+
+TEST(EntryCodegen, testPackHeaderTooSmallThrows) {
+  FramesEntry frames{};
+  alignas(4) char buffer[FramesEntry::kHeaderSize];
+
+  EXPECT_THROW(
+      FramesEntry::packHeader(frames, buffer, sizeof(buffer) - 1),
+      std::out_of_range);
+  EXPECT_THROW(
+      FramesEntry::packHeader(frames, nullptr, sizeof(buffer)),
+      std::invalid_argument);
+}
+
+TEST(EntryCodegen, testLoggerWritesEntriesInPlace) {
+  std::vector<int64_t> frames(50);
+  for (size_t i = 0; i < frames.size(); ++i) {
+    frames[i] = i * 1000;
+  }
+
+  mmapbuf::Buffer buffer(100);
+  auto& logger = buffer.logger();
+  auto cursor = buffer.ringBuffer().currentHead();
+
+  logger.write(StandardEntry{
+      .id = 0,
+      .type = EntryType::TRACE_START,
+      .timestamp = 123,
+      .tid = 1,
+      .callid = 2,
+      .matchid = 3,
+      .extra = 4});
+  logger.write(FramesEntry{
+      .id = 0,
+      .type = EntryType::STACK_FRAME,
+      .timestamp = 456,
+      .tid = 1,
+      .frames = {
+          .values = frames.data(),
+          .size = static_cast<uint16_t>(frames.size())}});
+
+  // The standard entry occupies exactly one slot.
+  auto second = cursor;
+  second.moveForward();
+  logger::Packet packet;
+  ASSERT_TRUE(buffer.ringBuffer().tryRead(packet, cursor));
+  EXPECT_TRUE(packet.start);
+  EXPECT_FALSE(packet.next);
+  ASSERT_TRUE(buffer.ringBuffer().tryRead(packet, second));
+  EXPECT_TRUE(packet.start);
+
+  TestVisitor visitor{};
+  std::vector<int64_t> read_frames;
+  writer::PacketReassembler reassembler([&](const void* data, size_t size) {
+    EntryParser::parse(data, size, visitor);
+    if (visitor.framesEntry.frames.values != nullptr) {
+      const int64_t* values = visitor.framesEntry.frames.values;
+      read_frames.assign(values, values + visitor.framesEntry.frames.size);
+      visitor.framesEntry.frames.values = nullptr;
+    }
+  });
+  while (buffer.ringBuffer().tryRead(packet, cursor)) {
+    reassembler.process(packet);
+    cursor.moveForward();
+  }
+
+  EXPECT_EQ(visitor.standardEntry.type, EntryType::TRACE_START);
+  EXPECT_EQ(visitor.standardEntry.timestamp, 123);
+  EXPECT_EQ(visitor.standardEntry.extra, 4);
+  EXPECT_EQ(visitor.framesEntry.timestamp, 456);
+  EXPECT_EQ(read_frames, frames);
+}
+
 } // namespace entries
 } // namespace profilo
 } // namespace facebook
@@ -0,0 +1,180 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <generated/EntryParser.h>
+#include <profiler/Constants.h>
+#include <writer/ColumnarEntryVisitor.h>
+#include <writer/DeltaEncodingVisitor.h>
+#include <writer/FusedEntryVisitor.h>
+#include <writer/PrintEntryVisitor.h>
+#include <writer/StackTraceInvertingVisitor.h>
+#include <writer/TimestampTruncatingVisitor.h>
+
+using namespace facebook::profilo::entries;
+using namespace facebook::profilo::writer;
+
+namespace facebook {
+namespace profilo {
+
+namespace {
+
+int64_t kFrames[] = {0x7f0010, 0x7f0020, 0x7f0030, 0x7f0040};
+uint8_t kName[] = "com.example.Feed.onBind";
+
+void visitEntries(EntryVisitor& visitor) {
+  visitor.visit(StandardEntry{
+      .id = 512,
+      .type = EntryType::TRACE_START,
+      .timestamp = 1000123456,
+      .tid = 1000,
+      .callid = 0,
+      .matchid = 0,
+      .extra = 42});
+  visitor.visit(FramesEntry{
+      .id = 513,
+      .type = EntryType::STACK_FRAME,
+      .timestamp = 1000200499,
+      .tid = 1001,
+      .matchid = 0,
+      .frames = {.values = kFrames, .size = 4}});
+  visitor.visit(StandardEntry{
+      .id = 517,
+      .type = EntryType::COUNTER,
+      .timestamp = 1000200500,
+      .tid = 1001,
+      .callid = 9240581,
+      .matchid = 0,
+      .extra = 100});
+  visitor.visit(BytesEntry{
+      .id = 518,
+      .type = EntryType::STRING_NAME,
+      .matchid = 517,
+      .bytes = {.values = kName, .size = sizeof(kName) - 1}});
+  visitor.visit(FramesEntry{
+      .id = 519,
+      .type = EntryType::STACK_FRAME,
+      .timestamp = 1000300000,
+      .tid = 1000,
+      .matchid = 3,
+      .frames = {.values = kFrames + 1, .size = 2}});
+  visitor.visit(StandardEntry{
+      .id = 521,
+      .type = EntryType::MARK_POP,
+      .timestamp = std::numeric_limits<int64_t>::max() / 2,
+      .tid = 0,
+      .callid = std::numeric_limits<int32_t>::min(),
+      .matchid = -1,
+      .extra = std::numeric_limits<int64_t>::min()});
+}
+
+template <class Output>
+std::string writeWithChain() {
+  std::stringstream stream;
+  Output output(stream);
+  DeltaEncodingVisitor delta(output);
+  TimestampTruncatingVisitor truncate(delta);
+  StackTraceInvertingVisitor invert(truncate);
+  visitEntries(invert);
+  return stream.str();
+}
+
+template <class Output>
+std::string writeFused() {
+  std::stringstream stream;
+  Output output(stream);
+  FusedEntryVisitor<Output> fused(output);
+  visitEntries(fused);
+  return stream.str();
+}
+
+} // namespace
+
+TEST(FusedEntryVisitorTest, testMatchesChainText) {
+  EXPECT_EQ(writeFused<PrintEntryVisitor>(), writeWithChain<PrintEntryVisitor>());
+}
+
+TEST(FusedEntryVisitorTest, testMatchesChainColumnar) {
+  std::stringstream chain_stream;
+  {
+    ColumnarEntryVisitor output(chain_stream);
+    DeltaEncodingVisitor delta(output);
+    TimestampTruncatingVisitor truncate(delta);
+    StackTraceInvertingVisitor invert(truncate);
+    visitEntries(invert);
+    output.flush();
+  }
+
+  std::stringstream fused_stream;
+  {
+    ColumnarEntryVisitor output(fused_stream);
+    FusedEntryVisitor<ColumnarEntryVisitor> fused(output);
+    visitEntries(fused);
+    output.flush();
+  }
+
+  EXPECT_FALSE(fused_stream.str().empty());
+  EXPECT_EQ(fused_stream.str(), chain_stream.str());
+}
+
+TEST(FusedEntryVisitorTest, testFramesAreInvertedAndEncoded) {
+  std::stringstream stream;
+  PrintEntryVisitor print(stream);
+  FusedEntryVisitor<PrintEntryVisitor> fused(print);
+
+  int64_t frames[] = {300, 200, 100};
+  fused.visit(FramesEntry{
+      .id = 1,
+      .type = EntryType::STACK_FRAME,
+      .timestamp = 1499,
+      .tid = 1,
+      .matchid = 10,
+      .frames = {.values = frames, .size = 3}});
+
+  EXPECT_EQ(
+      stream.str(),
+      "1|STACK_FRAME|1|1|0|10|100\n"
+      "1|STACK_FRAME|0|0|0|0|100\n"
+      "1|STACK_FRAME|0|0|0|0|100\n");
+}
+
+TEST(FusedEntryVisitorTest, testTooDeepStackThrows) {
+  std::stringstream stream;
+  PrintEntryVisitor print(stream);
+  FusedEntryVisitor<PrintEntryVisitor> fused(print);
+
+  std::vector<int64_t> frames(MAX_STACK_DEPTH + 1);
+  EXPECT_THROW(
+      fused.visit(FramesEntry{
+          .id = 1,
+          .type = EntryType::STACK_FRAME,
+          .timestamp = 1,
+          .tid = 1,
+          .matchid = 0,
+          .frames =
+              {.values = frames.data(),
+               .size = static_cast<uint16_t>(frames.size())}}),
+      std::invalid_argument);
+}
+
+} // namespace profilo
+} // namespace facebook
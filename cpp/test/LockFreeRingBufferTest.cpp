@@ -19,10 +19,13 @@
 
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <chrono>
 #include <climits>
 #include <memory>
+#include <thread>
 
 #include <profilo/logger/lfrb/LockFreeRingBuffer.h>
+#include <profilo/test/TestSequencer.h>
 #include <profilo/util/common.h>
 
 #include <zlib.h>
@@ -49,12 +52,17 @@ using TestBufferSlot = detail::RingBufferSlot<TestPacket>;
 //
 class LockFreeRingBufferTestAccessor {
  public:
-  static TestBuffer* allocate(size_t count) {
+  static TestBuffer* allocate(
+      size_t count,
+      WriteMode mode = WriteMode::GUARANTEED) {
     char* mem = new char[TestBuffer::calculateAllocationSize(count)];
-    return allocateAt(count, mem);
+    return allocateAt(count, mem, mode);
   }
-  static TestBuffer* allocateAt(size_t count, void* ptr) {
-    return TestBuffer::allocateAt(count, ptr);
+  static TestBuffer* allocateAt(
+      size_t count,
+      void* ptr,
+      WriteMode mode = WriteMode::GUARANTEED) {
+    return TestBuffer::allocateAt(count, ptr, mode);
   }
 
   static void destroy(TestBuffer* buf) {
@@ -114,6 +122,306 @@ TEST(LockFreeRingBufferTest, testAllocationCorrectness) {
   EXPECT_EQ(crc, crc_after);
 }
 
+TEST(LockFreeRingBufferTest, testReserveWritesContiguousRange) {
+  constexpr auto kBufferSize = 16;
+  constexpr auto kReserved = 5;
+  TestBuffer* buffer = LockFreeRingBufferTestAccessor::allocate(kBufferSize);
+
+  alignas(4) TestPacket packet{.payload = {}};
+  buffer->write(packet);
+
+  auto cursor = buffer->reserve(kReserved);
+
+  // Nothing in the range is readable until it's written.
+  auto read_cursor = cursor;
+  EXPECT_FALSE(buffer->tryRead(packet, read_cursor));
+
+  for (int i = 0; i < kReserved; ++i) {
+    packet.payload[0] = i;
+    buffer->writeAt(cursor, packet);
+    cursor.moveForward();
+  }
+
+  for (int i = 0; i < kReserved; ++i) {
+    ASSERT_TRUE(buffer->tryRead(packet, read_cursor));
+    EXPECT_EQ(packet.payload[0], i);
+    read_cursor.moveForward();
+  }
+  EXPECT_FALSE(buffer->tryRead(packet, read_cursor))
+      << "head must be right after the reserved range";
+
+  LockFreeRingBufferTestAccessor::destroy(buffer);
+}
+
+TEST(LockFreeRingBufferTest, testWriteNIsContiguous) {
+  constexpr auto kBufferSize = 16;
+  constexpr auto kBatch = 6;
+  TestBuffer* buffer = LockFreeRingBufferTestAccessor::allocate(kBufferSize);
+
+  TestPacket batch[kBatch]{};
+  for (int i = 0; i < kBatch; ++i) {
+    batch[i].payload[0] = i;
+  }
+
+  alignas(4) TestPacket packet{.payload = {}};
+  buffer->write(packet);
+  auto cursor = buffer->writeN(batch, kBatch);
+  buffer->write(packet);
+
+  for (int i = 0; i < kBatch; ++i) {
+    ASSERT_TRUE(buffer->tryRead(packet, cursor));
+    EXPECT_EQ(packet.payload[0], i);
+    cursor.moveForward();
+  }
+
+  LockFreeRingBufferTestAccessor::destroy(buffer);
+}
+
+TEST(LockFreeRingBufferTest, testReadRangeWrapsAround) {
+  constexpr auto kBufferSize = 8;
+  TestBuffer* buffer = LockFreeRingBufferTestAccessor::allocate(kBufferSize);
+
+  alignas(4) TestPacket packet{.payload = {}};
+  for (int i = 0; i < 13; ++i) {
+    packet.payload[0] = i;
+    buffer->write(packet);
+  }
+
+  // Tickets 5 to 12, the last three are in slots 0 to 2.
+  TestPacket range[kBufferSize]{};
+  auto cursor = buffer->currentTail();
+  ASSERT_EQ(buffer->tryReadRange(range, cursor, kBufferSize), kBufferSize);
+  for (int i = 0; i < kBufferSize; ++i) {
+    EXPECT_EQ(range[i].payload[0], 5 + i);
+  }
+
+  LockFreeRingBufferTestAccessor::destroy(buffer);
+}
+
+TEST(LockFreeRingBufferTest, testReadRangeStopsAtHead) {
+  constexpr auto kBufferSize = 16;
+  TestBuffer* buffer = LockFreeRingBufferTestAccessor::allocate(kBufferSize);
+
+  alignas(4) TestPacket packet{.payload = {}};
+  for (int i = 0; i < 3; ++i) {
+    buffer->write(packet);
+  }
+  auto reserved = buffer->reserve(2);
+  buffer->write(packet);
+
+  TestPacket range[kBufferSize]{};
+  EXPECT_EQ(buffer->tryReadRange(range, buffer->currentHead(), 10), 0);
+  auto cursor = buffer->currentTail();
+  EXPECT_EQ(buffer->tryReadRange(range, cursor, 10), 3);
+
+  buffer->writeAt(reserved, packet);
+  reserved.moveForward();
+  buffer->writeAt(reserved, packet);
+  EXPECT_EQ(buffer->tryReadRange(range, cursor, 10), 6);
+
+  LockFreeRingBufferTestAccessor::destroy(buffer);
+}
+
+TEST(LockFreeRingBufferTest, testReadRangeFailsOnOverwrittenSlots) {
+  constexpr auto kBufferSize = 4;
+  TestBuffer* buffer = LockFreeRingBufferTestAccessor::allocate(kBufferSize);
+
+  alignas(4) TestPacket packet{.payload = {}};
+  auto cursor = buffer->writeAndGetCursor(packet);
+  for (int i = 0; i < kBufferSize; ++i) {
+    buffer->write(packet);
+  }
+
+  TestPacket range[kBufferSize]{};
+  EXPECT_EQ(buffer->tryReadRange(range, cursor, kBufferSize), 0);
+  cursor.moveForward();
+  EXPECT_EQ(buffer->tryReadRange(range, cursor, kBufferSize), kBufferSize);
+
+  LockFreeRingBufferTestAccessor::destroy(buffer);
+}
+
+TestPacket makeTestPacket(char value) {
+  TestPacket packet{.payload = {}};
+  packet.payload[0] = value;
+  return packet;
+}
+
+bool isTombstone(TestPacket const& packet) {
+  for (char byte : packet.payload) {
+    if (byte != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+//
+// Writes to ticket 0 from another thread and holds its slot until
+// RELEASE_SLOT.
+//
+class SlotHolder {
+ public:
+  enum Turns {
+    INIT = 0,
+    HOLDING_SLOT,
+    RELEASE_SLOT,
+    MAX,
+  };
+
+  explicit SlotHolder(TestBuffer& buffer)
+      : sequencer_(INIT, MAX), thread_([this, &buffer] {
+          buffer.writeInPlace([this](TestPacket& packet) {
+            packet = makeTestPacket('h');
+            sequencer_.advance(HOLDING_SLOT);
+            sequencer_.waitFor(RELEASE_SLOT);
+          });
+        }) {
+    sequencer_.waitFor(HOLDING_SLOT);
+  }
+
+  void release() {
+    sequencer_.advance(RELEASE_SLOT);
+    thread_.join();
+  }
+
+ private:
+  test::TestSequencer sequencer_;
+  std::thread thread_;
+};
+
+TEST(LockFreeRingBufferTest, testGuaranteedIsDefault) {
+  TestBuffer* buffer = LockFreeRingBufferTestAccessor::allocate(4);
+  EXPECT_EQ(buffer->writeMode(), WriteMode::GUARANTEED);
+  writeRandomEntries(*buffer, 16, 4);
+  EXPECT_EQ(buffer->droppedWrites(), 0);
+  LockFreeRingBufferTestAccessor::destroy(buffer);
+}
+
+TEST(LockFreeRingBufferTest, testLossyWriteSkipsBusySlot) {
+  constexpr auto kBufferSize = 2;
+  TestBuffer* buffer =
+      LockFreeRingBufferTestAccessor::allocate(kBufferSize, WriteMode::LOSSY);
+
+  SlotHolder holder(*buffer); // ticket 0
+  auto packet = makeTestPacket('a');
+  auto first = buffer->writeAndGetCursor(packet); // ticket 1
+  packet = makeTestPacket('b');
+  // Ticket 2 needs the slot of ticket 0. Must not block.
+  auto skipped = buffer->writeAndGetCursor(packet);
+  EXPECT_EQ(buffer->droppedWrites(), 1);
+  EXPECT_FALSE(buffer->tryRead(packet, skipped));
+
+  holder.release();
+
+  ASSERT_TRUE(buffer->tryRead(packet, first));
+  EXPECT_EQ(packet.payload[0], 'a');
+  // The holder left a tombstone for the skipped write on its way out.
+  ASSERT_TRUE(buffer->tryRead(packet, skipped));
+  EXPECT_TRUE(isTombstone(packet));
+  EXPECT_FALSE(buffer->tryRead(packet, TestBuffer::Cursor(0)));
+
+  // The slot is usable again.
+  packet = makeTestPacket('c');
+  auto next = buffer->writeAndGetCursor(packet); // ticket 3
+  packet = makeTestPacket('d');
+  auto reused = buffer->writeAndGetCursor(packet); // ticket 4
+  ASSERT_TRUE(buffer->tryRead(packet, next));
+  EXPECT_EQ(packet.payload[0], 'c');
+  ASSERT_TRUE(buffer->tryRead(packet, reused));
+  EXPECT_EQ(packet.payload[0], 'd');
+  EXPECT_EQ(buffer->droppedWrites(), 1);
+
+  LockFreeRingBufferTestAccessor::destroy(buffer);
+}
+
+TEST(LockFreeRingBufferTest, testLossyWriteTakesOverIdleSlot) {
+  constexpr auto kBufferSize = 2;
+  TestBuffer* buffer =
+      LockFreeRingBufferTestAccessor::allocate(kBufferSize, WriteMode::LOSSY);
+
+  // A writer that got ticket 0 but hasn't written yet.
+  auto late = buffer->reserve(1);
+  auto packet = makeTestPacket('a');
+  buffer->write(packet); // ticket 1
+  packet = makeTestPacket('b');
+  auto cursor = buffer->writeAndGetCursor(packet); // ticket 2
+  EXPECT_EQ(buffer->droppedWrites(), 0);
+
+  ASSERT_TRUE(buffer->tryRead(packet, cursor));
+  EXPECT_EQ(packet.payload[0], 'b');
+
+  // Too late, the slot moved on.
+  packet = makeTestPacket('l');
+  buffer->writeAt(late, packet);
+  EXPECT_EQ(buffer->droppedWrites(), 1);
+  EXPECT_FALSE(buffer->tryRead(packet, late));
+  ASSERT_TRUE(buffer->tryRead(packet, cursor));
+  EXPECT_EQ(packet.payload[0], 'b');
+
+  LockFreeRingBufferTestAccessor::destroy(buffer);
+}
+
+TEST(LockFreeRingBufferTest, testLossyTombstoneWakesReader) {
+  constexpr auto kBufferSize = 2;
+  TestBuffer* buffer =
+      LockFreeRingBufferTestAccessor::allocate(kBufferSize, WriteMode::LOSSY);
+
+  SlotHolder holder(*buffer); // ticket 0
+  auto packet = makeTestPacket('a');
+  buffer->write(packet); // ticket 1
+  auto skipped = buffer->writeAndGetCursor(packet); // ticket 2, dropped
+
+  bool read = false;
+  TestPacket read_packet = makeTestPacket('x');
+  std::thread reader([&] {
+    read = buffer->waitAndTryRead(read_packet, skipped);
+  });
+
+  // Give the reader time to block on the slot.
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  holder.release();
+  reader.join();
+
+  EXPECT_TRUE(read);
+  EXPECT_TRUE(isTombstone(read_packet));
+
+  LockFreeRingBufferTestAccessor::destroy(buffer);
+}
+
+TEST(LockFreeRingBufferTest, testLossyWritesFromManyThreads) {
+  constexpr auto kBufferSize = 4;
+  constexpr auto kThreads = 16;
+  constexpr auto kWritesPerThread = 2000;
+  TestBuffer* buffer =
+      LockFreeRingBufferTestAccessor::allocate(kBufferSize, WriteMode::LOSSY);
+
+  std::vector<std::thread> threads;
+  for (int idx = 0; idx < kThreads; ++idx) {
+    threads.emplace_back([buffer, idx] {
+      auto packet = makeTestPacket('a' + idx);
+      for (int write = 0; write < kWritesPerThread; ++write) {
+        buffer->write(packet);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  // Every slot ends up readable, with either a write or a tombstone.
+  auto cursor = buffer->currentTail();
+  TestPacket packet{};
+  for (int idx = 0; idx < kBufferSize; ++idx, cursor.moveForward()) {
+    ASSERT_TRUE(buffer->tryRead(packet, cursor));
+    EXPECT_TRUE(
+        isTombstone(packet) ||
+        (packet.payload[0] >= 'a' && packet.payload[0] < 'a' + kThreads));
+  }
+  EXPECT_LT(buffer->droppedWrites(), kThreads * kWritesPerThread);
+
+  LockFreeRingBufferTestAccessor::destroy(buffer);
+}
+
 } // namespace lfrb
 } // namespace logger
 } // namespace profilo
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <string>
 #include <vector>
 
 #include <profilo/PacketLogger.h>
@@ -116,5 +117,188 @@ TEST(Logger, testPacketizedWriteBackwards) {
   }
 }
 
+TEST(Logger, testStagedWriteIsContiguous) {
+  std::vector<uint16_t> data(kItems);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = i;
+  }
+
+  Buffer buffer(1000);
+  PacketLogger logger(
+      [&]() -> TraceBuffer& { return buffer.ringBuffer(); },
+      /*staged=*/true);
+
+  for (size_t i = 1; i <= data.size(); ++i) {
+    auto cursor = logger.writeAndGetCursor(data.data(), i * kItemSize);
+
+    size_t expected_packets =
+        (i * kItemSize + sizeof(Packet::data) - 1) / sizeof(Packet::data);
+
+    size_t calls = 0;
+    PacketReassembler reassembler([&](const void* read_data, size_t size) {
+      EXPECT_EQ(size, i * kItemSize) << "read must be the same size as write";
+      const uint16_t* idata = reinterpret_cast<const uint16_t*>(read_data);
+
+      for (size_t j = 0; j < size / kItemSize; ++j) {
+        EXPECT_EQ(j, idata[j]) << "data must be the same";
+      }
+      ++calls;
+    });
+
+    Packet packet;
+    size_t packets = 0;
+    StreamID stream = 0;
+    while (buffer.ringBuffer().tryRead(packet, cursor)) {
+      if (packets == 0) {
+        EXPECT_TRUE(packet.start) << "cursor must point to the first packet";
+        stream = packet.stream;
+      }
+      EXPECT_EQ(stream, packet.stream) << "packets must be contiguous";
+      reassembler.process(packet);
+      cursor.moveForward();
+      ++packets;
+    }
+
+    EXPECT_EQ(packets, expected_packets);
+    EXPECT_EQ(calls, 1) << "must read exactly one payload";
+  }
+}
+
+namespace {
+
+Packet makePacket(StreamID stream, bool start, bool next, char value) {
+  Packet packet{
+      .stream = stream, .start = start, .next = next, .size = 1, .data = {}};
+  packet.data[0] = value;
+  return packet;
+}
+
+} // namespace
+
+TEST(Logger, testInterleavedStreams) {
+  // Two 3-packet streams interleaved with each other and with
+  // single-packet entries, as written by per-packet writers.
+  std::vector<Packet> packets = {
+      makePacket(1, true, true, 'a'),
+      makePacket(2, true, true, 'x'),
+      makePacket(1, false, true, 'b'),
+      makePacket(3, true, false, 's'),
+      makePacket(2, false, true, 'y'),
+      makePacket(1, false, false, 'c'),
+      makePacket(2, false, false, 'z'),
+  };
+
+  std::vector<std::string> forward;
+  PacketReassembler forward_reassembler([&](const void* data, size_t size) {
+    forward.emplace_back(static_cast<const char*>(data), size);
+  });
+  for (auto const& packet : packets) {
+    forward_reassembler.process(packet);
+  }
+  EXPECT_EQ(forward, (std::vector<std::string>{"s", "abc", "xyz"}));
+
+  std::vector<std::string> backward;
+  PacketReassembler backward_reassembler([&](const void* data, size_t size) {
+    backward.emplace_back(static_cast<const char*>(data), size);
+  });
+  for (auto it = packets.rbegin(); it != packets.rend(); ++it) {
+    backward_reassembler.processBackwards(*it);
+  }
+  EXPECT_EQ(backward, (std::vector<std::string>{"s", "xyz", "abc"}));
+}
+
+TEST(Logger, testManyInterleavedStreams) {
+  // 300 three-packet streams, written round-robin so that all of them are
+  // active at the same time.
+  constexpr StreamID kStreams = 300;
+  std::vector<Packet> packets;
+  for (char part = 0; part < 3; ++part) {
+    for (StreamID stream = 0; stream < kStreams; ++stream) {
+      packets.push_back(
+          makePacket(stream, part == 0, part != 2, 'a' + part));
+    }
+  }
+
+  size_t forward = 0;
+  PacketReassembler forward_reassembler(
+      [&](const void* data, size_t size) {
+        EXPECT_EQ(std::string(static_cast<const char*>(data), size), "abc");
+        ++forward;
+      },
+      kStreams);
+  for (auto const& packet : packets) {
+    forward_reassembler.process(packet);
+  }
+  EXPECT_EQ(forward, kStreams);
+
+  size_t backward = 0;
+  PacketReassembler backward_reassembler(
+      [&](const void* data, size_t size) {
+        EXPECT_EQ(std::string(static_cast<const char*>(data), size), "abc");
+        ++backward;
+      },
+      kStreams);
+  for (auto it = packets.rbegin(); it != packets.rend(); ++it) {
+    backward_reassembler.processBackwards(*it);
+  }
+  EXPECT_EQ(backward, kStreams);
+}
+
+TEST(Logger, testOldestInterleavedStreamIsDropped) {
+  // Room for two interleaved streams besides the current one: starting a
+  // fourth stream drops stream 1, the oldest.
+  std::vector<Packet> packets = {
+      makePacket(1, true, true, 'a'),
+      makePacket(2, true, true, 'b'),
+      makePacket(3, true, true, 'c'),
+      makePacket(4, true, true, 'd'),
+      makePacket(1, false, false, 'A'),
+      makePacket(2, false, false, 'B'),
+      makePacket(3, false, false, 'C'),
+      makePacket(4, false, false, 'D'),
+  };
+
+  std::vector<std::string> payloads;
+  PacketReassembler reassembler(
+      [&](const void* data, size_t size) {
+        payloads.emplace_back(static_cast<const char*>(data), size);
+      },
+      2);
+  for (auto const& packet : packets) {
+    reassembler.process(packet);
+  }
+  EXPECT_EQ(payloads, (std::vector<std::string>{"bB", "cC", "dD"}));
+}
+
+TEST(Logger, testTombstoneDropsInterruptedStream) {
+  // A lossy buffer dropped the middle packet of stream 1.
+  std::vector<Packet> packets = {
+      makePacket(1, true, true, 'a'),
+      Packet(),
+      makePacket(1, false, false, 'c'),
+      makePacket(2, true, false, 's'),
+      Packet(),
+  };
+  ASSERT_TRUE(packets[1].isTombstone());
+
+  std::vector<std::string> forward;
+  PacketReassembler forward_reassembler([&](const void* data, size_t size) {
+    forward.emplace_back(static_cast<const char*>(data), size);
+  });
+  for (auto const& packet : packets) {
+    forward_reassembler.process(packet);
+  }
+  EXPECT_EQ(forward, (std::vector<std::string>{"s"}));
+
+  std::vector<std::string> backward;
+  PacketReassembler backward_reassembler([&](const void* data, size_t size) {
+    backward.emplace_back(static_cast<const char*>(data), size);
+  });
+  for (auto it = packets.rbegin(); it != packets.rend(); ++it) {
+    backward_reassembler.processBackwards(*it);
+  }
+  EXPECT_EQ(backward, (std::vector<std::string>{"s"}));
+}
+
 } // namespace profilo
 } // namespace facebook
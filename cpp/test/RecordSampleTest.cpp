@@ -0,0 +1,144 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <profilo/perfevents/Records.h>
+
+#include <cstring>
+#include <vector>
+
+namespace facebook {
+namespace profilo {
+
+using namespace perfevents;
+
+namespace {
+
+// Two of the registers: bits 0 and 2.
+constexpr uint64_t kUserRegs = 0b101;
+
+// A sample of kStackSampleType as the kernel lays it out.
+std::vector<uint64_t> stackSample(uint64_t stack_size, uint64_t dyn_size) {
+  std::vector<uint64_t> words{
+      // pid, tid
+      (uint64_t{20} << 32) | 10,
+      // time, addr, id (of the group leader), stream_id
+      1000,
+      0,
+      5,
+      7,
+      // cpu, reserved
+      3,
+      // read: value, time_enabled, time_running, id
+      1,
+      2,
+      3,
+      7,
+      // callchain: nr, ips
+      3,
+      PERF_CONTEXT_USER,
+      0x1000,
+      0x2000,
+      // regs: abi, values
+      PERF_SAMPLE_REGS_ABI_64,
+      0xaa,
+      0xbb,
+      // stack: size, data
+      stack_size,
+  };
+  for (uint64_t word = 0; word < stack_size / sizeof(uint64_t); ++word) {
+    words.push_back(0x100 + word);
+  }
+  words.push_back(dyn_size);
+  return words;
+}
+
+} // namespace
+
+TEST(RecordSample, readsTheStackSamplingFields) {
+  auto words = stackSample(16, 8);
+  RecordSample sample(
+      words.data(),
+      words.size() * sizeof(uint64_t),
+      kStackSampleType,
+      kUserRegs);
+
+  EXPECT_EQ(sample.pid(), 10);
+  EXPECT_EQ(sample.tid(), 20);
+  EXPECT_EQ(sample.time(), 1000);
+  EXPECT_EQ(sample.cpu(), 3);
+  EXPECT_EQ(sample.groupLeaderId(), 5);
+
+  uint64_t size = 0;
+  auto chain = sample.callchain(size);
+  ASSERT_NE(chain, nullptr);
+  ASSERT_EQ(size, 3);
+  EXPECT_EQ(chain[0], PERF_CONTEXT_USER);
+  EXPECT_EQ(chain[2], 0x2000);
+
+  auto regs = sample.userRegs();
+  ASSERT_NE(regs, nullptr);
+  EXPECT_EQ(regs[0], 0xaa);
+  EXPECT_EQ(regs[1], 0xbb);
+
+  // Only the dynamic size was written to.
+  auto stack = sample.userStack(size);
+  ASSERT_NE(stack, nullptr);
+  ASSERT_EQ(size, 8);
+  uint64_t top;
+  memcpy(&top, stack, sizeof(top));
+  EXPECT_EQ(top, 0x100);
+}
+
+TEST(RecordSample, hasNoStackFieldsWithoutThem) {
+  auto words = stackSample(16, 8);
+  RecordSample sample(words.data(), words.size() * sizeof(uint64_t));
+
+  uint64_t size = 0;
+  EXPECT_EQ(sample.callchain(size), nullptr);
+  EXPECT_EQ(sample.userRegs(), nullptr);
+  EXPECT_EQ(sample.userStack(size), nullptr);
+  EXPECT_EQ(sample.groupLeaderId(), 5);
+}
+
+TEST(RecordSample, rejectsTruncatedStackFields) {
+  auto words = stackSample(16, 8);
+  // Cut into the stack copy.
+  RecordSample sample(
+      words.data(),
+      (words.size() - 2) * sizeof(uint64_t),
+      kStackSampleType,
+      kUserRegs);
+
+  uint64_t size = 0;
+  EXPECT_NE(sample.callchain(size), nullptr);
+  EXPECT_NE(sample.userRegs(), nullptr);
+  EXPECT_EQ(sample.userStack(size), nullptr);
+}
+
+TEST(RecordSample, rejectsUnknownSampleTypes) {
+  auto words = stackSample(0, 0);
+  EXPECT_THROW(
+      RecordSample(
+          words.data(),
+          words.size() * sizeof(uint64_t),
+          kSampleType | PERF_SAMPLE_RAW,
+          0),
+      std::invalid_argument);
+}
+
+} // namespace profilo
+} // namespace facebook
@@ -25,13 +25,22 @@
 #include <cinttypes>
 #include <memory>
 #include <thread>
+#include <unordered_set>
+#include <vector>
 
 #include <phaser.h>
 #include <profilo/LogEntry.h>
+#include <profilo/profiler/NativeTracer.h>
+#if HAS_PERF_SAMPLER
+#include <profilo/profiler/PerfSampler.h>
+#endif
+#include <profilo/profiler/SampleQueue.h>
 #include <profilo/profiler/SamplingProfiler.h>
 #include <profilo/profiler/SignalHandler.h>
+#include <profilo/profiler/StackTable.h>
 #include <profilo/profiler/ThreadTimer.h>
 #include <profilo/test/TestSequencer.h>
+#include <profilo/util/ThreadLifecycle.h>
 #include <profilo/util/common.h>
 #include "logger/MultiBufferLogger.h"
 
@@ -47,6 +56,7 @@ constexpr auto kDefaultSampleIntervalMs = kHalfHourInMilliseconds;
 constexpr auto kDefaultThreadDetectIntervalMs = kHalfHourInMilliseconds;
 constexpr bool kDefaultUseWallClockSetting = false;
 constexpr bool kDefaultUseCpuClockSetting = true;
+constexpr bool kDefaultUsePerfSampling = false;
 
 /* Scopes all access to private data from the SamplingProfiler instance*/
 class SamplingProfilerTestAccessor {
@@ -58,23 +68,35 @@ class SamplingProfilerTestAccessor {
     return profiler_.state_.isProfiling.load();
   }
 
+  bool isPerfSampling() const {
+    return std::atomic_load(&profiler_.state_.perfSampler) != nullptr;
+  }
+
   bool isLoggerLoopDone() const {
     return profiler_.state_.isLoggerLoopDone.load();
   }
 
-  int countSlotsWithPredicate(std::function<bool(StackSlot const&)> pred) {
-    return std::count_if(
-        std::begin(profiler_.state_.stacks),
-        std::end(profiler_.state_.stacks),
-        pred);
+  int countSamplesWithPredicate(std::function<bool(Sample const&)> pred) {
+    auto samples = getPendingSamples();
+    return std::count_if(samples.begin(), samples.end(), pred);
   }
 
-  StackSlot const* getSlots() {
-    return profiler_.state_.stacks;
+  // The samples not logged yet, in the order they were taken.
+  std::vector<Sample> getPendingSamples() {
+    std::vector<Sample> samples;
+    profiler_.state_.sampleQueues.peek(
+        [&samples](Sample const& sample) { samples.push_back(sample); });
+    return samples;
   }
 
-  std::atomic<uint32_t>& getFullSlotsCounter() {
-    return profiler_.state_.fullSlotsCounter;
+  std::atomic<uint32_t>& getQueuedSamplesCounter() {
+    return profiler_.state_.queuedSamples;
+  }
+
+  int getLoggedSamples(ThreadTimer::Type timerType) {
+    return timerType == ThreadTimer::Type::CpuTime
+        ? profiler_.state_.cpuTimeSamples.load()
+        : profiler_.state_.wallTimeSamples.load();
   }
 
  private:
@@ -204,7 +226,7 @@ class SamplingProfilerTest : public ::testing::Test {
 
   void runLoggingTest(
       TracerStdFunction tracer,
-      std::function<bool(StackSlot const&)> slot_predicate,
+      std::function<bool(Sample const&)> sample_predicate,
       int expected_count = 1);
 
   void runSampleCountTest(
@@ -234,19 +256,18 @@ class SamplingProfilerTest : public ::testing::Test {
   }
 
   int getNumSamplesTimerType(ThreadTimer::Type timerType) {
-    int cnt = access.countSlotsWithPredicate([timerType](auto const& slot) {
-      return slot.state == StackSlotState::FREE && slot.timerType == timerType;
+    int cnt = access.countSamplesWithPredicate([timerType](auto const& sample) {
+      return sample.timerType == timerType;
     });
 
-    return cnt;
+    return cnt + access.getLoggedSamples(timerType);
   }
 
   int getNumSamplesNotTimerType(ThreadTimer::Type timerType) {
-    int cnt = access.countSlotsWithPredicate([timerType](auto const& slot) {
-      return slot.state == StackSlotState::FREE && slot.timerType != timerType;
-    });
-
-    return cnt;
+    auto otherType = timerType == ThreadTimer::Type::CpuTime
+        ? ThreadTimer::Type::WallTime
+        : ThreadTimer::Type::CpuTime;
+    return getNumSamplesTimerType(otherType);
   }
 
   void assertSamplesTimerType(ThreadTimer::Type timerType) {
@@ -269,15 +290,13 @@ void SamplingProfilerTest::runLoggingTest(
     int expected_count) {
   runLoggingTest(
       tracer,
-      [error](StackSlot const& slot) {
-        return (slot.state.load() & 0xffff) == error;
-      },
+      [error](Sample const& sample) { return sample.retcode == error; },
       expected_count);
 }
 
 void SamplingProfilerTest::runLoggingTest(
     TracerStdFunction tracer,
-    std::function<bool(StackSlot const&)> slot_predicate,
+    std::function<bool(Sample const&)> sample_predicate,
     int expected_count) {
   // This test a SIGSEGV during tracing leads to an error entry being written.
   enum Sequence {
@@ -296,7 +315,8 @@ void SamplingProfilerTest::runLoggingTest(
       kDefaultSampleIntervalMs,
       kDefaultThreadDetectIntervalMs,
       kDefaultUseCpuClockSetting,
-      kDefaultUseWallClockSetting));
+      kDefaultUseWallClockSetting,
+      kDefaultUsePerfSampling));
 
   std::thread worker_thread([&] {
     sequencer.waitAndAdvance(START_WORKER_THREAD, SEND_PROFILING_SIGNAL);
@@ -323,8 +343,9 @@ void SamplingProfilerTest::runLoggingTest(
   profiler.stopProfiling();
   sequencer.advance(END);
 
-  EXPECT_EQ(access.countSlotsWithPredicate(slot_predicate), expected_count)
-      << "Incorrect number of slots matching the predicate";
+  EXPECT_EQ(
+      access.countSamplesWithPredicate(sample_predicate), expected_count)
+      << "Incorrect number of samples matching the predicate";
 
   worker_thread.join();
 }
@@ -334,7 +355,7 @@ TracerStdFunction signalCountTracerFunction(
     std::vector<int>& signal_cnt) {
   return [&signal_cnt, &tids](ucontext_t*, int64_t*, uint16_t&, uint16_t) {
     auto tid = threadID();
-    for (int worker = 0; worker < tids.size(); worker++) {
+    for (size_t worker = 0; worker < tids.size(); worker++) {
       if (tid == tids[worker]) { // assumes tid != 0
         signal_cnt[worker]++;
         // FBLOGV(
@@ -356,7 +377,7 @@ void assertSamplesWithinTolerance(
     int allowed_lost_samples,
     std::vector<int> expected_times_ms,
     std::vector<int> signal_cnt) {
-  for (int worker = 0; worker < signal_cnt.size(); worker++) {
+  for (size_t worker = 0; worker < signal_cnt.size(); worker++) {
     int expected_time_ms = expected_times_ms[worker];
     int signal_count_delta =
         abs(signal_cnt[worker] - expected_time_ms / sample_interval_ms);
@@ -465,7 +486,8 @@ void SamplingProfilerTest::runSampleCountTest(
       sample_interval_ms,
       thread_detect_interval_ms,
       enable_cpu_time_sampling,
-      enable_wall_time_sampling));
+      enable_wall_time_sampling,
+      kDefaultUsePerfSampling));
   struct timespec start_time, end_time;
   ASSERT_FALSE(clock_gettime(CLOCK_MONOTONIC, &start_time));
 
@@ -572,7 +594,8 @@ void SamplingProfilerTest::runThreadDetectTest(
       sample_interval_ms,
       thread_detect_interval_ms,
       !enable_wall_time_sampling,
-      enable_wall_time_sampling));
+      enable_wall_time_sampling,
+      kDefaultUsePerfSampling));
   sequencer.advance(RUN_WORKERS);
 
   // FBLOGV("------> main thread is %d", threadID());
@@ -676,14 +699,14 @@ TEST_F(SamplingProfilerTest, noErrorLoggingForTracerDisabled) {
 }
 
 TEST_F(SamplingProfilerTest, noErrorLoggingForTracerIgnoreRetcode) {
-  auto& fullStacksBefore = access.getFullSlotsCounter();
+  auto queuedBefore = access.getQueuedSamplesCounter().load();
   runLoggingTest(
       [](ucontext_t*, int64_t*, uint16_t& depth, uint16_t) {
         return StackCollectionRetcode::IGNORE;
       },
       StackCollectionRetcode::IGNORE,
       0);
-  ASSERT_EQ(access.getFullSlotsCounter().load(), fullStacksBefore.load());
+  ASSERT_EQ(access.getQueuedSamplesCounter().load(), queuedBefore);
 }
 
 TEST_F(SamplingProfilerTest, basicStackLogging) {
@@ -696,18 +719,18 @@ TEST_F(SamplingProfilerTest, basicStackLogging) {
         depth = max_depth;
         return StackCollectionRetcode::SUCCESS;
       },
-      [](StackSlot const& slot) {
-        if ((slot.state.load() & 0xffff) != StackCollectionRetcode::SUCCESS) {
+      [](Sample const& sample) {
+        if (sample.retcode != StackCollectionRetcode::SUCCESS) {
           return false;
         }
-        if (slot.depth != MAX_STACK_DEPTH) {
+        if (sample.depth != MAX_STACK_DEPTH) {
           return false;
         }
-        if (slot.profilerType != kTestTracer) {
+        if (sample.profilerType != static_cast<uint32_t>(kTestTracer)) {
           return false;
         }
-        for (int i = 0; i < slot.depth; ++i) {
-          if (slot.frames[i] != MAGIC_FRAME) {
+        for (int i = 0; i < sample.depth; ++i) {
+          if (sample.frames[i] != MAGIC_FRAME) {
             return false;
           }
         }
@@ -751,7 +774,8 @@ TEST_F(SamplingProfilerTest, stopProfilingWhileHandlingFault) {
         kDefaultSampleIntervalMs,
         kDefaultThreadDetectIntervalMs,
         kDefaultUseCpuClockSetting,
-        kDefaultUseWallClockSetting));
+        kDefaultUseWallClockSetting,
+        kDefaultUsePerfSampling));
     sequencer.advance(START_WORKER_THREAD);
 
     sequencer.waitAndAdvance(STOP_PROFILING, INSPECT_MIDDLE_OF_STOP);
@@ -869,7 +893,8 @@ TEST_F(SamplingProfilerTest, stopProfilingWhileExecutingTracer) {
         kDefaultSampleIntervalMs,
         kDefaultThreadDetectIntervalMs,
         kDefaultUseCpuClockSetting,
-        kDefaultUseWallClockSetting));
+        kDefaultUseWallClockSetting,
+        kDefaultUsePerfSampling));
     sequencer.advance(START_WORKER_THREAD);
 
     sequencer.waitAndAdvance(STOP_PROFILING, INSPECT_MIDDLE_OF_STOP);
@@ -957,7 +982,8 @@ TEST_F(SamplingProfilerTest, nestedFaultingTracersUnstackProperly) {
       kDefaultSampleIntervalMs,
       kDefaultThreadDetectIntervalMs,
       kDefaultUseCpuClockSetting,
-      kDefaultUseWallClockSetting));
+      kDefaultUseWallClockSetting,
+      kDefaultUsePerfSampling));
 
   // Target thread that will receive the profiling signal.
   std::thread worker_thread([&] {
@@ -1086,20 +1112,21 @@ TEST_F(SamplingProfilerTest, nestedFaultingTracersUnstackProperly) {
   sequencer.waitAndAdvance(STOP_PROFILING, END_WORKER_THREAD);
   profiler.stopProfiling();
 
-  auto numErrors = access.countSlotsWithPredicate([](StackSlot const& slot) {
-    return (slot.state.load() & 0xffff) ==
-        StackCollectionRetcode::SIGNAL_INTERRUPT &&
-        slot.profilerType == kTestTracer;
+  auto numErrors = access.countSamplesWithPredicate([](Sample const& sample) {
+    return sample.retcode == StackCollectionRetcode::SIGNAL_INTERRUPT &&
+        sample.profilerType == static_cast<uint32_t>(kTestTracer);
   });
   EXPECT_EQ(numErrors, 3);
 
-  // The earliest slot should belong to the earliest entry to the tracer.
-  // However, signal errors update the time slot with the time of return from
-  // the fault handler. Therefore, the earliest slot should exit last and have
-  // the highest timestamp. We can use strict inequality because we arrange the
-  // exit times to be at least 1ms apart.
-  EXPECT_GT(access.getSlots()[0].time, access.getSlots()[1].time);
-  EXPECT_GT(access.getSlots()[1].time, access.getSlots()[2].time);
+  // The earliest sample should belong to the earliest entry to the tracer.
+  // However, signal errors update the sample time with the time of return from
+  // the fault handler. Therefore, the earliest sample should exit last and
+  // have the highest timestamp. We can use strict inequality because we
+  // arrange the exit times to be at least 1ms apart.
+  auto samples = access.getPendingSamples();
+  ASSERT_EQ(samples.size(), 3);
+  EXPECT_GT(samples[0].time, samples[1].time);
+  EXPECT_GT(samples[1].time, samples[2].time);
 
   worker_thread.join();
 
@@ -1122,7 +1149,8 @@ TEST_F(SamplingProfilerTest, profilingSignalIsIgnoredAfterStop) {
       kDefaultSampleIntervalMs,
       kDefaultThreadDetectIntervalMs,
       kDefaultUseCpuClockSetting,
-      kDefaultUseWallClockSetting));
+      kDefaultUseWallClockSetting,
+      kDefaultUsePerfSampling));
   profiler.stopProfiling();
 
   // No death!
@@ -1149,6 +1177,460 @@ TEST_F(SamplingProfilerTest, verifyWallThreadDetect) {
   runThreadDetectTest(true);
 }
 
+TEST_F(SamplingProfilerTest, threadStartEventStartsTimers) {
+  // This test confirms that a thread reported by ThreadLifecycle gets sampled
+  // without waiting for the next /proc/self/task listing.
+  constexpr int sample_interval_ms = 19;
+  constexpr int thread_detect_interval_ms = kHalfHourInMilliseconds;
+
+  std::vector<int32_t> tids(1, -1);
+  std::vector<int> signal_cnt(1, 0);
+  SetTracer(std::make_unique<TracerStdFunction>(
+      signalCountTracerFunction(tids, signal_cnt)));
+
+  std::thread logger_thread([this] { this->profiler.loggerLoop(); });
+  ASSERT_TRUE(profiler.startProfiling(
+      kTestTracer,
+      sample_interval_ms,
+      thread_detect_interval_ms,
+      true,
+      false,
+      kDefaultUsePerfSampling));
+  // Past the listing at the start of the thread detection loop.
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  std::thread worker([&tids] {
+    auto tid = threadID();
+    tids[0] = tid;
+    // As the pthread_create hook would, where it's installed.
+    util::ThreadLifecycle::getInstance().threadStarted(tid);
+    float f = 0;
+    burnCpuMs(300, &f);
+    util::ThreadLifecycle::getInstance().threadExited(tid);
+  });
+  worker.join();
+
+  profiler.stopProfiling();
+  logger_thread.join();
+
+  EXPECT_GT(signal_cnt[0], 0);
+}
+
+#if PROFILO_NATIVE_UNWINDER_SUPPORTED
+
+class RecordingNativeTracer : public NativeTracer {
+ public:
+  explicit RecordingNativeTracer(MultiBufferLogger& logger)
+      : NativeTracer(logger, false, 4, true) {}
+
+  void flushStack(
+      MultiBufferLogger& logger,
+      int64_t* frames,
+      uint16_t depth,
+      int tid,
+      int64_t time_) override {
+    stacks.emplace_back(frames, frames + depth);
+  }
+
+  // Only read once the logger thread is done.
+  std::vector<std::vector<int64_t>> stacks;
+};
+
+// Where each function of the chain returns to, innermost first.
+std::array<int64_t, 3> chainReturnAddresses;
+
+__attribute__((noinline)) void nativeChainC() {
+  chainReturnAddresses[0] =
+      reinterpret_cast<int64_t>(__builtin_return_address(0));
+  sigval val;
+  val.sival_int = ThreadTimer::encodeType(ThreadTimer::Type::WallTime);
+  // Delivered to this thread before the call returns.
+  pthread_sigqueue(pthread_self(), PROFILER_SIGNAL, val);
+  // Keeps the calls above from becoming tail calls.
+  asm volatile("" ::: "memory");
+}
+
+__attribute__((noinline)) void nativeChainB() {
+  chainReturnAddresses[1] =
+      reinterpret_cast<int64_t>(__builtin_return_address(0));
+  nativeChainC();
+  asm volatile("" ::: "memory");
+}
+
+__attribute__((noinline)) void nativeChainA() {
+  chainReturnAddresses[2] =
+      reinterpret_cast<int64_t>(__builtin_return_address(0));
+  nativeChainB();
+  asm volatile("" ::: "memory");
+}
+
+TEST(NativeTracerTest, unwindsSyntheticCallChain) {
+  SamplingProfiler profiler;
+  MultiBufferLogger logger;
+  auto tracer = std::make_shared<RecordingNativeTracer>(logger);
+  auto tracer_map = std::unordered_map<int32_t, std::shared_ptr<BaseTracer>>();
+  tracer_map[tracers::NATIVE] = tracer;
+  ASSERT_TRUE(profiler.initialize(logger, tracers::NATIVE, tracer_map));
+
+  ASSERT_TRUE(profiler.startProfiling(
+      tracers::NATIVE,
+      kDefaultSampleIntervalMs,
+      kDefaultThreadDetectIntervalMs,
+      kDefaultUseCpuClockSetting,
+      kDefaultUseWallClockSetting,
+      kDefaultUsePerfSampling));
+  std::thread logger_thread([&profiler] { profiler.loggerLoop(); });
+  nativeChainA();
+  profiler.stopProfiling();
+  logger_thread.join();
+
+  // Unwound when the logger thread flushed the sample.
+  ASSERT_EQ(tracer->stacks.size(), 1);
+  auto& frames = tracer->stacks[0];
+  // The chain, from the innermost function out, below the frames of
+  // pthread_sigqueue.
+  auto frame = frames.begin();
+  for (auto address : chainReturnAddresses) {
+    frame = std::find(frame, frames.end(), address);
+    ASSERT_NE(frame, frames.end())
+        << "Missing return address " << std::hex << address;
+  }
+}
+
+TEST(NativeTracerTest, restartReleasesQueuedCaptures) {
+  SamplingProfiler profiler;
+  MultiBufferLogger logger;
+  auto tracer = std::make_shared<RecordingNativeTracer>(logger);
+  auto tracer_map = std::unordered_map<int32_t, std::shared_ptr<BaseTracer>>();
+  tracer_map[tracers::NATIVE] = tracer;
+  ASSERT_TRUE(profiler.initialize(logger, tracers::NATIVE, tracer_map));
+
+  // No logger thread, every capture stays with a queued sample.
+  ASSERT_TRUE(profiler.startProfiling(
+      tracers::NATIVE,
+      kDefaultSampleIntervalMs,
+      kDefaultThreadDetectIntervalMs,
+      kDefaultUseCpuClockSetting,
+      kDefaultUseWallClockSetting,
+      kDefaultUsePerfSampling));
+  for (int i = 0; i < 4; ++i) {
+    nativeChainA();
+  }
+  profiler.stopProfiling();
+
+  ASSERT_TRUE(profiler.startProfiling(
+      tracers::NATIVE,
+      kDefaultSampleIntervalMs,
+      kDefaultThreadDetectIntervalMs,
+      kDefaultUseCpuClockSetting,
+      kDefaultUseWallClockSetting,
+      kDefaultUsePerfSampling));
+  std::thread logger_thread([&profiler] { profiler.loggerLoop(); });
+  nativeChainA();
+  profiler.stopProfiling();
+  logger_thread.join();
+
+  // The sample of the second trace got a capture again.
+  EXPECT_EQ(tracer->stacks.size(), 1u);
+}
+
+#endif
+
+#if HAS_PERF_SAMPLER
+
+// Burns CPU on another thread until the predicate holds or time runs out.
+void burnCpuUntil(std::function<bool(int32_t tid)> done) {
+  std::atomic<int32_t> busy_tid{0};
+  std::thread busy_thread([&] {
+    busy_tid = threadID();
+    float f = 0;
+    for (int i = 0; i < 100 && !done(busy_tid); ++i) {
+      burnCpuMs(20, &f);
+    }
+  });
+  busy_thread.join();
+}
+
+TEST(PerfSamplerTest, reportsTheThreadsOfSamples) {
+  MultiBufferLogger logger;
+  PerfSampler sampler(logger);
+  std::mutex mutex;
+  std::unordered_set<int32_t> sampled;
+  bool started = sampler.start(1, [&](int32_t tid) {
+    std::lock_guard<std::mutex> lock(mutex);
+    sampled.insert(tid);
+  });
+  if (!started) {
+    // No perf events here, SamplingProfiler falls back to the timers.
+    return;
+  }
+
+  int32_t busy_tid = 0;
+  burnCpuUntil([&](int32_t tid) {
+    busy_tid = tid;
+    std::lock_guard<std::mutex> lock(mutex);
+    return sampled.count(tid) > 0;
+  });
+  sampler.stop();
+
+  std::lock_guard<std::mutex> lock(mutex);
+  ASSERT_EQ(sampled.count(busy_tid), 1);
+}
+
+TEST(PerfSamplerTest, signalsSampledThreadsForTheOtherTracers) {
+  constexpr int32_t kSignalTracer = 1 << 16;
+  SamplingProfiler profiler;
+  MultiBufferLogger logger;
+  auto native = std::make_shared<TestTracer>();
+  auto other = std::make_shared<TestTracer>();
+  std::atomic<int> native_cpu_samples{0};
+  native->setCollectStackFn(std::make_unique<TracerStdFunction>(
+      [&](ucontext_t*, int64_t*, uint16_t&, uint16_t) {
+        native_cpu_samples.fetch_add(1);
+        return StackCollectionRetcode::IGNORE;
+      }));
+  std::mutex mutex;
+  std::unordered_set<int32_t> signalled;
+  other->setCollectStackFn(std::make_unique<TracerStdFunction>(
+      [&](ucontext_t*, int64_t* frames, uint16_t& depth, uint16_t) {
+        std::lock_guard<std::mutex> lock(mutex);
+        signalled.insert(threadID());
+        frames[0] = 1;
+        depth = 1;
+        return StackCollectionRetcode::SUCCESS;
+      }));
+  auto tracer_map = std::unordered_map<int32_t, std::shared_ptr<BaseTracer>>();
+  tracer_map[tracers::NATIVE] = native;
+  tracer_map[kSignalTracer] = other;
+  ASSERT_TRUE(profiler.initialize(
+      logger, tracers::NATIVE | kSignalTracer, tracer_map));
+
+  ASSERT_TRUE(profiler.startProfiling(
+      tracers::NATIVE | kSignalTracer,
+      1,
+      kDefaultThreadDetectIntervalMs,
+      kDefaultUseCpuClockSetting,
+      kDefaultUseWallClockSetting,
+      true));
+  int32_t busy_tid = 0;
+  burnCpuUntil([&](int32_t tid) {
+    busy_tid = tid;
+    std::lock_guard<std::mutex> lock(mutex);
+    return signalled.count(tid) > 0;
+  });
+  SamplingProfilerTestAccessor access(profiler);
+  bool perf_sampling = access.isPerfSampling();
+  profiler.stopProfiling();
+
+  std::lock_guard<std::mutex> lock(mutex);
+  ASSERT_EQ(signalled.count(busy_tid), 1);
+  if (perf_sampling) {
+    // Its stacks came from the perf samples instead.
+    ASSERT_EQ(native_cpu_samples.load(), 0);
+  }
+}
+
+#endif
+
+constexpr uint32_t kQueueTestTracer = tracers::NATIVE;
+
+TEST(SampleQueueTest, keepsOnlyCollectedFramesAcrossWrapArounds) {
+  SampleQueue queue{threadID()};
+  // Enough samples to wrap around the ring a few times.
+  for (int64_t round = 0; round < 64; ++round) {
+    for (uint16_t depth = 1; depth <= 3; ++depth) {
+      SampleQueue::Reservation sample;
+      ASSERT_TRUE(queue.begin(false, sample));
+      for (uint16_t i = 0; i < depth; ++i) {
+        sample.frames[i] = round * 10 + i;
+      }
+      queue.commit(
+          sample,
+          round,
+          kQueueTestTracer,
+          ThreadTimer::Type::CpuTime,
+          StackCollectionRetcode::SUCCESS,
+          depth);
+      queue.end(sample);
+    }
+
+    uint16_t expectedDepth = 1;
+    auto count = queue.drain([&](Sample const& sample) {
+      EXPECT_EQ(sample.time, round);
+      EXPECT_EQ(sample.tid, threadID());
+      EXPECT_EQ(sample.depth, expectedDepth);
+      for (uint16_t i = 0; i < sample.depth; ++i) {
+        EXPECT_EQ(sample.frames[i], round * 10 + i);
+      }
+      ++expectedDepth;
+    });
+    ASSERT_EQ(count, 3);
+  }
+}
+
+TEST(SampleQueueTest, publishesNestedSamplesWithTheOutermost) {
+  SampleQueue queue{threadID()};
+  SampleQueue::Reservation outer;
+  SampleQueue::Reservation inner;
+  ASSERT_TRUE(queue.begin(true, outer));
+  ASSERT_TRUE(queue.begin(false, inner));
+  queue.commit(
+      inner,
+      2,
+      kQueueTestTracer,
+      ThreadTimer::Type::WallTime,
+      StackCollectionRetcode::EMPTY_STACK,
+      0);
+  queue.end(inner);
+  ASSERT_EQ(queue.peek([](Sample const&) {}), 0);
+
+  outer.frames[0] = 42;
+  outer.method_names[0] = "run";
+  outer.class_descriptors[0] = "Lcom/facebook/Test;";
+  queue.commit(
+      outer,
+      1,
+      kQueueTestTracer,
+      ThreadTimer::Type::WallTime,
+      StackCollectionRetcode::SUCCESS,
+      1);
+  queue.end(outer);
+
+  std::vector<Sample> samples;
+  queue.drain([&](Sample const& sample) { samples.push_back(sample); });
+  ASSERT_EQ(samples.size(), 2);
+  EXPECT_EQ(samples[0].time, 1);
+  EXPECT_EQ(samples[0].frames[0], 42);
+  EXPECT_STREQ(samples[0].method_names[0], "run");
+  EXPECT_STREQ(samples[0].class_descriptors[0], "Lcom/facebook/Test;");
+  EXPECT_EQ(samples[1].time, 2);
+  EXPECT_EQ(samples[1].retcode, StackCollectionRetcode::EMPTY_STACK);
+  EXPECT_EQ(samples[1].method_names, nullptr);
+}
+
+TEST(SampleQueueTest, threadsClaimSparesUntilDiscovered) {
+  SampleQueues queues;
+  queues.reset();
+  int32_t tid = threadID();
+  ASSERT_EQ(queues.find(tid), nullptr);
+
+  auto spare = queues.acquire(tid);
+  ASSERT_NE(spare, nullptr);
+  EXPECT_EQ(spare->tid(), tid);
+  EXPECT_EQ(queues.acquire(tid), spare);
+
+  // Discovering the thread keeps the queue it already writes to.
+  queues.add(tid);
+  queues.update();
+  EXPECT_EQ(queues.find(tid), spare);
+
+  int32_t otherTid = tid + 1;
+  queues.add(otherTid);
+  auto other = queues.find(otherTid);
+  ASSERT_NE(other, nullptr);
+  EXPECT_NE(other, spare);
+}
+
+TEST(StackTableTest, definesThenReferencesTheSameStack) {
+  StackTable table;
+  int64_t frames[] = {0xface, 0xb00c, 0xf00d};
+  int32_t id = 0;
+  EXPECT_EQ(
+      table.use(kQueueTestTracer, frames, 3, 1000, id),
+      StackTable::Use::DEFINE);
+  EXPECT_GT(id, 0);
+
+  int32_t again = 0;
+  EXPECT_EQ(
+      table.use(kQueueTestTracer, frames, 3, 1000, again),
+      StackTable::Use::REFERENCE);
+  EXPECT_EQ(again, id);
+  EXPECT_EQ(table.size(), 1);
+}
+
+TEST(StackTableTest, tellsStacksAndTracersApart) {
+  StackTable table;
+  int64_t frames[] = {0xface, 0xb00c, 0xf00d};
+  int64_t other[] = {0xface, 0xb00c, 0xbeef};
+  int32_t id = 0;
+  int32_t other_id = 0;
+  int32_t shorter_id = 0;
+  int32_t other_tracer_id = 0;
+  table.use(kQueueTestTracer, frames, 3, 1000, id);
+  EXPECT_EQ(
+      table.use(kQueueTestTracer, other, 3, 1000, other_id),
+      StackTable::Use::DEFINE);
+  EXPECT_EQ(
+      table.use(kQueueTestTracer, frames, 2, 1000, shorter_id),
+      StackTable::Use::DEFINE);
+  EXPECT_EQ(
+      table.use(tracers::JAVASCRIPT, frames, 3, 1000, other_tracer_id),
+      StackTable::Use::DEFINE);
+
+  std::unordered_set<int32_t> ids{id, other_id, shorter_id, other_tracer_id};
+  EXPECT_EQ(ids.size(), 4);
+  EXPECT_EQ(table.size(), 4);
+}
+
+TEST(StackTableTest, inlinesStacksOnceFull) {
+  StackTable table{4};
+  int64_t frames[] = {0xface, 0xb00c, 0xf00d};
+  int64_t other[] = {0xface, 0xbeef};
+  int32_t id = 0;
+  EXPECT_EQ(
+      table.use(kQueueTestTracer, frames, 3, 1000, id),
+      StackTable::Use::DEFINE);
+  EXPECT_EQ(
+      table.use(kQueueTestTracer, other, 2, 1000, id),
+      StackTable::Use::INLINE);
+  EXPECT_EQ(id, 0);
+
+  // Stacks already in the table are still referenced.
+  EXPECT_EQ(
+      table.use(kQueueTestTracer, frames, 3, 1000, id),
+      StackTable::Use::REFERENCE);
+}
+
+TEST(StackTableTest, redefinesStacksOlderThanMaxAge) {
+  StackTable table;
+  int64_t frames[] = {0xface, 0xb00c, 0xf00d};
+  int32_t id = 0;
+  int32_t again = 0;
+  table.logged(10);
+  table.use(kQueueTestTracer, frames, 3, 100, id);
+  table.logged(11);
+
+  table.logged(110);
+  EXPECT_EQ(
+      table.use(kQueueTestTracer, frames, 3, 100, again),
+      StackTable::Use::REFERENCE);
+
+  table.logged(111);
+  EXPECT_EQ(
+      table.use(kQueueTestTracer, frames, 3, 100, again),
+      StackTable::Use::DEFINE);
+  EXPECT_EQ(again, id);
+
+  EXPECT_EQ(
+      table.use(kQueueTestTracer, frames, 3, 100, again),
+      StackTable::Use::REFERENCE);
+}
+
+TEST(StackTableTest, resetDropsStacks) {
+  StackTable table;
+  int64_t frames[] = {0xface, 0xb00c, 0xf00d};
+  int32_t id = 0;
+  int32_t after_reset = 0;
+  table.use(kQueueTestTracer, frames, 3, 1000, id);
+  table.reset();
+  EXPECT_EQ(table.size(), 0);
+
+  EXPECT_EQ(
+      table.use(kQueueTestTracer, frames, 3, 1000, after_reset),
+      StackTable::Use::DEFINE);
+  EXPECT_NE(after_reset, id);
+}
+
 } // namespace profiler
 } // namespace profilo
 } // namespace facebook
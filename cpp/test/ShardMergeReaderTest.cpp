@@ -0,0 +1,299 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <profilo/entries/Entry.h>
+#include <profilo/entries/EntryType.h>
+#include <profilo/logger/Logger.h>
+#include <profilo/mmapbuf/Buffer.h>
+#include <profilo/writer/ShardMergeReader.h>
+
+using namespace facebook::profilo::entries;
+using namespace facebook::profilo::writer;
+
+namespace facebook {
+namespace profilo {
+
+namespace {
+
+constexpr size_t kShardCount = 3;
+constexpr size_t kEntryCount = 3 * 32;
+
+struct Visited {
+  EntryType type;
+  int64_t timestamp;
+  int32_t id;
+};
+
+class RecordingVisitor : public EntryVisitor {
+ public:
+  void visit(const StandardEntry& entry) override {
+    visited.push_back({entry.type, entry.timestamp, entry.id});
+  }
+
+  void visit(const FramesEntry& entry) override {
+    visited.push_back({entry.type, entry.timestamp, entry.id});
+  }
+
+  void visit(const BytesEntry& entry) override {
+    visited.push_back({entry.type, -1, entry.id});
+  }
+
+  std::vector<Visited> visited;
+};
+
+bool samePosition(TraceBuffer::Cursor const& a, TraceBuffer::Cursor const& b) {
+  return a.distanceTo(b) == 0 && b.distanceTo(a) == 0;
+}
+
+class ShardMergeReaderTest : public ::testing::Test {
+ protected:
+  ShardMergeReaderTest()
+      : ::testing::Test(), buffer_(kEntryCount, kShardCount), ids_(1) {}
+
+  int32_t write(size_t shard, EntryType type, int64_t timestamp) {
+    Logger logger(
+        [this, shard]() -> TraceBuffer& { return buffer_.shard(shard); },
+        ids_);
+    return logger.write(StandardEntry{
+        .id = 0,
+        .type = type,
+        .timestamp = timestamp,
+        .tid = 1,
+        .callid = 0,
+        .matchid = 0,
+        .extra = 0});
+  }
+
+  int32_t writeBytes(size_t shard, int32_t matchid, const char* bytes) {
+    Logger logger(
+        [this, shard]() -> TraceBuffer& { return buffer_.shard(shard); },
+        ids_);
+    return logger.writeBytes(
+        EntryType::STRING_VALUE,
+        matchid,
+        reinterpret_cast<const uint8_t*>(bytes),
+        strlen(bytes));
+  }
+
+  std::vector<Visited> readAll(
+      mmapbuf::Buffer::ShardCursors& cursors,
+      ShardMergeReader::Direction direction) {
+    ShardMergeReader reader(buffer_.shards(), cursors, direction);
+    RecordingVisitor visitor;
+    while (reader.next(visitor) == ShardMergeReader::Status::ENTRY) {
+    }
+    return visitor.visited;
+  }
+
+  mmapbuf::Buffer buffer_;
+  Logger::EntryIDCounter ids_;
+};
+
+} // namespace
+
+TEST_F(ShardMergeReaderTest, testForwardMergesByTimestamp) {
+  write(1, EntryType::TRACE_START, 100);
+  write(0, EntryType::MARK_PUSH, 110);
+  write(2, EntryType::MARK_PUSH, 115);
+  write(1, EntryType::MARK_POP, 120);
+  write(0, EntryType::MARK_POP, 130);
+  write(2, EntryType::TRACE_END, 140);
+
+  auto cursors = buffer_.currentTails();
+  auto visited = readAll(cursors, ShardMergeReader::Direction::FORWARD);
+
+  ASSERT_EQ(visited.size(), 6);
+  int64_t expected[] = {100, 110, 115, 120, 130, 140};
+  for (size_t idx = 0; idx < visited.size(); ++idx) {
+    EXPECT_EQ(visited[idx].timestamp, expected[idx]);
+  }
+  EXPECT_EQ(visited.front().type, EntryType::TRACE_START);
+  EXPECT_EQ(visited.back().type, EntryType::TRACE_END);
+}
+
+TEST_F(ShardMergeReaderTest, testBackwardMergesByTimestamp) {
+  write(0, EntryType::MARK_PUSH, 10);
+  write(1, EntryType::MARK_PUSH, 20);
+  write(0, EntryType::MARK_POP, 30);
+  write(2, EntryType::MARK_POP, 40);
+
+  auto cursors = buffer_.currentHeads();
+  for (auto& cursor : cursors) {
+    cursor.moveBackward();
+  }
+  auto visited = readAll(cursors, ShardMergeReader::Direction::BACKWARD);
+
+  ASSERT_EQ(visited.size(), 4);
+  int64_t expected[] = {40, 30, 20, 10};
+  for (size_t idx = 0; idx < visited.size(); ++idx) {
+    EXPECT_EQ(visited[idx].timestamp, expected[idx]);
+  }
+}
+
+TEST_F(ShardMergeReaderTest, testBytesEntryFollowsItsEntry) {
+  auto mark = write(0, EntryType::MARK_PUSH, 10);
+  write(1, EntryType::MARK_PUSH, 11);
+  // Long enough to take several packets.
+  auto name = writeBytes(
+      0,
+      mark,
+      "a name that does not fit into a single packet of the trace buffer, "
+      "so it has to be reassembled from a few of them");
+  write(1, EntryType::MARK_POP, 12);
+
+  auto cursors = buffer_.currentTails();
+  auto visited = readAll(cursors, ShardMergeReader::Direction::FORWARD);
+
+  ASSERT_EQ(visited.size(), 4);
+  EXPECT_EQ(visited[0].id, mark);
+  EXPECT_EQ(visited[1].id, name);
+  EXPECT_EQ(visited[2].timestamp, 11);
+  EXPECT_EQ(visited[3].timestamp, 12);
+}
+
+TEST_F(ShardMergeReaderTest, testForwardReadsNewEntries) {
+  auto cursors = buffer_.currentHeads();
+  ShardMergeReader reader(
+      buffer_.shards(), cursors, ShardMergeReader::Direction::FORWARD);
+  RecordingVisitor visitor;
+
+  EXPECT_EQ(reader.next(visitor), ShardMergeReader::Status::EMPTY);
+
+  write(2, EntryType::MARK_PUSH, 10);
+  EXPECT_EQ(reader.next(visitor), ShardMergeReader::Status::ENTRY);
+  EXPECT_EQ(reader.next(visitor), ShardMergeReader::Status::EMPTY);
+
+  write(0, EntryType::MARK_POP, 20);
+  EXPECT_EQ(reader.next(visitor), ShardMergeReader::Status::ENTRY);
+
+  ASSERT_EQ(visitor.visited.size(), 2);
+  EXPECT_EQ(visitor.visited[0].timestamp, 10);
+  EXPECT_EQ(visitor.visited[1].timestamp, 20);
+}
+
+TEST_F(ShardMergeReaderTest, testPositionsPointAtVisitedEntry) {
+  write(0, EntryType::MARK_PUSH, 10);
+  auto start = buffer_.shard(1).currentHead();
+  write(1, EntryType::TRACE_START, 20);
+  write(1, EntryType::MARK_POP, 30);
+
+  auto cursors = buffer_.currentTails();
+  ShardMergeReader reader(
+      buffer_.shards(), cursors, ShardMergeReader::Direction::FORWARD);
+
+  class PositionsVisitor : public RecordingVisitor {
+   public:
+    explicit PositionsVisitor(ShardMergeReader& reader) : reader_(reader) {}
+
+    void visit(const StandardEntry& entry) override {
+      if (entry.type == EntryType::TRACE_START) {
+        positions = reader_.positions();
+      }
+    }
+
+    mmapbuf::Buffer::ShardCursors positions;
+
+   private:
+    ShardMergeReader& reader_;
+  } visitor(reader);
+
+  while (reader.next(visitor) == ShardMergeReader::Status::ENTRY) {
+  }
+
+  ASSERT_EQ(visitor.positions.size(), kShardCount);
+  EXPECT_TRUE(
+      samePosition(visitor.positions[0], buffer_.shard(0).currentHead()));
+  EXPECT_TRUE(samePosition(visitor.positions[1], start));
+}
+
+TEST_F(ShardMergeReaderTest, testForwardReportsLappedShard) {
+  auto cursors = buffer_.currentHeads();
+  for (size_t idx = 0; idx < kEntryCount / kShardCount + 1; ++idx) {
+    write(1, EntryType::MARK_PUSH, idx);
+  }
+
+  ShardMergeReader reader(
+      buffer_.shards(), cursors, ShardMergeReader::Direction::FORWARD);
+  RecordingVisitor visitor;
+  EXPECT_EQ(reader.next(visitor), ShardMergeReader::Status::MISSED);
+}
+
+TEST_F(ShardMergeReaderTest, testNeedsCursorPerShard) {
+  mmapbuf::Buffer::ShardCursors cursors{buffer_.shard(0).currentHead()};
+  EXPECT_THROW(
+      ShardMergeReader(
+          buffer_.shards(), cursors, ShardMergeReader::Direction::FORWARD),
+      std::invalid_argument);
+}
+
+TEST(ShardedBufferTest, testShardsDontOverlap) {
+  mmapbuf::Buffer buffer(4 * 7, 4);
+  ASSERT_EQ(buffer.shardCount(), 4);
+  EXPECT_EQ(buffer.entryCount, 4 * 7);
+
+  alignas(4) logger::Packet packet{};
+  for (size_t shard = 0; shard < buffer.shardCount(); ++shard) {
+    for (size_t idx = 0; idx < 7; ++idx) {
+      packet.stream = shard;
+      buffer.shard(shard).write(packet);
+    }
+  }
+
+  for (size_t shard = 0; shard < buffer.shardCount(); ++shard) {
+    EXPECT_EQ(
+        TraceBuffer::Cursor(0).distanceTo(buffer.shard(shard).currentHead()),
+        7);
+    auto cursor = buffer.shard(shard).currentTail();
+    for (size_t idx = 0; idx < 7; ++idx, cursor.moveForward()) {
+      ASSERT_TRUE(buffer.shard(shard).tryRead(packet, cursor));
+      EXPECT_EQ(packet.stream, shard);
+    }
+  }
+}
+
+TEST(ShardedBufferTest, testLoggerWritesToSomeShard) {
+  mmapbuf::Buffer buffer(4 * 8, 4);
+  auto before = buffer.currentHeads();
+  buffer.logger().write(StandardEntry{
+      .id = 0,
+      .type = EntryType::MARK_PUSH,
+      .timestamp = 1,
+      .tid = 1,
+      .callid = 0,
+      .matchid = 0,
+      .extra = 0});
+
+  uint64_t written = 0;
+  auto after = buffer.currentHeads();
+  for (size_t shard = 0; shard < buffer.shardCount(); ++shard) {
+    written += before[shard].distanceTo(after[shard]);
+  }
+  EXPECT_EQ(written, 1);
+}
+
+TEST(ShardedBufferTest, testRejectsBadShardCount) {
+  EXPECT_THROW(mmapbuf::Buffer(10, 0), std::invalid_argument);
+  EXPECT_THROW(mmapbuf::Buffer(3, 4), std::invalid_argument);
+}
+
+} // namespace profilo
+} // namespace facebook
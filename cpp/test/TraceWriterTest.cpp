@@ -15,8 +15,12 @@
  */
 
 #include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <chrono>
+#include <condition_variable>
 #include <limits>
+#include <mutex>
 #include <sstream>
 #include <thread>
 
@@ -31,9 +35,13 @@
 #include <profilo/PacketLogger.h>
 #include <profilo/entries/Entry.h>
 #include <profilo/entries/EntryType.h>
+#include <profilo/logger/Logger.h>
+#include <logger/MultiBufferLogger.h>
+#include <profilo/logger/StringTable.h>
 #include <profilo/mmapbuf/Buffer.h>
 #include <profilo/writer/TraceCallbacks.h>
 #include <profilo/writer/TraceWriter.h>
+#include <profilo/writer/trace_backwards.h>
 
 using namespace facebook::profilo::logger;
 using namespace facebook::profilo::writer;
@@ -189,8 +197,8 @@ class TraceWriterTest : public ::testing::Test {
 TEST_F(TraceWriterTest, testLoopStop) {
   auto thread = std::thread([&] { writer_.loop(); });
 
-  writer_.submit(
-      buffer_->ringBuffer().currentTail(), TraceWriter::kStopLoopTraceID);
+  EXPECT_TRUE(writer_.submit(
+      buffer_->ringBuffer().currentTail(), TraceWriter::kStopLoopTraceID));
   thread.join();
 }
 
@@ -200,7 +208,7 @@ TEST_F(TraceWriterTest, testTraceFileCreatedSimple) {
 
   auto thread = std::thread([&] { writer_.loop(); });
 
-  writer_.submit(kTraceID);
+  EXPECT_TRUE(writer_.submit(kTraceID));
   thread.join();
 
   EXPECT_EQ(getFileCount(), 1) << "There should be only one real file.";
@@ -248,7 +256,7 @@ TEST_F(TraceWriterTest, testNoTraceSubmitPastStart) {
 
   auto thread = std::thread([&] { writer_.loop(); });
 
-  writer_.submit(cursorPastStart, kTraceID);
+  EXPECT_TRUE(writer_.submit(cursorPastStart, kTraceID));
   thread.join();
 
   EXPECT_EQ(getFileCount(), 0);
@@ -259,13 +267,13 @@ TEST_F(TraceWriterTest, testNoTraceSubmitCursorOutOfBounds) {
   auto cursorAtTraceStart = buffer_->ringBuffer().currentTail();
 
   // force a wrap around
-  for (int i = 0; i < kBufferSize; ++i) {
+  for (size_t i = 0; i < kBufferSize; ++i) {
     writeTraceEnd();
   }
 
   auto thread = std::thread([&] { writer_.loop(); });
 
-  writer_.submit(cursorAtTraceStart, kTraceID);
+  EXPECT_TRUE(writer_.submit(cursorAtTraceStart, kTraceID));
   thread.join();
 
   EXPECT_EQ(getFileCount(), 0);
@@ -279,7 +287,7 @@ void TraceWriterTest::testNoTraceStartCursorAtTail(
 
   auto thread = std::thread([&] { writer_.loop(); });
 
-  writer_.submit(cursorAtBeginning, kTraceID);
+  EXPECT_TRUE(writer_.submit(cursorAtBeginning, kTraceID));
   thread.join();
 
   //
@@ -306,7 +314,7 @@ TEST_F(TraceWriterTest, testHeadersPropagateToFile) {
 
   auto thread = std::thread([&] { writer_.loop(); });
 
-  writer_.submit(kTraceID);
+  EXPECT_TRUE(writer_.submit(kTraceID));
   thread.join();
 
   auto trace = getOnlyTraceFileContents();
@@ -315,6 +323,87 @@ TEST_F(TraceWriterTest, testHeadersPropagateToFile) {
   EXPECT_NE(trace.find("key2|value2"), std::string::npos);
 }
 
+TEST_F(TraceWriterTest, testColumnarFormatDeclaredInHeaders) {
+  TraceWriter columnar_writer(
+      std::move(trace_dir_.path().generic_string()),
+      "test-prefix",
+      buffer_,
+      callbacks_,
+      generateHeaders(),
+      nullptr,
+      TraceFormat::COLUMNAR);
+
+  writeTraceStart();
+  writeTraceEnd();
+
+  auto thread = std::thread([&] { columnar_writer.loop(); });
+
+  EXPECT_TRUE(columnar_writer.submit(kTraceID));
+  thread.join();
+
+  auto trace = getOnlyTraceFileContents();
+  auto headers_end = trace.find("\n\n");
+  ASSERT_NE(headers_end, std::string::npos);
+
+  auto headers = trace.substr(0, headers_end + 1);
+  EXPECT_NE(headers.find("fmt|columnar\n"), std::string::npos);
+  EXPECT_NE(headers.find("key1|value1"), std::string::npos);
+  // Both entries end up in a single block, as binary.
+  auto body = trace.substr(headers_end + 2);
+  ASSERT_FALSE(body.empty());
+  EXPECT_EQ(body[0], 2) << "block must hold TRACE_START and TRACE_END";
+  EXPECT_EQ(body.find("|"), std::string::npos);
+}
+
+TEST_F(TraceWriterTest, testTextFormatDeclaredInHeaders) {
+  writeTraceStart();
+  writeTraceEnd();
+
+  auto thread = std::thread([&] { writer_.loop(); });
+
+  EXPECT_TRUE(writer_.submit(kTraceID));
+  thread.join();
+
+  auto trace = getOnlyTraceFileContents();
+  EXPECT_NE(trace.find("fmt|text\n"), std::string::npos);
+  EXPECT_NE(trace.find("comp|zlib\n"), std::string::npos);
+  EXPECT_NE(trace.find("|TRACE_START|"), std::string::npos);
+}
+
+TEST_F(TraceWriterTest, testCompressionHeaderOverridesConfig) {
+  auto headers = generateHeaders();
+  headers.emplace_back(TraceFileHelpers::kCompressionHeader, "none");
+  CompressionConfig compression;
+  compression.codec = CompressionCodec::ZLIB;
+  TraceWriter uncompressed_writer(
+      std::move(trace_dir_.path().generic_string()),
+      "test-prefix",
+      buffer_,
+      callbacks_,
+      std::move(headers),
+      nullptr,
+      TraceFormat::TEXT,
+      compression);
+
+  writeTraceStart();
+  writeTraceEnd();
+
+  auto thread = std::thread([&] { uncompressed_writer.loop(); });
+
+  EXPECT_TRUE(uncompressed_writer.submit(kTraceID));
+  thread.join();
+
+  // Read the file as is, without the zlib auto-detection of zstr.
+  std::ifstream input(getOnlyTraceFile().generic_string());
+  std::stringstream trace;
+  trace << input.rdbuf();
+  auto contents = trace.str();
+  ASSERT_EQ(contents.substr(0, 3), "dt\n");
+  EXPECT_NE(contents.find("comp|none\n"), std::string::npos);
+  EXPECT_EQ(contents.find("comp|zlib\n"), std::string::npos);
+  EXPECT_NE(contents.find("|TRACE_END|"), std::string::npos);
+}
+
 void TraceWriterTest::testCallbackCalls(std::function<void()> expectations) {
   ::testing::InSequence dummy_;
 
@@ -324,7 +413,7 @@ void TraceWriterTest::testCallbackCalls(std::function<void()> expectations) {
 
   auto thread = std::thread([&] { writer_.loop(); });
 
-  writer_.submit(buffer_start, kTraceID);
+  EXPECT_TRUE(writer_.submit(buffer_start, kTraceID));
   thread.join();
 }
 
@@ -361,11 +450,869 @@ TEST_F(TraceWriterTest, testCallbacksMissedStart) {
     EXPECT_CALL(*callbacks_, onTraceAbort(kTraceID, _)).Times(0);
 
     writeTraceStart();
-    for (int idx = 0; idx < kBufferSize; idx++) {
+    for (size_t idx = 0; idx < kBufferSize; idx++) {
       writeFillerEvent();
     }
   });
 }
 
+TEST_F(TraceWriterTest, testLoopProcessesAllPendingTraces) {
+  const int64_t kSecondTraceID = kTraceID + 1;
+  using ::testing::_;
+  EXPECT_CALL(*callbacks_, onTraceEnd(kTraceID));
+  EXPECT_CALL(*callbacks_, onTraceEnd(kSecondTraceID));
+  EXPECT_CALL(*callbacks_, onTraceAbort(_, _)).Times(0);
+
+  auto first_start = buffer_->ringBuffer().currentHead();
+  writeTraceStart();
+  writeTraceEnd();
+  auto second_start = buffer_->ringBuffer().currentHead();
+  writeTraceStart(kSecondTraceID);
+  writeTraceEnd(kSecondTraceID);
+
+  // Both traces end before the writer gets to either of them.
+  EXPECT_TRUE(writer_.submit(first_start, kTraceID));
+  EXPECT_TRUE(writer_.submit(second_start, kSecondTraceID));
+
+  auto thread = std::thread([&] { writer_.loop(); });
+  thread.join();
+
+  EXPECT_EQ(getFileCount(), 2);
+}
+
+TEST_F(TraceWriterTest, testSubmitFailsWhenQueueIsFull) {
+  TraceWriter writer(
+      std::move(trace_dir_.path().generic_string()),
+      "test-prefix",
+      buffer_,
+      callbacks_,
+      generateHeaders(),
+      nullptr,
+      TraceFormat::TEXT,
+      CompressionConfig(),
+      /* max_pending_traces */ 1);
+
+  writeTraceStart();
+  writeTraceEnd();
+
+  EXPECT_TRUE(writer.submit(kTraceID));
+  EXPECT_FALSE(writer.submit(kTraceID + 1));
+
+  auto thread = std::thread([&] { writer.loop(); });
+  thread.join();
+
+  EXPECT_EQ(getFileCount(), 1);
+  // Processing frees up the queue.
+  EXPECT_TRUE(writer.submit(kTraceID + 1));
+}
+
+TEST_F(TraceWriterTest, testBackwardTraceReadsWholeWrappedBuffer) {
+  constexpr size_t kSlots = 200;
+  auto buffer = std::make_shared<mmapbuf::Buffer>(kSlots);
+  TraceWriter writer(
+      std::move(trace_dir_.path().generic_string()),
+      "test-prefix",
+      buffer,
+      callbacks_,
+      generateHeaders(),
+      [](EntryVisitor& visitor, Buffer& buffer, ShardCursors& cursors) {
+        traceBackwards(visitor, buffer, cursors);
+      });
+  auto write = [&buffer](EntryType type) {
+    buffer->logger().write(StandardEntry{
+        .id = 0,
+        .type = type,
+        .timestamp = 100,
+        .tid = 0,
+        .callid = 0,
+        .matchid = 0,
+        .extra = kTraceID,
+    });
+  };
+
+  // Wraps around, the oldest ones are overwritten.
+  for (size_t idx = 0; idx < kSlots + kSlots / 2; ++idx) {
+    write(EntryType::MARK_PUSH);
+  }
+  auto cursor = buffer->ringBuffer().currentHead();
+  write(EntryType::TRACE_BACKWARDS);
+  write(EntryType::TRACE_END);
+
+  writer.processTrace(kTraceID, cursor);
+
+  auto trace = getOnlyTraceFileContents();
+  size_t pushes = 0;
+  for (auto pos = trace.find("|MARK_PUSH|"); pos != std::string::npos;
+       pos = trace.find("|MARK_PUSH|", pos + 1)) {
+    ++pushes;
+  }
+  // Every slot but the two written after them.
+  EXPECT_EQ(pushes, kSlots - 2);
+}
+
+//
+// Producer that laps the writer: after TRACE_START it writes `fillers`
+// entries and TRACE_END while the writer is held up in onTraceStart, so the
+// writer only gets to the buffer after most of the trace was overwritten.
+//
+class TraceWriterStreamingTest : public TraceWriterTest {
+ protected:
+  std::string runFastProducer(TraceWriter& writer, size_t fillers) {
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool started = false;
+    bool produced = false;
+    ON_CALL(*callbacks_, onTraceStart(kTraceID, ::testing::_))
+        .WillByDefault(::testing::Invoke([&](int64_t, int32_t) {
+          std::unique_lock<std::mutex> lock(mutex);
+          started = true;
+          cv.notify_all();
+          cv.wait(lock, [&] { return produced; });
+        }));
+
+    auto start = buffer_->ringBuffer().currentHead();
+    writeTraceStart();
+    auto thread = std::thread([&] { writer.processTrace(kTraceID, start); });
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [&] { return started; });
+    }
+
+    for (size_t i = 0; i < fillers; ++i) {
+      writeFillerEvent();
+    }
+    writeTraceEnd();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      produced = true;
+    }
+    cv.notify_all();
+    thread.join();
+
+    return getOnlyTraceFileContents();
+  }
+
+  std::unique_ptr<TraceWriter> makeWriter(StreamingConfig streaming) {
+    return std::make_unique<TraceWriter>(
+        std::move(trace_dir_.path().generic_string()),
+        "test-prefix",
+        buffer_,
+        callbacks_,
+        generateHeaders(),
+        nullptr,
+        TraceFormat::TEXT,
+        CompressionConfig(),
+        TraceWriter::kDefaultMaxPendingTraces,
+        std::move(streaming));
+  }
+};
+
+TEST_F(TraceWriterStreamingTest, testFastProducerAbortsWithoutStreaming) {
+  using ::testing::_;
+  EXPECT_CALL(*callbacks_, onTraceStart(kTraceID, _));
+  EXPECT_CALL(*callbacks_, onTraceAbort(kTraceID, AbortReason::MISSED_EVENT));
+  EXPECT_CALL(*callbacks_, onTraceEnd(_)).Times(0);
+
+  auto trace = runFastProducer(writer_, 10 * kBufferSize);
+  EXPECT_EQ(trace.find("|TRACE_END|"), std::string::npos);
+}
+
+TEST_F(TraceWriterStreamingTest, testFastProducerSkipsAheadWhenStreaming) {
+  using ::testing::_;
+  EXPECT_CALL(*callbacks_, onTraceStart(kTraceID, _));
+  EXPECT_CALL(*callbacks_, onTraceEnd(kTraceID));
+  EXPECT_CALL(*callbacks_, onTraceAbort(_, _)).Times(0);
+
+  StreamingConfig streaming;
+  streaming.enabled = true;
+  auto writer = makeWriter(std::move(streaming));
+
+  auto trace = runFastProducer(*writer, 10 * kBufferSize);
+
+  auto lost = trace.find("|TRACE_PACKETS_LOST|");
+  ASSERT_NE(lost, std::string::npos);
+  EXPECT_LT(trace.find("|TRACE_START|"), lost);
+  EXPECT_LT(lost, trace.find("|TRACE_END|"));
+  // The gap's size is in the last column.
+  auto lost_line = trace.substr(lost, trace.find('\n', lost) - lost);
+  auto lost_packets = std::stoull(lost_line.substr(lost_line.rfind('|') + 1));
+  EXPECT_GT(lost_packets, 0);
+  EXPECT_LE(lost_packets, 10 * kBufferSize + 1);
+}
+
+TEST_F(TraceWriterStreamingTest, testProgressReportedPerChunk) {
+  using ::testing::_;
+  EXPECT_CALL(*callbacks_, onTraceEnd(kTraceID));
+  EXPECT_CALL(*callbacks_, onTraceAbort(_, _)).Times(0);
+
+  std::vector<StreamingProgress> progress;
+  std::vector<std::string> chunks;
+  StreamingConfig streaming;
+  streaming.enabled = true;
+  streaming.chunk_packets = 2;
+  streaming.progress_callback = [&](StreamingProgress const& report) {
+    progress.push_back(report);
+    // Each flush leaves a readable file behind.
+    chunks.push_back(getOnlyTraceFileContents());
+  };
+  auto writer = makeWriter(std::move(streaming));
+
+  // A producer that stays ahead of the writer, but within the buffer.
+  auto start = buffer_->ringBuffer().currentHead();
+  writeTraceStart();
+  for (int i = 0; i < 3; ++i) {
+    writeFillerEvent();
+  }
+  writeTraceEnd();
+  auto cursor = start;
+  writer->processTrace(kTraceID, cursor);
+
+  // Packets 2 and 4 end a chunk, TRACE_END ends the trace at packet 5.
+  ASSERT_EQ(progress.size(), 2);
+  EXPECT_EQ(progress[0].trace_id, kTraceID);
+  EXPECT_EQ(progress[0].lag, 3);
+  EXPECT_EQ(progress[1].lag, 1);
+  EXPECT_EQ(progress[1].lost_packets, 0);
+  EXPECT_EQ(start.distanceTo(progress[0].checkpoint), 2);
+  EXPECT_EQ(start.distanceTo(progress[1].checkpoint), 4);
+
+  EXPECT_NE(chunks[0].find("|TRACE_START|"), std::string::npos) << chunks[0];
+  EXPECT_EQ(chunks[0].find("|TRACE_END|"), std::string::npos);
+  EXPECT_EQ(chunks[1].find("|TRACE_END|"), std::string::npos);
+  EXPECT_NE(getOnlyTraceFileContents().find("|TRACE_END|"), std::string::npos);
+}
+
+//
+// A buffer with one ring per shard, written to through a logger per shard.
+//
+class ShardedTraceWriterTest : public TraceWriterTest {
+ protected:
+  static constexpr size_t kShards = 3;
+  static constexpr size_t kShardSize = 16;
+
+  ShardedTraceWriterTest()
+      : TraceWriterTest(),
+        sharded_buffer_(
+            std::make_shared<mmapbuf::Buffer>(kShards * kShardSize, kShards)),
+        ids_(1),
+        sharded_writer_(
+            std::move(trace_dir_.path().generic_string()),
+            "test-prefix",
+            sharded_buffer_,
+            callbacks_,
+            generateHeaders(),
+            [this](EntryVisitor& visitor, Buffer& buffer, ShardCursors& cursors) {
+              backwards_cursors_ = cursors;
+            }) {}
+
+  void write(size_t shard, EntryType type, int64_t timestamp) {
+    Logger logger(
+        [this, shard]() -> TraceBuffer& {
+          return sharded_buffer_->shard(shard);
+        },
+        ids_);
+    logger.write(StandardEntry{
+        .id = 0,
+        .type = type,
+        .timestamp = timestamp,
+        .tid = 0,
+        .callid = 0,
+        .matchid = 0,
+        .extra = kTraceID,
+    });
+  }
+
+  std::shared_ptr<mmapbuf::Buffer> sharded_buffer_;
+  Logger::EntryIDCounter ids_;
+  TraceWriter sharded_writer_;
+  ShardCursors backwards_cursors_;
+};
+
+constexpr size_t ShardedTraceWriterTest::kShards;
+
+TEST_F(ShardedTraceWriterTest, testTraceMergedAcrossShards) {
+  using ::testing::_;
+  EXPECT_CALL(*callbacks_, onTraceStart(kTraceID, _));
+  EXPECT_CALL(*callbacks_, onTraceEnd(kTraceID));
+  EXPECT_CALL(*callbacks_, onTraceAbort(_, _)).Times(0);
+
+  auto start_cursors = sharded_buffer_->currentHeads();
+  auto cursors = start_cursors;
+  write(0, EntryType::COUNTER, 90);
+  write(1, EntryType::TRACE_BACKWARDS, 100);
+  write(0, EntryType::MARK_PUSH, 110);
+  write(2, EntryType::MARK_POP, 120);
+  write(0, EntryType::TRACE_END, 130);
+
+  sharded_writer_.processTrace(kTraceID, cursors);
+
+  auto trace = getOnlyTraceFileContents();
+  auto start = trace.find("|TRACE_BACKWARDS|");
+  auto push = trace.find("|MARK_PUSH|");
+  auto pop = trace.find("|MARK_POP|");
+  auto end = trace.find("|TRACE_END|");
+  ASSERT_NE(start, std::string::npos);
+  ASSERT_NE(end, std::string::npos);
+  EXPECT_LT(start, push);
+  EXPECT_LT(push, pop);
+  EXPECT_LT(pop, end);
+  // Before the trace start, left to the trace backwards callback.
+  EXPECT_EQ(trace.find("|COUNTER|"), std::string::npos);
+
+  // Called at the trace start, with every shard where it was then.
+  ASSERT_EQ(backwards_cursors_.size(), kShards);
+  EXPECT_EQ(start_cursors[0].distanceTo(backwards_cursors_[0]), 1);
+  EXPECT_EQ(start_cursors[1].distanceTo(backwards_cursors_[1]), 0);
+  EXPECT_EQ(start_cursors[2].distanceTo(backwards_cursors_[2]), 0);
+}
+
+TEST_F(ShardedTraceWriterTest, testLoopWaitsForOtherShards) {
+  using ::testing::_;
+  EXPECT_CALL(*callbacks_, onTraceEnd(kTraceID));
+
+  auto thread = std::thread([&] { sharded_writer_.loop(); });
+  EXPECT_TRUE(
+      sharded_writer_.submit(sharded_buffer_->currentHeads(), kTraceID));
+
+  write(2, EntryType::TRACE_START, 100);
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  write(1, EntryType::TRACE_END, 110);
+  thread.join();
+
+  EXPECT_NE(getOnlyTraceFileContents().find("|TRACE_END|"), std::string::npos);
+}
+
+TEST_F(ShardedTraceWriterTest, testDumpIncludesAllShards) {
+  write(0, EntryType::MARK_PUSH, 10);
+  write(1, EntryType::COUNTER, 20);
+  write(2, EntryType::MARK_POP, 30);
+  // dump() leaves out the last write of each shard.
+  write(0, EntryType::TRACE_END, 40);
+  write(1, EntryType::TRACE_END, 40);
+  write(2, EntryType::TRACE_END, 40);
+
+  sharded_writer_.dump(kTraceID);
+
+  auto trace = getOnlyTraceFileContents();
+  // Newest first.
+  auto pop = trace.find("|MARK_POP|");
+  auto counter = trace.find("|COUNTER|");
+  auto push = trace.find("|MARK_PUSH|");
+  ASSERT_NE(pop, std::string::npos);
+  EXPECT_LT(pop, counter);
+  EXPECT_LT(counter, push);
+}
+
+TEST_F(ShardedTraceWriterTest, testNeedsCursorPerShard) {
+  auto cursor = sharded_buffer_->ringBuffer().currentHead();
+  bool submitted = false;
+  EXPECT_THROW(
+      submitted = sharded_writer_.submit(cursor, kTraceID),
+      std::invalid_argument);
+  EXPECT_FALSE(submitted);
+  EXPECT_THROW(
+      sharded_writer_.processTrace(kTraceID, cursor), std::invalid_argument);
+}
+
+TEST_F(ShardedTraceWriterTest, testStreamingNeedsUnshardedBuffer) {
+  StreamingConfig streaming;
+  streaming.enabled = true;
+  EXPECT_THROW(
+      TraceWriter(
+          std::move(trace_dir_.path().generic_string()),
+          "test-prefix",
+          sharded_buffer_,
+          callbacks_,
+          generateHeaders(),
+          nullptr,
+          TraceFormat::TEXT,
+          CompressionConfig(),
+          TraceWriter::kDefaultMaxPendingTraces,
+          std::move(streaming)),
+      std::invalid_argument);
+}
+
+//
+// A buffer holding a byte ring instead of packets.
+//
+class ByteRingTraceWriterTest : public TraceWriterTest {
+ protected:
+  static constexpr size_t kRingSlots = 16;
+
+  ByteRingTraceWriterTest()
+      : TraceWriterTest(),
+        ring_buffer_(std::make_shared<mmapbuf::Buffer>(
+            kRingSlots,
+            1,
+            Buffer::WriteMode::GUARANTEED,
+            Buffer::Backend::BYTE_RING)),
+        ids_(1),
+        ring_logger_(ring_buffer_->byteRing(), ids_),
+        ring_writer_(
+            std::move(trace_dir_.path().generic_string()),
+            "test-prefix",
+            ring_buffer_,
+            callbacks_,
+            generateHeaders(),
+            [this](EntryVisitor& visitor, Buffer& buffer, ShardCursors& cursors) {
+              backwards_cursors_ = cursors;
+              traceBackwards(visitor, buffer, cursors);
+            }) {}
+
+  TraceBuffer::Cursor write(EntryType type, int64_t timestamp) {
+    TraceBuffer::Cursor cursor(0);
+    ring_logger_.writeAndGetCursor(
+        StandardEntry{
+            .id = 0,
+            .type = type,
+            .timestamp = timestamp,
+            .tid = 0,
+            .callid = 0,
+            .matchid = 0,
+            .extra = kTraceID,
+        },
+        cursor);
+    return cursor;
+  }
+
+  std::shared_ptr<mmapbuf::Buffer> ring_buffer_;
+  Logger::EntryIDCounter ids_;
+  Logger ring_logger_;
+  TraceWriter ring_writer_;
+  ShardCursors backwards_cursors_;
+};
+
+TEST_F(ByteRingTraceWriterTest, testTraceReadFromRecords) {
+  using ::testing::_;
+  EXPECT_CALL(*callbacks_, onTraceStart(kTraceID, _));
+  EXPECT_CALL(*callbacks_, onTraceEnd(kTraceID));
+  EXPECT_CALL(*callbacks_, onTraceAbort(_, _)).Times(0);
+
+  write(EntryType::COUNTER, 90);
+  auto cursor = ring_buffer_->currentHeads().front();
+  auto start = write(EntryType::TRACE_BACKWARDS, 100);
+  write(EntryType::MARK_PUSH, 110);
+  write(EntryType::TRACE_END, 120);
+
+  ring_writer_.processTrace(kTraceID, cursor);
+
+  auto trace = getOnlyTraceFileContents();
+  auto counter = trace.find("|COUNTER|");
+  auto push = trace.find("|MARK_PUSH|");
+  ASSERT_NE(counter, std::string::npos);
+  ASSERT_NE(push, std::string::npos);
+  // Found by walking back from the trace start.
+  EXPECT_LT(counter, push);
+  ASSERT_EQ(backwards_cursors_.size(), 1);
+  EXPECT_EQ(start.distanceTo(backwards_cursors_[0]), 0);
+  EXPECT_EQ(backwards_cursors_[0].distanceTo(start), 0);
+}
+
+TEST_F(ByteRingTraceWriterTest, testLoopPollsForRecords) {
+  using ::testing::_;
+  EXPECT_CALL(*callbacks_, onTraceEnd(kTraceID));
+
+  auto thread = std::thread([&] { ring_writer_.loop(); });
+  EXPECT_TRUE(ring_writer_.submit(ring_buffer_->currentHeads(), kTraceID));
+
+  write(EntryType::TRACE_START, 100);
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  write(EntryType::TRACE_END, 110);
+  thread.join();
+
+  EXPECT_NE(getOnlyTraceFileContents().find("|TRACE_END|"), std::string::npos);
+}
+
+TEST_F(ByteRingTraceWriterTest, testLappedTraceAborts) {
+  using ::testing::_;
+  EXPECT_CALL(*callbacks_, onTraceAbort(kTraceID, AbortReason::MISSED_EVENT));
+  EXPECT_CALL(*callbacks_, onTraceEnd(_)).Times(0);
+
+  // Hold the writer up in onTraceStart until the ring went around.
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool started = false;
+  bool produced = false;
+  EXPECT_CALL(*callbacks_, onTraceStart(kTraceID, _))
+      .WillOnce(::testing::Invoke([&](int64_t, int32_t) {
+        std::unique_lock<std::mutex> lock(mutex);
+        started = true;
+        cv.notify_all();
+        cv.wait(lock, [&] { return produced; });
+      }));
+
+  auto cursor = ring_buffer_->currentHeads().front();
+  write(EntryType::TRACE_START, 100);
+  auto thread =
+      std::thread([&] { ring_writer_.processTrace(kTraceID, cursor); });
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&] { return started; });
+  }
+
+  for (size_t idx = 0; idx < 4 * kRingSlots; ++idx) {
+    write(EntryType::MARK_PUSH, 110);
+  }
+  write(EntryType::TRACE_END, 120);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    produced = true;
+  }
+  cv.notify_all();
+  thread.join();
+}
+
+TEST_F(ByteRingTraceWriterTest, testDumpIncludesLastRecord) {
+  write(EntryType::MARK_PUSH, 10);
+  write(EntryType::MARK_POP, 20);
+
+  ring_writer_.dump(kTraceID);
+
+  auto trace = getOnlyTraceFileContents();
+  // Newest first.
+  auto pop = trace.find("|MARK_POP|");
+  auto push = trace.find("|MARK_PUSH|");
+  ASSERT_NE(pop, std::string::npos);
+  EXPECT_LT(pop, push);
+}
+
+TEST_F(ByteRingTraceWriterTest, testStreamingNeedsPacketBuffer) {
+  StreamingConfig streaming;
+  streaming.enabled = true;
+  EXPECT_THROW(
+      TraceWriter(
+          std::move(trace_dir_.path().generic_string()),
+          "test-prefix",
+          ring_buffer_,
+          callbacks_,
+          generateHeaders(),
+          nullptr,
+          TraceFormat::TEXT,
+          CompressionConfig(),
+          TraceWriter::kDefaultMaxPendingTraces,
+          std::move(streaming)),
+      std::invalid_argument);
+}
+
+//
+// Names logged through MultiBufferLogger::writeNamed, which interns them.
+//
+class InternedStringTraceWriterTest : public TraceWriterTest {
+ protected:
+  static constexpr size_t kNamedBufferSize = 1024;
+
+  InternedStringTraceWriterTest()
+      : TraceWriterTest(),
+        named_buffer_(std::make_shared<mmapbuf::Buffer>(kNamedBufferSize)),
+        ids_(1),
+        strings_(),
+        named_logger_(ids_, strings_) {
+    named_logger_.addBuffer(named_buffer_);
+  }
+
+  std::unique_ptr<TraceWriter> makeWriter(const StringTable* strings) {
+    return std::make_unique<TraceWriter>(
+        std::move(trace_dir_.path().generic_string()),
+        "test-prefix",
+        named_buffer_,
+        callbacks_,
+        generateHeaders(),
+        [](EntryVisitor& visitor, Buffer& buffer, ShardCursors& cursors) {
+          traceBackwards(visitor, buffer, cursors);
+        },
+        TraceFormat::TEXT,
+        CompressionConfig(),
+        TraceWriter::kDefaultMaxPendingTraces,
+        StreamingConfig(),
+        strings);
+  }
+
+  void write(EntryType type) {
+    named_logger_.write(StandardEntry{
+        .id = 0,
+        .type = type,
+        .timestamp = 100,
+        .tid = 0,
+        .callid = 0,
+        .matchid = 0,
+        .extra = kTraceID,
+    });
+  }
+
+  void writeNamed(const char* name) {
+    named_logger_.writeNamed(
+        StandardEntry{
+            .id = 0,
+            .type = EntryType::MARK_PUSH,
+            .timestamp = 100,
+            .tid = 0,
+        },
+        name,
+        strlen(name));
+  }
+
+  static size_t count(const std::string& trace, const std::string& needle) {
+    size_t result = 0;
+    for (auto pos = trace.find(needle); pos != std::string::npos;
+         pos = trace.find(needle, pos + 1)) {
+      ++result;
+    }
+    return result;
+  }
+
+  std::shared_ptr<mmapbuf::Buffer> named_buffer_;
+  Logger::EntryIDCounter ids_;
+  StringTable strings_;
+  MultiBufferLogger named_logger_;
+};
+
+TEST_F(InternedStringTraceWriterTest, testNamesExpandedInTrace) {
+  auto cursor = named_buffer_->ringBuffer().currentHead();
+  write(EntryType::TRACE_START);
+  writeNamed("Choreographer#doFrame");
+  writeNamed("Choreographer#doFrame");
+  write(EntryType::TRACE_END);
+
+  makeWriter(nullptr)->processTrace(kTraceID, cursor);
+
+  auto trace = getOnlyTraceFileContents();
+  EXPECT_EQ(count(trace, "|STRING_NAME|"), 2);
+  EXPECT_EQ(count(trace, "Choreographer#doFrame"), 2);
+  EXPECT_EQ(count(trace, "|STRING_DEFINITION|"), 0);
+  EXPECT_EQ(count(trace, "|MARK_PUSH|"), 2);
+}
+
+TEST_F(InternedStringTraceWriterTest, testBackwardTraceVisitsDefinitionsFirst) {
+  writeNamed("Choreographer#doFrame");
+  writeNamed("Choreographer#doFrame");
+  auto cursor = named_buffer_->ringBuffer().currentHead();
+  write(EntryType::TRACE_BACKWARDS);
+  write(EntryType::TRACE_END);
+
+  // Only the definitions in the buffer can name the blocks.
+  makeWriter(nullptr)->processTrace(kTraceID, cursor);
+
+  auto trace = getOnlyTraceFileContents();
+  EXPECT_EQ(count(trace, "Choreographer#doFrame"), 2);
+  EXPECT_EQ(count(trace, "|STRING_DEFINITION|"), 0);
+}
+
+TEST_F(InternedStringTraceWriterTest, testTableNamesBlocksDefinedBeforeTrace) {
+  writeNamed("Choreographer#doFrame");
+  auto cursor = named_buffer_->ringBuffer().currentHead();
+  write(EntryType::TRACE_START);
+  writeNamed("Choreographer#doFrame");
+  write(EntryType::TRACE_END);
+
+  makeWriter(&strings_)->processTrace(kTraceID, cursor);
+
+  auto trace = getOnlyTraceFileContents();
+  EXPECT_EQ(count(trace, "|MARK_PUSH|"), 1);
+  EXPECT_EQ(count(trace, "Choreographer#doFrame"), 1);
+}
+
+//
+// Stack samples as the sampling profiler logs them, deduplicated by its
+// StackTable.
+//
+class InternedStackTraceWriterTest : public InternedStringTraceWriterTest {
+ protected:
+  static constexpr int32_t kStackTid = 42;
+
+  void writeSample(int64_t timestamp, int32_t matchid) {
+    named_logger_.write(StandardEntry{
+        .id = 0,
+        .type = EntryType::CPU_STACK_SAMPLE,
+        .timestamp = timestamp,
+        .tid = kStackTid,
+        .matchid = matchid,
+    });
+  }
+
+  void writeFrames(int64_t timestamp) {
+    named_logger_.write(FramesEntry{
+        .id = 0,
+        .type = EntryType::STACK_FRAME,
+        .timestamp = timestamp,
+        .tid = kStackTid,
+        .matchid = 0,
+        .frames = {.values = kFrames, .size = 3},
+    });
+  }
+
+  // A stack sample the way StackTable::Use::DEFINE logs it.
+  void writeDefinition(int64_t timestamp, int32_t stack_id) {
+    writeSample(timestamp, stack_id);
+    writeFrames(timestamp);
+  }
+
+  static constexpr int64_t kFrames[] = {0xface, 0xb00c, 0xf00d};
+};
+
+constexpr int64_t InternedStackTraceWriterTest::kFrames[];
+
+TEST_F(InternedStackTraceWriterTest, testReferencesExpandedInTrace) {
+  auto cursor = named_buffer_->ringBuffer().currentHead();
+  write(EntryType::TRACE_START);
+  writeDefinition(101, 7);
+  writeSample(102, -7);
+  writeSample(103, -7);
+  write(EntryType::TRACE_END);
+
+  makeWriter(nullptr)->processTrace(kTraceID, cursor);
+
+  auto trace = getOnlyTraceFileContents();
+  EXPECT_EQ(count(trace, "|CPU_STACK_SAMPLE|"), 3);
+  EXPECT_EQ(count(trace, "|STACK_FRAME|"), 3 * 3);
+  EXPECT_EQ(count(trace, "|-7|"), 0);
+}
+
+TEST_F(InternedStackTraceWriterTest, testBackwardTraceVisitsDefinitionsFirst) {
+  writeDefinition(101, 7);
+  writeSample(102, -7);
+  writeSample(103, -7);
+  auto cursor = named_buffer_->ringBuffer().currentHead();
+  write(EntryType::TRACE_BACKWARDS);
+  write(EntryType::TRACE_END);
+
+  makeWriter(nullptr)->processTrace(kTraceID, cursor);
+
+  auto trace = getOnlyTraceFileContents();
+  EXPECT_EQ(count(trace, "|CPU_STACK_SAMPLE|"), 3);
+  EXPECT_EQ(count(trace, "|STACK_FRAME|"), 3 * 3);
+}
+
+TEST_F(InternedStackTraceWriterTest, testOverwrittenDefinitionMarked) {
+  writeDefinition(101, 7);
+  // Lap the definition.
+  for (size_t i = 0; i < 2 * kNamedBufferSize; ++i) {
+    writeSample(102 + i, -7);
+  }
+  auto cursor = named_buffer_->ringBuffer().currentHead();
+  write(EntryType::TRACE_BACKWARDS);
+  write(EntryType::TRACE_END);
+
+  makeWriter(nullptr)->processTrace(kTraceID, cursor);
+
+  auto trace = getOnlyTraceFileContents();
+  auto samples = count(trace, "|CPU_STACK_SAMPLE|");
+  EXPECT_GT(samples, 0);
+  EXPECT_EQ(count(trace, "|STKERR_UNRESOLVED_STACK|"), samples);
+  EXPECT_EQ(count(trace, "|STACK_FRAME|"), 0);
+}
+
+//
+// Large payloads that go through the blob arena of the buffer.
+//
+class BlobTraceWriterTest : public TraceWriterTest {
+ protected:
+  static constexpr size_t kBlobBufferSize = 64;
+  static constexpr size_t kArenaSize = mmapbuf::Buffer::kMinBlobArenaSize;
+
+  BlobTraceWriterTest()
+      : TraceWriterTest(),
+        blob_buffer_(std::make_shared<mmapbuf::Buffer>(
+            kBlobBufferSize,
+            1,
+            mmapbuf::Buffer::WriteMode::GUARANTEED,
+            mmapbuf::Buffer::Backend::PACKETS,
+            kArenaSize)) {}
+
+  std::unique_ptr<TraceWriter> makeWriter() {
+    return std::make_unique<TraceWriter>(
+        std::move(trace_dir_.path().generic_string()),
+        "test-prefix",
+        blob_buffer_,
+        callbacks_,
+        generateHeaders(),
+        [](EntryVisitor& visitor, Buffer& buffer, ShardCursors& cursors) {
+          traceBackwards(visitor, buffer, cursors);
+        });
+  }
+
+  void write(EntryType type) {
+    blob_buffer_->logger().write(StandardEntry{
+        .id = 0,
+        .type = type,
+        .timestamp = 100,
+        .tid = 0,
+        .callid = 0,
+        .matchid = 0,
+        .extra = kTraceID,
+    });
+  }
+
+  void writeValue(const std::string& value) {
+    blob_buffer_->logger().writeBytes(
+        EntryType::STRING_VALUE,
+        0,
+        reinterpret_cast<const uint8_t*>(value.data()),
+        value.size());
+  }
+
+  std::shared_ptr<mmapbuf::Buffer> blob_buffer_;
+};
+
+TEST_F(BlobTraceWriterTest, testBlobsResolvedInTrace) {
+  auto& ring = blob_buffer_->ringBuffer();
+  auto cursor = ring.currentHead();
+  std::string large(Logger::kMaxVariableLengthEntry + 100, 'x');
+  std::string small(Logger::kMinBlobLength - 1, 's');
+  write(EntryType::TRACE_START);
+  writeValue(large);
+  writeValue(small);
+  write(EntryType::TRACE_END);
+
+  // TRACE_START, one packet for the reference, the small value, TRACE_END.
+  auto smallPackets = (small.size() + BytesEntry::kHeaderSize +
+                       sizeof(Packet::data) - 1) /
+      sizeof(Packet::data);
+  EXPECT_EQ(cursor.distanceTo(ring.currentHead()), 3 + smallPackets);
+
+  makeWriter()->processTrace(kTraceID, cursor);
+
+  auto trace = getOnlyTraceFileContents();
+  EXPECT_NE(trace.find(large), std::string::npos);
+  EXPECT_NE(trace.find(small), std::string::npos);
+  EXPECT_EQ(trace.find("BLOB_REFERENCE"), std::string::npos);
+}
+
+TEST_F(BlobTraceWriterTest, testOverwrittenBlobsMarkedLost) {
+  auto cursor = blob_buffer_->ringBuffer().currentHead();
+  write(EntryType::TRACE_START);
+  // Each takes more than a third of the arena, the first one is overwritten
+  // by the third.
+  for (char fill : {'a', 'b', 'c'}) {
+    writeValue(std::string(kArenaSize / 3 + 8, fill));
+  }
+  write(EntryType::TRACE_END);
+
+  makeWriter()->processTrace(kTraceID, cursor);
+
+  auto trace = getOnlyTraceFileContents();
+  EXPECT_EQ(trace.find(std::string(kArenaSize / 3 + 8, 'a')), std::string::npos);
+  EXPECT_NE(trace.find(std::string(kArenaSize / 3 + 8, 'b')), std::string::npos);
+  EXPECT_NE(trace.find(std::string(kArenaSize / 3 + 8, 'c')), std::string::npos);
+  EXPECT_EQ(trace.find("BLOB_REFERENCE"), std::string::npos);
+  // The first one is marked as lost.
+  auto lost = trace.find("|BLOB_LOST|");
+  EXPECT_NE(lost, std::string::npos);
+  EXPECT_EQ(trace.find("|BLOB_LOST|", lost + 1), std::string::npos);
+}
+
+TEST_F(BlobTraceWriterTest, testBlobsResolvedInBackwardTrace) {
+  std::string large(Logger::kMaxVariableLengthEntry + 100, 'x');
+  writeValue(large);
+  auto cursor = blob_buffer_->ringBuffer().currentHead();
+  write(EntryType::TRACE_BACKWARDS);
+  write(EntryType::TRACE_END);
+
+  makeWriter()->processTrace(kTraceID, cursor);
+
+  auto trace = getOnlyTraceFileContents();
+  EXPECT_NE(trace.find(large), std::string::npos);
+  EXPECT_EQ(trace.find("BLOB_REFERENCE"), std::string::npos);
+}
+
 } // namespace profilo
 } // namespace facebook
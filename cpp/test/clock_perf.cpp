@@ -0,0 +1,99 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//
+// Cost of a timestamp from every clock source available on this device, and
+// how far the cycle counter source drifts from CLOCK_MONOTONIC.
+//
+// Usage: clock_perf [reads]
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <initializer_list>
+
+#include <profilo/util/Clock.h>
+
+using namespace facebook::profilo;
+
+namespace {
+
+constexpr int kRepetitions = 5;
+
+double nsPerRead(clock::Source source, size_t reads) {
+  double best = 0;
+  for (int rep = 0; rep < kRepetitions; ++rep) {
+    int64_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < reads; ++i) {
+      sink += clock::read(source);
+    }
+    auto end = std::chrono::steady_clock::now();
+    if (sink == 0) {
+      fprintf(stderr, "Clock returned only zeroes\n");
+    }
+    double ns = std::chrono::duration<double, std::nano>(end - start).count() /
+        reads;
+    if (rep == 0 || ns < best) {
+      best = ns;
+    }
+  }
+  return best;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  size_t reads = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000000;
+
+  bool counter = clock::setSource(clock::Source::CYCLE_COUNTER);
+  clock::setSource(clock::Source::VDSO);
+
+  printf("%-14s %12s\n", "source", "ns/timestamp");
+  for (auto source :
+       {clock::Source::SYSCALL,
+        clock::Source::VDSO,
+        clock::Source::CYCLE_COUNTER,
+        clock::Source::COARSE}) {
+    if (source == clock::Source::CYCLE_COUNTER && !counter) {
+      printf("%-14s %12s\n", clock::sourceName(source), "unavailable");
+      continue;
+    }
+    printf("%-14s %12.1f\n", clock::sourceName(source), nsPerRead(source, reads));
+  }
+
+  if (counter) {
+    // Read the counter source between two CLOCK_MONOTONIC reads, so it
+    // should land in between them. Runs over a few resyncs.
+    int64_t worst = 0;
+    auto end = clock::read(clock::Source::VDSO) + 3 * clock::kResyncIntervalNs;
+    while (clock::read(clock::Source::VDSO) < end) {
+      auto before = clock::read(clock::Source::VDSO);
+      auto value = clock::read(clock::Source::CYCLE_COUNTER);
+      auto after = clock::read(clock::Source::VDSO);
+      int64_t error = value < before ? before - value
+          : value > after            ? value - after
+                                     : 0;
+      if (error > worst) {
+        worst = error;
+      }
+    }
+    printf("cycle_counter max error vs CLOCK_MONOTONIC: %lld ns\n",
+           static_cast<long long>(worst));
+  }
+  return 0;
+}
@@ -0,0 +1,138 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//
+// Compression speed and ratio of every codec, and of zlib at a range of
+// levels, over recorded traces.
+//
+// Usage: compression_perf [trace files...]
+//
+// Trace files can be gzip compressed, as written by TraceWriter, or plain.
+// Without files, a synthetic text trace is used instead.
+//
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <zstr/zstr.hpp>
+
+#include <profilo/writer/Compression.h>
+
+using namespace facebook::profilo::writer;
+
+namespace {
+
+constexpr int kRepetitions = 5;
+
+std::string readFile(const std::string& path) {
+  std::stringstream contents;
+  // Passes plain files through untouched.
+  zstr::ifstream input(path);
+  contents << input.rdbuf();
+  return contents.str();
+}
+
+// Delta encoded text entries in the proportions of a sampling trace.
+std::string makeSyntheticTrace(size_t lines) {
+  std::mt19937 rng(7);
+  std::stringstream trace;
+  trace << "dt\nver|3\nid|AAAAAAAAAAB\nprec|6\nfmt|text\n\n";
+  for (size_t i = 0; i < lines; ++i) {
+    auto tid = 1000 + rng() % 8;
+    switch (rng() % 4) {
+      case 0:
+        trace << "1|STACK_FRAME|" << rng() % 20 << "|" << tid << "|0|0|"
+              << 0x7f00000000 + (rng() % 4096) * 16 << "\n";
+        break;
+      case 1:
+        trace << "1|COUNTER|" << rng() % 20 << "|" << tid << "|9240581|0|"
+              << rng() % 100000 << "\n";
+        break;
+      default:
+        trace << "1|" << ((i & 1) ? "MARK_PUSH" : "MARK_POP") << "|"
+              << rng() % 20 << "|" << tid << "|0|0|0\n";
+        break;
+    }
+  }
+  return trace.str();
+}
+
+void run(
+    const char* name,
+    CompressionConfig const& config,
+    std::vector<std::string> const& traces) {
+  size_t input_bytes = 0;
+  size_t output_bytes = 0;
+  double seconds = 0;
+
+  for (int rep = 0; rep < kRepetitions; ++rep) {
+    for (auto const& trace : traces) {
+      std::ostringstream sink;
+      auto start = std::chrono::steady_clock::now();
+      {
+        auto compressed = makeCompressingStreambuf(sink.rdbuf(), config);
+        std::ostream output(
+            compressed != nullptr ? compressed.get() : sink.rdbuf());
+        output.write(trace.data(), trace.size());
+        output.flush();
+      }
+      auto end = std::chrono::steady_clock::now();
+
+      seconds += std::chrono::duration<double>(end - start).count();
+      input_bytes += trace.size();
+      output_bytes += sink.str().size();
+    }
+  }
+
+  printf(
+      "%-10s %10.2f %12.1f %10.3f\n",
+      name,
+      input_bytes / seconds / 1e6,
+      output_bytes / static_cast<double>(kRepetitions),
+      static_cast<double>(input_bytes) / output_bytes);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  std::vector<std::string> traces;
+  for (int i = 1; i < argc; ++i) {
+    traces.push_back(readFile(argv[i]));
+  }
+  if (traces.empty()) {
+    traces.push_back(makeSyntheticTrace(500000));
+  }
+
+  printf("%-10s %10s %12s %10s\n", "codec", "MB/s", "bytes", "ratio");
+  CompressionConfig config;
+  config.codec = CompressionCodec::NONE;
+  run(getCompressionCodecName(config.codec), config, traces);
+
+  config.codec = CompressionCodec::ZLIB;
+  run("zlib", config, traces);
+  for (int level : {1, 6, 9}) {
+    config.level = level;
+    auto name = std::string("zlib-") + std::to_string(level);
+    run(name.c_str(), config, traces);
+  }
+  return 0;
+}
@@ -172,6 +172,14 @@ TEST_F(TracedCounterTest, testFourPointsWithOneDuplicate) {
   EXPECT_EQ(cEntry.extra, kValueB);
 }
 
+TEST_F(TracedCounterTest, testCoarseTimestampsAlwaysIncrease) {
+  CoarseTimestamps timestamps;
+  // Far more readings than fit in a jiffy, so the coarse clock repeats.
+  for (int i = 0; i < 1000; i++) {
+    EXPECT_NO_THROW(counter_.record(i, timestamps.next()));
+  }
+}
+
 } // namespace counters
 } // namespace profilo
 } // namespace facebook
@@ -18,6 +18,8 @@
 #include <gtest/gtest.h>
 
 #include <fstream>
+#include <future>
+#include <thread>
 
 #include <profilo/counters/ProcFs.h>
 #include <profilo/util/common.h>
@@ -266,6 +268,35 @@ TEST_F(ProcFsTest, testMeminfoFile) {
   EXPECT_EQ(statInfo.inactiveKB, 5855820);
 }
 
+TEST(ThreadCacheTest, testThreadEventsBetweenListings) {
+  MultiBufferLogger logger;
+  ThreadCache cache(logger);
+  cache.setThreadEvents(true);
+  // Lists the threads, the next samplings don't.
+  cache.sampleAndLogForEach(ALL_STATS_MASK);
+
+  std::promise<int32_t> started;
+  std::promise<void> done;
+  std::thread thread([&started, &done] {
+    started.set_value(threadID());
+    done.get_future().wait();
+  });
+  auto tid = started.get_future().get();
+
+  cache.sampleAndLogForEach(ALL_STATS_MASK);
+  EXPECT_EQ(cache.getStatsAvailabililty(tid), 0);
+
+  cache.onThreadStart(tid);
+  cache.sampleAndLogForEach(ALL_STATS_MASK);
+  EXPECT_NE(cache.getStatsAvailabililty(tid), 0);
+
+  cache.onThreadExit(tid);
+  EXPECT_EQ(cache.getStatsAvailabililty(tid), 0);
+
+  done.set_value();
+  thread.join();
+}
+
 } // namespace counters
 } // namespace profilo
 } // namespace facebook
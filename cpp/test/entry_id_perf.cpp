@@ -0,0 +1,138 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//
+// Logger::EntryIDCounter, leased ID blocks vs the CAS loop on a single
+// counter it replaced.
+//
+// Usage: entry_id_perf [max_threads] [ids_per_thread]
+//
+// Prints one line per (counter, thread count) so the scaling curve can be
+// compared between the two.
+//
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#include <profilo/Logger.h>
+
+using namespace facebook::profilo;
+
+namespace {
+
+// The counter as it was before IDs were leased in blocks.
+class CASCounter {
+ public:
+  explicit CASCounter(int32_t initial) : value_(initial) {}
+
+  int32_t next() {
+    int32_t value, newValue;
+    do {
+      value = value_.load();
+      if (value <= 0 || value == std::numeric_limits<int32_t>::max()) {
+        newValue = 1;
+      } else {
+        newValue = value + 1;
+      }
+    } while (!value_.compare_exchange_weak(value, newValue));
+    return value;
+  }
+
+ private:
+  std::atomic<int32_t> value_;
+};
+
+template <typename Counter>
+double runThreads(size_t threads, size_t ids_per_thread) {
+  Counter counter(Logger::kDefaultInitialID);
+
+  std::atomic<size_t> ready{0};
+  std::atomic<bool> go{false};
+  std::atomic<int64_t> sink{0};
+  std::vector<std::thread> workers;
+  workers.reserve(threads);
+
+  for (size_t t = 0; t < threads; ++t) {
+    workers.emplace_back([&] {
+      ready.fetch_add(1);
+      while (!go.load()) {
+      }
+      int64_t sum = 0;
+      for (size_t i = 0; i < ids_per_thread; ++i) {
+        sum += counter.next();
+      }
+      sink.fetch_add(sum);
+    });
+  }
+
+  while (ready.load() != threads) {
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  go.store(true);
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  if (sink.load() == 0) {
+    fprintf(stderr, "Counter returned only zeroes\n");
+  }
+  return std::chrono::duration<double>(end - start).count();
+}
+
+void printRow(
+    const char* name,
+    size_t threads,
+    size_t ids_per_thread,
+    double secs) {
+  double ids = threads * ids_per_thread;
+  printf(
+      "%-8s %8zu %14.1f %14.3f\n",
+      name,
+      threads,
+      secs * 1e9 / ids * threads,
+      ids / secs / 1e6);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  size_t max_threads = argc > 1 ? strtoul(argv[1], nullptr, 10) : 8;
+  size_t ids_per_thread = argc > 2 ? strtoul(argv[2], nullptr, 10) : 1000000;
+
+  printf("%-8s %8s %14s %14s\n", "counter", "threads", "ns/id", "Mids/s");
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    printRow(
+        "cas",
+        threads,
+        ids_per_thread,
+        runThreads<CASCounter>(threads, ids_per_thread));
+  }
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    printRow(
+        "leased",
+        threads,
+        ids_per_thread,
+        runThreads<Logger::EntryIDCounter>(threads, ids_per_thread));
+  }
+  return 0;
+}
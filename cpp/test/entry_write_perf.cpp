@@ -0,0 +1,153 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//
+// Single-threaded cost of logging a StandardEntry and a FramesEntry,
+// serialized into a temporary payload and then packetized ("copy") vs
+// serialized straight into the buffer slots by Logger ("in-place"), and of
+// a StandardEntry written to a byte ring in the compact encoding Logger
+// uses there ("ring") vs the fixed one ("ring-fixed").
+//
+// Usage: entry_write_perf [iterations] [frame_count]
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <profilo/Logger.h>
+#include <profilo/PacketLogger.h>
+#include <profilo/mmapbuf/Buffer.h>
+
+using namespace facebook::profilo;
+using namespace facebook::profilo::entries;
+
+namespace {
+
+constexpr size_t kBufferSlots = 100000;
+
+// The serialization path Logger::write used before entries were packed
+// directly into the buffer.
+template <class T>
+void writeCopy(logger::PacketLogger& logger, const T& entry) {
+  auto size = T::calculateSize(entry);
+  char payload[size];
+  T::pack(entry, payload, size);
+  logger.write(payload, size);
+}
+
+template <class Fn>
+double nsPerEntry(size_t iterations, Fn&& fn) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; ++i) {
+    fn(i);
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() /
+      iterations;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  size_t iterations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 5000000;
+  size_t frame_count = argc > 2 ? strtoul(argv[2], nullptr, 10) : 40;
+
+  std::vector<int64_t> frames(frame_count);
+  for (size_t i = 0; i < frames.size(); ++i) {
+    frames[i] = 0x7f0000000000 + i * 64;
+  }
+
+  StandardEntry standard{
+      .id = 1,
+      .type = EntryType::MARK_PUSH,
+      .timestamp = 0,
+      .tid = 1234,
+      .callid = 1,
+      .matchid = 2,
+      .extra = 3};
+  FramesEntry stack{
+      .id = 1,
+      .type = EntryType::STACK_FRAME,
+      .timestamp = 0,
+      .tid = 1234,
+      .matchid = 0,
+      .frames = {
+          .values = frames.data(),
+          .size = static_cast<uint16_t>(frames.size())}};
+
+  mmapbuf::Buffer buffer(kBufferSlots);
+  logger::PacketLogger copy_logger(
+      [&]() -> TraceBuffer& { return buffer.ringBuffer(); },
+      /* staged */ true);
+  Logger& in_place_logger = buffer.logger();
+
+  printf("%-10s %-10s %12s\n", "entry", "path", "ns/entry");
+
+  double ns = nsPerEntry(iterations, [&](size_t i) {
+    standard.timestamp = i;
+    writeCopy(copy_logger, standard);
+  });
+  printf("%-10s %-10s %12.1f\n", "standard", "copy", ns);
+
+  ns = nsPerEntry(iterations, [&](size_t i) {
+    standard.timestamp = i;
+    in_place_logger.write(standard);
+  });
+  printf("%-10s %-10s %12.1f\n", "standard", "in-place", ns);
+
+  mmapbuf::Buffer ring_buffer(
+      kBufferSlots,
+      1,
+      mmapbuf::Buffer::WriteMode::GUARANTEED,
+      mmapbuf::Buffer::Backend::BYTE_RING);
+  auto& byte_ring = ring_buffer.byteRing();
+  Logger& ring_logger = ring_buffer.logger();
+
+  ns = nsPerEntry(iterations, [&](size_t i) {
+    standard.timestamp = i;
+    ring_logger.write(standard);
+  });
+  printf("%-10s %-10s %12.1f\n", "standard", "ring", ns);
+
+  ns = nsPerEntry(iterations, [&](size_t i) {
+    standard.timestamp = i;
+    auto size = StandardEntry::calculateSize(standard);
+    auto reservation = byte_ring.reserve(size);
+    StandardEntry::pack(standard, reservation.data, size);
+    byte_ring.commit(reservation);
+  });
+  printf("%-10s %-10s %12.1f\n", "standard", "ring-fixed", ns);
+  printf(
+      "standard entry: %zu bytes compact, %zu bytes fixed\n",
+      StandardEntry::calculateCompactSize(standard),
+      StandardEntry::calculateSize(standard));
+
+  ns = nsPerEntry(iterations, [&](size_t i) {
+    stack.timestamp = i;
+    writeCopy(copy_logger, stack);
+  });
+  printf("%-10s %-10s %12.1f\n", "frames", "copy", ns);
+
+  ns = nsPerEntry(iterations, [&](size_t i) {
+    stack.timestamp = i;
+    in_place_logger.write(stack);
+  });
+  printf("%-10s %-10s %12.1f\n", "frames", "in-place", ns);
+
+  return 0;
+}
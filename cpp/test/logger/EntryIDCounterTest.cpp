@@ -0,0 +1,237 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <signal.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <profilo/logger/Logger.h>
+
+namespace facebook {
+namespace profilo {
+
+namespace {
+
+// Takes IDs on a thread of its own, one call at a time, so its lease stays
+// put between the calls.
+class IDThread {
+ public:
+  explicit IDThread(Logger::EntryIDCounter& counter)
+      : counter_(counter), thread_([this] { run(); }) {}
+
+  ~IDThread() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      done_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+  }
+
+  int32_t next() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    requested_ = true;
+    cv_.notify_all();
+    cv_.wait(lock, [this] { return !requested_; });
+    return id_;
+  }
+
+ private:
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      cv_.wait(lock, [this] { return requested_ || done_; });
+      if (done_) {
+        return;
+      }
+      id_ = counter_.next();
+      requested_ = false;
+      cv_.notify_all();
+    }
+  }
+
+  Logger::EntryIDCounter& counter_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool requested_ = false;
+  bool done_ = false;
+  int32_t id_ = 0;
+  std::thread thread_;
+};
+
+constexpr int kHandlerIDs = 1000;
+Logger::EntryIDCounter* handler_counter = nullptr;
+int32_t handler_ids[kHandlerIDs];
+std::atomic<int> handler_count{0};
+
+void takeID(int) {
+  auto idx = handler_count.fetch_add(1);
+  if (idx < kHandlerIDs) {
+    handler_ids[idx] = handler_counter->next();
+  }
+}
+
+} // namespace
+
+TEST(EntryIDCounterTest, testStartsAtInitialValue) {
+  Logger::EntryIDCounter counter{Logger::kDefaultInitialID};
+  for (int32_t idx = 0; idx < 200; ++idx) {
+    EXPECT_EQ(counter.next(), Logger::kDefaultInitialID + idx);
+  }
+}
+
+TEST(EntryIDCounterTest, testWrapsAroundToOne) {
+  constexpr auto kMax = std::numeric_limits<int32_t>::max();
+  Logger::EntryIDCounter counter{kMax - 1};
+  EXPECT_EQ(counter.next(), kMax - 1);
+  EXPECT_EQ(counter.next(), kMax);
+  EXPECT_EQ(counter.next(), 1);
+  EXPECT_EQ(counter.next(), 2);
+}
+
+TEST(EntryIDCounterTest, testCountersDontShareLeases) {
+  auto first = std::make_unique<Logger::EntryIDCounter>(1);
+  EXPECT_EQ(first->next(), 1);
+  first.reset();
+  // Likely at the same address as the first one.
+  auto second = std::make_unique<Logger::EntryIDCounter>(1000);
+  EXPECT_EQ(second->next(), 1000);
+}
+
+TEST(EntryIDCounterTest, testUniqueAcrossThreads) {
+  constexpr int kThreads = 8;
+  constexpr int kIDs = 10000;
+  Logger::EntryIDCounter counter{1};
+  std::vector<std::vector<int32_t>> ids(kThreads);
+  std::vector<std::thread> threads;
+  for (int thread = 0; thread < kThreads; ++thread) {
+    threads.emplace_back([&counter, &ids, thread] {
+      for (int idx = 0; idx < kIDs; ++idx) {
+        ids[thread].push_back(counter.next());
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  std::unordered_set<int32_t> seen;
+  for (auto& thread_ids : ids) {
+    for (size_t idx = 0; idx < thread_ids.size(); ++idx) {
+      EXPECT_GT(thread_ids[idx], 0);
+      EXPECT_TRUE(seen.insert(thread_ids[idx]).second);
+      if (idx > 0) {
+        EXPECT_GT(thread_ids[idx], thread_ids[idx - 1]);
+      }
+    }
+  }
+  EXPECT_EQ(seen.size(), kThreads * kIDs);
+}
+
+TEST(EntryIDCounterTest, testStaleLeaseDropped) {
+  using Counter = Logger::EntryIDCounter;
+  Counter counter{1};
+  IDThread idle{counter};
+  std::unordered_set<int32_t> seen;
+
+  // The idle thread leases the first block, this one the second.
+  auto idle_id = idle.next();
+  int32_t id = 0;
+  for (uint32_t idx = 0; idx < Counter::kBlockSize; ++idx) {
+    id = counter.next();
+    EXPECT_TRUE(seen.insert(id).second);
+  }
+  EXPECT_TRUE(seen.insert(idle_id).second);
+
+  // One block behind is within kMaxLag, the idle thread keeps its lease.
+  idle_id = idle.next();
+  EXPECT_EQ(idle_id, 2);
+  EXPECT_TRUE(seen.insert(idle_id).second);
+
+  // Two aren't, it leases a new block past the one this thread is on.
+  for (uint32_t idx = 0; idx < Counter::kBlockSize * 3 / 2; ++idx) {
+    id = counter.next();
+    EXPECT_TRUE(seen.insert(id).second);
+  }
+  idle_id = idle.next();
+  EXPECT_GT(idle_id, id);
+  EXPECT_TRUE(seen.insert(idle_id).second);
+
+  // This thread's lease is a block behind now, and keeps going.
+  auto next_id = counter.next();
+  EXPECT_EQ(next_id, id + 1);
+  EXPECT_LE(idle_id - next_id, static_cast<int32_t>(Counter::kMaxLag));
+  EXPECT_TRUE(seen.insert(next_id).second);
+}
+
+TEST(EntryIDCounterTest, testUniqueWithSignalHandlers) {
+  Logger::EntryIDCounter counter{1};
+  handler_counter = &counter;
+  handler_count = 0;
+  struct sigaction action {};
+  struct sigaction previous {};
+  action.sa_handler = takeID;
+  ASSERT_EQ(sigaction(SIGUSR1, &action, &previous), 0);
+
+  std::atomic<bool> sent{false};
+  auto target = pthread_self();
+  std::thread signaller([&sent, target] {
+    for (int idx = 0; idx < kHandlerIDs; ++idx) {
+      pthread_kill(target, SIGUSR1);
+      std::this_thread::yield();
+    }
+    sent = true;
+  });
+
+  // One bit per ID, there are far too many to keep in a set.
+  std::vector<bool> seen;
+  while (!sent) {
+    auto id = counter.next();
+    if (static_cast<size_t>(id) >= seen.size()) {
+      seen.resize(id * 2);
+    }
+    EXPECT_FALSE(seen[id]);
+    seen[id] = true;
+  }
+  // Any signal still pending is handled on the way out of the join.
+  signaller.join();
+  ASSERT_EQ(sigaction(SIGUSR1, &previous, nullptr), 0);
+
+  auto handled = std::min(handler_count.load(), kHandlerIDs);
+  EXPECT_GT(handled, 0);
+  for (int idx = 0; idx < handled; ++idx) {
+    auto id = handler_ids[idx];
+    if (static_cast<size_t>(id) >= seen.size()) {
+      seen.resize(id * 2);
+    }
+    EXPECT_FALSE(seen[id]);
+    seen[id] = true;
+  }
+}
+
+} // namespace profilo
+} // namespace facebook
@@ -14,13 +14,24 @@
  * limitations under the License.
  */
 
+#include <sched.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
 #include <limits>
 #include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
 #include <gtest/gtest.h>
 #include <logger/MultiBufferLogger.h>
+#include <logger/StringTable.h>
+#include <profilo/entries/EntryParser.h>
 #include <profilo/mmapbuf/Buffer.h>
 
 namespace facebook {
@@ -78,6 +89,345 @@ TEST(MultiBufferLoggerTest, testMultiBufferWrite) {
   EXPECT_EQ(entry.extra, result2.extra);
 }
 
+TEST(MultiBufferLoggerTest, testWriteNamedDefinesNameOnce) {
+  Logger::EntryIDCounter ids{1};
+  StringTable strings(16);
+  MultiBufferLogger logger{ids, strings};
+  // Big enough for references to span the lag of other threads' IDs.
+  auto buffer = std::make_shared<Buffer>(1024);
+  logger.addBuffer(buffer);
+
+  StandardEntry push{.type = EntryType::MARK_PUSH, .timestamp = 100};
+  auto first = logger.writeNamed(push, "name", 4);
+  auto second = logger.writeNamed(push, "name", 4);
+  EXPECT_NE(first, second);
+
+  auto& ring = buffer->ringBuffer();
+  auto cursor = ring.currentTail();
+  BytesEntry definition{};
+  readOneEntry(definition, ring, cursor);
+  EXPECT_EQ(definition.type, EntryType::STRING_DEFINITION);
+  EXPECT_EQ(
+      std::string(
+          reinterpret_cast<const char*>(definition.bytes.values),
+          definition.bytes.size),
+      "name");
+
+  StandardEntry result{};
+  for (auto id : {first, second}) {
+    cursor.moveForward();
+    readOneEntry(result, ring, cursor);
+    EXPECT_EQ(result.id, id);
+    EXPECT_EQ(result.type, EntryType::MARK_PUSH);
+    EXPECT_EQ(result.matchid, -definition.matchid);
+  }
+  EXPECT_EQ(cursor.distanceTo(ring.currentHead()), 1);
+}
+
+TEST(MultiBufferLoggerTest, testWriteNamedInlinesWhenTableIsFull) {
+  Logger::EntryIDCounter ids{1};
+  StringTable strings(1);
+  MultiBufferLogger logger{ids, strings};
+  auto buffer = std::make_shared<Buffer>(10);
+  logger.addBuffer(buffer);
+
+  StandardEntry push{.type = EntryType::MARK_PUSH, .timestamp = 100};
+  ASSERT_GT(strings.intern("taken", 5), 0);
+  auto id = logger.writeNamed(push, "name", 4);
+
+  auto& ring = buffer->ringBuffer();
+  auto cursor = ring.currentTail();
+  StandardEntry result{};
+  readOneEntry(result, ring, cursor);
+  EXPECT_EQ(result.id, id);
+  EXPECT_EQ(result.matchid, 0);
+
+  cursor.moveForward();
+  BytesEntry name{};
+  readOneEntry(name, ring, cursor);
+  EXPECT_EQ(name.type, EntryType::STRING_NAME);
+  EXPECT_EQ(name.matchid, id);
+}
+
+namespace {
+
+class CollectingVisitor : public entries::EntryVisitor {
+ public:
+  void visit(const StandardEntry& entry) override {
+    standard.push_back(entry);
+  }
+
+  void visit(const FramesEntry& entry) override {}
+
+  void visit(const BytesEntry& entry) override {
+    bytes.emplace_back(
+        reinterpret_cast<const char*>(entry.bytes.values), entry.bytes.size);
+  }
+
+  std::vector<StandardEntry> standard;
+  std::vector<std::string> bytes;
+};
+
+} // namespace
+
+TEST(MultiBufferLoggerTest, testWritesPackedEntryToEveryBackend) {
+  MultiBufferLogger logger{};
+  auto packets = std::make_shared<Buffer>(10);
+  auto byteRing = std::make_shared<Buffer>(
+      10, 1, Buffer::WriteMode::GUARANTEED, Buffer::Backend::BYTE_RING);
+  logger.addBuffer(packets);
+  logger.addBuffer(byteRing);
+
+  StandardEntry entry{
+      .id = 0,
+      .type = EntryType::MARK_PUSH,
+      .timestamp = 100,
+      .tid = 1,
+      .callid = 200,
+      .matchid = 300,
+      .extra = 400,
+  };
+  logger.write(entry);
+  auto bytesID = logger.writeBytes(
+      EntryType::STRING_NAME,
+      entry.id,
+      reinterpret_cast<const uint8_t*>("name"),
+      4);
+
+  auto& ring = packets->ringBuffer();
+  auto cursor = ring.currentTail();
+  StandardEntry fromPackets{};
+  readOneEntry(fromPackets, ring, cursor);
+  cursor.moveForward();
+  BytesEntry bytesFromPackets{};
+  readOneEntry(bytesFromPackets, ring, cursor);
+  EXPECT_EQ(bytesFromPackets.id, bytesID);
+  EXPECT_EQ(bytesFromPackets.matchid, entry.id);
+
+  CollectingVisitor visitor;
+  auto position = byteRing->byteRing().currentTail();
+  std::vector<char> record;
+  while (byteRing->byteRing().tryRead(position, record) ==
+         ByteRingBuffer::ReadResult::OK) {
+    entries::EntryParser::parse(record.data(), record.size(), visitor);
+  }
+  ASSERT_EQ(visitor.standard.size(), 1);
+  ASSERT_EQ(visitor.bytes.size(), 1);
+  EXPECT_EQ(visitor.bytes[0], "name");
+
+  for (auto& result : {fromPackets, visitor.standard[0]}) {
+    EXPECT_EQ(result.id, entry.id);
+    EXPECT_EQ(result.type, entry.type);
+    EXPECT_EQ(result.timestamp, entry.timestamp);
+    EXPECT_EQ(result.tid, entry.tid);
+    EXPECT_EQ(result.callid, entry.callid);
+    EXPECT_EQ(result.matchid, entry.matchid);
+    EXPECT_EQ(result.extra, entry.extra);
+  }
+}
+
+TEST(MultiBufferLoggerTest, testWriteNamedRedefinesBeforeShardWraps) {
+  // Keeps every entry in the shard of one CPU.
+  cpu_set_t affinity, pinned;
+  ASSERT_EQ(sched_getaffinity(0, sizeof(affinity), &affinity), 0);
+  CPU_ZERO(&pinned);
+  CPU_SET(sched_getcpu(), &pinned);
+  ASSERT_EQ(sched_setaffinity(0, sizeof(pinned), &pinned), 0);
+
+  constexpr size_t kShards = 4;
+  constexpr size_t kShardPackets = 1024;
+  Logger::EntryIDCounter ids{1};
+  StringTable strings(16);
+  MultiBufferLogger logger{ids, strings};
+  auto buffer = std::make_shared<Buffer>(kShards * kShardPackets, kShards);
+  logger.addBuffer(buffer);
+  auto& shard = buffer->currentShard();
+
+  StandardEntry push{.type = EntryType::MARK_PUSH, .timestamp = 100};
+  StandardEntry pop{.type = EntryType::MARK_POP, .timestamp = 100};
+  // Wraps the shard many times over, with references at varying distances
+  // from their definition.
+  for (int round = 0; round < 1000; ++round) {
+    logger.writeNamed(push, "name", 4);
+
+    CollectingVisitor visitor;
+    auto cursor = shard.currentTail();
+    auto head = shard.currentHead();
+    Packet packet{};
+    for (; cursor.distanceTo(head) > 0; cursor.moveForward()) {
+      ASSERT_TRUE(shard.tryRead(packet, cursor));
+      entries::EntryParser::parse(packet.data, packet.size, visitor);
+    }
+    ASSERT_EQ(visitor.standard.back().type, EntryType::MARK_PUSH);
+    ASSERT_LT(visitor.standard.back().matchid, 0);
+    EXPECT_NE(
+        std::find(visitor.bytes.begin(), visitor.bytes.end(), "name"),
+        visitor.bytes.end())
+        << "Definition overwritten in round " << round;
+
+    for (int idx = 0; idx <= round % 7; ++idx) {
+      logger.write(pop);
+    }
+  }
+
+  ASSERT_EQ(sched_setaffinity(0, sizeof(affinity), &affinity), 0);
+}
+
+TEST(MultiBufferLoggerTest, testLargeBytesNeedBlobArenaInEveryBuffer) {
+  MultiBufferLogger logger{};
+  std::vector<std::shared_ptr<Buffer>> buffers;
+  for (int idx = 0; idx < 2; ++idx) {
+    buffers.push_back(std::make_shared<Buffer>(
+        10,
+        1,
+        Buffer::WriteMode::GUARANTEED,
+        Buffer::Backend::PACKETS,
+        Buffer::kMinBlobArenaSize));
+    logger.addBuffer(buffers.back());
+  }
+
+  std::string large(Logger::kMaxVariableLengthEntry + 1, 'x');
+  auto id = logger.writeBytes(
+      EntryType::STRING_VALUE,
+      0,
+      reinterpret_cast<const uint8_t*>(large.data()),
+      large.size());
+  for (auto& buffer : buffers) {
+    auto& ring = buffer->ringBuffer();
+    EXPECT_EQ(ring.currentTail().distanceTo(ring.currentHead()), 1);
+    BytesEntry reference{};
+    readOneEntry(reference, ring, ring.currentTail());
+    EXPECT_EQ(reference.id, id);
+    EXPECT_EQ(reference.type, EntryType::BLOB_REFERENCE);
+    EXPECT_EQ(reference.bytes.size, sizeof(Logger::BlobReference));
+  }
+
+  logger.addBuffer(std::make_shared<Buffer>(10));
+  EXPECT_THROW(
+      logger.writeBytes(
+          EntryType::STRING_VALUE,
+          0,
+          reinterpret_cast<const uint8_t*>(large.data()),
+          large.size()),
+      std::overflow_error);
+}
+
+TEST(MultiBufferLoggerTest, testLargeBytesLimitedByArenaSize) {
+  MultiBufferLogger logger{};
+  auto buffer = std::make_shared<Buffer>(
+      10,
+      1,
+      Buffer::WriteMode::GUARANTEED,
+      Buffer::Backend::PACKETS,
+      Buffer::kMinBlobArenaSize);
+  logger.addBuffer(buffer);
+
+  // Half the arena, less the record header.
+  size_t max_length = Buffer::kMinBlobArenaSize / 2 - 8;
+  EXPECT_EQ(buffer->logger().maxBytesLength(), max_length);
+
+  std::string largest(max_length, 'x');
+  logger.writeBytes(
+      EntryType::STRING_VALUE,
+      0,
+      reinterpret_cast<const uint8_t*>(largest.data()),
+      largest.size());
+  auto& ring = buffer->ringBuffer();
+  BytesEntry reference{};
+  readOneEntry(reference, ring, ring.currentTail());
+  EXPECT_EQ(reference.type, EntryType::BLOB_REFERENCE);
+
+  std::string larger(max_length + 1, 'x');
+  EXPECT_THROW(
+      logger.writeBytes(
+          EntryType::STRING_VALUE,
+          0,
+          reinterpret_cast<const uint8_t*>(larger.data()),
+          larger.size()),
+      std::overflow_error);
+}
+
+TEST(MultiBufferLoggerTest, testBuffersChangeWhileWriting) {
+  constexpr int kThreads = 4;
+  constexpr int kWrites = 5000;
+  MultiBufferLogger logger{};
+  auto kept = std::make_shared<Buffer>(kThreads * kWrites);
+  logger.addBuffer(kept);
+  auto start = kept->ringBuffer().currentHead();
+
+  std::atomic<bool> done{false};
+  std::thread churn([&] {
+    while (!done.load()) {
+      auto buffer = std::make_shared<Buffer>(100);
+      logger.addBuffer(buffer);
+      logger.removeBuffer(buffer);
+    }
+  });
+
+  std::vector<std::thread> writers;
+  for (int thread = 0; thread < kThreads; ++thread) {
+    writers.emplace_back([&logger] {
+      for (int idx = 0; idx < kWrites; ++idx) {
+        logger.write(StandardEntry{.type = EntryType::MARK_PUSH});
+      }
+    });
+  }
+  for (auto& writer : writers) {
+    writer.join();
+  }
+  done.store(true);
+  churn.join();
+
+  EXPECT_EQ(
+      start.distanceTo(kept->ringBuffer().currentHead()), kThreads * kWrites);
+}
+
+//
+// Not a correctness test, prints how fast several threads fan out entries
+// to several buffers.
+//
+TEST(MultiBufferLoggerTest, testMultithreadedThroughput) {
+  constexpr int kBuffers = 3;
+  constexpr int kWrites = 100000;
+  for (int threads = 1; threads <= 4; threads *= 2) {
+    MultiBufferLogger logger{};
+    std::vector<std::shared_ptr<Buffer>> buffers;
+    for (int idx = 0; idx < kBuffers; ++idx) {
+      buffers.push_back(std::make_shared<Buffer>(10000));
+      logger.addBuffer(buffers.back());
+    }
+
+    std::vector<std::thread> writers;
+    auto begin = std::chrono::steady_clock::now();
+    for (int thread = 0; thread < threads; ++thread) {
+      writers.emplace_back([&logger] {
+        for (int idx = 0; idx < kWrites; ++idx) {
+          logger.write(StandardEntry{
+              .type = EntryType::MARK_PUSH, .timestamp = idx, .tid = 1});
+        }
+      });
+    }
+    for (auto& writer : writers) {
+      writer.join();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double secs = std::chrono::duration<double>(end - begin).count();
+    printf(
+        "%d threads, %d buffers: %.1f ns/entry, %.3f Mentries/s\n",
+        threads,
+        kBuffers,
+        secs * 1e9 / kWrites,
+        threads * kWrites / secs / 1e6);
+    for (auto& buffer : buffers) {
+      EXPECT_EQ(
+          buffer->ringBuffer().currentTail().distanceTo(
+              buffer->ringBuffer().currentHead()),
+          10000);
+    }
+  }
+}
+
 } // namespace logger
 } // namespace profilo
 } // namespace facebook
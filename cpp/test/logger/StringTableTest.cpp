@@ -0,0 +1,132 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <profilo/logger/StringTable.h>
+
+namespace facebook {
+namespace profilo {
+namespace logger {
+
+namespace {
+
+int32_t intern(StringTable& table, const std::string& name) {
+  return table.intern(name.data(), name.size());
+}
+
+std::string lookup(StringTable& table, int32_t id) {
+  size_t length = 0;
+  auto name = table.lookup(id, length);
+  return name == nullptr ? "" : std::string(name, length);
+}
+
+} // namespace
+
+TEST(StringTableTest, testSameNameSameID) {
+  StringTable table(16);
+  auto id = intern(table, "Choreographer#doFrame");
+  EXPECT_GT(id, 0);
+  EXPECT_EQ(intern(table, "Choreographer#doFrame"), id);
+  EXPECT_NE(intern(table, "Choreographer#onVsync"), id);
+  EXPECT_EQ(lookup(table, id), "Choreographer#doFrame");
+}
+
+TEST(StringTableTest, testLookupUnknownID) {
+  StringTable table(16);
+  size_t length = 0;
+  EXPECT_EQ(table.lookup(0, length), nullptr);
+  EXPECT_EQ(table.lookup(1, length), nullptr);
+  EXPECT_EQ(table.lookup(17, length), nullptr);
+  EXPECT_EQ(table.lookup(-1, length), nullptr);
+}
+
+TEST(StringTableTest, testRejectsEmptyAndLongNames) {
+  StringTable table(16);
+  EXPECT_EQ(intern(table, ""), 0);
+  EXPECT_EQ(intern(table, std::string(StringTable::kMaxLength + 1, 'x')), 0);
+  EXPECT_GT(intern(table, std::string(StringTable::kMaxLength, 'x')), 0);
+}
+
+TEST(StringTableTest, testFullTableRejectsNewNames) {
+  StringTable table(4);
+  for (int idx = 0; idx < 4; ++idx) {
+    EXPECT_GT(intern(table, std::to_string(idx)), 0);
+  }
+  EXPECT_EQ(intern(table, "one too many"), 0);
+  // Names already in there are still found.
+  EXPECT_GT(intern(table, "2"), 0);
+}
+
+TEST(StringTableTest, testDefinedOnceUntilReset) {
+  StringTable table(16);
+  auto id = intern(table, "name");
+
+  EXPECT_EQ(table.use(id, 10, 100), StringTable::Use::DEFINE);
+  // Being defined by the first user.
+  EXPECT_EQ(table.use(id, 11, 100), StringTable::Use::INLINE);
+  table.defined(id, 12);
+  EXPECT_EQ(table.use(id, 13, 100), StringTable::Use::REFERENCE);
+  // Took its entry ID before the definition did.
+  EXPECT_EQ(table.use(id, 11, 100), StringTable::Use::REFERENCE);
+
+  table.reset();
+  EXPECT_EQ(table.use(id, 14, 100), StringTable::Use::DEFINE);
+}
+
+TEST(StringTableTest, testOldDefinitionsWrittenAgain) {
+  StringTable table(16);
+  auto id = intern(table, "name");
+
+  EXPECT_EQ(table.use(id, 10, 100), StringTable::Use::DEFINE);
+  table.defined(id, 10);
+  EXPECT_EQ(table.use(id, 109, 100), StringTable::Use::REFERENCE);
+  EXPECT_EQ(table.use(id, 110, 100), StringTable::Use::DEFINE);
+}
+
+TEST(StringTableTest, testConcurrentInternsAgree) {
+  constexpr int kThreads = 4;
+  constexpr int kNames = 100;
+  StringTable table(1024);
+  std::vector<std::vector<int32_t>> ids(kThreads);
+  std::vector<std::thread> threads;
+  for (int thread = 0; thread < kThreads; ++thread) {
+    threads.emplace_back([&table, &ids, thread] {
+      for (int idx = 0; idx < kNames; ++idx) {
+        ids[thread].push_back(intern(table, "name " + std::to_string(idx)));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  for (int idx = 0; idx < kNames; ++idx) {
+    ASSERT_GT(ids[0][idx], 0);
+    EXPECT_EQ(lookup(table, ids[0][idx]), "name " + std::to_string(idx));
+    for (int thread = 1; thread < kThreads; ++thread) {
+      EXPECT_EQ(ids[thread][idx], ids[0][idx]);
+    }
+  }
+}
+
+} // namespace logger
+} // namespace profilo
+} // namespace facebook
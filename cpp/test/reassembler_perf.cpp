@@ -0,0 +1,201 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//
+// Replays a synthetic buffer of interleaved multi-packet entries, forwards
+// and backwards, through PacketReassembler and through the std::list based
+// stream lookup it replaced.
+//
+// Usage: reassembler_perf [slots] [writers] [max_packets_per_entry]
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <random>
+#include <vector>
+
+#include <profilo/writer/PacketReassembler.h>
+
+using namespace facebook::profilo;
+using namespace facebook::profilo::logger;
+using namespace facebook::profilo::writer;
+
+namespace {
+
+//
+// The previous implementation: one std::list node per active stream,
+// searched linearly for every packet.
+//
+class ListPacketReassembler {
+ public:
+  using PayloadCallback = PacketReassembler::PayloadCallback;
+
+  explicit ListPacketReassembler(PayloadCallback callback)
+      : callback_(std::move(callback)) {}
+
+  void process(Packet const& packet) {
+    if (packet.start && !packet.next) {
+      callback_(packet.data, packet.size);
+      return;
+    }
+    if (packet.start) {
+      active_streams_.push_front(Stream{packet.stream, {}});
+      append(active_streams_.front(), packet, false);
+      return;
+    }
+    for (auto it = active_streams_.begin(); it != active_streams_.end(); ++it) {
+      if (it->stream == packet.stream) {
+        append(*it, packet, false);
+        if (!packet.next) {
+          callback_(it->data.data(), it->data.size());
+          active_streams_.erase(it);
+        }
+        return;
+      }
+    }
+  }
+
+  void processBackwards(Packet const& packet) {
+    if (packet.start && !packet.next) {
+      callback_(packet.data, packet.size);
+      return;
+    }
+    if (!packet.next) {
+      active_streams_.push_front(Stream{packet.stream, {}});
+      append(active_streams_.front(), packet, true);
+      return;
+    }
+    for (auto it = active_streams_.begin(); it != active_streams_.end(); ++it) {
+      if (it->stream == packet.stream) {
+        append(*it, packet, true);
+        if (packet.start) {
+          std::reverse(it->data.begin(), it->data.end());
+          callback_(it->data.data(), it->data.size());
+          active_streams_.erase(it);
+        }
+        return;
+      }
+    }
+  }
+
+ private:
+  struct Stream {
+    StreamID stream;
+    std::vector<char> data;
+  };
+
+  std::list<Stream> active_streams_;
+  PayloadCallback callback_;
+
+  static void append(Stream& stream, Packet const& packet, bool reverse) {
+    auto prev_size = stream.data.size();
+    stream.data.resize(prev_size + packet.size);
+    char* data = stream.data.data() + prev_size;
+    std::memcpy(data, packet.data, packet.size);
+    if (reverse) {
+      std::reverse(data, data + packet.size);
+    }
+  }
+};
+
+// Every writer emits its entries packet by packet and a random writer goes
+// next, which is how concurrent per-packet writes end up in the buffer.
+std::vector<Packet> makeInterleavedBuffer(
+    size_t slots,
+    size_t writers,
+    size_t max_packets) {
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<size_t> pick_writer(0, writers - 1);
+  std::uniform_int_distribution<size_t> pick_length(1, max_packets);
+
+  struct Writer {
+    StreamID stream;
+    size_t remaining;
+    bool started;
+  };
+  std::vector<Writer> state(writers, Writer{0, 0, false});
+  StreamID next_stream = 0;
+
+  std::vector<Packet> packets(slots);
+  for (auto& packet : packets) {
+    auto& writer = state[pick_writer(rng)];
+    if (writer.remaining == 0) {
+      writer = Writer{next_stream++, pick_length(rng), false};
+    }
+    packet.stream = writer.stream;
+    packet.start = !writer.started;
+    packet.next = writer.remaining > 1;
+    packet.size = sizeof(packet.data);
+    std::memset(packet.data, 'x', sizeof(packet.data));
+    writer.started = true;
+    --writer.remaining;
+  }
+  return packets;
+}
+
+template <class Reassembler>
+double replay(std::vector<Packet> const& packets, bool backwards) {
+  size_t payloads = 0;
+  Reassembler reassembler([&](const void*, size_t) { ++payloads; });
+
+  auto start = std::chrono::steady_clock::now();
+  if (backwards) {
+    for (auto it = packets.rbegin(); it != packets.rend(); ++it) {
+      reassembler.processBackwards(*it);
+    }
+  } else {
+    for (auto const& packet : packets) {
+      reassembler.process(packet);
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  if (payloads == 0) {
+    fprintf(stderr, "No payloads reassembled\n");
+  }
+  return std::chrono::duration<double, std::nano>(end - start).count() /
+      packets.size();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  size_t slots = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+  size_t writers = argc > 2 ? strtoul(argv[2], nullptr, 10) : 64;
+  size_t max_packets = argc > 3 ? strtoul(argv[3], nullptr, 10) : 8;
+
+  auto packets = makeInterleavedBuffer(slots, writers, max_packets);
+
+  printf("%-8s %-10s %12s\n", "impl", "direction", "ns/packet");
+  for (bool backwards : {false, true}) {
+    const char* direction = backwards ? "backward" : "forward";
+    printf(
+        "%-8s %-10s %12.1f\n",
+        "list",
+        direction,
+        replay<ListPacketReassembler>(packets, backwards));
+    printf(
+        "%-8s %-10s %12.1f\n",
+        "table",
+        direction,
+        replay<PacketReassembler>(packets, backwards));
+  }
+  return 0;
+}
@@ -0,0 +1,158 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//
+// Multithreaded write throughput of PacketLogger on top of the
+// LockFreeRingBuffer, batched (writeN) vs staged (in-place) writes. The
+// packet mode is the baseline they replace: one ticket per packet, written
+// straight to the ring buffer.
+//
+// Usage: ring_buffer_perf [max_threads] [writes_per_thread] [payload_size]
+//
+// Prints one line per (mode, thread count) so the scaling curve can be
+// compared between the modes.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <profilo/PacketLogger.h>
+#include <profilo/mmapbuf/Buffer.h>
+
+using namespace facebook::profilo;
+using namespace facebook::profilo::logger;
+
+namespace {
+
+constexpr size_t kBufferSlots = 100000;
+
+enum class Mode { PACKET, BATCHED, STAGED };
+
+const char* modeName(Mode mode) {
+  switch (mode) {
+    case Mode::PACKET:
+      return "packet";
+    case Mode::BATCHED:
+      return "batched";
+    case Mode::STAGED:
+      return "staged";
+  }
+  return "unknown";
+}
+
+// What PacketLogger did before entries got a ticket range: every packet
+// takes its own ticket, so the packets of concurrent entries interleave.
+void writePerPacket(
+    TraceBuffer& buffer,
+    StreamID stream_id,
+    const char* payload,
+    size_t size) {
+  size_t offset = 0;
+  while (offset < size) {
+    auto remaining = size - offset;
+    uint16_t write_size = std::min(sizeof(Packet::data), remaining);
+
+    Packet packet{
+        .stream = stream_id,
+        .start = offset == 0,
+        .next = remaining > sizeof(Packet::data),
+        .size = write_size,
+        .data = {}};
+    std::memcpy(packet.data, payload + offset, write_size);
+
+    buffer.write(packet);
+    offset += write_size;
+  }
+}
+
+double runWriters(
+    Mode mode,
+    size_t threads,
+    size_t writes_per_thread,
+    size_t payload_size) {
+  mmapbuf::Buffer buffer(kBufferSlots);
+  PacketLogger logger(
+      [&]() -> TraceBuffer& { return buffer.ringBuffer(); },
+      mode == Mode::STAGED);
+  std::atomic<StreamID> stream_ids{0};
+
+  std::atomic<size_t> ready{0};
+  std::atomic<bool> go{false};
+  std::vector<std::thread> workers;
+  workers.reserve(threads);
+
+  for (size_t t = 0; t < threads; ++t) {
+    workers.emplace_back([&] {
+      std::vector<char> payload(payload_size, 'x');
+      ready.fetch_add(1);
+      while (!go.load()) {
+      }
+      for (size_t i = 0; i < writes_per_thread; ++i) {
+        if (mode == Mode::PACKET) {
+          writePerPacket(
+              buffer.ringBuffer(),
+              stream_ids.fetch_add(1, std::memory_order_relaxed),
+              payload.data(),
+              payload.size());
+        } else {
+          logger.write(payload.data(), payload.size());
+        }
+      }
+    });
+  }
+
+  while (ready.load() != threads) {
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  go.store(true);
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double>(end - start).count();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  size_t max_threads = argc > 1 ? strtoul(argv[1], nullptr, 10) : 32;
+  size_t writes_per_thread = argc > 2 ? strtoul(argv[2], nullptr, 10) : 100000;
+  size_t payload_size = argc > 3 ? strtoul(argv[3], nullptr, 10) : 200;
+
+  printf(
+      "%-8s %8s %14s %14s\n", "mode", "threads", "ns/entry", "Mentries/s");
+  for (Mode mode : {Mode::PACKET, Mode::BATCHED, Mode::STAGED}) {
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+      double secs = runWriters(mode, threads, writes_per_thread, payload_size);
+      double entries = threads * writes_per_thread;
+      printf(
+          "%-8s %8zu %14.1f %14.3f\n",
+          modeName(mode),
+          threads,
+          secs * 1e9 / entries * threads,
+          entries / secs / 1e6);
+    }
+  }
+  return 0;
+}
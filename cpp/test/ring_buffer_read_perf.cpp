@@ -0,0 +1,107 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//
+// How fast a full LockFreeRingBuffer is scanned, one packet at a time
+// (tryRead) vs a range at a time (tryReadRange).
+//
+// Usage: ring_buffer_read_perf [buffer_slots] [iterations] [range_size]
+//
+// Prints one line per read mode.
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <profilo/mmapbuf/Buffer.h>
+
+using namespace facebook::profilo;
+using namespace facebook::profilo::logger;
+
+namespace {
+
+// Out of line, so that the compiler copies whole packets in both modes.
+__attribute__((noinline)) uint64_t checksum(const Packet& packet) {
+  return packet.size + static_cast<uint8_t>(packet.data[0]);
+}
+
+double scanOneByOne(TraceBuffer& ring, size_t slots, uint64_t& sum) {
+  auto start = std::chrono::steady_clock::now();
+  auto cursor = ring.currentTail();
+  alignas(4) Packet packet;
+  for (size_t idx = 0; idx < slots && ring.tryRead(packet, cursor); ++idx) {
+    sum += checksum(packet);
+    cursor.moveForward();
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(end - start).count();
+}
+
+double scanRanges(
+    TraceBuffer& ring,
+    size_t slots,
+    uint32_t range_size,
+    uint64_t& sum) {
+  std::vector<Packet> packets(range_size);
+  auto start = std::chrono::steady_clock::now();
+  auto cursor = ring.currentTail();
+  for (size_t done = 0; done < slots;) {
+    auto read = ring.tryReadRange(packets.data(), cursor, range_size);
+    for (uint32_t idx = 0; idx < read; ++idx) {
+      sum += checksum(packets[idx]);
+    }
+    done += read;
+    if (read < range_size) {
+      break;
+    }
+    cursor.moveForward(read);
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(end - start).count();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  size_t slots = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+  size_t iterations = argc > 2 ? strtoul(argv[2], nullptr, 10) : 100;
+  uint32_t range_size = argc > 3 ? strtoul(argv[3], nullptr, 10) : 64;
+
+  mmapbuf::Buffer buffer(slots);
+  auto& ring = buffer.ringBuffer();
+  for (size_t idx = 0; idx < slots; ++idx) {
+    Packet packet{};
+    packet.size = static_cast<uint16_t>(idx % sizeof(packet.data));
+    ring.write(packet);
+  }
+
+  uint64_t sum = 0;
+  double one_by_one = 0;
+  double ranges = 0;
+  for (size_t iteration = 0; iteration < iterations; ++iteration) {
+    one_by_one += scanOneByOne(ring, slots, sum);
+    ranges += scanRanges(ring, slots, range_size, sum);
+  }
+
+  double packets = static_cast<double>(slots) * iterations;
+  printf("%-10s %14s\n", "mode", "ns/packet");
+  printf("%-10s %14.2f\n", "tryRead", one_by_one * 1e9 / packets);
+  printf("%-10s %14.2f\n", "range", ranges * 1e9 / packets);
+  printf("(checksum %llu)\n", static_cast<unsigned long long>(sum));
+  return 0;
+}
@@ -0,0 +1,149 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//
+// Cost and size of encoding a trace as text (PrintEntryVisitor) vs columnar
+// blocks (ColumnarEntryVisitor), both behind DeltaEncodingVisitor and zlib
+// level 3 like TraceLifecycleVisitor sets them up.
+//
+// Usage: trace_format_perf [entries]
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include <zstr/zstr.hpp>
+
+#include <profilo/writer/ColumnarEntryVisitor.h>
+#include <profilo/writer/DeltaEncodingVisitor.h>
+#include <profilo/writer/PrintEntryVisitor.h>
+
+using namespace facebook::profilo::entries;
+using namespace facebook::profilo::writer;
+
+namespace {
+
+// Stack samples, block markers, counters and string annotations from a
+// handful of threads, roughly in the proportions of a sampling trace.
+template <class Fn>
+void forEachEntry(size_t count, Fn&& fn) {
+  std::mt19937 rng(7);
+  // Samples mostly hit a limited set of distinct stacks.
+  std::vector<std::vector<int64_t>> stacks(64, std::vector<int64_t>(32));
+  for (auto& stack : stacks) {
+    for (auto& frame : stack) {
+      frame = 0x7f00000000 + (rng() % 4096) * 16;
+    }
+  }
+  uint8_t name[] = "com.example.Feed.onBind";
+  int64_t timestamp = 1000000;
+  int32_t id = 512;
+
+  for (size_t i = 0; i < count; ++i) {
+    timestamp += rng() % 20000;
+    int32_t tid = 1000 + rng() % 8;
+    switch (rng() % 10) {
+      case 0:
+      case 1:
+      case 2: {
+        auto& frames = stacks[rng() % stacks.size()];
+        fn(FramesEntry{
+            .id = id++,
+            .type = EntryType::STACK_FRAME,
+            .timestamp = timestamp,
+            .tid = tid,
+            .matchid = 0,
+            .frames = {
+                .values = frames.data(),
+                .size = static_cast<uint16_t>(frames.size())}});
+        break;
+      }
+      case 3:
+        fn(BytesEntry{
+            .id = id++,
+            .type = EntryType::STRING_NAME,
+            .matchid = id - 2,
+            .bytes = {.values = name, .size = sizeof(name) - 1}});
+        break;
+      case 4:
+      case 5:
+        fn(StandardEntry{
+            .id = id++,
+            .type = EntryType::COUNTER,
+            .timestamp = timestamp,
+            .tid = tid,
+            .callid = 9240581,
+            .matchid = 0,
+            .extra = static_cast<int64_t>(rng() % 100000)});
+        break;
+      default:
+        fn(StandardEntry{
+            .id = id++,
+            .type = (i & 1) ? EntryType::MARK_PUSH : EntryType::MARK_POP,
+            .timestamp = timestamp,
+            .tid = tid,
+            .callid = 0,
+            .matchid = 0,
+            .extra = 0});
+        break;
+    }
+  }
+}
+
+// The text format writes every entry as it goes, the columnar one buffers
+// the current block.
+void finish(PrintEntryVisitor&) {}
+
+void finish(ColumnarEntryVisitor& visitor) {
+  visitor.flush();
+}
+
+template <class OutputVisitor>
+void run(const char* name, size_t count) {
+  std::ostringstream sink;
+  auto start = std::chrono::steady_clock::now();
+  {
+    zstr::ostreambuf compressed(sink.rdbuf(), 512 * 1024, 3);
+    std::ostream output(&compressed);
+    OutputVisitor visitor(output);
+    DeltaEncodingVisitor delta(visitor);
+    forEachEntry(count, [&](auto const& entry) { delta.visit(entry); });
+    finish(visitor);
+    output.flush();
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  printf(
+      "%-10s %12.1f %14zu\n",
+      name,
+      std::chrono::duration<double, std::nano>(end - start).count() / count,
+      sink.str().size());
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 200000;
+
+  printf("%-10s %12s %14s\n", "format", "ns/entry", "bytes");
+  run<PrintEntryVisitor>("text", count);
+  run<ColumnarEntryVisitor>("columnar", count);
+  return 0;
+}
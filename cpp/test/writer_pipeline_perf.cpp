@@ -0,0 +1,453 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//
+// Consumer side throughput of the writer pipeline. Every stage of the chain
+// TraceLifecycleVisitor::onTraceStart builds is measured on its own, and then
+// the full chain, each reading the same filled TraceBuffer through
+// PacketReassembler and EntryParser like TraceWriter::processTrace does.
+//
+// Usage: writer_pipeline_perf [entries]
+//        writer_pipeline_perf --dump=<mmap buffer file>
+//
+// Without a dump, the buffer is filled with each of a few synthetic entry
+// mixes in turn. A dump is a file-backed buffer as left behind by
+// MmapBufferManager; its packets are copied into an anonymous buffer first.
+//
+// The "read" stage is the cost of getting entries out of the buffer and is
+// included in every other row. "encode" is the chain without an output,
+// and the "-fused" / "fused" rows are the same as FusedEntryVisitor, which
+// is what the writer actually runs. Bytes are entry payload bytes read from the
+// buffer, except for the "out" column which is what the stage wrote.
+//
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <random>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include <zstr/zstr.hpp>
+
+#include <profilo/entries/EntryParser.h>
+#include <profilo/logger/buffer/RingBuffer.h>
+#include <profilo/mmapbuf/Buffer.h>
+#include <profilo/mmapbuf/header/MmapBufferHeader.h>
+#include <profilo/writer/DeltaEncodingVisitor.h>
+#include <profilo/writer/FusedEntryVisitor.h>
+#include <profilo/writer/PacketReassembler.h>
+#include <profilo/writer/PrintEntryVisitor.h>
+#include <profilo/writer/StackTraceInvertingVisitor.h>
+#include <profilo/writer/TimestampTruncatingVisitor.h>
+#include <profilo/writer/TraceFileHelpers.h>
+
+using namespace facebook::profilo;
+using namespace facebook::profilo::entries;
+using namespace facebook::profilo::logger;
+using namespace facebook::profilo::writer;
+
+namespace {
+
+constexpr int kRepetitions = 5;
+// Upper bound on packets per synthetic entry, for sizing the buffer.
+constexpr size_t kMaxPacketsPerEntry = 8;
+// TraceLifecycleVisitor's zlib level and buffer size.
+constexpr int kCompressionLevel = 3;
+constexpr size_t kCompressionBufferSize = 512 * 1024;
+
+class NullVisitor final : public EntryVisitor {
+ public:
+  virtual void visit(const StandardEntry&) override {}
+  virtual void visit(const FramesEntry&) override {}
+  virtual void visit(const BytesEntry&) override {}
+};
+
+// Discards everything, counting the bytes it was given.
+class CountingStreambuf : public std::streambuf {
+ public:
+  size_t count() const {
+    return count_;
+  }
+
+ protected:
+  virtual int_type overflow(int_type ch) override {
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+      ++count_;
+    }
+    return traits_type::not_eof(ch);
+  }
+
+  virtual std::streamsize xsputn(const char*, std::streamsize count) override {
+    count_ += count;
+    return count;
+  }
+
+ private:
+  size_t count_ = 0;
+};
+
+//
+// Relative weights of the three entry shapes in a synthetic buffer.
+//
+struct EntryMix {
+  const char* name;
+  uint32_t standard;
+  uint32_t frames;
+  uint32_t bytes;
+};
+
+constexpr EntryMix kMixes[] = {
+    // Stack samples with the occasional block marker and counter.
+    {"sampling", 4, 5, 1},
+    // Block markers and counters, few stacks.
+    {"markers", 8, 1, 1},
+    // Annotation heavy, every block carries key/value strings.
+    {"strings", 4, 1, 5},
+};
+
+void fillBuffer(mmapbuf::Buffer& buffer, EntryMix const& mix, size_t count) {
+  auto& logger = buffer.logger();
+  std::mt19937 rng(7);
+  // Samples mostly hit a limited set of distinct stacks, of varying depth.
+  std::vector<std::vector<int64_t>> stacks(64);
+  for (auto& stack : stacks) {
+    stack.resize(8 + rng() % 32);
+    for (auto& frame : stack) {
+      frame = 0x7f00000000 + (rng() % 4096) * 16;
+    }
+  }
+  std::vector<std::string> strings{
+      "com.example.Feed.onBind",
+      "render",
+      "com.example.network.HttpRequest#execute",
+      "Choreographer#doFrame",
+      "android.view.ViewRootImpl.performTraversals",
+  };
+
+  int64_t timestamp = 1000000;
+  int32_t last_id = 0;
+  auto total = mix.standard + mix.frames + mix.bytes;
+  for (size_t i = 0; i < count; ++i) {
+    timestamp += rng() % 20000;
+    int32_t tid = 1000 + rng() % 8;
+    auto pick = rng() % total;
+    if (pick < mix.standard) {
+      bool counter = rng() % 3 == 0;
+      last_id = logger.write(StandardEntry{
+          .id = 0,
+          .type = counter ? EntryType::COUNTER
+                          : (i & 1) ? EntryType::MARK_PUSH
+                                    : EntryType::MARK_POP,
+          .timestamp = timestamp,
+          .tid = tid,
+          .callid = counter ? 9240581 : 0,
+          .matchid = 0,
+          .extra = counter ? static_cast<int64_t>(rng() % 100000) : 0});
+    } else if (pick < mix.standard + mix.frames) {
+      auto& frames = stacks[rng() % stacks.size()];
+      last_id = logger.write(FramesEntry{
+          .id = 0,
+          .type = EntryType::STACK_FRAME,
+          .timestamp = timestamp,
+          .tid = tid,
+          .matchid = 0,
+          .frames = {
+              .values = frames.data(),
+              .size = static_cast<uint16_t>(frames.size())}});
+    } else {
+      auto& string = strings[rng() % strings.size()];
+      last_id = logger.writeBytes(
+          (i & 1) ? EntryType::STRING_KEY : EntryType::STRING_VALUE,
+          last_id,
+          reinterpret_cast<const uint8_t*>(string.data()),
+          string.size());
+    }
+  }
+}
+
+//
+// Copies the packets of a dumped file-backed buffer into a new buffer.
+// Returns nullptr if the file isn't a buffer this build can read.
+//
+std::unique_ptr<mmapbuf::Buffer> loadDump(const char* path) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+    return nullptr;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 ||
+      static_cast<size_t>(file_stat.st_size) <
+          sizeof(mmapbuf::MmapBufferPrefix)) {
+    fprintf(stderr, "%s is too small to be a buffer\n", path);
+    close(fd);
+    return nullptr;
+  }
+  size_t size = file_stat.st_size;
+  // Private and writable, reads go through the slots' atomics.
+  void* map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "Unable to map %s: %s\n", path, strerror(errno));
+    return nullptr;
+  }
+
+  std::unique_ptr<mmapbuf::Buffer> buffer;
+  auto prefix = reinterpret_cast<mmapbuf::MmapBufferPrefix*>(map);
+  // The header is packed, copy the field before it binds to a reference.
+  uint32_t slots = prefix->header.size;
+  if (prefix->staticHeader.magic != mmapbuf::header::kMagic ||
+      prefix->staticHeader.version != mmapbuf::header::kVersion ||
+      prefix->header.bufferVersion != RingBuffer::kVersion) {
+    fprintf(stderr, "%s is not a supported buffer file\n", path);
+  } else if (
+      size < sizeof(mmapbuf::MmapBufferPrefix) +
+          TraceBuffer::calculateAllocationSize(slots)) {
+    fprintf(stderr, "%s is truncated\n", path);
+  } else {
+    auto& source = *reinterpret_cast<TraceBuffer*>(
+        reinterpret_cast<char*>(map) + sizeof(mmapbuf::MmapBufferPrefix));
+    buffer = std::make_unique<mmapbuf::Buffer>(slots);
+    auto& dest = buffer->ringBuffer();
+    auto cursor = source.currentTail(0);
+    alignas(4) Packet packet;
+    while (source.tryRead(packet, cursor)) {
+      dest.write(packet);
+      if (!cursor.moveForward()) {
+        break;
+      }
+    }
+  }
+  munmap(map, size);
+  return buffer;
+}
+
+struct Stage {
+  const char* name;
+  // Builds the stage on top of the sink and returns its entry point.
+  std::function<EntryVisitor&(
+      std::vector<std::unique_ptr<EntryVisitor>>& chain,
+      std::ostream& sink)>
+      build;
+  bool compressed;
+};
+
+template <class V>
+EntryVisitor& push(std::vector<std::unique_ptr<EntryVisitor>>& chain, V* v) {
+  chain.emplace_back(v);
+  return *v;
+}
+
+const std::vector<Stage>& stages() {
+  static const std::vector<Stage> kStages{
+      {"read",
+       [](auto& chain, auto&) -> EntryVisitor& {
+         return push(chain, new NullVisitor());
+       },
+       false},
+      {"invert",
+       [](auto& chain, auto&) -> EntryVisitor& {
+         auto& sink = push(chain, new NullVisitor());
+         return push(chain, new StackTraceInvertingVisitor(sink));
+       },
+       false},
+      {"truncate",
+       [](auto& chain, auto&) -> EntryVisitor& {
+         auto& sink = push(chain, new NullVisitor());
+         return push(
+             chain,
+             new TimestampTruncatingVisitor(
+                 sink, TraceFileHelpers::kTimestampPrecision));
+       },
+       false},
+      {"delta",
+       [](auto& chain, auto&) -> EntryVisitor& {
+         auto& sink = push(chain, new NullVisitor());
+         return push(chain, new DeltaEncodingVisitor(sink));
+       },
+       false},
+      {"encode",
+       [](auto& chain, auto&) -> EntryVisitor& {
+         auto& sink = push(chain, new NullVisitor());
+         auto& delta = push(chain, new DeltaEncodingVisitor(sink));
+         auto& truncate = push(
+             chain,
+             new TimestampTruncatingVisitor(
+                 delta, TraceFileHelpers::kTimestampPrecision));
+         return push(chain, new StackTraceInvertingVisitor(truncate));
+       },
+       false},
+      {"encode-fused",
+       [](auto& chain, auto&) -> EntryVisitor& {
+         auto sink = new NullVisitor();
+         push(chain, sink);
+         return push(chain, new FusedEntryVisitor<NullVisitor>(*sink));
+       },
+       false},
+      {"print",
+       [](auto& chain, auto& output) -> EntryVisitor& {
+         return push(chain, new PrintEntryVisitor(output));
+       },
+       false},
+      {"print+zlib",
+       [](auto& chain, auto& output) -> EntryVisitor& {
+         return push(chain, new PrintEntryVisitor(output));
+       },
+       true},
+      {"chain",
+       [](auto& chain, auto& output) -> EntryVisitor& {
+         auto& print = push(chain, new PrintEntryVisitor(output));
+         auto& delta = push(chain, new DeltaEncodingVisitor(print));
+         auto& truncate = push(
+             chain,
+             new TimestampTruncatingVisitor(
+                 delta, TraceFileHelpers::kTimestampPrecision));
+         return push(chain, new StackTraceInvertingVisitor(truncate));
+       },
+       true},
+      {"fused",
+       [](auto& chain, auto& output) -> EntryVisitor& {
+         auto print = new PrintEntryVisitor(output);
+         push(chain, print);
+         return push(chain, new FusedEntryVisitor<PrintEntryVisitor>(*print));
+       },
+       true},
+  };
+  return kStages;
+}
+
+struct Result {
+  double seconds;
+  size_t entries;
+  size_t payload_bytes;
+  size_t output_bytes;
+};
+
+Result runStage(Stage const& stage, TraceBuffer& buffer) {
+  CountingStreambuf counter;
+  std::unique_ptr<zstr::ostreambuf> compressed;
+  if (stage.compressed) {
+    compressed = std::make_unique<zstr::ostreambuf>(
+        &counter, kCompressionBufferSize, kCompressionLevel);
+  }
+  std::ostream output(
+      compressed ? static_cast<std::streambuf*>(compressed.get()) : &counter);
+
+  std::vector<std::unique_ptr<EntryVisitor>> chain;
+  auto& visitor = stage.build(chain, output);
+
+  size_t entries = 0;
+  size_t payload_bytes = 0;
+  PacketReassembler reassembler([&](const void* data, size_t size) {
+    ++entries;
+    payload_bytes += size;
+    EntryParser::parse(data, size, visitor);
+  });
+
+  auto start = std::chrono::steady_clock::now();
+  auto cursor = buffer.currentTail(0);
+  alignas(4) Packet packet;
+  while (buffer.tryRead(packet, cursor)) {
+    reassembler.process(packet);
+    if (!cursor.moveForward()) {
+      break;
+    }
+  }
+  output.flush();
+  compressed.reset();
+  auto end = std::chrono::steady_clock::now();
+
+  return Result{
+      .seconds = std::chrono::duration<double>(end - start).count(),
+      .entries = entries,
+      .payload_bytes = payload_bytes,
+      .output_bytes = counter.count(),
+  };
+}
+
+void runAll(const char* name, TraceBuffer& buffer) {
+  for (auto const& stage : stages()) {
+    Result best{};
+    for (int i = 0; i < kRepetitions; ++i) {
+      auto result = runStage(stage, buffer);
+      if (i == 0 || result.seconds < best.seconds) {
+        best = result;
+      }
+    }
+    if (best.entries == 0) {
+      fprintf(stderr, "No entries read from %s\n", name);
+      return;
+    }
+    printf(
+        "%-10s %-12s %10zu %12.1f %14.3f %10.1f %14zu\n",
+        name,
+        stage.name,
+        best.entries,
+        best.seconds * 1e9 / best.entries,
+        best.entries / best.seconds / 1e6,
+        best.payload_bytes / best.seconds / (1024 * 1024),
+        best.output_bytes);
+  }
+}
+
+void printHeader() {
+  printf(
+      "%-10s %-12s %10s %12s %14s %10s %14s\n",
+      "input",
+      "stage",
+      "entries",
+      "ns/entry",
+      "Mentries/s",
+      "MiB/s",
+      "out");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const char kDumpFlag[] = "--dump=";
+  if (argc > 1 && strncmp(argv[1], kDumpFlag, sizeof(kDumpFlag) - 1) == 0) {
+    auto buffer = loadDump(argv[1] + sizeof(kDumpFlag) - 1);
+    if (buffer == nullptr) {
+      return 1;
+    }
+    printHeader();
+    runAll("dump", buffer->ringBuffer());
+    return 0;
+  }
+
+  size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 200000;
+
+  printHeader();
+  for (auto const& mix : kMixes) {
+    mmapbuf::Buffer buffer(count * kMaxPacketsPerEntry);
+    fillBuffer(buffer, mix, count);
+    runAll(mix.name, buffer.ringBuffer());
+  }
+  return 0;
+}
@@ -0,0 +1,425 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Clock.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+
+#if defined(__linux__) || defined(ANDROID)
+#include <sys/syscall.h> // __NR_clock_gettime
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+namespace facebook {
+namespace profilo {
+namespace clock {
+
+namespace {
+
+static const int64_t kSecondNanos = 1000000000;
+
+std::atomic<Source> gSource{Source::VDSO};
+
+#if defined(__linux__) || defined(ANDROID)
+
+inline int64_t toNanos(const timespec& ts) {
+  return static_cast<int64_t>(ts.tv_sec) * kSecondNanos + ts.tv_nsec;
+}
+
+inline int64_t vdsoTime() {
+  timespec ts{};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return toNanos(ts);
+}
+
+inline int64_t syscallTime() {
+  timespec ts{};
+  syscall(__NR_clock_gettime, CLOCK_MONOTONIC, &ts);
+  return toNanos(ts);
+}
+
+inline int64_t coarseClockTime() {
+  timespec ts{};
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return toNanos(ts);
+}
+
+#else
+
+inline int64_t vdsoTime() {
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+inline int64_t syscallTime() {
+  return vdsoTime();
+}
+
+inline int64_t coarseClockTime() {
+  return vdsoTime();
+}
+
+#endif
+
+//
+// Raw counter access. counterFrequency() is 0 where the frequency has to be
+// calibrated against CLOCK_MONOTONIC.
+//
+#if defined(__x86_64__) || defined(__i386__)
+
+constexpr bool kHasCycleCounter = true;
+
+inline uint64_t readCounter() {
+  uint32_t lo, hi;
+  __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+  return (static_cast<uint64_t>(hi) << 32) | lo;
+}
+
+uint64_t counterFrequency() {
+  return 0;
+}
+
+bool counterUsable() {
+  // Invariant TSC: constant rate across P-, C- and T-states.
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) {
+    return false;
+  }
+  return (edx & (1u << 8)) != 0;
+}
+
+#elif defined(__aarch64__)
+
+constexpr bool kHasCycleCounter = true;
+
+inline uint64_t readCounter() {
+  uint64_t value;
+  // The isb keeps the read from being speculated ahead of earlier code.
+  __asm__ __volatile__("isb\n\tmrs %0, cntvct_el0" : "=r"(value)::"memory");
+  return value;
+}
+
+uint64_t counterFrequency() {
+  uint64_t frequency;
+  __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(frequency));
+  return frequency;
+}
+
+bool counterUsable() {
+  // The generic timer is constant rate by definition and Linux lets
+  // userspace read the virtual count.
+  return true;
+}
+
+#else
+
+constexpr bool kHasCycleCounter = false;
+
+inline uint64_t readCounter() {
+  return 0;
+}
+
+uint64_t counterFrequency() {
+  return 0;
+}
+
+bool counterUsable() {
+  return false;
+}
+
+#endif
+
+//
+// Counter to nanoseconds conversion:
+//   ns = base_ns + ((ticks - base_ticks) * mult) >> kMultShift
+//
+// Readers only convert deltas below resync_ticks, which bounds the product
+// to kResyncIntervalNs << kMultShift and keeps it from overflowing.
+//
+// The fields are published under a sequence lock. Readers never wait on it:
+// if it's held, possibly by the very thread a signal handler interrupted,
+// they read the vDSO clock instead.
+//
+constexpr uint32_t kMultShift = 32;
+// Frequencies outside of this range mean calibration went wrong.
+constexpr uint64_t kMinCounterFrequency = 1000000; // 1 MHz
+constexpr uint64_t kMaxCounterFrequency = 20000000000; // 20 GHz
+constexpr int64_t kCalibrationNs = 10000000; // 10 ms
+
+struct CounterAnchor {
+  std::atomic<uint32_t> seq{0};
+  std::atomic<uint64_t> base_ticks{0};
+  std::atomic<int64_t> base_ns{0};
+  std::atomic<uint64_t> mult{0};
+  std::atomic<uint64_t> resync_ticks{0};
+  // Nonzero if the hardware reports its frequency, so mult never changes.
+  uint64_t fixed_frequency{0};
+};
+
+CounterAnchor gAnchor;
+
+//
+// Samples the counter and CLOCK_MONOTONIC at (nearly) the same instant, by
+// reading the clock between two counter reads.
+//
+void sampleCounter(uint64_t& ticks, int64_t& ns) {
+  auto before = readCounter();
+  ns = vdsoTime();
+  auto after = readCounter();
+  ticks = before + (after - before) / 2;
+}
+
+uint64_t multFor(double ns_per_tick) {
+  return static_cast<uint64_t>(ns_per_tick * (1ull << kMultShift));
+}
+
+bool frequencyInRange(double ticks_per_sec) {
+  return ticks_per_sec >= kMinCounterFrequency &&
+      ticks_per_sec <= kMaxCounterFrequency;
+}
+
+//
+// Writes a new anchor. Caller must hold the sequence lock.
+//
+void storeAnchor(uint64_t ticks, int64_t ns, uint64_t mult) {
+  gAnchor.base_ticks.store(ticks, std::memory_order_relaxed);
+  gAnchor.base_ns.store(ns, std::memory_order_relaxed);
+  gAnchor.mult.store(mult, std::memory_order_relaxed);
+  // Ticks per resync interval, from ns = ticks * mult >> kMultShift.
+  gAnchor.resync_ticks.store(
+      static_cast<uint64_t>(
+          static_cast<double>(kResyncIntervalNs) * (1ull << kMultShift) /
+          mult),
+      std::memory_order_relaxed);
+}
+
+bool tryLockAnchor(uint32_t expected_seq) {
+  if (!gAnchor.seq.compare_exchange_strong(
+          expected_seq, expected_seq + 1, std::memory_order_acquire)) {
+    return false;
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+  return true;
+}
+
+void unlockAnchor(uint32_t locked_seq) {
+  gAnchor.seq.store(locked_seq + 1, std::memory_order_release);
+}
+
+//
+// Moves the anchor to now and, for calibrated counters, refines the rate
+// over the interval since the previous anchor. Returns the current time.
+//
+int64_t resync(uint32_t seq) {
+  if (!tryLockAnchor(seq)) {
+    return vdsoTime();
+  }
+
+  uint64_t ticks;
+  int64_t ns;
+  sampleCounter(ticks, ns);
+
+  auto mult = gAnchor.mult.load(std::memory_order_relaxed);
+  if (gAnchor.fixed_frequency == 0) {
+    auto elapsed_ticks =
+        ticks - gAnchor.base_ticks.load(std::memory_order_relaxed);
+    auto elapsed_ns = ns - gAnchor.base_ns.load(std::memory_order_relaxed);
+    // Short intervals, from a reader racing an earlier resync, are too noisy
+    // to calibrate with.
+    if (elapsed_ticks > 0 && elapsed_ns >= kResyncIntervalNs / 2) {
+      double ns_per_tick = static_cast<double>(elapsed_ns) / elapsed_ticks;
+      if (frequencyInRange(kSecondNanos / ns_per_tick)) {
+        mult = multFor(ns_per_tick);
+      }
+    }
+  }
+  storeAnchor(ticks, ns, mult);
+  unlockAnchor(seq + 1);
+  return ns;
+}
+
+//
+// The highest time counterTime() returned on this thread. A resync moves the
+// anchor to a fresh CLOCK_MONOTONIC reading, and readers that can't use the
+// anchor read the vDSO: either can be behind what the previous anchor
+// extrapolated to. Kept per thread so that readers don't contend on it.
+//
+thread_local std::atomic<int64_t> tLastCounterNs{0};
+
+int64_t counterReading() {
+  auto seq = gAnchor.seq.load(std::memory_order_acquire);
+  if (seq & 1) {
+    return vdsoTime();
+  }
+  auto base_ticks = gAnchor.base_ticks.load(std::memory_order_relaxed);
+  auto base_ns = gAnchor.base_ns.load(std::memory_order_relaxed);
+  auto mult = gAnchor.mult.load(std::memory_order_relaxed);
+  auto resync_ticks = gAnchor.resync_ticks.load(std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (gAnchor.seq.load(std::memory_order_relaxed) != seq || mult == 0) {
+    return vdsoTime();
+  }
+
+  auto delta = readCounter() - base_ticks;
+  if (delta >= resync_ticks) {
+    // Also covers a counter read from before a concurrent resync moved
+    // base_ticks past it, which underflows.
+    return resync(seq);
+  }
+  return base_ns + static_cast<int64_t>((delta * mult) >> kMultShift);
+}
+
+//
+// Clamps readings to the thread's high-water mark, so that they strictly
+// increase across resyncs and fallbacks on each thread. Readings from
+// different threads aren't ordered beyond what the anchor gives. The CAS
+// loop only retries when a signal handler on this thread read the clock in
+// between, so it's safe in signal handlers too.
+//
+int64_t counterTime() {
+  auto value = counterReading();
+  auto last = tLastCounterNs.load(std::memory_order_relaxed);
+  int64_t next;
+  do {
+    next = value > last ? value : last + 1;
+  } while (!tLastCounterNs.compare_exchange_weak(
+      last, next, std::memory_order_relaxed));
+  return next;
+}
+
+//
+// Sets up the counter anchor. Returns false if the counter can't be used.
+//
+bool calibrateCounter() {
+  if (!kHasCycleCounter || !counterUsable()) {
+    return false;
+  }
+
+  uint32_t seq = gAnchor.seq.load(std::memory_order_acquire);
+  if ((seq & 1) || !tryLockAnchor(seq)) {
+    return false;
+  }
+
+  uint64_t start_ticks;
+  int64_t start_ns;
+  sampleCounter(start_ticks, start_ns);
+
+  double ns_per_tick = 0;
+  auto frequency = counterFrequency();
+  if (frequency != 0) {
+    ns_per_tick = static_cast<double>(kSecondNanos) / frequency;
+  } else {
+    timespec wait{.tv_sec = 0, .tv_nsec = kCalibrationNs};
+    while (nanosleep(&wait, &wait) != 0) {
+    }
+    uint64_t end_ticks;
+    int64_t end_ns;
+    sampleCounter(end_ticks, end_ns);
+    if (end_ticks > start_ticks && end_ns > start_ns) {
+      ns_per_tick =
+          static_cast<double>(end_ns - start_ns) / (end_ticks - start_ticks);
+    }
+    start_ticks = end_ticks;
+    start_ns = end_ns;
+  }
+
+  bool ok = ns_per_tick > 0 && frequencyInRange(kSecondNanos / ns_per_tick);
+  if (ok) {
+    gAnchor.fixed_frequency = frequency;
+    storeAnchor(start_ticks, start_ns, multFor(ns_per_tick));
+  }
+  unlockAnchor(seq + 1);
+  return ok;
+}
+
+} // namespace
+
+int64_t read(Source source) {
+  switch (source) {
+    case Source::SYSCALL:
+      return syscallTime();
+    case Source::CYCLE_COUNTER:
+      return counterTime();
+    case Source::COARSE:
+      return coarseClockTime();
+    case Source::VDSO:
+    default:
+      return vdsoTime();
+  }
+}
+
+int64_t now() {
+  return read(gSource.load(std::memory_order_relaxed));
+}
+
+int64_t coarseTime() {
+  return coarseClockTime();
+}
+
+bool isAvailable(Source source) {
+  switch (source) {
+    case Source::VDSO:
+    case Source::SYSCALL:
+    case Source::COARSE:
+      return true;
+    case Source::CYCLE_COUNTER:
+      return kHasCycleCounter && counterUsable();
+    default:
+      return false;
+  }
+}
+
+bool setSource(Source source) {
+  if (source == Source::COARSE || !isAvailable(source)) {
+    return false;
+  }
+  if (source == Source::CYCLE_COUNTER &&
+      gAnchor.mult.load(std::memory_order_acquire) == 0 &&
+      !calibrateCounter()) {
+    return false;
+  }
+  gSource.store(source, std::memory_order_relaxed);
+  return true;
+}
+
+Source currentSource() {
+  return gSource.load(std::memory_order_relaxed);
+}
+
+const char* sourceName(Source source) {
+  switch (source) {
+    case Source::VDSO:
+      return "vdso";
+    case Source::SYSCALL:
+      return "syscall";
+    case Source::CYCLE_COUNTER:
+      return "cycle_counter";
+    case Source::COARSE:
+      return "coarse";
+    default:
+      return "unknown";
+  }
+}
+
+} // namespace clock
+} // namespace profilo
+} // namespace facebook
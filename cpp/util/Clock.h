@@ -0,0 +1,86 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+namespace facebook {
+namespace profilo {
+namespace clock {
+
+//
+// Where monotonicTime() gets its timestamps from. All sources count
+// nanoseconds on the CLOCK_MONOTONIC timeline.
+//
+enum class Source : int32_t {
+  // clock_gettime(CLOCK_MONOTONIC) through libc, which is served from the
+  // vDSO without entering the kernel. The default.
+  VDSO = 0,
+  // clock_gettime(CLOCK_MONOTONIC) as a raw syscall.
+  SYSCALL = 1,
+  // The CPU's counter (invariant TSC on x86, cntvct_el0 on arm64), scaled to
+  // nanoseconds and re-anchored to CLOCK_MONOTONIC every kResyncIntervalNs.
+  // Readings strictly increase on each thread, across re-anchors too; across
+  // threads they can be out of order by the re-anchoring error. Only
+  // available where the counter is readable from userspace and constant
+  // rate.
+  CYCLE_COUNTER = 2,
+  // CLOCK_MONOTONIC_COARSE. Cheapest, but only as precise as a jiffy. Not
+  // selectable with setSource(): readings repeat within a jiffy, and
+  // consumers like counters::Counter need strictly increasing timestamps.
+  COARSE = 3,
+};
+
+constexpr int64_t kResyncIntervalNs = 1000000000; // 1 second
+
+//
+// Reads the current time from the selected source.
+//
+int64_t now();
+
+//
+// Reads the current time from a specific source. Reading CYCLE_COUNTER
+// before it has been selected with setSource() falls back to VDSO.
+//
+int64_t read(Source source);
+
+//
+// Timestamp for low-precision data, on the same timeline as monotonicTime()
+// but up to a jiffy behind it. Consecutive calls can return the same value.
+//
+int64_t coarseTime();
+
+bool isAvailable(Source source);
+
+//
+// Selects the source behind monotonicTime() for the whole process.
+// Selecting CYCLE_COUNTER calibrates the counter first, which takes a few
+// milliseconds. Returns false and keeps the current source if the requested
+// one isn't available on this device, or is COARSE.
+//
+bool setSource(Source source);
+
+Source currentSource();
+
+//
+// Stable name of a source, as written in the trace headers.
+//
+const char* sourceName(Source source);
+
+} // namespace clock
+} // namespace profilo
+} // namespace facebook
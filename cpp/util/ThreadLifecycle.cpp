@@ -0,0 +1,182 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <util/ThreadLifecycle.h>
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+
+#include <fb/log.h>
+#include <linker/sharedlibs.h>
+#include <plthooks/plthooks.h>
+#include <util/common.h>
+#include <util/hooks.h>
+
+namespace facebook {
+namespace profilo {
+namespace util {
+
+namespace {
+
+constexpr char kPthreadCreate[] = "pthread_create";
+
+struct StartRoutine {
+  void* (*routine)(void*);
+  void* arg;
+};
+
+pthread_key_t exitKey;
+
+void onThreadExitKey(void* /* value */) {
+  ThreadLifecycle::getInstance().threadExited(threadID());
+}
+
+void* startRoutineHook(void* data) {
+  auto start = *static_cast<StartRoutine*>(data);
+  delete static_cast<StartRoutine*>(data);
+
+  ThreadLifecycle::getInstance().threadStarted(threadID());
+  // Any non-null value has the destructor called at exit.
+  pthread_setspecific(exitKey, &exitKey);
+  return start.routine(start.arg);
+}
+
+int pthread_create_hook(
+    pthread_t* thread,
+    const pthread_attr_t* attr,
+    void* (*routine)(void*),
+    void* arg) {
+  StartRoutine* start = nullptr;
+  if (ThreadLifecycle::getInstance().hasListeners()) {
+    start = new (std::nothrow) StartRoutine{routine, arg};
+  }
+  if (start == nullptr) {
+    return CALL_PREV(pthread_create_hook, thread, attr, routine, arg);
+  }
+
+  int ret =
+      CALL_PREV(pthread_create_hook, thread, attr, &startRoutineHook, start);
+  if (ret != 0) {
+    delete start;
+  }
+  return ret;
+}
+
+// Libraries that create threads, other than libc and this one.
+bool allowHookingCb(char const* libname, char const* full_libname, void* data) {
+  auto seenLibs = static_cast<std::unordered_set<std::string>*>(data);
+  if (!seenLibs->insert(libname).second) {
+    return false;
+  }
+
+  auto result = linker::sharedLib(libname);
+  if (!result.success) {
+    return false;
+  }
+  return result.data.find_symbol_by_name(kPthreadCreate) != nullptr;
+}
+
+} // namespace
+
+ThreadLifecycle& ThreadLifecycle::getInstance() {
+  static ThreadLifecycle lifecycle;
+  return lifecycle;
+}
+
+ThreadLifecycle::ThreadLifecycle()
+    : mutex_(),
+      listeners_(),
+      has_listeners_(false),
+      seen_libs_(),
+      hooked_(false) {
+  if (pthread_key_create(&exitKey, onThreadExitKey) != 0) {
+    throw std::runtime_error("Could not create the thread exit key");
+  }
+
+  seen_libs_.insert("libc.so");
+  Dl_info info;
+  if (dladdr((void*)&allowHookingCb, &info) && info.dli_fname != nullptr) {
+    // A thread may block trying to hook the current library.
+    auto slash = strrchr(info.dli_fname, '/');
+    seen_libs_.insert(slash != nullptr ? slash + 1 : info.dli_fname);
+  } else {
+    // Then nothing is hooked, see hookLoadedLibs().
+    seen_libs_.clear();
+  }
+}
+
+bool ThreadLifecycle::addListener(Listener* listener) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (listeners_.empty()) {
+    hooked_ = hookLoadedLibs() || hooked_;
+  }
+  listeners_.push_back(listener);
+  has_listeners_.store(true, std::memory_order_relaxed);
+  return hooked_;
+}
+
+void ThreadLifecycle::removeListener(Listener* listener) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  listeners_.erase(
+      std::remove(listeners_.begin(), listeners_.end(), listener),
+      listeners_.end());
+  has_listeners_.store(!listeners_.empty(), std::memory_order_relaxed);
+}
+
+void ThreadLifecycle::threadStarted(int32_t tid) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto listener : listeners_) {
+    listener->onThreadStart(tid);
+  }
+}
+
+void ThreadLifecycle::threadExited(int32_t tid) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto listener : listeners_) {
+    listener->onThreadExit(tid);
+  }
+}
+
+bool ThreadLifecycle::hookLoadedLibs() {
+  if (seen_libs_.empty()) {
+    FBLOGV("Could not resolve the current library, not hooking");
+    return false;
+  }
+  if (plthooks_initialize()) {
+    FBLOGV("Could not initialize plthooks");
+    return false;
+  }
+
+  static std::vector<plt_hook_spec> functionHooks = {
+      {"libc.so", kPthreadCreate, reinterpret_cast<void*>(&pthread_create_hook)},
+  };
+  try {
+    hooks::hookLoadedLibs(functionHooks, allowHookingCb, &seen_libs_);
+  } catch (const std::runtime_error& e) {
+    // Some libraries may still have been hooked.
+    FBLOGW("Could not hook pthread_create: %s", e.what());
+    return false;
+  }
+  return true;
+}
+
+} // namespace util
+} // namespace profilo
+} // namespace facebook
@@ -0,0 +1,87 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace facebook {
+namespace profilo {
+namespace util {
+
+//
+// Tells listeners about threads of the process starting and exiting, as it
+// happens, instead of them listing /proc/self/task to find out.
+//
+// pthread_create() is hooked in the loaded libraries. A hooked thread reports
+// its start before running its start routine and sets a thread-specific key,
+// whose destructor reports its exit, pthread_exit() included. Threads that
+// were running before the first listener, or that are created by libraries
+// loaded since the last hooking, are missed: listeners still list
+// /proc/self/task now and then to reconcile.
+//
+class ThreadLifecycle {
+ public:
+  struct Listener {
+    // Both are called on the thread itself, so must be quick. They aren't
+    // called concurrently with each other or with removeListener().
+    virtual void onThreadStart(int32_t tid) = 0;
+    virtual void onThreadExit(int32_t tid) = 0;
+    virtual ~Listener() = default;
+  };
+
+  static ThreadLifecycle& getInstance();
+
+  ThreadLifecycle(const ThreadLifecycle&) = delete;
+  ThreadLifecycle& operator=(const ThreadLifecycle&) = delete;
+
+  //
+  // The first listener hooks the libraries loaded since the last time.
+  // Returns whether events are delivered at all, if not the listener has to
+  // poll.
+  //
+  bool addListener(Listener* listener);
+  void removeListener(Listener* listener);
+
+  bool hasListeners() const {
+    return has_listeners_.load(std::memory_order_relaxed);
+  }
+
+  // Reports a thread of the process starting or exiting, from the hooks.
+  void threadStarted(int32_t tid);
+  void threadExited(int32_t tid);
+
+ private:
+  ThreadLifecycle();
+
+  bool hookLoadedLibs();
+
+  std::mutex mutex_; // Guards listeners_, seen_libs_ and hooked_
+  std::vector<Listener*> listeners_;
+  std::atomic_bool has_listeners_;
+  // Libraries hooked or skipped so far.
+  std::unordered_set<std::string> seen_libs_;
+  bool hooked_;
+};
+
+} // namespace util
+} // namespace profilo
+} // namespace facebook
@@ -22,31 +22,21 @@
 #include <sys/stat.h>
 #include <time.h>
 #include <algorithm>
-#include <chrono>
 #include <sstream>
 #include <system_error>
 
 #if defined(__linux__) || defined(ANDROID)
-#include <sys/syscall.h> // __NR_gettid, __NR_clock_gettime
+#include <sys/syscall.h> // __NR_gettid
 #endif
 
+#include "Clock.h"
+
 namespace facebook {
 namespace profilo {
 
-#if defined(__linux__) || defined(ANDROID)
-static const int64_t kSecondNanos = 1000000000;
-
 int64_t monotonicTime() {
-  timespec ts{};
-  syscall(__NR_clock_gettime, CLOCK_MONOTONIC, &ts);
-  return static_cast<int64_t>(ts.tv_sec) * kSecondNanos + ts.tv_nsec;
+  return clock::now();
 }
-#else
-int64_t monotonicTime() {
-  auto now = std::chrono::steady_clock::now().time_since_epoch();
-  return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
-}
-#endif
 
 #ifdef ANDROID
 typedef pid_t (*gettid_t)(pthread_t);
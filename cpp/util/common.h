@@ -25,6 +25,7 @@
 namespace facebook {
 namespace profilo {
 
+// CLOCK_MONOTONIC in nanoseconds, from the source selected in Clock.h.
 int64_t monotonicTime();
 
 int32_t threadID();
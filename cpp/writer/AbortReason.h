@@ -28,6 +28,7 @@ enum AbortReason {
   NEW_START = 5,
   CONDITION_NOT_MET = 6,
   WRITER_EXCEPTION = 7,
+  WRITER_QUEUE_FULL = 10,
 };
 
 } // namespace writer
@@ -0,0 +1,83 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <writer/BlobResolvingVisitor.h>
+
+#include <cstring>
+
+namespace facebook {
+namespace profilo {
+namespace writer {
+
+BlobResolvingVisitor::BlobResolvingVisitor(
+    EntryVisitor& delegate,
+    const logger::ByteRingBuffer* arena)
+    : delegate_(delegate), arena_(arena), blob_() {}
+
+void BlobResolvingVisitor::lost(const BytesEntry& reference) {
+  delegate_.visit(BytesEntry{
+      .id = reference.id,
+      .type = EntryType::BLOB_LOST,
+      .matchid = reference.matchid,
+      .bytes = {.values = nullptr, .size = 0},
+  });
+}
+
+void BlobResolvingVisitor::visit(const StandardEntry& entry) {
+  delegate_.visit(entry);
+}
+
+void BlobResolvingVisitor::visit(const FramesEntry& entry) {
+  delegate_.visit(entry);
+}
+
+void BlobResolvingVisitor::visit(const BytesEntry& entry) {
+  if (entry.type != EntryType::BLOB_REFERENCE) {
+    delegate_.visit(entry);
+    return;
+  }
+
+  Logger::BlobReference reference;
+  if (entry.bytes.size != sizeof(reference) || arena_ == nullptr) {
+    lost(entry);
+    return;
+  }
+  std::memcpy(&reference, entry.bytes.values, sizeof(reference));
+
+  auto result = arena_->readAt(
+      logger::ByteRingBuffer::Cursor(reference.position), blob_);
+  if (result != logger::ByteRingBuffer::ReadResult::OK ||
+      blob_.size() != reference.length) {
+    // Overwritten by newer blobs.
+    lost(entry);
+    return;
+  }
+
+  delegate_.visit(BytesEntry{
+      .id = entry.id,
+      .type = static_cast<EntryType>(reference.type),
+      .matchid = entry.matchid,
+      .bytes =
+          {
+              .values = reinterpret_cast<const uint8_t*>(blob_.data()),
+              .size = static_cast<uint16_t>(blob_.size()),
+          },
+  });
+}
+
+} // namespace writer
+} // namespace profilo
+} // namespace facebook
@@ -0,0 +1,63 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <generated/EntryParser.h>
+#include <logger/Logger.h>
+#include <logger/buffer/ByteRingBuffer.h>
+
+namespace facebook {
+namespace profilo {
+namespace writer {
+
+using namespace entries;
+
+//
+// Turns BLOB_REFERENCE entries back into the BytesEntry they stand in for,
+// with the payload read from the blob arena of the buffer (see
+// Logger::writeBytes). Traces read the same whether or not payloads went
+// through an arena.
+//
+// A reference to a blob that has been overwritten since, or that isn't in
+// `arena` at all, is passed on as a BLOB_LOST entry with the same id and
+// matchid and no payload.
+//
+class BlobResolvingVisitor : public EntryVisitor {
+ public:
+  BlobResolvingVisitor(
+      EntryVisitor& delegate,
+      const logger::ByteRingBuffer* arena);
+
+  virtual void visit(const StandardEntry& entry) override;
+  virtual void visit(const FramesEntry& entry) override;
+  virtual void visit(const BytesEntry& entry) override;
+
+ private:
+  void lost(const BytesEntry& reference);
+
+  EntryVisitor& delegate_;
+  const logger::ByteRingBuffer* arena_;
+  // Reused across blobs.
+  std::vector<char> blob_;
+};
+
+} // namespace writer
+} // namespace profilo
+} // namespace facebook
@@ -0,0 +1,168 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <writer/ColumnarEntryVisitor.h>
+
+#include <cstring>
+
+namespace facebook {
+namespace profilo {
+namespace writer {
+
+namespace {
+
+inline void putVarint(std::vector<uint8_t>& out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<uint8_t>(value) | 0x80);
+    value >>= 7;
+  }
+  out.push_back(static_cast<uint8_t>(value));
+}
+
+inline void putSigned(std::vector<uint8_t>& out, int32_t value) {
+  uint32_t bits = static_cast<uint32_t>(value);
+  putVarint(out, (bits << 1) ^ static_cast<uint32_t>(value >> 31));
+}
+
+inline void putSigned(std::vector<uint8_t>& out, int64_t value) {
+  uint64_t bits = static_cast<uint64_t>(value);
+  putVarint(out, (bits << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+inline void writeVarint(std::ostream& stream, uint64_t value) {
+  uint8_t buf[10];
+  size_t len = 0;
+  while (value >= 0x80) {
+    buf[len++] = static_cast<uint8_t>(value) | 0x80;
+    value >>= 7;
+  }
+  buf[len++] = static_cast<uint8_t>(value);
+  stream.write(reinterpret_cast<const char*>(buf), len);
+}
+
+} // namespace
+
+ColumnarEntryVisitor::ColumnarEntryVisitor(std::ostream& stream)
+    : stream_(stream),
+      columns_(),
+      rows_(0),
+      new_types_(),
+      new_type_count_(0),
+      known_types_() {}
+
+void ColumnarEntryVisitor::addRow(EntryType type, bool is_bytes) {
+  auto type_id = static_cast<uint32_t>(type);
+  if (type_id >= known_types_.size()) {
+    known_types_.resize(type_id + 1);
+  }
+  if (!known_types_[type_id]) {
+    const char* name = entries::to_string(type);
+    size_t len = strlen(name);
+    putVarint(new_types_, type_id);
+    putVarint(new_types_, len);
+    new_types_.insert(new_types_.end(), name, name + len);
+    ++new_type_count_;
+    known_types_[type_id] = true;
+  }
+
+  putVarint(columns_[KIND], (type_id << 1) | (is_bytes ? 1 : 0));
+  ++rows_;
+}
+
+void ColumnarEntryVisitor::writeStandardRow(
+    int32_t id,
+    int64_t timestamp,
+    int32_t tid,
+    int32_t callid,
+    int32_t matchid,
+    int64_t extra) {
+  putSigned(columns_[ID], id);
+  putSigned(columns_[TIMESTAMP], timestamp);
+  putSigned(columns_[TID], tid);
+  putSigned(columns_[CALLID], callid);
+  putSigned(columns_[MATCHID], matchid);
+  putSigned(columns_[EXTRA], extra);
+
+  if (rows_ >= kBlockRows) {
+    flush();
+  }
+}
+
+void ColumnarEntryVisitor::visit(const StandardEntry& data) {
+  addRow(static_cast<EntryType>(data.type), false);
+  writeStandardRow(
+      data.id,
+      data.timestamp,
+      data.tid,
+      data.callid,
+      data.matchid,
+      data.extra);
+}
+
+void ColumnarEntryVisitor::visit(const FramesEntry& data) {
+  // One row per frame with an unused callid, like PrintEntryVisitor.
+  for (size_t idx = 0; idx < data.frames.size; ++idx) {
+    addRow(static_cast<EntryType>(data.type), false);
+    writeStandardRow(
+        data.id,
+        data.timestamp,
+        data.tid,
+        0,
+        data.matchid,
+        data.frames.values[idx]);
+  }
+}
+
+void ColumnarEntryVisitor::visit(const BytesEntry& data) {
+  addRow(static_cast<EntryType>(data.type), true);
+  putSigned(columns_[ID], data.id);
+  putSigned(columns_[MATCHID], data.matchid);
+  putVarint(columns_[BYTES], data.bytes.size);
+  columns_[BYTES].insert(
+      columns_[BYTES].end(),
+      data.bytes.values,
+      data.bytes.values + data.bytes.size);
+
+  if (rows_ >= kBlockRows) {
+    flush();
+  }
+}
+
+void ColumnarEntryVisitor::flush() {
+  if (rows_ == 0) {
+    return;
+  }
+
+  writeVarint(stream_, rows_);
+  writeVarint(stream_, new_type_count_);
+  stream_.write(
+      reinterpret_cast<const char*>(new_types_.data()), new_types_.size());
+
+  for (auto& column : columns_) {
+    writeVarint(stream_, column.size());
+    stream_.write(reinterpret_cast<const char*>(column.data()), column.size());
+    // Keeps the capacity for the next block.
+    column.clear();
+  }
+
+  rows_ = 0;
+  new_types_.clear();
+  new_type_count_ = 0;
+}
+
+} // namespace writer
+} // namespace profilo
+} // namespace facebook
@@ -0,0 +1,99 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <ostream>
+#include <vector>
+
+#include <generated/EntryParser.h>
+
+namespace facebook {
+namespace profilo {
+namespace writer {
+
+using namespace entries;
+
+//
+// Binary, block-based alternative to PrintEntryVisitor. Entries are
+// accumulated column by column and written out in blocks:
+//
+//   block   := varint(rows) varint(new_types) (varint(type) varint(len) name)*
+//              column{8}
+//   column  := varint(byte_length) byte{byte_length}
+//
+// The columns, in order, are kind, id, timestamp, tid, callid, matchid, extra
+// and bytes. kind holds (type << 1 | is_bytes_entry) for every row. Rows of
+// standard and frames entries have a value in each numeric column, rows of
+// bytes entries only in id, matchid and bytes (varint length, then the data).
+// Numeric values are zigzag varints. Meant to sit below DeltaEncodingVisitor,
+// so they are mostly small deltas. Type names are sent in the block that first
+// uses them.
+//
+class ColumnarEntryVisitor final : public EntryVisitor {
+ public:
+  static constexpr size_t kBlockRows = 4096;
+
+  ColumnarEntryVisitor() = delete;
+  ColumnarEntryVisitor(const ColumnarEntryVisitor&) = delete;
+
+  virtual ~ColumnarEntryVisitor() = default;
+
+  explicit ColumnarEntryVisitor(std::ostream& stream);
+
+  virtual void visit(const StandardEntry& data);
+  virtual void visit(const FramesEntry& data);
+  virtual void visit(const BytesEntry& data);
+
+  //
+  // Writes out the pending rows as a block. Must be called before the
+  // stream is closed.
+  //
+  void flush();
+
+ private:
+  enum Column {
+    KIND = 0,
+    ID,
+    TIMESTAMP,
+    TID,
+    CALLID,
+    MATCHID,
+    EXTRA,
+    BYTES,
+    COLUMN_COUNT,
+  };
+
+  std::ostream& stream_;
+  std::vector<uint8_t> columns_[COLUMN_COUNT];
+  size_t rows_;
+  std::vector<uint8_t> new_types_;
+  size_t new_type_count_;
+  std::vector<bool> known_types_;
+
+  void addRow(EntryType type, bool is_bytes);
+  void writeStandardRow(
+      int32_t id,
+      int64_t timestamp,
+      int32_t tid,
+      int32_t callid,
+      int32_t matchid,
+      int64_t extra);
+};
+
+} // namespace writer
+} // namespace profilo
+} // namespace facebook
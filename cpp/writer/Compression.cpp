@@ -0,0 +1,74 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <writer/Compression.h>
+
+#include <zlib.h>
+#include <zstr/src/zstr.hpp>
+
+#include <stdexcept>
+
+namespace facebook {
+namespace profilo {
+namespace writer {
+
+namespace {
+
+constexpr size_t kBufferSize = 512 * 1024;
+constexpr int kDefaultZlibLevel = 3;
+
+int levelOr(CompressionConfig const& config, int default_level) {
+  return config.level == CompressionConfig::kDefaultLevel ? default_level
+                                                          : config.level;
+}
+
+} // namespace
+
+const char* getCompressionCodecName(CompressionCodec codec) {
+  switch (codec) {
+    case CompressionCodec::NONE:
+      return "none";
+    case CompressionCodec::ZLIB:
+      return "zlib";
+  }
+  throw std::invalid_argument("Unknown compression codec");
+}
+
+CompressionCodec parseCompressionCodec(std::string const& name) {
+  for (auto codec : {CompressionCodec::NONE, CompressionCodec::ZLIB}) {
+    if (name == getCompressionCodecName(codec)) {
+      return codec;
+    }
+  }
+  throw std::invalid_argument("Unknown compression codec: " + name);
+}
+
+std::unique_ptr<std::streambuf> makeCompressingStreambuf(
+    std::streambuf* sink,
+    CompressionConfig const& config) {
+  switch (config.codec) {
+    case CompressionCodec::NONE:
+      return nullptr;
+    case CompressionCodec::ZLIB:
+      return std::make_unique<zstr::ostreambuf>(
+          sink, kBufferSize, levelOr(config, kDefaultZlibLevel));
+  }
+  throw std::invalid_argument("Unknown compression codec");
+}
+
+} // namespace writer
+} // namespace profilo
+} // namespace facebook
@@ -0,0 +1,62 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <memory>
+#include <streambuf>
+#include <string>
+
+namespace facebook {
+namespace profilo {
+namespace writer {
+
+//
+// Codecs trace files can be written with. Only zlib (gzip framing) is
+// supported: the builds link zlib alone, zstd and LZ4 are not available.
+//
+enum class CompressionCodec {
+  NONE,
+  ZLIB,
+};
+
+struct CompressionConfig {
+  // Lets each codec pick its own default level.
+  static constexpr int kDefaultLevel = -1;
+
+  CompressionCodec codec = CompressionCodec::ZLIB;
+  int level = kDefaultLevel;
+};
+
+const char* getCompressionCodecName(CompressionCodec codec);
+
+// Accepts "none" and "zlib". Throws std::invalid_argument for any other
+// name, including "zstd" and "lz4".
+CompressionCodec parseCompressionCodec(std::string const& name);
+
+//
+// Returns a streambuf that compresses everything written to it into `sink`,
+// or nullptr for CompressionCodec::NONE, in which case the caller should
+// write to `sink` directly. Every sync() completes the current gzip member,
+// the output is a valid gzip stream either way.
+//
+std::unique_ptr<std::streambuf> makeCompressingStreambuf(
+    std::streambuf* sink,
+    CompressionConfig const& config);
+
+} // namespace writer
+} // namespace profilo
+} // namespace facebook
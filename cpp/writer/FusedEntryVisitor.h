@@ -0,0 +1,133 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdexcept>
+
+// Needed for MAX_STACK_DEPTH
+#include <profiler/Constants.h>
+
+#include <generated/EntryParser.h>
+#include <writer/TimestampTruncatingVisitor.h>
+
+namespace facebook {
+namespace profilo {
+namespace writer {
+
+using namespace entries;
+
+//
+// The standard writer chain in a single pass:
+//
+//   StackTraceInvertingVisitor -> TimestampTruncatingVisitor
+//     -> DeltaEncodingVisitor -> Output
+//
+// Frames are read back to front instead of being copied in reverse, and
+// every entry is truncated and delta encoded in one step before being handed
+// to the output. Output is a concrete visitor type (PrintEntryVisitor,
+// ColumnarEntryVisitor), so the calls into it are not virtual. The output is
+// identical to the chain's.
+//
+// The individual visitors are still what to use when a custom delegate needs
+// to sit somewhere in the middle of the chain.
+//
+template <class Output>
+class FusedEntryVisitor : public EntryVisitor {
+ public:
+  explicit FusedEntryVisitor(Output& output) : output_(output), last_values_() {}
+
+  virtual void visit(const StandardEntry& entry) override {
+    auto timestamp = TimestampTruncatingVisitor::truncate(entry.timestamp);
+    StandardEntry encoded{
+        .id = entry.id - last_values_.id,
+        .type = entry.type,
+        .timestamp = timestamp - last_values_.timestamp,
+        .tid = entry.tid - last_values_.tid,
+        .callid = entry.callid - last_values_.callid,
+        .matchid = entry.matchid - last_values_.matchid,
+        .extra = entry.extra - last_values_.extra,
+    };
+
+    last_values_ = {
+        .id = entry.id,
+        .timestamp = timestamp,
+        .tid = entry.tid,
+        .callid = entry.callid,
+        .matchid = entry.matchid,
+        .extra = entry.extra,
+    };
+
+    output_.visit(encoded);
+  }
+
+  virtual void visit(const FramesEntry& entry) override {
+    if (entry.frames.size > MAX_STACK_DEPTH) {
+      throw std::invalid_argument("entry.frames.size > MAX_STACK_DEPTH");
+    }
+
+    auto timestamp = TimestampTruncatingVisitor::truncate(entry.timestamp);
+    int64_t frame[1];
+    FramesEntry encoded{
+        .id = 0,
+        .type = entry.type,
+        .timestamp = 0,
+        .tid = 0,
+        .matchid = 0,
+        .frames = {.values = frame, .size = 1}};
+
+    // Top frame first, one entry per frame.
+    for (int32_t idx = 0; idx < entry.frames.size; ++idx) {
+      int64_t current_frame = entry.frames.values[entry.frames.size - 1 - idx];
+
+      encoded.id = entry.id - last_values_.id + idx;
+      encoded.timestamp = timestamp - last_values_.timestamp;
+      encoded.tid = entry.tid - last_values_.tid;
+      encoded.matchid = entry.matchid - last_values_.matchid;
+      frame[0] = current_frame - last_values_.extra;
+
+      // FramesEntries don't use callid, it keeps whatever it was before.
+      last_values_.id = entry.id + idx;
+      last_values_.timestamp = timestamp;
+      last_values_.tid = entry.tid;
+      last_values_.matchid = entry.matchid;
+      last_values_.extra = current_frame;
+
+      output_.visit(encoded);
+    }
+  }
+
+  virtual void visit(const BytesEntry& entry) override {
+    // BytesEntry is neither truncated nor delta-encoded
+    output_.visit(entry);
+  }
+
+ private:
+  Output& output_;
+
+  struct {
+    int32_t id;
+    int64_t timestamp;
+    int32_t tid;
+    int32_t callid;
+    int32_t matchid;
+    int64_t extra;
+  } last_values_;
+};
+
+} // namespace writer
+} // namespace profilo
+} // namespace facebook
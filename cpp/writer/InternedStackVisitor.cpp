@@ -0,0 +1,103 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <writer/InternedStackVisitor.h>
+
+namespace facebook {
+namespace profilo {
+namespace writer {
+
+InternedStackVisitor::InternedStackVisitor(EntryVisitor& delegate)
+    : delegate_(delegate), definitions_(), pending_() {}
+
+void InternedStackVisitor::define(int32_t stack_id, const FramesEntry& entry) {
+  auto& stack = definitions_[stack_id];
+  stack.type = entry.type;
+  stack.frames.assign(
+      entry.frames.values, entry.frames.values + entry.frames.size);
+}
+
+void InternedStackVisitor::visit(const StandardEntry& entry) {
+  if (!isStackSample(entry) || entry.matchid == 0) {
+    delegate_.visit(entry);
+    return;
+  }
+
+  StandardEntry sample(entry);
+  sample.matchid = 0;
+  delegate_.visit(sample);
+
+  if (entry.matchid > 0) {
+    pending_[entry.tid] = PendingSample{
+        .timestamp = entry.timestamp,
+        .stack_id = entry.matchid,
+    };
+    return;
+  }
+
+  auto definition = definitions_.find(-entry.matchid);
+  if (definition == definitions_.end()) {
+    // Defined in a part of the buffer that was overwritten, mark the sample
+    // so it doesn't pass for one without frames.
+    delegate_.visit(StandardEntry{
+        .id = 0,
+        .type = EntryType::STKERR_UNRESOLVED_STACK,
+        .timestamp = entry.timestamp,
+        .tid = entry.tid,
+        .callid = -entry.matchid,
+        .matchid = entry.id,
+        .extra = 0,
+    });
+    return;
+  }
+  auto& stack = definition->second;
+  delegate_.visit(FramesEntry{
+      .id = 0,
+      .type = stack.type,
+      .timestamp = entry.timestamp,
+      .tid = entry.tid,
+      .matchid = 0,
+      .frames =
+          {
+              .values = stack.frames.data(),
+              .size = static_cast<uint16_t>(stack.frames.size()),
+          },
+  });
+}
+
+void InternedStackVisitor::visit(const FramesEntry& entry) {
+  if (entry.matchid > 0) {
+    // A definition visited up front.
+    define(entry.matchid, entry);
+    return;
+  }
+  delegate_.visit(entry);
+
+  auto sample = pending_.find(entry.tid);
+  if (sample != pending_.end() &&
+      sample->second.timestamp == entry.timestamp) {
+    define(sample->second.stack_id, entry);
+    pending_.erase(sample);
+  }
+}
+
+void InternedStackVisitor::visit(const BytesEntry& entry) {
+  delegate_.visit(entry);
+}
+
+} // namespace writer
+} // namespace profilo
+} // namespace facebook
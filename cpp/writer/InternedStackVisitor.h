@@ -0,0 +1,81 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include <generated/EntryParser.h>
+
+namespace facebook {
+namespace profilo {
+namespace writer {
+
+using namespace entries;
+
+//
+// Turns the stacks deduplicated by the sampling profiler's StackTable back
+// into frames entries, so that traces read the same with or without it. A
+// CPU_STACK_SAMPLE or WALL_STACK_SAMPLE with a matchid of -(stack id) is
+// passed on with a matchid of 0 and followed by the frames of the stack.
+//
+// A stack is defined by a sample with a matchid of (stack id) followed by
+// the frames entry of the same thread and timestamp, which are passed on as
+// they are. Walking backwards, traceBackwards() visits the definitions up
+// front instead, as frames entries with a matchid of (stack id), which are
+// dropped.
+//
+// A sample whose definition isn't in the buffer anymore is followed by a
+// STKERR_UNRESOLVED_STACK entry instead of its frames, with the stack id as
+// callid and the sample's id as matchid.
+//
+class InternedStackVisitor : public EntryVisitor {
+ public:
+  explicit InternedStackVisitor(EntryVisitor& delegate);
+
+  virtual void visit(const StandardEntry& entry) override;
+  virtual void visit(const FramesEntry& entry) override;
+  virtual void visit(const BytesEntry& entry) override;
+
+  static bool isStackSample(const StandardEntry& entry) {
+    return entry.type == EntryType::CPU_STACK_SAMPLE ||
+        entry.type == EntryType::WALL_STACK_SAMPLE;
+  }
+
+ private:
+  struct Stack {
+    EntryType type;
+    std::vector<int64_t> frames;
+  };
+
+  // A defining sample whose frames come next.
+  struct PendingSample {
+    int64_t timestamp;
+    int32_t stack_id;
+  };
+
+  void define(int32_t stack_id, const FramesEntry& entry);
+
+  EntryVisitor& delegate_;
+  std::unordered_map<int32_t, Stack> definitions_;
+  // By thread.
+  std::unordered_map<int32_t, PendingSample> pending_;
+};
+
+} // namespace writer
+} // namespace profilo
+} // namespace facebook
@@ -0,0 +1,80 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <writer/InternedStringVisitor.h>
+
+namespace facebook {
+namespace profilo {
+namespace writer {
+
+InternedStringVisitor::InternedStringVisitor(
+    EntryVisitor& delegate,
+    const logger::StringTable* strings)
+    : delegate_(delegate), strings_(strings), definitions_() {}
+
+void InternedStringVisitor::visit(const StandardEntry& entry) {
+  if (entry.type != EntryType::MARK_PUSH || entry.matchid >= 0) {
+    delegate_.visit(entry);
+    return;
+  }
+
+  int32_t string_id = -entry.matchid;
+  StandardEntry named(entry);
+  named.matchid = 0;
+  delegate_.visit(named);
+
+  const char* name = nullptr;
+  size_t length = 0;
+  auto definition = definitions_.find(string_id);
+  if (definition != definitions_.end()) {
+    name = definition->second.data();
+    length = definition->second.size();
+  } else if (strings_ != nullptr) {
+    name = strings_->lookup(string_id, length);
+  }
+  if (name == nullptr) {
+    // Defined in a part of the buffer that was overwritten.
+    return;
+  }
+
+  delegate_.visit(BytesEntry{
+      .id = 0,
+      .type = EntryType::STRING_NAME,
+      .matchid = entry.id,
+      .bytes =
+          {
+              .values = reinterpret_cast<const uint8_t*>(name),
+              .size = static_cast<uint16_t>(length),
+          },
+  });
+}
+
+void InternedStringVisitor::visit(const FramesEntry& entry) {
+  delegate_.visit(entry);
+}
+
+void InternedStringVisitor::visit(const BytesEntry& entry) {
+  if (entry.type != EntryType::STRING_DEFINITION) {
+    delegate_.visit(entry);
+    return;
+  }
+  definitions_[entry.matchid].assign(
+      reinterpret_cast<const char*>(entry.bytes.values), entry.bytes.size);
+}
+
+} // namespace writer
+} // namespace profilo
+} // namespace facebook
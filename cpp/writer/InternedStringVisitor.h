@@ -0,0 +1,61 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+
+#include <generated/EntryParser.h>
+#include <logger/StringTable.h>
+
+namespace facebook {
+namespace profilo {
+namespace writer {
+
+using namespace entries;
+
+//
+// Turns the names interned by MultiBufferLogger::writeNamed back into
+// STRING_NAME entries, so that traces read the same with or without
+// interning. STRING_DEFINITION entries are dropped, a MARK_PUSH with a
+// matchid of -(string id) is passed on with a matchid of 0 and followed by
+// a STRING_NAME entry.
+//
+// Names are looked up in the definitions visited so far, then in
+// `strings` if set. Only the table of the process that wrote the buffer may
+// be passed in. It knows every name, including ones defined before the
+// trace start or, walking backwards, defined after their use.
+//
+class InternedStringVisitor : public EntryVisitor {
+ public:
+  InternedStringVisitor(
+      EntryVisitor& delegate,
+      const logger::StringTable* strings = nullptr);
+
+  virtual void visit(const StandardEntry& entry) override;
+  virtual void visit(const FramesEntry& entry) override;
+  virtual void visit(const BytesEntry& entry) override;
+
+ private:
+  EntryVisitor& delegate_;
+  const logger::StringTable* strings_;
+  std::unordered_map<int32_t, std::string> definitions_;
+};
+
+} // namespace writer
+} // namespace profilo
+} // namespace facebook
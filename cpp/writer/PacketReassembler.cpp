@@ -17,18 +17,104 @@
 #include "PacketReassembler.h"
 
 #include <algorithm>
+#include <cstring>
+#include <stdexcept>
 
 namespace facebook {
 namespace profilo {
 namespace writer {
 
 using detail::PacketStream;
+using detail::StreamTable;
+
+namespace detail {
+
+StreamTable::StreamTable(uint32_t capacity)
+    : slots_(), mask_(0), size_(0), capacity_(capacity) {
+  // Keep the load factor at or below 1/2.
+  uint32_t slot_count = 1;
+  while (slot_count < capacity * 2) {
+    slot_count <<= 1;
+  }
+  slots_.resize(slot_count, Slot{.stream = 0, .index = kNotFound});
+  mask_ = slot_count - 1;
+}
+
+uint32_t StreamTable::find(StreamID stream) const {
+  for (uint32_t pos = home(stream);; pos = (pos + 1) & mask_) {
+    auto& slot = slots_[pos];
+    if (slot.index == kNotFound) {
+      return kNotFound;
+    }
+    if (slot.stream == stream) {
+      return slot.index;
+    }
+  }
+}
+
+void StreamTable::insert(StreamID stream, uint32_t index) {
+  uint32_t pos = home(stream);
+  while (slots_[pos].index != kNotFound) {
+    pos = (pos + 1) & mask_;
+  }
+  slots_[pos] = Slot{.stream = stream, .index = index};
+  ++size_;
+}
+
+void StreamTable::erase(StreamID stream) {
+  uint32_t pos = home(stream);
+  while (true) {
+    if (slots_[pos].index == kNotFound) {
+      return;
+    }
+    if (slots_[pos].stream == stream) {
+      break;
+    }
+    pos = (pos + 1) & mask_;
+  }
+
+  // Shift back the following entries of the cluster that would no longer be
+  // reachable from their home slot through the hole at `pos`.
+  uint32_t hole = pos;
+  for (uint32_t next = (hole + 1) & mask_; slots_[next].index != kNotFound;
+       next = (next + 1) & mask_) {
+    uint32_t next_home = home(slots_[next].stream);
+    bool reachable = ((next - next_home) & mask_) < ((next - hole) & mask_);
+    if (!reachable) {
+      slots_[hole] = slots_[next];
+      hole = next;
+    }
+  }
+  slots_[hole].index = kNotFound;
+  --size_;
+}
+
+void StreamTable::clear() {
+  for (auto& slot : slots_) {
+    slot.index = kNotFound;
+  }
+  size_ = 0;
+}
+
+} // namespace detail
 
 PacketReassembler::PacketReassembler(
-    PacketReassembler::PayloadCallback callback)
-    : active_streams_(),
-      pooled_streams_(kStreamPoolSize),
-      callback_(std::move(callback)) {}
+    PacketReassembler::PayloadCallback callback,
+    uint32_t max_active_streams)
+    : streams_(max_active_streams + 1),
+      free_streams_(),
+      current_stream_(kNoStream),
+      active_streams_(max_active_streams),
+      next_age_(0),
+      callback_(std::move(callback)) {
+  if (max_active_streams == 0) {
+    throw std::invalid_argument("max_active_streams is 0");
+  }
+  free_streams_.reserve(streams_.size());
+  for (uint32_t idx = streams_.size(); idx > 0; --idx) {
+    free_streams_.push_back(idx - 1);
+  }
+}
 
 namespace {
 
@@ -53,112 +139,175 @@ inline void appendToStreamReverse(PacketStream& stream, Packet const& packet) {
 
 } // anonymous namespace
 
-PacketStream PacketReassembler::newStream() {
-  if (!pooled_streams_.empty()) {
-    // Take a pooled stream and remove the moved-from instance.
-    PacketStream stream = std::move(*pooled_streams_.begin());
-    pooled_streams_.pop_front();
-    return stream;
-  } else {
-    // No pooled stream to use, make a new one.
-    return PacketStream{};
+void PacketReassembler::reset() {
+  current_stream_ = kNoStream;
+  active_streams_.clear();
+  free_streams_.clear();
+  for (uint32_t idx = streams_.size(); idx > 0; --idx) {
+    free_streams_.push_back(idx - 1);
   }
 }
 
-void PacketReassembler::recycleStream(PacketStream stream) {
-  // Return to pool, if necessary. Otherwise, release via RAII.
-  if (pooled_streams_.size() < kStreamPoolSize) {
-    // Changes the `size` to 0 but the `capacity` will not be affected.
-    stream.data.resize(0);
-    pooled_streams_.push_back(std::move(stream));
+uint32_t PacketReassembler::allocateStream() {
+  // The pool holds one stream more than the table, the current one.
+  uint32_t index = free_streams_.back();
+  free_streams_.pop_back();
+  return index;
+}
+
+void PacketReassembler::evictOldestStream() {
+  // Only reached when max_active_streams streams are interleaved at once,
+  // i.e. when the buffer holds streams that will never complete.
+  uint32_t oldest = kNoStream;
+  for (uint32_t idx = 0; idx < streams_.size(); ++idx) {
+    if (idx == current_stream_ ||
+        active_streams_.find(streams_[idx].stream) != idx) {
+      continue;
+    }
+    if (oldest == kNoStream || streams_[idx].age < streams_[oldest].age) {
+      oldest = idx;
+    }
+  }
+  active_streams_.erase(streams_[oldest].stream);
+  free_streams_.push_back(oldest);
+}
+
+void PacketReassembler::startCurrentStream(StreamID stream) {
+  if (current_stream_ != kNoStream) {
+    // Interleaved with another stream, keep collecting it on the side.
+    if (active_streams_.size() == active_streams_.capacity()) {
+      evictOldestStream();
+    }
+    active_streams_.insert(streams_[current_stream_].stream, current_stream_);
+  }
+
+  current_stream_ = allocateStream();
+  auto& current = streams_[current_stream_];
+  current.stream = stream;
+  current.age = next_age_++;
+  // Changes the `size` to 0 but the `capacity` will not be affected.
+  current.data.resize(0);
+}
+
+void PacketReassembler::finishStream(uint32_t index) {
+  // Returned to the pool first so that a throwing callback can't leak it.
+  // Its data is only cleared once it's handed out again.
+  free_streams_.push_back(index);
+  auto& stream = streams_[index];
+  callback_(stream.data.data(), stream.data.size());
+}
+
+void PacketReassembler::dropCurrentStream() {
+  if (current_stream_ != kNoStream) {
+    free_streams_.push_back(current_stream_);
+    current_stream_ = kNoStream;
   }
 }
 
 void PacketReassembler::process(Packet const& packet) {
   //
-  // Collect packets into active_streams_, inside PacketStream objects.
-  //
-  // Last packet within the stream flushes to the callback.
-  // The PacketStream object can then be moved to pooled_stream_ for reuse.
+  // Fast path: the packets of an entry are written to a contiguous range,
+  // so a packet is either a whole entry or continues the current stream.
   //
+  if (packet.start && !packet.next) {
+    callback_(packet.data, packet.size);
+    return;
+  }
 
-  // Is this part of an existing stream?
-  if (active_streams_.size() > 0) {
-    for (auto it = active_streams_.begin(), end = active_streams_.end();
-         it != end;
-         ++it) {
-      auto& stream = *it;
+  if (packet.isTombstone()) {
+    // A dropped write. Entries are written to contiguous ranges, so it most
+    // likely took a packet out of the current stream.
+    dropCurrentStream();
+    return;
+  }
 
-      if (stream.stream == packet.stream) {
-        appendToStream(stream, packet);
+  if (current_stream_ != kNoStream &&
+      streams_[current_stream_].stream == packet.stream) {
+    appendToStream(streams_[current_stream_], packet);
+    if (!packet.next) {
+      auto index = current_stream_;
+      current_stream_ = kNoStream;
+      finishStream(index);
+    }
+    return;
+  }
 
-        if (!packet.next) {
-          // Flush the stream
-          callback_(stream.data.data(), stream.data.size());
+  if (packet.start) {
+    startCurrentStream(packet.stream);
+    appendToStream(streams_[current_stream_], packet);
+    return;
+  }
 
-          PacketStream temp_stream = std::move(*it);
-          active_streams_.erase(it); // remove moved-from instance
+  //
+  // Is this part of an interleaved stream?
+  // Last packet within the stream flushes to the callback and the stream
+  // goes back to the pool.
+  //
+  auto index = active_streams_.find(packet.stream);
+  if (index != kNoStream) {
+    appendToStream(streams_[index], packet);
 
-          recycleStream(std::move(temp_stream));
-        }
-        return; // packet is handled
-      }
+    if (!packet.next) {
+      active_streams_.erase(packet.stream);
+      finishStream(index);
     }
   }
 
-  if (packet.start && !packet.next) {
-    callback_(packet.data, packet.size);
-  } else if (packet.start) { // Ignore if we only started from the middle of the
-                             // packet
-    PacketStream stream = newStream();
-    stream.stream = packet.stream;
-    appendToStream(stream, packet);
-    active_streams_.push_front(std::move(stream));
-  }
+  // Ignore if we only started from the middle of the stream.
 }
 
 void PacketReassembler::processBackwards(Packet const& packet) {
   //
-  // Collect packets into active_streams_, inside PacketStream objects.
-  //
-  // Last packet within the stream flushes to the callback.
-  // The PacketStream object can then be moved to pooled_stream_ for reuse.
+  // Fast path: the packets of an entry are written to a contiguous range,
+  // so a packet is either a whole entry or continues the current stream.
   //
+  if (packet.start && !packet.next) {
+    callback_(packet.data, packet.size);
+    return;
+  }
 
-  // Is this part of an existing stream?
-  if (active_streams_.size() > 0) {
-    for (auto it = active_streams_.begin(), end = active_streams_.end();
-         it != end;
-         ++it) {
-      auto& stream = *it;
+  if (packet.isTombstone()) {
+    dropCurrentStream();
+    return;
+  }
 
-      if (stream.stream == packet.stream) {
-        appendToStreamReverse(stream, packet);
+  if (current_stream_ != kNoStream &&
+      streams_[current_stream_].stream == packet.stream) {
+    auto& current = streams_[current_stream_];
+    appendToStreamReverse(current, packet);
+    if (packet.start) {
+      std::reverse(current.data.begin(), current.data.end());
+      auto index = current_stream_;
+      current_stream_ = kNoStream;
+      finishStream(index);
+    }
+    return;
+  }
 
-        if (packet.start) {
-          // Flush the stream
-          std::reverse(stream.data.begin(), stream.data.end());
-          callback_(stream.data.data(), stream.data.size());
+  if (!packet.next) {
+    startCurrentStream(packet.stream);
+    appendToStreamReverse(streams_[current_stream_], packet);
+    return;
+  }
 
-          PacketStream temp_stream = std::move(*it);
-          active_streams_.erase(it); // remove moved-from instance
+  //
+  // Is this part of an interleaved stream?
+  // Last packet within the stream flushes to the callback and the stream
+  // goes back to the pool.
+  //
+  auto index = active_streams_.find(packet.stream);
+  if (index != kNoStream) {
+    auto& stream = streams_[index];
+    appendToStreamReverse(stream, packet);
 
-          recycleStream(std::move(temp_stream));
-        }
-        return; // packet is handled
-      }
+    if (packet.start) {
+      std::reverse(stream.data.begin(), stream.data.end());
+      active_streams_.erase(packet.stream);
+      finishStream(index);
     }
   }
 
-  if (packet.start && !packet.next) {
-    callback_(packet.data, packet.size);
-  } else if (!packet.next) { // Ignore if we only started from the middle of the
-                             // packet
-    PacketStream stream = newStream();
-    stream.stream = packet.stream;
-    appendToStreamReverse(stream, packet);
-    active_streams_.push_front(std::move(stream));
-  }
+  // Ignore if we only started from the middle of the stream.
 }
 
 } // namespace writer
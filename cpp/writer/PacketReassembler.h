@@ -18,8 +18,9 @@
 
 #include <logger/buffer/Packet.h>
 
+#include <cstdint>
+
 #include <functional>
-#include <list>
 #include <vector>
 
 namespace facebook {
@@ -32,6 +33,9 @@ namespace detail {
 
 struct PacketStream {
   StreamID stream;
+  // Order in which the stream was started, used to evict the oldest
+  // incomplete stream when the table is full.
+  uint64_t age;
   std::vector<char> data;
 
   PacketStream() = default;
@@ -41,26 +45,98 @@ struct PacketStream {
   PacketStream& operator=(PacketStream&& other) = default;
 };
 
+//
+// Fixed-capacity open addressing map from StreamID to an index into the
+// reassembler's stream pool. Uses linear probing and backward shift deletion,
+// so lookups never have to skip over tombstones.
+//
+class StreamTable {
+ public:
+  static constexpr uint32_t kNotFound = UINT32_MAX;
+
+  explicit StreamTable(uint32_t capacity);
+
+  uint32_t find(StreamID stream) const;
+  // The stream must not be in the table and size() must be below capacity.
+  void insert(StreamID stream, uint32_t index);
+  void erase(StreamID stream);
+  void clear();
+
+  uint32_t size() const {
+    return size_;
+  }
+
+  uint32_t capacity() const {
+    return capacity_;
+  }
+
+ private:
+  struct Slot {
+    StreamID stream;
+    uint32_t index; // kNotFound if the slot is empty
+  };
+
+  std::vector<Slot> slots_;
+  uint32_t mask_;
+  uint32_t size_;
+  uint32_t capacity_;
+
+  uint32_t home(StreamID stream) const {
+    // Fibonacci hashing, StreamIDs are sequential.
+    return (stream * 2654435761u) & mask_;
+  }
+};
+
 } // namespace detail
 
 class PacketReassembler {
  public:
   using PayloadCallback = std::function<void(const void*, size_t)>;
 
-  PacketReassembler(PayloadCallback callback);
+  static constexpr uint32_t kDefaultMaxActiveStreams = 256;
+
+  //
+  // max_active_streams: how many interleaved streams can be collected at
+  //                     once. When exceeded, the oldest incomplete stream is
+  //                     dropped.
+  //
+  PacketReassembler(
+      PayloadCallback callback,
+      uint32_t max_active_streams = kDefaultMaxActiveStreams);
+  //
+  // Tombstone packets are skipped, along with the incomplete stream they
+  // interrupt.
+  //
   void process(Packet const& packet);
   void processBackwards(Packet const& packet);
 
+  //
+  // Drops all incomplete streams. For readers that skipped packets, whose
+  // streams could otherwise be completed with unrelated data.
+  //
+  void reset();
+
  private:
-  static constexpr auto kStreamPoolSize = 8;
+  static constexpr uint32_t kNoStream = detail::StreamTable::kNotFound;
 
-  std::list<detail::PacketStream> active_streams_;
-  std::list<detail::PacketStream> pooled_streams_;
+  // All streams live in one contiguous pool, allocated up front. Their data
+  // keeps its capacity across reuse, so steady state processing does not
+  // allocate.
+  std::vector<detail::PacketStream> streams_;
+  std::vector<uint32_t> free_streams_;
+  // Stream that the most recent start packet opened. Writers claim
+  // contiguous ranges, so this is where the next packet almost always goes.
+  uint32_t current_stream_;
+  // Streams that got interleaved with others.
+  detail::StreamTable active_streams_;
+  uint64_t next_age_;
   PayloadCallback callback_;
 
-  detail::PacketStream newStream();
-  void startNewStream(Packet& packet);
-  void recycleStream(detail::PacketStream stream);
+  void startCurrentStream(StreamID stream);
+  void finishStream(uint32_t index);
+  void dropCurrentStream();
+  uint32_t allocateStream();
+  void evictOldestStream();
 };
 
 } // namespace writer
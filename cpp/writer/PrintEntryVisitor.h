@@ -24,7 +24,7 @@ namespace writer {
 
 using namespace entries;
 
-class PrintEntryVisitor : public EntryVisitor {
+class PrintEntryVisitor final : public EntryVisitor {
  public:
   PrintEntryVisitor() = delete;
   PrintEntryVisitor(const PrintEntryVisitor&) = delete;
@@ -0,0 +1,158 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <writer/ShardMergeReader.h>
+
+#include <limits>
+#include <stdexcept>
+
+namespace facebook {
+namespace profilo {
+namespace writer {
+
+namespace {
+
+bool peekTimestamp(const void* data, size_t size, int64_t& timestamp) {
+  switch (entries::peek_type(data, size)) {
+    case entries::StandardEntry::kSerializationType:
+    case entries::StandardEntry::kCompactSerializationType: {
+      entries::StandardEntry entry;
+      entries::StandardEntry::unpack(entry, data, size);
+      timestamp = entry.timestamp;
+      return true;
+    }
+    case entries::FramesEntry::kSerializationType: {
+      entries::FramesEntry entry;
+      entries::FramesEntry::unpack(entry, data, size);
+      timestamp = entry.timestamp;
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+} // namespace
+
+ShardMergeReader::ShardMergeReader(
+    std::vector<TraceBuffer*> shards,
+    std::vector<TraceBuffer::Cursor>& cursors,
+    Direction direction)
+    : shards_(), cursors_(cursors), direction_(direction) {
+  if (shards.size() != cursors.size()) {
+    throw std::invalid_argument("Need exactly one cursor per shard");
+  }
+
+  shards_.reserve(shards.size());
+  for (size_t idx = 0; idx < shards.size(); ++idx) {
+    shards_.push_back(Shard{
+        .buffer = shards[idx],
+        .reassembler = nullptr,
+        .entry = {},
+        .has_entry = false,
+        .exhausted = false,
+        .timestamp = direction == Direction::FORWARD
+            ? std::numeric_limits<int64_t>::min()
+            : std::numeric_limits<int64_t>::max(),
+        .entry_start = cursors[idx],
+    });
+  }
+  // Set up after shards_ stops moving, the callbacks point into it.
+  for (auto& shard : shards_) {
+    Shard* target = &shard;
+    shard.reassembler = std::make_unique<PacketReassembler>(
+        [target](const void* data, size_t size) {
+          auto bytes = static_cast<const char*>(data);
+          target->entry.assign(bytes, bytes + size);
+          target->has_entry = true;
+          peekTimestamp(data, size, target->timestamp);
+        });
+  }
+}
+
+bool ShardMergeReader::fill(size_t idx) {
+  auto& shard = shards_[idx];
+  auto& cursor = cursors_[idx];
+
+  alignas(4) Packet packet;
+  while (!shard.has_entry && !shard.exhausted) {
+    if (!shard.buffer->tryRead(packet, cursor)) {
+      if (direction_ == Direction::BACKWARD) {
+        shard.exhausted = true;
+        break;
+      }
+      // Either not written yet or already overwritten.
+      return cursor.distanceTo(shard.buffer->currentTail()) == 0;
+    }
+
+    if (direction_ == Direction::FORWARD) {
+      shard.reassembler->process(packet);
+      cursor.moveForward();
+    } else {
+      shard.reassembler->processBackwards(packet);
+      if (!cursor.moveBackward()) {
+        shard.exhausted = true;
+      }
+    }
+  }
+  return true;
+}
+
+ShardMergeReader::Status ShardMergeReader::next(
+    entries::EntryVisitor& visitor) {
+  Shard* next = nullptr;
+  size_t next_idx = 0;
+  for (size_t idx = 0; idx < shards_.size(); ++idx) {
+    if (!fill(idx)) {
+      return Status::MISSED;
+    }
+
+    auto& shard = shards_[idx];
+    if (!shard.has_entry) {
+      continue;
+    }
+    if (next == nullptr ||
+        (direction_ == Direction::FORWARD
+             ? shard.timestamp < next->timestamp
+             : shard.timestamp > next->timestamp)) {
+      next = &shard;
+      next_idx = idx;
+    }
+  }
+
+  if (next == nullptr) {
+    return Status::EMPTY;
+  }
+
+  entries::EntryParser::parse(next->entry.data(), next->entry.size(), visitor);
+  next->has_entry = false;
+  next->entry_start = cursors_[next_idx];
+  return Status::ENTRY;
+}
+
+std::vector<TraceBuffer::Cursor> ShardMergeReader::positions() const {
+  std::vector<TraceBuffer::Cursor> positions;
+  positions.reserve(shards_.size());
+  for (size_t idx = 0; idx < shards_.size(); ++idx) {
+    positions.push_back(
+        shards_[idx].has_entry ? shards_[idx].entry_start : cursors_[idx]);
+  }
+  return positions;
+}
+
+} // namespace writer
+} // namespace profilo
+} // namespace facebook
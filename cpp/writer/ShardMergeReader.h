@@ -0,0 +1,100 @@
+/**
+ * Copyright 2004-present, Facebook, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <generated/EntryParser.h>
+#include <logger/buffer/TraceBuffer.h>
+#include <writer/PacketReassembler.h>
+
+namespace facebook {
+namespace profilo {
+namespace writer {
+
+//
+// Reads the shards of a sharded buffer as a single sequence of entries, in
+// timestamp order, by doing a k-way merge over the next entry of each shard.
+//
+// Packets are reassembled per shard, an entry never spans shards. Entries
+// without a timestamp (BytesEntry) sort with the entry read before them from
+// the same shard, which in forward order is the entry they annotate.
+//
+// Shards are never waited on. Reading forward, a shard whose next slot isn't
+// written yet just doesn't take part in the merge until it is, so entries
+// racing the reader can come out of order, as they can with a single ring.
+//
+class ShardMergeReader {
+ public:
+  enum class Direction { FORWARD, BACKWARD };
+
+  enum class Status {
+    ENTRY,
+    // No shard has a complete entry at the moment. Reading backwards, this
+    // is the end of the buffer.
+    EMPTY,
+    // Reading forward, producers lapped the cursor of a shard.
+    MISSED,
+  };
+
+  //
+  // cursors: one per shard, where to start reading. Updated as shards are
+  //          read. Reading backwards, the cursors point at the first packet
+  //          to read and the shards are read towards their tails.
+  //
+  ShardMergeReader(
+      std::vector<TraceBuffer*> shards,
+      std::vector<TraceBuffer::Cursor>& cursors,
+      Direction direction);
+
+  //
+  // Parses the next entry in merged order into the visitor.
+  //
+  Status next(entries::EntryVisitor& visitor);
+
+  //
+  // For each shard, the first position that hasn't been handed to a visitor
+  // yet. While next() is visiting an entry, that's the entry itself.
+  //
+  std::vector<TraceBuffer::Cursor> positions() const;
+
+ private:
+  struct Shard {
+    TraceBuffer* buffer;
+    std::unique_ptr<PacketReassembler> reassembler;
+    std::vector<char> entry;
+    bool has_entry;
+    bool exhausted;
+    int64_t timestamp;
+    // Where the packets of `entry` start.
+    TraceBuffer::Cursor entry_start;
+  };
+
+  std::vector<Shard> shards_;
+  std::vector<TraceBuffer::Cursor>& cursors_;
+  const Direction direction_;
+
+  // Reads the shard until it has a complete entry. Returns false if the
+  // shard was lapped.
+  bool fill(size_t idx);
+};
+
+} // namespace writer
+} // namespace profilo
+} // namespace facebook
@@ -16,6 +16,8 @@
 
 #pragma once
 
+#include <cstdint>
+
 #include <generated/EntryParser.h>
 
 namespace facebook {
@@ -24,6 +26,43 @@ namespace writer {
 
 using namespace entries;
 
+// Multiplication of two 64-bit numbers, keeping only the top 64 bits. This
+// is necessary for the reciprocal multiplication optimization (see below).
+// This could be simplified with __uint128_t, but unfortunately we don't have
+// that type. If somehow/sometime it ever becomes available, we can get rid
+// of this function and perform the multiplication directly.
+inline uint64_t mulhi(uint64_t a, uint64_t b) {
+  uint64_t a_lo = (uint32_t)a;
+  uint64_t a_hi = a >> 32;
+  uint64_t b_lo = (uint32_t)b;
+  uint64_t b_hi = b >> 32;
+
+  uint64_t a_x_b_hi = a_hi * b_hi;
+  uint64_t a_x_b_mid = a_hi * b_lo;
+  uint64_t b_x_a_mid = b_hi * a_lo;
+  uint64_t a_x_b_lo = a_lo * b_lo;
+
+  uint64_t carry_bit = ((uint64_t)(uint32_t)a_x_b_mid +
+                        (uint64_t)(uint32_t)b_x_a_mid + (a_x_b_lo >> 32)) >>
+      32;
+
+  uint64_t multhi =
+      a_x_b_hi + (a_x_b_mid >> 32) + (b_x_a_mid >> 32) + carry_bit;
+
+  return multhi;
+}
+
+// Optimization to divide by 1000.
+// See https://homepage.divms.uiowa.edu/~jones/bcd/divide.html
+// In short, the insight is that it's faster to multiply by the reciprocal
+// of a number than divide by it. In this case, the reciprocal of 1000
+// is 0.001, which in fixed point notation is 0x4189374bc6a7f4 (with a
+// 64 bit shift).
+inline uint64_t div_1000(uint64_t num) {
+  static constexpr uint64_t divisor = 0x4189374bc6a7f4;
+  return mulhi(num, divisor);
+}
+
 class TimestampTruncatingVisitor : public EntryVisitor {
  public:
   //
@@ -38,6 +77,17 @@ class TimestampTruncatingVisitor : public EntryVisitor {
   virtual void visit(const FramesEntry& entry) override;
   virtual void visit(const BytesEntry& entry) override;
 
+  //
+  // Rounds a nanosecond timestamp to the nearest microsecond.
+  //
+  static int64_t truncate(int64_t timestamp) {
+    // This 500 comes from the denominator (1000) divided by 2. The math here
+    // is (a + b/2) / b = (2a + b)/2b = a/b + 1/2 = round(a/b).
+    // The denominator is always 1000 because that's what we use to truncate
+    // ns timestamps into us.
+    return div_1000(timestamp + 500);
+  }
+
  private:
   EntryVisitor& delegate_;
 
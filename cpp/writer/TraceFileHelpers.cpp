@@ -21,15 +21,17 @@
 #include <stdio.h>
 #include <sys/stat.h>
 #include <sys/types.h>
-#include <zlib.h>
-#include <zstr/src/zstr.hpp>
+#include <fstream>
 #include <sstream>
+#include <stdexcept>
 #include <system_error>
 
 namespace facebook {
 namespace profilo {
 namespace writer {
 
+constexpr const char* TraceFileHelpers::kCompressionHeader;
+
 namespace {
 std::string getTraceIDAsString(int64_t trace_id) {
   const char* kBase64Alphabet =
@@ -69,6 +71,25 @@ std::string getTraceFilename(
   return filename.str();
 }
 
+const char* getFormatName(TraceFormat format) {
+  switch (format) {
+    case TraceFormat::TEXT:
+      return "text";
+    case TraceFormat::COLUMNAR:
+      return "columnar";
+  }
+  throw std::invalid_argument("Unknown trace format");
+}
+
+// Owns the compressing streambuf that replaces the file buffer. Members are
+// destroyed before the base class, so the compressor can still flush into
+// the file.
+struct CompressedOfstream : public std::ofstream {
+  using std::ofstream::ofstream;
+
+  std::unique_ptr<std::streambuf> compressor;
+};
+
 std::string sanitize(std::string input) {
   for (size_t idx = 0; idx < input.size(); ++idx) {
     char ch = input[idx];
@@ -86,13 +107,22 @@ std::string sanitize(std::string input) {
 void TraceFileHelpers::writeHeaders(
     std::ostream& output,
     int64_t trace_id,
-    std::vector<std::pair<std::string, std::string>> const& trace_headers) {
+    std::vector<std::pair<std::string, std::string>> const& trace_headers,
+    TraceFormat format,
+    CompressionConfig const& compression) {
   output << "dt\n"
          << "ver|" << kTraceFormatVersion << "\n"
          << "id|" << getTraceIDAsString(trace_id) << "\n"
-         << "prec|" << kTimestampPrecision << "\n";
+         << "prec|" << kTimestampPrecision << "\n"
+         << "fmt|" << getFormatName(format) << "\n"
+         << kCompressionHeader << '|'
+         << getCompressionCodecName(compression.codec) << "\n";
 
   for (auto const& header : trace_headers) {
+    if (header.first == kCompressionHeader) {
+      // Replaced by the resolved codec above.
+      continue;
+    }
     output << header.first << '|' << header.second << '\n';
   }
 
@@ -123,29 +153,48 @@ void TraceFileHelpers::ensureFolder(const std::string& folder) {
   }
 }
 
+CompressionConfig TraceFileHelpers::resolveCompression(
+    CompressionConfig const& defaults,
+    std::vector<std::pair<std::string, std::string>> const& trace_headers) {
+  CompressionConfig config = defaults;
+  for (auto const& header : trace_headers) {
+    if (header.first == kCompressionHeader) {
+      auto codec = parseCompressionCodec(header.second);
+      if (codec != config.codec) {
+        // The configured level was meant for another codec.
+        config.codec = codec;
+        config.level = CompressionConfig::kDefaultLevel;
+      }
+    }
+  }
+  return config;
+}
+
 std::unique_ptr<std::ofstream> TraceFileHelpers::openCompressedStream(
     int64_t trace_id,
     std::string const& trace_folder,
-    std::string const& trace_prefix) {
+    std::string const& trace_prefix,
+    CompressionConfig const& compression) {
   ensureFolder(trace_folder.c_str());
 
   std::string trace_file =
       TraceFileHelpers::getTraceFilePath(trace_id, trace_prefix, trace_folder);
 
-  auto output = std::make_unique<std::ofstream>(
-      trace_file, std::ofstream::out | std::ofstream::binary);
+  auto output = std::make_unique<CompressedOfstream>();
   output->exceptions(std::ofstream::badbit | std::ofstream::failbit);
 
-  zstr::ostreambuf* output_buf = new zstr::ostreambuf(
-      output->rdbuf(), // wrap the ofstream buffer
-      512 * 1024, // input and output buffers
-      3 // compression level
-  );
-
-  // Disable ofstream buffering
-  output->rdbuf()->pubsetbuf(nullptr, 0);
-  // Replace ofstream buffer with the compressed one
-  output->basic_ios<char>::rdbuf(output_buf);
+  output->compressor =
+      makeCompressingStreambuf(output->rdbuf(), compression);
+  if (output->compressor != nullptr) {
+    // Disable ofstream buffering, the compressor buffers already and has to
+    // reach the file when flushed. Only possible before opening the file.
+    output->rdbuf()->pubsetbuf(nullptr, 0);
+  }
+  output->open(trace_file, std::ofstream::out | std::ofstream::binary);
+  if (output->compressor != nullptr) {
+    // Replace ofstream buffer with the compressed one
+    output->basic_ios<char>::rdbuf(output->compressor.get());
+  }
 
   return output;
 }
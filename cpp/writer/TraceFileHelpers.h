@@ -21,24 +21,51 @@
 #include <utility>
 #include <vector>
 
+#include <writer/Compression.h>
+
 namespace facebook {
 namespace profilo {
 namespace writer {
 
+// Encoding of the entries that follow the trace headers.
+enum class TraceFormat {
+  // One pipe-separated line per entry, see PrintEntryVisitor.
+  TEXT,
+  // Blocks of varint columns, see ColumnarEntryVisitor.
+  COLUMNAR,
+};
+
 class TraceFileHelpers {
  public:
   // Timestamp precision is microsec by default.
   static constexpr size_t kTimestampPrecision = 6;
   static constexpr size_t kTraceFormatVersion = 3;
 
+  // Trace header that selects the compression codec of a trace by name,
+  // overriding the writer's configuration. Only "none" and "zlib" are
+  // supported, see CompressionCodec.
+  static constexpr const char* kCompressionHeader = "comp";
+
   static void writeHeaders(
       std::ostream& output,
       int64_t id,
-      std::vector<std::pair<std::string, std::string>> const& trace_headers);
+      std::vector<std::pair<std::string, std::string>> const& trace_headers,
+      TraceFormat format = TraceFormat::TEXT,
+      CompressionConfig const& compression = CompressionConfig());
   static std::unique_ptr<std::ofstream> openCompressedStream(
       int64_t trace_id,
       std::string const& trace_folder,
-      std::string const& trace_prefix);
+      std::string const& trace_prefix,
+      CompressionConfig const& compression = CompressionConfig());
+
+  //
+  // Returns `defaults` with the codec replaced by the one named in the
+  // kCompressionHeader trace header, if any. Throws std::invalid_argument if
+  // the header names a codec other than "none" or "zlib".
+  //
+  static CompressionConfig resolveCompression(
+      CompressionConfig const& defaults,
+      std::vector<std::pair<std::string, std::string>> const& trace_headers);
 
  private:
   static std::string getTraceFilePath(
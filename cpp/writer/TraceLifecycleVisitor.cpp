@@ -19,10 +19,11 @@
 
 #include <system_error>
 
-#include <writer/DeltaEncodingVisitor.h>
+#include <writer/ColumnarEntryVisitor.h>
+#include <writer/FusedEntryVisitor.h>
+#include <writer/InternedStackVisitor.h>
+#include <writer/InternedStringVisitor.h>
 #include <writer/PrintEntryVisitor.h>
-#include <writer/StackTraceInvertingVisitor.h>
-#include <writer/TimestampTruncatingVisitor.h>
 #include <writer/TraceLifecycleVisitor.h>
 
 namespace facebook {
@@ -37,13 +38,21 @@ TraceLifecycleVisitor::TraceLifecycleVisitor(
     std::shared_ptr<TraceCallbacks> callbacks,
     const std::vector<std::pair<std::string, std::string>>& headers,
     int64_t trace_id,
-    std::function<void(TraceLifecycleVisitor& visitor)> trace_backward_callback)
+    std::function<void(TraceLifecycleVisitor& visitor)> trace_backward_callback,
+    TraceFormat format,
+    CompressionConfig compression,
+    const logger::StringTable* strings)
     :
 
       trace_folder_(trace_folder),
       trace_prefix_(trace_prefix),
       trace_headers_(headers),
+      format_(format),
+      compression_(
+          TraceFileHelpers::resolveCompression(compression, headers)),
+      strings_(strings),
       output_(nullptr),
+      columnar_visitor_(nullptr),
       delegates_(),
       expected_trace_(trace_id),
       callbacks_(callbacks),
@@ -132,6 +141,16 @@ void TraceLifecycleVisitor::abort(AbortReason reason) {
   onTraceAbort(expected_trace_, reason);
 }
 
+void TraceLifecycleVisitor::flush() {
+  if (output_ == nullptr) {
+    return;
+  }
+  if (columnar_visitor_ != nullptr) {
+    columnar_visitor_->flush();
+  }
+  output_->flush();
+}
+
 void TraceLifecycleVisitor::onTraceStart(int64_t trace_id, int32_t flags) {
   if (output_ != nullptr) {
     // active trace with same ID, abort
@@ -140,15 +159,29 @@ void TraceLifecycleVisitor::onTraceStart(int64_t trace_id, int32_t flags) {
   }
 
   output_ = TraceFileHelpers::openCompressedStream(
-      trace_id, trace_folder_, trace_prefix_);
-  TraceFileHelpers::writeHeaders(*output_, trace_id, trace_headers_);
-
-  // outputTime = truncate(current) - truncate(prev)
-  delegates_.emplace_back(new PrintEntryVisitor(*output_));
-  delegates_.emplace_back(new DeltaEncodingVisitor(*delegates_.back()));
-  delegates_.emplace_back(new TimestampTruncatingVisitor(
-      *delegates_.back(), TraceFileHelpers::kTimestampPrecision));
-  delegates_.emplace_back(new StackTraceInvertingVisitor(*delegates_.back()));
+      trace_id, trace_folder_, trace_prefix_, compression_);
+  TraceFileHelpers::writeHeaders(
+      *output_, trace_id, trace_headers_, format_, compression_);
+
+  // Inverts stacks and delta encodes with
+  // outputTime = truncate(current) - truncate(prev), in one pass.
+  static_assert(
+      TraceFileHelpers::kTimestampPrecision == 6,
+      "FusedEntryVisitor truncates to microseconds");
+  if (format_ == TraceFormat::COLUMNAR) {
+    columnar_visitor_ = new ColumnarEntryVisitor(*output_);
+    delegates_.emplace_back(columnar_visitor_);
+    delegates_.emplace_back(
+        new FusedEntryVisitor<ColumnarEntryVisitor>(*columnar_visitor_));
+  } else {
+    auto print = new PrintEntryVisitor(*output_);
+    delegates_.emplace_back(print);
+    delegates_.emplace_back(new FusedEntryVisitor<PrintEntryVisitor>(*print));
+  }
+  // Interned names and stacks are expanded before anything else sees them.
+  delegates_.emplace_back(new InternedStackVisitor(*delegates_.back()));
+  delegates_.emplace_back(
+      new InternedStringVisitor(*delegates_.back(), strings_));
 
   if (callbacks_.get() != nullptr) {
     callbacks_->onTraceStart(trace_id, flags);
@@ -175,6 +208,10 @@ void TraceLifecycleVisitor::onTraceEnd(int64_t trace_id) {
 }
 
 void TraceLifecycleVisitor::cleanupState() {
+  if (columnar_visitor_ != nullptr) {
+    columnar_visitor_->flush();
+    columnar_visitor_ = nullptr;
+  }
   delegates_.clear();
   thread_priority_ = nullptr;
   if (output_) {
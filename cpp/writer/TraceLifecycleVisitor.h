@@ -25,7 +25,9 @@
 
 #include <generated/Entry.h>
 #include <generated/EntryParser.h>
+#include <logger/StringTable.h>
 #include <writer/AbortReason.h>
+#include <writer/ColumnarEntryVisitor.h>
 #include <writer/ScopedThreadPriority.h>
 #include <writer/TraceCallbacks.h>
 #include <writer/TraceFileHelpers.h>
@@ -47,7 +49,10 @@ class TraceLifecycleVisitor : public EntryVisitor {
       const std::vector<std::pair<std::string, std::string>>& headers,
       int64_t trace_id,
       std::function<void(TraceLifecycleVisitor& visitor)>
-          trace_backward_callback = nullptr);
+          trace_backward_callback = nullptr,
+      TraceFormat format = TraceFormat::TEXT,
+      CompressionConfig compression = CompressionConfig(),
+      const logger::StringTable* strings = nullptr);
 
   virtual void visit(const StandardEntry& entry) override;
   virtual void visit(const FramesEntry& entry) override;
@@ -55,6 +60,16 @@ class TraceLifecycleVisitor : public EntryVisitor {
 
   void abort(AbortReason reason);
 
+  //
+  // Writes out everything visited so far, leaving a complete compressed
+  // chunk on disk. No-op if the trace hasn't started or is already done.
+  //
+  void flush();
+
+  inline bool started() const {
+    return started_;
+  }
+
   inline bool done() const {
     return done_;
   }
@@ -67,7 +82,13 @@ class TraceLifecycleVisitor : public EntryVisitor {
   const std::string trace_folder_;
   const std::string trace_prefix_;
   const std::vector<std::pair<std::string, std::string>> trace_headers_;
+  const TraceFormat format_;
+  const CompressionConfig compression_;
+  // See InternedStringVisitor.
+  const logger::StringTable* strings_;
   std::unique_ptr<std::ofstream> output_;
+  // Owned by delegates_, set for TraceFormat::COLUMNAR.
+  ColumnarEntryVisitor* columnar_visitor_;
 
   // chain of delegates
   std::deque<std::unique_ptr<EntryVisitor>> delegates_;
@@ -17,51 +17,152 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <chrono>
 #include <ctime>
 #include <memory>
 #include <ostream>
 #include <sstream>
 #include <stdexcept>
 #include <system_error>
+#include <thread>
 #include <unordered_set>
 
 #include <generated/EntryParser.h>
-#include <writer/DeltaEncodingVisitor.h>
+#include <writer/BlobResolvingVisitor.h>
+#include <writer/ColumnarEntryVisitor.h>
+#include <writer/FusedEntryVisitor.h>
+#include <writer/InternedStackVisitor.h>
+#include <writer/InternedStringVisitor.h>
 #include <writer/PacketReassembler.h>
 #include <writer/PrintEntryVisitor.h>
-#include <writer/StackTraceInvertingVisitor.h>
-#include <writer/TimestampTruncatingVisitor.h>
+#include <writer/ShardMergeReader.h>
 #include <writer/TraceLifecycleVisitor.h>
 #include <writer/TraceWriter.h>
 #include <writer/trace_backwards.h>
 
 #include <LogEntry.h>
+#include <util/common.h>
 
 namespace facebook {
 namespace profilo {
 namespace writer {
 
+constexpr size_t TraceWriter::kDefaultMaxPendingTraces;
+
+namespace {
+
+// Where a lapped streaming writer resumes in the readable window. Halfway
+// leaves producers half a buffer to fill before they can lap it again.
+constexpr double kStreamingResyncFraction = 0.5;
+
+// How long to wait for new entries when every shard of a sharded buffer, or
+// a byte ring, has been read up to its head. There's no way to block on
+// several shards, nor on a byte ring.
+constexpr auto kPollInterval = std::chrono::milliseconds(2);
+
+// Packets read from the ring at a time.
+constexpr uint32_t kReadBatchSize = 64;
+
+//
+// Keeps callbacks of traces processed on different threads from running
+// concurrently, implementations don't have to be thread-safe.
+//
+class SerializedTraceCallbacks : public TraceCallbacks {
+ public:
+  explicit SerializedTraceCallbacks(std::shared_ptr<TraceCallbacks> delegate)
+      : mutex_(), delegate_(std::move(delegate)) {}
+
+  void onTraceStart(int64_t trace_id, int32_t flags) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    delegate_->onTraceStart(trace_id, flags);
+  }
+
+  void onTraceEnd(int64_t trace_id) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    delegate_->onTraceEnd(trace_id);
+  }
+
+  void onTraceAbort(int64_t trace_id, AbortReason reason) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    delegate_->onTraceAbort(trace_id, reason);
+  }
+
+ private:
+  std::mutex mutex_;
+  std::shared_ptr<TraceCallbacks> delegate_;
+};
+
+std::shared_ptr<TraceCallbacks> serialize(
+    std::shared_ptr<TraceCallbacks> callbacks) {
+  if (callbacks == nullptr) {
+    return nullptr;
+  }
+  return std::make_shared<SerializedTraceCallbacks>(std::move(callbacks));
+}
+
+//
+// For errors thrown while processing a trace. Only a trace that started and
+// hasn't ended or been aborted yet has callbacks still owed to it.
+//
+void abortUnfinished(TraceLifecycleVisitor& visitor) {
+  if (visitor.started() && !visitor.done()) {
+    visitor.abort(AbortReason::WRITER_EXCEPTION);
+  }
+}
+
+} // namespace
+
 TraceWriter::TraceWriter(
     const std::string&& folder,
     const std::string&& trace_prefix,
     std::shared_ptr<Buffer> buffer,
     std::shared_ptr<TraceCallbacks> callbacks,
     std::vector<std::pair<std::string, std::string>>&& headers,
-    TraceBackwardsCallback trace_backwards_callback)
+    TraceBackwardsCallback trace_backwards_callback,
+    TraceFormat format,
+    CompressionConfig compression,
+    size_t max_pending_traces,
+    StreamingConfig streaming,
+    const logger::StringTable* strings)
     : wakeup_mutex_(),
       wakeup_cv_(),
-      wakeup_trace_id_(nullptr),
+      pending_traces_(),
+      max_pending_traces_(max_pending_traces),
       stop_requested_(false),
       trace_folder_(std::move(folder)),
       trace_prefix_(std::move(trace_prefix)),
       buffer_(std::move(buffer)),
       trace_headers_(std::move(headers)),
-      callbacks_(callbacks),
-      trace_backwards_callback_(trace_backwards_callback) {}
+      format_(format),
+      compression_(
+          TraceFileHelpers::resolveCompression(compression, trace_headers_)),
+      streaming_(std::move(streaming)),
+      strings_(strings),
+      callbacks_(serialize(std::move(callbacks))),
+      trace_backwards_callback_(trace_backwards_callback) {
+  if (max_pending_traces_ == 0) {
+    throw std::invalid_argument("max_pending_traces must be positive");
+  }
+  if (streaming_.enabled && streaming_.chunk_packets == 0) {
+    throw std::invalid_argument("chunk_packets must be positive");
+  }
+  if (streaming_.enabled && buffer_ != nullptr &&
+      (buffer_->shardCount() != 1 ||
+       buffer_->backend() != Buffer::Backend::PACKETS)) {
+    throw std::invalid_argument("streaming needs an unsharded packet buffer");
+  }
+}
 
 int64_t TraceWriter::processTrace(
     int64_t trace_id,
     TraceBuffer::Cursor& cursor) {
+  if (buffer_->shardCount() != 1) {
+    throw std::invalid_argument("Sharded buffers need a cursor per shard");
+  }
+  if (buffer_->backend() == Buffer::Backend::BYTE_RING) {
+    return processByteRingTrace(trace_id, cursor);
+  }
+
   TraceLifecycleVisitor visitor(
       trace_folder_,
       trace_prefix_,
@@ -72,94 +173,273 @@ int64_t TraceWriter::processTrace(
         if (trace_backwards_callback_ == nullptr) {
           return;
         }
-        trace_backwards_callback_(visitor, buffer_->ringBuffer(), cursor);
-      });
+        ShardCursors cursors{cursor};
+        trace_backwards_callback_(visitor, *buffer_, cursors);
+      },
+      format_,
+      compression_,
+      strings_);
 
-  PacketReassembler reassembler([&visitor](const void* data, size_t size) {
-    EntryParser::parse(data, size, visitor);
+  BlobResolvingVisitor resolver(visitor, buffer_->blobArena());
+  PacketReassembler reassembler([&resolver](const void* data, size_t size) {
+    EntryParser::parse(data, size, resolver);
   });
 
-  while (!visitor.done()) {
-    alignas(4) Packet packet;
-    if (!buffer_->ringBuffer().waitAndTryRead(packet, cursor)) {
-      // Missed event, abort.
-      visitor.abort(AbortReason::MISSED_EVENT);
-      break;
+  auto& ring_buffer = buffer_->ringBuffer();
+  uint64_t lost_packets = 0;
+  uint32_t chunk_packets = 0;
+
+  // Packets already written are read ahead a batch at a time, the writer
+  // only waits on the ring once it has caught up with it.
+  alignas(4) Packet packets[kReadBatchSize];
+  uint32_t batch_size = 0;
+  uint32_t batch_pos = 0;
+
+  try {
+    while (!visitor.done()) {
+      if (batch_pos == batch_size) {
+        batch_pos = 0;
+        batch_size = ring_buffer.tryReadRange(packets, cursor, kReadBatchSize);
+        if (batch_size == 0 && ring_buffer.waitAndTryRead(packets[0], cursor)) {
+          batch_size = 1;
+        }
+      }
+      if (batch_size == 0) {
+        if (!streaming_.enabled || !visitor.started()) {
+          // Missed event, abort.
+          visitor.abort(AbortReason::MISSED_EVENT);
+          break;
+        }
+
+        // Lapped by the producers, skip ahead and note the gap.
+        auto resync = ring_buffer.currentTail(kStreamingResyncFraction);
+        auto lost = cursor.distanceTo(resync);
+        lost_packets += lost;
+        cursor = resync;
+        reassembler.reset();
+        visitor.visit(StandardEntry{
+            .id = 0,
+            .type = EntryType::TRACE_PACKETS_LOST,
+            .timestamp = monotonicTime(),
+            .tid = threadID(),
+            .callid = 0,
+            .matchid = 0,
+            .extra = static_cast<int64_t>(lost),
+        });
+        continue;
+      }
+      reassembler.process(packets[batch_pos++]);
+      cursor.moveForward();
+
+      if (streaming_.enabled && !visitor.done() && visitor.started() &&
+          ++chunk_packets == streaming_.chunk_packets) {
+        chunk_packets = 0;
+        visitor.flush();
+        if (streaming_.progress_callback != nullptr) {
+          streaming_.progress_callback(StreamingProgress{
+              .trace_id = trace_id,
+              .lag = cursor.distanceTo(ring_buffer.currentHead()),
+              .lost_packets = lost_packets,
+              .checkpoint = cursor,
+          });
+        }
+      }
     }
-    reassembler.process(packet);
-    cursor.moveForward();
+  } catch (...) {
+    abortUnfinished(visitor);
+    throw;
   }
 
   return visitor.getTraceID();
 }
 
-void TraceWriter::loop() {
-  int64_t trace_id = 0;
-  // dummy call, no default constructor
-  TraceBuffer::Cursor cursor = buffer_->ringBuffer().currentTail();
-  bool stop_requested = false;
+int64_t TraceWriter::processTrace(int64_t trace_id, ShardCursors& cursors) {
+  if (cursors.size() != buffer_->shardCount()) {
+    throw std::invalid_argument("Need exactly one cursor per shard");
+  }
+  if (cursors.size() == 1) {
+    return processTrace(trace_id, cursors.front());
+  }
+  return processShardedTrace(trace_id, cursors);
+}
 
-  {
-    std::unique_lock<std::mutex> lock(wakeup_mutex_);
-    wakeup_cv_.wait(lock, [this, &trace_id, &cursor, &stop_requested] {
-      stop_requested = stop_requested_;
-      bool woken_up = false;
-      if (wakeup_trace_id_) {
-        std::tie(cursor, trace_id) = *wakeup_trace_id_;
-        wakeup_trace_id_ = nullptr;
-        woken_up = true;
+int64_t TraceWriter::processShardedTrace(
+    int64_t trace_id,
+    ShardCursors& cursors) {
+  ShardMergeReader reader(
+      buffer_->shards(), cursors, ShardMergeReader::Direction::FORWARD);
+
+  TraceLifecycleVisitor visitor(
+      trace_folder_,
+      trace_prefix_,
+      callbacks_,
+      trace_headers_,
+      trace_id,
+      [this, &reader](TraceLifecycleVisitor& visitor) {
+        if (trace_backwards_callback_ == nullptr) {
+          return;
+        }
+        auto positions = reader.positions();
+        trace_backwards_callback_(visitor, *buffer_, positions);
+      },
+      format_,
+      compression_,
+      strings_);
+
+  BlobResolvingVisitor resolver(visitor, buffer_->blobArena());
+  try {
+    while (!visitor.done()) {
+      auto status = reader.next(resolver);
+      if (status == ShardMergeReader::Status::MISSED) {
+        // Missed event, abort.
+        visitor.abort(AbortReason::MISSED_EVENT);
+        break;
       }
-      return stop_requested || woken_up;
-    });
+      if (status == ShardMergeReader::Status::EMPTY) {
+        std::this_thread::sleep_for(kPollInterval);
+      }
+    }
+  } catch (...) {
+    abortUnfinished(visitor);
+    throw;
   }
 
-  if (trace_id != 0) {
-    processTrace(trace_id, cursor);
+  return visitor.getTraceID();
+}
+
+int64_t TraceWriter::processByteRingTrace(
+    int64_t trace_id,
+    TraceBuffer::Cursor& cursor) {
+  // Where the record being visited starts, for trace_backwards_callback_.
+  TraceBuffer::Cursor record_start = cursor;
+  TraceLifecycleVisitor visitor(
+      trace_folder_,
+      trace_prefix_,
+      callbacks_,
+      trace_headers_,
+      trace_id,
+      [this, &record_start](TraceLifecycleVisitor& visitor) {
+        if (trace_backwards_callback_ == nullptr) {
+          return;
+        }
+        ShardCursors cursors{record_start};
+        trace_backwards_callback_(visitor, *buffer_, cursors);
+      },
+      format_,
+      compression_,
+      strings_);
+
+  BlobResolvingVisitor resolver(visitor, buffer_->blobArena());
+  auto& byte_ring = buffer_->byteRing();
+  std::vector<char> record;
+  try {
+    while (!visitor.done()) {
+      record_start = cursor;
+      auto result = byte_ring.tryRead(cursor, record);
+      if (result == logger::ByteRingBuffer::ReadResult::LAPPED) {
+        // Missed event, abort.
+        visitor.abort(AbortReason::MISSED_EVENT);
+        break;
+      }
+      if (result == logger::ByteRingBuffer::ReadResult::NOT_READY) {
+        std::this_thread::sleep_for(kPollInterval);
+        continue;
+      }
+      EntryParser::parse(record.data(), record.size(), resolver);
+    }
+  } catch (...) {
+    abortUnfinished(visitor);
+    throw;
+  }
+
+  return visitor.getTraceID();
+}
+
+void TraceWriter::loop() {
+  std::unique_lock<std::mutex> lock(wakeup_mutex_);
+  wakeup_cv_.wait(
+      lock, [this] { return stop_requested_ || !pending_traces_.empty(); });
+
+  while (!stop_requested_ && !pending_traces_.empty()) {
+    auto pending = pending_traces_.front();
+    pending_traces_.pop_front();
+
+    lock.unlock();
+    processTrace(pending.second, pending.first);
+    lock.lock();
   }
 }
 
 void TraceWriter::dump(int64_t trace_id) {
   auto output = TraceFileHelpers::openCompressedStream(
-      trace_id, trace_folder_, trace_prefix_);
-  TraceFileHelpers::writeHeaders(*output, trace_id, trace_headers_);
+      trace_id, trace_folder_, trace_prefix_, compression_);
+  TraceFileHelpers::writeHeaders(
+      *output, trace_id, trace_headers_, format_, compression_);
 
-  auto printVisitor = std::make_unique<PrintEntryVisitor>(*output);
-  auto deltaVisitor = std::make_unique<DeltaEncodingVisitor>(*printVisitor);
-  auto timestampVisitor = std::make_unique<TimestampTruncatingVisitor>(
-      *deltaVisitor, TraceFileHelpers::kTimestampPrecision);
-  auto stacktraceVisitor =
-      std::make_unique<StackTraceInvertingVisitor>(*timestampVisitor);
+  std::unique_ptr<ColumnarEntryVisitor> columnarVisitor;
+  std::unique_ptr<PrintEntryVisitor> printVisitor;
+  std::unique_ptr<EntryVisitor> fusedVisitor;
+  if (format_ == TraceFormat::COLUMNAR) {
+    columnarVisitor = std::make_unique<ColumnarEntryVisitor>(*output);
+    fusedVisitor = std::make_unique<FusedEntryVisitor<ColumnarEntryVisitor>>(
+        *columnarVisitor);
+  } else {
+    printVisitor = std::make_unique<PrintEntryVisitor>(*output);
+    fusedVisitor =
+        std::make_unique<FusedEntryVisitor<PrintEntryVisitor>>(*printVisitor);
+  }
+  InternedStackVisitor stacks(*fusedVisitor);
+  InternedStringVisitor visitor(stacks, strings_);
 
   // First write that hasn't happened yet...
-  TraceBuffer::Cursor cursor = buffer_->ringBuffer().currentHead();
+  ShardCursors cursors = buffer_->currentHeads();
   // ... minus one, i.e. last write that has happened.
   // Also equivalent to .currentTail(1.0) but that's way less readable.
-  cursor.moveBackward();
+  // A byte ring is read up to the record before its cursor, the head is
+  // where it has to start.
+  if (buffer_->backend() == Buffer::Backend::PACKETS) {
+    for (auto& cursor : cursors) {
+      cursor.moveBackward();
+    }
+  }
 
-  traceBackwards(*stacktraceVisitor, buffer_->ringBuffer(), cursor);
+  traceBackwards(visitor, *buffer_, cursors);
 
+  if (columnarVisitor != nullptr) {
+    columnarVisitor->flush();
+  }
   output->flush();
   output->close();
 }
 
-void TraceWriter::submit(TraceBuffer::Cursor cursor, int64_t trace_id) {
+bool TraceWriter::submit(TraceBuffer::Cursor cursor, int64_t trace_id) {
+  return submit(ShardCursors{cursor}, trace_id);
+}
+
+bool TraceWriter::submit(ShardCursors cursors, int64_t trace_id) {
+  if (trace_id != kStopLoopTraceID &&
+      cursors.size() != buffer_->shardCount()) {
+    throw std::invalid_argument("Need exactly one cursor per shard");
+  }
   {
     std::lock_guard<std::mutex> lock(wakeup_mutex_);
     if (trace_id == kStopLoopTraceID) {
       stop_requested_ = true;
-      wakeup_trace_id_ = nullptr;
+      pending_traces_.clear();
     } else {
+      if (pending_traces_.size() >= max_pending_traces_) {
+        return false;
+      }
       stop_requested_ = false;
-      wakeup_trace_id_ =
-          std::make_unique<std::pair<TraceBuffer::Cursor, int64_t>>(
-              std::make_pair(cursor, trace_id));
+      pending_traces_.emplace_back(std::move(cursors), trace_id);
     }
   }
   wakeup_cv_.notify_all();
+  return true;
 }
 
-void TraceWriter::submit(int64_t trace_id) {
-  submit(buffer_->ringBuffer().currentTail(), trace_id);
+bool TraceWriter::submit(int64_t trace_id) {
+  return submit(buffer_->currentTails(), trace_id);
 }
 
 } // namespace writer
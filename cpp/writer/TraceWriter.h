@@ -18,6 +18,7 @@
 
 #include <unistd.h>
 #include <condition_variable>
+#include <deque>
 #include <memory>
 #include <mutex>
 #include <queue>
@@ -27,29 +28,86 @@
 
 #include <LogEntry.h>
 #include <generated/EntryParser.h>
+#include <logger/StringTable.h>
 #include <mmapbuf/Buffer.h>
 #include <writer/PacketReassembler.h>
 #include <writer/TraceCallbacks.h>
+#include <writer/TraceFileHelpers.h>
 
 namespace facebook {
 namespace profilo {
 namespace writer {
 
 using Buffer = mmapbuf::Buffer;
+using ShardCursors = Buffer::ShardCursors;
+
+//
+// Called when a trace starts, with the position of the trace start in each
+// shard of the buffer.
+//
+using TraceBackwardsCallback =
+    std::function<void(entries::EntryVisitor&, Buffer&, ShardCursors&)>;
+
+struct StreamingProgress {
+  int64_t trace_id;
+  // Packets between the writer and the head of the buffer.
+  uint64_t lag;
+  // Packets overwritten before the writer got to them, since the trace
+  // started.
+  uint64_t lost_packets;
+  // Everything before this position is on disk.
+  TraceBuffer::Cursor checkpoint;
+};
 
-using TraceBackwardsCallback = std::function<
-    void(entries::EntryVisitor&, TraceBuffer&, TraceBuffer::Cursor&)>;
+using StreamingProgressCallback =
+    std::function<void(StreamingProgress const&)>;
+
+//
+// In streaming mode a trace outlives the buffer: when producers lap the
+// writer, it skips ahead instead of aborting with MISSED_EVENT. The skipped
+// range is recorded in the trace as a TRACE_PACKETS_LOST entry (extra = the
+// packet count). Every chunk_packets packets the trace file is flushed as a
+// complete compressed chunk and progress_callback is called with the
+// writer's checkpoint and lag.
+//
+// Control entries (e.g. TRACE_END) that get skipped leave the trace open
+// until the next one for the same trace ID.
+//
+// Streaming needs an unsharded packet buffer.
+//
+struct StreamingConfig {
+  static constexpr uint32_t kDefaultChunkPackets = 4096;
+
+  bool enabled = false;
+  uint32_t chunk_packets = kDefaultChunkPackets;
+  StreamingProgressCallback progress_callback = nullptr;
+};
 
 class TraceWriter {
  public:
   static const int64_t kStopLoopTraceID = 0;
+  static constexpr size_t kDefaultMaxPendingTraces = 8;
 
   //
   // folder: the absolute path to the folder that will store any trace folders.
   // trace_prefix: a file prefix for every trace file written by this writer.
-  // buffer: the ring buffer instance to use.
+  // buffer: the ring buffer instance to use. The shards of a sharded buffer
+  //         are merged by timestamp. A byte ring is polled for new records,
+  //         as it can't be waited on.
   // headers: a list of key-value headers to output at
   //          the beginning of the trace
+  // format: the encoding of the trace entries, declared in the headers
+  // compression: the codec of the trace file, unless a trace header named
+  //              TraceFileHelpers::kCompressionHeader picks another one
+  // max_pending_traces: how many submitted traces can wait for loop()
+  //                     before submit() starts rejecting them
+  // streaming: see StreamingConfig
+  // strings: the string table of the process writing to the buffer, which
+  //          resolves interned names whose definition isn't in the trace.
+  //          Leave unset when reading a buffer from another process.
+  //
+  // callbacks are never invoked concurrently, even when several threads
+  // process traces of this writer.
   //
   TraceWriter(
       const std::string&& folder,
@@ -58,10 +116,17 @@ class TraceWriter {
       std::shared_ptr<TraceCallbacks> callbacks = nullptr,
       std::vector<std::pair<std::string, std::string>>&& headers =
           std::vector<std::pair<std::string, std::string>>(),
-      TraceBackwardsCallback trace_backwards_callback = nullptr);
+      TraceBackwardsCallback trace_backwards_callback = nullptr,
+      TraceFormat format = TraceFormat::TEXT,
+      CompressionConfig compression = CompressionConfig(),
+      size_t max_pending_traces = kDefaultMaxPendingTraces,
+      StreamingConfig streaming = StreamingConfig(),
+      const logger::StringTable* strings = nullptr);
 
   //
-  // Wait until a submit() call and then process a submitted trace ID.
+  // Wait until a submit() call and then process submitted traces until none
+  // are pending. Several threads can run loop() at the same time, each trace
+  // is processed by exactly one of them.
   //
   void loop();
 
@@ -77,37 +142,64 @@ class TraceWriter {
   // with this method on a single Writer (and Buffer) instance, but not both.
   // Mixed mode usage is not safe.
   //
+  // The single cursor version needs an unsharded buffer.
+  //
+  // Errors are rethrown, after aborting the trace with
+  // AbortReason::WRITER_EXCEPTION if it started and hasn't ended yet.
+  //
   int64_t processTrace(int64_t trace_id, TraceBuffer::Cursor& cursor);
+  int64_t processTrace(int64_t trace_id, ShardCursors& cursors);
 
   //
   // Submit a trace ID for processing. Walk will start from `cursor`.
   // Will wake up the thread and let it run until the trace is finished.
   //
+  // Returns false and drops the trace if max_pending_traces traces are
+  // already waiting. No callbacks are issued for a dropped trace, as its
+  // start was never seen by the writer.
+  //
   // Call with trace_id = kStopLoopTraceID to terminate loop()
-  // without processing a trace.
+  // without processing a trace. This drops all pending traces.
   //
-  void submit(TraceBuffer::Cursor cursor, int64_t trace_id);
+  // The single cursor version needs an unsharded buffer. With a sharded one,
+  // pass a cursor per shard from before the trace start was written, as
+  // any of them can hold the trace start.
+  //
+  __attribute__((warn_unused_result)) bool submit(
+      TraceBuffer::Cursor cursor,
+      int64_t trace_id);
+  __attribute__((warn_unused_result)) bool submit(
+      ShardCursors cursors,
+      int64_t trace_id);
 
   //
-  // Equivalent to write(buffer_.currentTail(), trace_id).
+  // Equivalent to write(buffer_.currentTails(), trace_id).
   // This will force the TraceWriter to scan the entire ring buffer for the
   // start event. Prefer the cursor version of submit() where appropriate.
   //
-  void submit(int64_t trace_id);
+  __attribute__((warn_unused_result)) bool submit(int64_t trace_id);
 
  private:
   std::mutex wakeup_mutex_;
   std::condition_variable wakeup_cv_;
-  std::unique_ptr<std::pair<TraceBuffer::Cursor, int64_t>> wakeup_trace_id_;
+  std::deque<std::pair<ShardCursors, int64_t>> pending_traces_;
+  const size_t max_pending_traces_;
   bool stop_requested_;
 
   const std::string trace_folder_;
   const std::string trace_prefix_;
   std::shared_ptr<Buffer> buffer_;
   std::vector<std::pair<std::string, std::string>> trace_headers_;
+  const TraceFormat format_;
+  const CompressionConfig compression_;
+  const StreamingConfig streaming_;
+  const logger::StringTable* strings_;
 
   std::shared_ptr<TraceCallbacks> callbacks_;
   TraceBackwardsCallback trace_backwards_callback_;
+
+  int64_t processShardedTrace(int64_t trace_id, ShardCursors& cursors);
+  int64_t processByteRingTrace(int64_t trace_id, TraceBuffer::Cursor& cursor);
 };
 
 } // namespace writer
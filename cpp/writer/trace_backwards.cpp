@@ -16,13 +16,27 @@
 
 #include "trace_backwards.h"
 
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
 #include <generated/EntryParser.h>
+#include <writer/BlobResolvingVisitor.h>
+#include <writer/InternedStackVisitor.h>
 #include <writer/PacketReassembler.h>
+#include <writer/ShardMergeReader.h>
 
 namespace facebook {
 namespace profilo {
 namespace writer {
 
+namespace {
+
+// Packets the backward walk reads at a time.
+constexpr uint32_t kReadBatchSize = 64;
+
+} // namespace
+
 void traceBackwards(
     entries::EntryVisitor& visitor,
     TraceBuffer& buffer,
@@ -34,6 +48,26 @@ void traceBackwards(
   TraceBuffer::Cursor backCursor{cursor};
   backCursor.moveBackward(); // Move back before trace start
 
+  // Packets are read a batch at a time, the batch ending at backCursor.
+  alignas(4) Packet packets[kReadBatchSize];
+  while (true) {
+    auto remaining = TraceBuffer::Cursor(0).distanceTo(backCursor) + 1;
+    auto size = static_cast<uint32_t>(
+        std::min<uint64_t>(remaining, kReadBatchSize));
+    TraceBuffer::Cursor batchStart{backCursor};
+    batchStart.moveBackward(size - 1);
+    if (buffer.tryReadRange(packets, batchStart, size) < size) {
+      break; // Some were overwritten, finish up one packet at a time.
+    }
+    for (auto idx = size; idx > 0; --idx) {
+      reassembler.processBackwards(packets[idx - 1]);
+    }
+    if (size == remaining) {
+      return; // done
+    }
+    backCursor.moveBackward(size);
+  }
+
   alignas(4) Packet packet;
   while (buffer.tryRead(packet, backCursor)) {
     reassembler.processBackwards(packet);
@@ -43,6 +77,126 @@ void traceBackwards(
   }
 }
 
+void traceBackwards(
+    entries::EntryVisitor& visitor,
+    logger::ByteRingBuffer& buffer,
+    TraceBuffer::Cursor& cursor) {
+  // Records can only be found walking forward, from the tail.
+  std::vector<TraceBuffer::Cursor> starts;
+  std::vector<char> record;
+  auto position = buffer.currentTail();
+  while (position.distanceTo(cursor) > 0) {
+    auto start = position;
+    if (buffer.tryRead(position, record) !=
+            logger::ByteRingBuffer::ReadResult::OK ||
+        cursor.distanceTo(position) > 0) {
+      // Also stops at a record that starts past `cursor` after padding.
+      break;
+    }
+    starts.push_back(start);
+  }
+
+  for (auto it = starts.rbegin(); it != starts.rend(); ++it) {
+    auto start = *it;
+    if (buffer.tryRead(start, record) !=
+        logger::ByteRingBuffer::ReadResult::OK) {
+      break; // Reclaimed since, and so are all the older ones.
+    }
+    entries::EntryParser::parse(record.data(), record.size(), visitor);
+  }
+}
+
+namespace {
+
+// Passes on the STRING_DEFINITION entries and the stack definitions only.
+// A stack definition is its sample followed by its frames, which walking
+// backwards come the other way around. They're passed on as one frames
+// entry with the stack id for a matchid, see InternedStackVisitor.
+class DefinitionsVisitor : public entries::EntryVisitor {
+ public:
+  explicit DefinitionsVisitor(entries::EntryVisitor& delegate)
+      : delegate_(delegate), frames_() {}
+
+  void visit(const entries::StandardEntry& entry) override {
+    if (!InternedStackVisitor::isStackSample(entry) || entry.matchid <= 0) {
+      return;
+    }
+    auto frames = frames_.find(entry.tid);
+    if (frames == frames_.end() ||
+        frames->second.timestamp != entry.timestamp) {
+      return;
+    }
+    entries::FramesEntry definition{frames->second};
+    definition.matchid = entry.matchid;
+    definition.frames.values = frames->second.values.data();
+    delegate_.visit(definition);
+    frames_.erase(frames);
+  }
+
+  void visit(const entries::FramesEntry& entry) override {
+    auto& frames = frames_[entry.tid];
+    static_cast<entries::FramesEntry&>(frames) = entry;
+    frames.values.assign(
+        entry.frames.values, entry.frames.values + entry.frames.size);
+  }
+
+  void visit(const entries::BytesEntry& entry) override {
+    if (entry.type == entries::EntryType::STRING_DEFINITION) {
+      delegate_.visit(entry);
+    }
+  }
+
+ private:
+  // The latest frames entry of a thread, with a copy of its frames.
+  struct Frames : entries::FramesEntry {
+    std::vector<int64_t> values;
+  };
+
+  entries::EntryVisitor& delegate_;
+  std::unordered_map<int32_t, Frames> frames_;
+};
+
+void walkBackwards(
+    entries::EntryVisitor& visitor,
+    mmapbuf::Buffer& buffer,
+    mmapbuf::Buffer::ShardCursors& cursors) {
+  if (buffer.backend() == mmapbuf::Buffer::Backend::BYTE_RING) {
+    traceBackwards(visitor, buffer.byteRing(), cursors.front());
+    return;
+  }
+  if (buffer.shardCount() == 1) {
+    traceBackwards(visitor, buffer.ringBuffer(), cursors.front());
+    return;
+  }
+
+  mmapbuf::Buffer::ShardCursors backCursors{cursors};
+  for (auto& backCursor : backCursors) {
+    backCursor.moveBackward(); // Move back before trace start
+  }
+
+  ShardMergeReader reader(
+      buffer.shards(), backCursors, ShardMergeReader::Direction::BACKWARD);
+  while (reader.next(visitor) == ShardMergeReader::Status::ENTRY) {
+  }
+}
+
+} // namespace
+
+void traceBackwards(
+    entries::EntryVisitor& visitor,
+    mmapbuf::Buffer& buffer,
+    mmapbuf::Buffer::ShardCursors& cursors) {
+  // Payloads are resolved first, a definition may be in the blob arena too.
+  BlobResolvingVisitor resolved(visitor, buffer.blobArena());
+  // An interned name or stack is defined at its first use, which walking
+  // backwards comes to last. Its definition is visited up front, in a walk of
+  // its own.
+  DefinitionsVisitor definitions(resolved);
+  BlobResolvingVisitor resolved_definitions(definitions, buffer.blobArena());
+  walkBackwards(resolved_definitions, buffer, cursors);
+  walkBackwards(resolved, buffer, cursors);
+}
+
 } // namespace writer
 } // namespace profilo
 } // namespace facebook
@@ -15,7 +15,9 @@
  */
 
 #include <generated/EntryParser.h>
+#include <logger/buffer/ByteRingBuffer.h>
 #include <logger/buffer/TraceBuffer.h>
+#include <mmapbuf/Buffer.h>
 
 namespace facebook {
 namespace profilo {
@@ -26,6 +28,25 @@ void traceBackwards(
     TraceBuffer& buffer,
     TraceBuffer::Cursor& cursor);
 
+//
+// Visits the records before `cursor`, newest first, until the oldest one
+// that's still in the ring.
+//
+void traceBackwards(
+    entries::EntryVisitor& visitor,
+    logger::ByteRingBuffer& buffer,
+    TraceBuffer::Cursor& cursor);
+
+//
+// Walks back from one cursor per shard, merging the shards by timestamp.
+// Same as the single TraceBuffer (or byte ring) version for an unsharded
+// buffer, except that STRING_DEFINITION entries are all visited first.
+//
+void traceBackwards(
+    entries::EntryVisitor& visitor,
+    mmapbuf::Buffer& buffer,
+    mmapbuf::Buffer::ShardCursors& cursors);
+
 } // namespace writer
 } // namespace profilo
 } // namespace facebook
@@ -23,7 +23,8 @@
 #include <system_error>
 #include <vector>
 
-#include <util/common.h>
+#include <profilo/util/Clock.h>
+#include <profilo/util/common.h>
 
 namespace facebook {
 namespace profilo {
@@ -31,7 +32,7 @@ namespace writer {
 
 std::vector<std::pair<std::string, std::string>> calculateHeaders(pid_t pid) {
   auto result = std::vector<std::pair<std::string, std::string>>();
-  result.reserve(4);
+  result.reserve(5);
 
   {
     std::stringstream ss;
@@ -67,6 +68,9 @@ std::vector<std::pair<std::string, std::string>> calculateHeaders(pid_t pid) {
     result.push_back(std::make_pair("trace_backdating_window", ss.str()));
   }
 
+  result.push_back(std::make_pair(
+      "clock", std::string(clock::sourceName(clock::currentSource()))));
+
   return result;
 }
 
@@ -29,6 +29,7 @@ public final class ProfiloConstants {
   public static final int ABORT_REASON_CONDITION_NOT_MET = 6;
   public static final int ABORT_REASON_WRITER_EXCEPTION = 8;
   public static final int ABORT_REASON_LOGOUT = 9;
+  public static final int ABORT_REASON_WRITER_QUEUE_FULL = 10;
 
   // Things in the remote process can go wrong for the same reason as in the
   // main process. Thus, just mark if the reason is "remote" by using a single
@@ -74,6 +75,8 @@ public final class ProfiloConstants {
         return "writer_exception";
       case ABORT_REASON_LOGOUT:
         return "logout";
+      case ABORT_REASON_WRITER_QUEUE_FULL:
+        return "writer_queue_full";
     }
     return "UNKNOWN REASON " + abortReason;
   }
@@ -81,6 +84,9 @@ public final class ProfiloConstants {
   public static final String TRACE_CONFIG_PARAM_TRACE_TIMEOUT_MS = "trace_config.trace_timeout_ms";
   public static final String TRACE_CONFIG_PARAM_LOGGER_PRIORITY = "trace_config.logger_priority";
   public static final int TRACE_CONFIG_PARAM_LOGGER_PRIORITY_DEFAULT = 5;
+  // Values of clock::Source in cpp/util/Clock.h: 0 = vdso, 1 = syscall, 2 = cycle_counter.
+  public static final String TRACE_CONFIG_PARAM_CLOCK_SOURCE = "trace_config.clock_source";
+  public static final int TRACE_CONFIG_PARAM_CLOCK_SOURCE_DEFAULT = 0;
   public static final String TRACE_CONFIG_PARAM_POST_TRACE_EXTENSION_MSEC =
       "trace_config.post_trace_extension_ms";
   public static final int TRACE_CONFIG_PARAM_POST_TRACE_EXTENSION_MSEC_DEFAULT = 0;
@@ -90,13 +96,13 @@ public final class ProfiloConstants {
       "provider.stack_trace.thread_detect_interval_ms";
   public static final String PROVIDER_PARAM_NATIVE_STACK_TRACE_UNWIND_DEX_FRAMES =
       "provider.native_stack_trace.unwind_dex_frames";
-  public static final String PROVIDER_PARAM_NATIVE_STACK_TRACE_UNWINDER_THREAD_PRIORITY =
-      "provider.native_stack_trace.unwinder_thread_pri";
   public static final String PROVIDER_PARAM_NATIVE_STACK_TRACE_UNWINDER_QUEUE_SIZE =
       "provider.native_stack_trace.unwinder_queue_size";
   public static final int PROVIDER_PARAM_NATIVE_STACK_TRACE_UNWINDER_QUEUE_SIZE_DEFAULT = 256;
   public static final String PROVIDER_PARAM_NATIVE_STACK_TRACE_LOG_PARTIAL_STACKS =
       "provider.native_stack_trace.log_partial_stacks";
+  public static final String PROVIDER_PARAM_NATIVE_STACK_TRACE_PERF_SAMPLING =
+      "provider.native_stack_trace.perf_sampling";
 
   // Keys to query conditions in a config
   public static final String TRACE_CONFIG_DURATION_CONDITION = "trace_config.duration_condition";
@@ -337,6 +337,12 @@ public class TraceControlHandler extends Handler {
       // We want to write TRACE_START while we're still synchronously in the startTrace call.
       // This way we can be sure that the worker thread will not miss any entries, as it starts
       // reading from TRACE_START.
+      // The clock is selected before that, so that the whole trace and its "clock" header
+      // agree on it.
+      BufferLogger.setClockSource(
+          context.mTraceConfigExtras.getIntParam(
+              ProfiloConstants.TRACE_CONFIG_PARAM_CLOCK_SOURCE,
+              ProfiloConstants.TRACE_CONFIG_PARAM_CLOCK_SOURCE_DEFAULT));
       BufferLogger.writeAndWakeupTraceWriter(
           thread.getTraceWriter(),
           context.mainBuffer,
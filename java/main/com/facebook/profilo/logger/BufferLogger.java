@@ -38,6 +38,10 @@ public final class BufferLogger {
   public static native int writeBytesEntry(
       Buffer buffer, int flags, int type, int arg1 /* matchid */, String arg2 /* bytes */);
 
+  /**
+   * Returns 0 if the writer's queue was full. The trace is aborted through the writer's callbacks
+   * then.
+   */
   public static native int writeAndWakeupTraceWriter(
       NativeTraceWriter writer,
       Buffer buffer,
@@ -46,4 +50,11 @@ public final class BufferLogger {
       int callid,
       int matchid,
       long extra);
+
+  /**
+   * Selects the clock behind native timestamps for the whole process, see clock::Source in
+   * cpp/util/Clock.h. Returns false and keeps the current clock if the source isn't available on
+   * this device.
+   */
+  public static native boolean setClockSource(int source);
 }
@@ -111,7 +111,6 @@ public class CPUProfiler {
       Context context,
       MultiBufferLogger logger,
       boolean nativeTracerUnwindDexFrames,
-      int nativeTracerUnwinderThreadPriority,
       int nativeTracerUnwinderQueueSize,
       boolean nativeTracerLogPartialStacks)
       throws Exception {
@@ -125,7 +124,6 @@ public class CPUProfiler {
             logger,
             sAvailableTracers,
             nativeTracerUnwindDexFrames,
-            nativeTracerUnwinderThreadPriority,
             nativeTracerUnwinderQueueSize,
             nativeTracerLogPartialStacks);
     return sInitialized;
@@ -143,7 +141,8 @@ public class CPUProfiler {
       int samplingRateMs,
       int threadDetectIntervalMs,
       boolean cpuClockModeEnabled,
-      boolean wallClockModeEnabled) {
+      boolean wallClockModeEnabled,
+      boolean perfSamplingEnabled) {
     if (!cpuClockModeEnabled && !wallClockModeEnabled) {
       return false;
     }
@@ -156,7 +155,8 @@ public class CPUProfiler {
             samplingRateMs,
             threadDetectIntervalMs,
             cpuClockModeEnabled,
-            wallClockModeEnabled);
+            wallClockModeEnabled,
+            perfSamplingEnabled);
   }
 
   public static void loggerLoop() {
@@ -179,7 +179,6 @@ public class CPUProfiler {
       MultiBufferLogger logger,
       int availableTracers,
       boolean nativeTracerUnwindDexFrames,
-      int nativeTracerUnwinderThreadPriority,
       int nativeTracerUnwinderQueueSize,
       boolean nativeTracerLogPartialStacks);
 
@@ -189,7 +188,8 @@ public class CPUProfiler {
       int samplingRateMs,
       int threadDetectIntervalMs,
       boolean cpuClockModeEnabled,
-      boolean wallClockModeEnabled);
+      boolean wallClockModeEnabled,
+      boolean perfSamplingEnabled);
 
   @DoNotStrip
   private static native void nativeStopProfiling();
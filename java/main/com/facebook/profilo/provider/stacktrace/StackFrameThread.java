@@ -100,7 +100,6 @@ public final class StackFrameThread extends BaseTraceProvider {
    */
   private synchronized boolean initProfiler(
       boolean nativeTracerUnwindDexFrames,
-      int nativeTracerUnwinderThreadPriority,
       int nativeTracerUnwinderQueueSize,
       boolean nativeTracerLogPartialStacks) {
     try {
@@ -108,7 +107,6 @@ public final class StackFrameThread extends BaseTraceProvider {
           mContext,
           getLogger(),
           nativeTracerUnwindDexFrames,
-          nativeTracerUnwinderThreadPriority,
           nativeTracerUnwinderQueueSize,
           nativeTracerLogPartialStacks);
     } catch (Exception ex) {
@@ -122,13 +120,12 @@ public final class StackFrameThread extends BaseTraceProvider {
       int threadDetectIntervalMs,
       int enabledProviders,
       boolean nativeTracerUnwindDexFrames,
-      int nativeTracerUnwinderThreadPriority,
       int nativeTracerUnwinderQueueSize,
       TimeSource timeSource,
-      boolean nativeTracerLogPartialStacks) {
+      boolean nativeTracerLogPartialStacks,
+      boolean perfSamplingEnabled) {
     if (!initProfiler(
         nativeTracerUnwindDexFrames,
-        nativeTracerUnwinderThreadPriority,
         nativeTracerUnwinderQueueSize,
         nativeTracerLogPartialStacks)) {
       return false;
@@ -171,7 +168,8 @@ public final class StackFrameThread extends BaseTraceProvider {
             sampleRateMs,
             threadDetectIntervalMs,
             cpuClockModeEnabled,
-            wallClockModeEnabled);
+            wallClockModeEnabled,
+            perfSamplingEnabled);
     if (!started) {
       return false;
     }
@@ -233,15 +231,14 @@ public final class StackFrameThread extends BaseTraceProvider {
             context.enabledProviders,
             context.mTraceConfigExtras.getBoolParam(
                 ProfiloConstants.PROVIDER_PARAM_NATIVE_STACK_TRACE_UNWIND_DEX_FRAMES, false),
-            context.mTraceConfigExtras.getIntParam(
-                ProfiloConstants.PROVIDER_PARAM_NATIVE_STACK_TRACE_UNWINDER_THREAD_PRIORITY,
-                ProfiloConstants.TRACE_CONFIG_PARAM_LOGGER_PRIORITY_DEFAULT),
             context.mTraceConfigExtras.getIntParam(
                 ProfiloConstants.PROVIDER_PARAM_NATIVE_STACK_TRACE_UNWINDER_QUEUE_SIZE,
                 ProfiloConstants.PROVIDER_PARAM_NATIVE_STACK_TRACE_UNWINDER_QUEUE_SIZE_DEFAULT),
             timeSource,
             context.mTraceConfigExtras.getBoolParam(
-                ProfiloConstants.PROVIDER_PARAM_NATIVE_STACK_TRACE_LOG_PARTIAL_STACKS, false));
+                ProfiloConstants.PROVIDER_PARAM_NATIVE_STACK_TRACE_LOG_PARTIAL_STACKS, false),
+            context.mTraceConfigExtras.getBoolParam(
+                ProfiloConstants.PROVIDER_PARAM_NATIVE_STACK_TRACE_PERF_SAMPLING, false));
     if (!enabled) {
       return;
     }
@@ -19,10 +19,9 @@ from .importer.interpreter import TraceFileInterpreter
 from .importer.trace_file import TraceFile
 
 if __name__ == "__main__":
-    import gzip
     import sys
 
-    with gzip.open(sys.argv[1]) as f:
+    with open(sys.argv[1], "rb") as f:
         tracefile = TraceFile.from_file(f)
         interpreter = TraceFileInterpreter(tracefile)
         trace = interpreter.interpret()
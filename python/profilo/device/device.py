@@ -17,13 +17,14 @@ limitations under the License.
 
 import collections
 import datetime
-import gzip
 import os
 import subprocess
 import sys
 import zipfile
 from io import BytesIO
 
+from ..importer import compression
+
 
 # Traces go to the files/profilo directory when they are created, then moved into the
 # files/profilo/upload/ directory for uploading, and then moved back to files/profilo once
@@ -84,13 +85,13 @@ def _get_data_dir_full_path(package):
     return subprocess.check_output(command).decode("utf-8").strip()
 
 
-def _is_profilo_trace(gzip_file):
+def _is_profilo_trace(content):
     try:
-        data = gzip_file.read()
+        data = compression.decompress(content)
         if not data.startswith(_PROFILO_HEADER_START):
             return False
-    except IOError:
-        # Not a gzipped file
+    except (IOError, EOFError, ImportError):
+        # Corrupt or written with a codec we can't read here
         return False
 
     return True
@@ -105,7 +106,7 @@ def _validate_trace(package, data_dir_path, file_path):
 
     A file is a "profilo trace" if:
 
-        a) It is a gzipped file
+        a) It is compressed with a known codec, or not at all
         b) It starts with the magic _PROFILO_HEADER_START bytes
     """
     full_path = "/data/data/{package}/{path}".format(package=package, path=file_path)
@@ -131,12 +132,10 @@ def _validate_trace(package, data_dir_path, file_path):
                 if info_file.filename.startswith("extra/"):
                     continue
                 f = zipped.open(info_file)
-                gz = gzip.GzipFile(fileobj=BytesIO(f.read()))
-                if not _is_profilo_trace(gz):
+                if not _is_profilo_trace(f.read()):
                     return False
     else:
-        gz = gzip.GzipFile(fileobj=BytesIO(content))
-        if not _is_profilo_trace(gz):
+        if not _is_profilo_trace(content):
             return False
 
     return True
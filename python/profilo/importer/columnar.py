@@ -0,0 +1,112 @@
+"""
+Copyright 2018-present, Facebook, Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+"""
+
+# Reader for traces written with the columnar format (header "fmt|columnar"),
+# see ColumnarEntryVisitor.h for the layout.
+
+COLUMN_COUNT = 8
+(
+    COLUMN_KIND,
+    COLUMN_ID,
+    COLUMN_TIMESTAMP,
+    COLUMN_TID,
+    COLUMN_CALLID,
+    COLUMN_MATCHID,
+    COLUMN_EXTRA,
+    COLUMN_BYTES,
+) = range(COLUMN_COUNT)
+
+
+class _Reader(object):
+    def __init__(self, data, pos=0, end=None):
+        self.data = data
+        self.pos = pos
+        self.end = len(data) if end is None else end
+
+    def at_end(self):
+        return self.pos >= self.end
+
+    def varint(self):
+        value = 0
+        shift = 0
+        while True:
+            if self.pos >= self.end:
+                raise ValueError("Truncated varint in columnar trace")
+            byte = self.data[self.pos]
+            self.pos += 1
+            value |= (byte & 0x7F) << shift
+            if not byte & 0x80:
+                return value
+            shift += 7
+
+    def zigzag(self):
+        value = self.varint()
+        return (value >> 1) ^ -(value & 1)
+
+    def slice(self, size):
+        if self.pos + size > self.end:
+            raise ValueError("Truncated block in columnar trace")
+        reader = _Reader(self.data, self.pos, self.pos + size)
+        self.pos += size
+        return reader
+
+
+def read_entries(data, standard_entry, bytes_entry):
+    """
+    Generates the delta-encoded entries stored in `data` (the bytes after the
+    trace headers), in the same form as parsing the text format would.
+    """
+    data = bytearray(data)
+    reader = _Reader(data)
+    type_names = {}
+
+    while not reader.at_end():
+        rows = reader.varint()
+        for _ in range(reader.varint()):
+            type_id = reader.varint()
+            name = reader.slice(reader.varint())
+            type_names[type_id] = data[name.pos : name.end].decode("utf-8")
+
+        columns = [reader.slice(reader.varint()) for _ in range(COLUMN_COUNT)]
+        kind = columns[COLUMN_KIND]
+        ids = columns[COLUMN_ID]
+        matchids = columns[COLUMN_MATCHID]
+        values = columns[COLUMN_BYTES]
+
+        for _ in range(rows):
+            row_kind = kind.varint()
+            type_name = type_names[row_kind >> 1]
+            if row_kind & 1:
+                entry_id = ids.zigzag()
+                arg1 = matchids.zigzag()
+                value = values.slice(values.varint())
+                yield bytes_entry(
+                    id=entry_id,
+                    type=type_name,
+                    arg1=arg1,
+                    data=data[value.pos : value.end].decode("utf-8"),
+                )
+                continue
+
+            yield standard_entry(
+                id=ids.zigzag(),
+                type=type_name,
+                timestamp=columns[COLUMN_TIMESTAMP].zigzag(),
+                tid=columns[COLUMN_TID].zigzag(),
+                arg1=columns[COLUMN_CALLID].zigzag(),
+                arg2=matchids.zigzag(),
+                arg3=columns[COLUMN_EXTRA].zigzag(),
+            )
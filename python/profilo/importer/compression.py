@@ -0,0 +1,38 @@
+"""
+Copyright 2018-present, Facebook, Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+"""
+
+# Detects the codec of a trace file from its magic bytes, see
+# cpp/writer/Compression.h for the codecs a trace can be written with.
+
+import gzip
+
+
+GZIP_MAGIC = b"\x1f\x8b"
+
+
+def codec_name(data):
+    if data.startswith(GZIP_MAGIC):
+        return "zlib"
+    return "none"
+
+
+def decompress(data):
+    """
+    Returns the uncompressed contents of a trace file.
+    """
+    if codec_name(data) == "zlib":
+        return gzip.decompress(data)
+    return data
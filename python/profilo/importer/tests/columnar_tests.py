@@ -0,0 +1,105 @@
+"""
+Copyright 2018-present, Facebook, Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+"""
+
+import unittest
+
+from ..trace_file import BytesEntry, StandardEntry, TraceFile
+
+
+def varint(value):
+    out = bytearray()
+    while value >= 0x80:
+        out.append((value & 0x7F) | 0x80)
+        value >>= 7
+    out.append(value)
+    return bytes(out)
+
+
+def zigzag(value):
+    return varint(((value << 1) ^ (value >> 63)) & 0xFFFFFFFFFFFFFFFF)
+
+
+def block(rows, types, columns):
+    out = varint(rows) + varint(len(types))
+    for type_id, name in types:
+        out += varint(type_id) + varint(len(name)) + name.encode("utf-8")
+    for column in columns:
+        out += varint(len(column)) + column
+    return out
+
+
+class ColumnarTraceTests(unittest.TestCase):
+    HEADERS = b"dt\nver|3\nid|AAAAAAAAAAB\nprec|6\nfmt|columnar\n\n"
+
+    def test_matches_text_format(self):
+        text = (
+            b"dt\nver|3\nid|AAAAAAAAAAB\nprec|6\nfmt|text\n\n"
+            b"10|TRACE_START|123|0|1|2|3\n"
+            b"14|STRING_KEY|11|hi!\n"
+            b"1|TRACE_END|-2|1|1|1|-3\n"
+        )
+
+        # Split over two blocks, types are only named in the first one.
+        data = self.HEADERS + block(
+            rows=2,
+            types=[(1, "TRACE_START"), (2, "STRING_KEY"), (3, "TRACE_END")],
+            columns=[
+                varint(1 << 1) + varint(2 << 1 | 1),
+                zigzag(10) + zigzag(14),
+                zigzag(123),
+                zigzag(0),
+                zigzag(1),
+                zigzag(2) + zigzag(11),
+                zigzag(3),
+                varint(3) + b"hi!",
+            ],
+        )
+        data += block(
+            rows=1,
+            types=[],
+            columns=[
+                varint(3 << 1),
+                zigzag(1),
+                zigzag(-2),
+                zigzag(1),
+                zigzag(1),
+                zigzag(1),
+                zigzag(-3),
+                b"",
+            ],
+        )
+
+        expected = TraceFile.from_bytes(text)
+        actual = TraceFile.from_bytes(data)
+
+        self.assertEqual(actual.headers["fmt"], "columnar")
+        self.assertEqual(actual.entries, expected.entries)
+        self.assertEqual(
+            actual.entries,
+            [
+                StandardEntry(10, "TRACE_START", 123000, 0, 1, 2, 3),
+                BytesEntry(14, "STRING_KEY", 11, "hi!"),
+                StandardEntry(11, "TRACE_END", 121000, 1, 2, 3, 0),
+            ],
+        )
+
+    def test_unknown_format(self):
+        with self.assertRaises(ValueError):
+            TraceFile.from_bytes(b"dt\nfmt|bogus\n\n")
+
+
+if __name__ == "__main__":
+    unittest.main()
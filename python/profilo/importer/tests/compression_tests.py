@@ -0,0 +1,46 @@
+"""
+Copyright 2018-present, Facebook, Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+"""
+
+import gzip
+import unittest
+
+from .. import compression
+from ..trace_file import TraceFile
+
+
+TRACE = b"dt\nver|3\nprec|6\nfmt|text\ncomp|zlib\n\n1|TRACE_START|123|0|1|2|3\n"
+
+
+class CompressionTest(unittest.TestCase):
+    def test_codec_detection(self):
+        self.assertEqual(compression.codec_name(gzip.compress(TRACE)), "zlib")
+        self.assertEqual(compression.codec_name(TRACE), "none")
+
+    def test_multiple_gzip_members(self):
+        # Every flush of the writer ends a gzip member.
+        data = gzip.compress(TRACE[:20]) + gzip.compress(TRACE[20:])
+        self.assertEqual(compression.decompress(data), TRACE)
+
+    def test_trace_file_reads_any_codec(self):
+        expected = TraceFile.from_bytes(TRACE)
+        actual = TraceFile.from_bytes(gzip.compress(TRACE))
+
+        self.assertEqual(actual.headers["comp"], "zlib")
+        self.assertEqual(actual.entries, expected.entries)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -17,12 +17,14 @@ limitations under the License.
 
 from collections import namedtuple
 
+from . import columnar, compression
+
 
 class TraceEntry(object):
     @staticmethod
     def construct(line):
         line = line.split("|")
-        if line[1] in ["STRING_KEY", "STRING_VALUE", "STRING_NAME"]:
+        if line[1] in ["STRING_KEY", "STRING_VALUE", "STRING_NAME", "BLOB_LOST"]:
             return BytesEntry(
                 id=int(line[0]),
                 type=line[1],
@@ -130,15 +132,19 @@ class TraceFile(object):
             last_entry = delta_entry
         return entries
 
+    @staticmethod
+    def __parse_headers(data):
+        # Headers have a `key|value` format.
+        headers = [x.split("|") for x in data.split("\n")]
+        return {x[0]: x[1] for x in headers if len(x) >= 2}
+
     @staticmethod
     def from_string(data):
 
         # Headers are separated from actual data by '\n\n'.
         data = data.split("\n\n", 1)
 
-        # Headers have a `key|value` format.
-        headers = [x.split("|") for x in data[0].split("\n")]
-        headers = {x[0]: x[1] for x in headers if len(x) >= 2}
+        headers = TraceFile.__parse_headers(data[0])
         data = data[1]
 
         # Don't materialize the full list of delta-encoded entries,
@@ -152,18 +158,38 @@ class TraceFile(object):
 
         return TraceFile(headers=headers, entries=entries)
 
+    @staticmethod
+    def from_bytes(data):
+        # Compressed with the codec named by the `comp` header, which is
+        # itself compressed, so sniff the codec instead.
+        data = compression.decompress(data)
+
+        # The headers are always text, the `fmt` header says how the
+        # entries that follow them are encoded.
+        header_data, entry_data = data.split(b"\n\n", 1)
+        headers = TraceFile.__parse_headers(header_data.decode("utf-8"))
+
+        fmt = headers.get("fmt", "text")
+        if fmt == "text":
+            return TraceFile.from_string(data.decode("utf-8"))
+        if fmt != "columnar":
+            raise ValueError("Unknown trace format: {}".format(fmt))
+
+        gen_entries = columnar.read_entries(entry_data, StandardEntry, BytesEntry)
+        entries = TraceFile.__delta_decode_entries(headers, gen_entries)
+
+        return TraceFile(headers=headers, entries=entries)
+
     @staticmethod
     def from_file(fd):
         with fd:
-            data = fd.read().decode("utf-8")
-            return TraceFile.from_string(data)
+            return TraceFile.from_bytes(fd.read())
 
 
 if __name__ == "__main__":
-    import gzip
     import sys
 
-    with gzip.open(sys.argv[1]) as f:
+    with open(sys.argv[1], "rb") as f:
         trace = TraceFile.from_file(f)
         for entry in trace.entries:
             print(entry)
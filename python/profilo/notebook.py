@@ -15,7 +15,6 @@ limitations under the License.
 """
 
 
-import gzip
 import os.path
 
 from .importer.interpreter import TraceFileInterpreter
@@ -24,10 +23,8 @@ from .importer.trace_file import TraceFile
 
 def open_trace(filepath):
     filepath = os.path.expanduser(filepath)
-    if filepath.endswith("gz"):
-        fd = gzip.open(filepath, mode="rb")
-    else:
-        fd = open(filepath, mode="rb")
+    # TraceFile detects the compression codec itself.
+    fd = open(filepath, mode="rb")
 
     interpreter = TraceFileInterpreter(TraceFile.from_file(fd))
     return interpreter.interpret()
@@ -232,7 +232,6 @@ if __name__ == "__main__":
         -> Blocks
         -> System counters
     """
-    import gzip
     import os
     import sys
 
@@ -275,14 +274,14 @@ if __name__ == "__main__":
             for elem in zipped.namelist():
                 if elem.startswith("main-"):
                     main_found = True
-                    with gzip.open(zipped.open(elem)) as fd:
+                    with zipped.open(elem) as fd:
                         tracefile = TraceFile.from_file(fd)
                     break
             if not main_found:
                 print("Did not find trace inside zip file")
                 sys.exit(3)
     else:
-        with gzip.open(args.trace) as fd:
+        with open(args.trace, "rb") as fd:
             tracefile = TraceFile.from_file(fd)
 
     args.func(tracefile, args)